@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "jeux_client.h"
+#include "protocol.h"
+#include "game.h"
+#include "census.h"
+
+/*
+ * Memory footprint of idle connections and active games.
+ *
+ * Usage: footprint_bench [-s server] [-p port] [-n conns[,conns...]] [-g games]
+ *
+ * For each connection count (default 10000 and 50000) in turn, starts a
+ * fresh server (default bin/jeux, on port 9990), then opens connections
+ * to it one at a time and logs each in, until the count is reached or
+ * a connection is refused.  The server refuses connections once its
+ * client registry is full, and connecting fails once the file limit is
+ * reached (it is raised to the hard limit first), so "served" may be
+ * short of the count asked for.  The server's resident set size is read
+ * before the connections are opened, once they are all idle, and once
+ * the given number of games (default 16) have been started between pairs
+ * of them, and reported per idle connection and per game.
+ */
+
+#define FP_REPLY_TIMEOUT_MS 5000
+#define FP_SETTLE_US 200000
+#define FP_PENDING (-2)
+
+typedef struct fp_conn {
+    JC_CONN *conn;
+    int reply;                  /* type of the last reply, -1 if none came, or FP_PENDING */
+    int invited;                /* id of the last INVITED, or -1 */
+    int accepted;               /* an ACCEPTED has arrived */
+    int lost;
+} FP_CONN;
+
+static char *server = "bin/jeux";
+static char *port = "9990";
+static JC_LOOP *loop;
+
+static void got_reply(JC_CONN *conn, void *arg, JEUX_PACKET_HEADER *hdr, void *payload) {
+    FP_CONN *c = arg;
+    c->reply = hdr == NULL ? -1 : hdr->type;
+}
+
+static void got_event(JC_CONN *conn, void *arg, JEUX_PACKET_HEADER *hdr, void *payload) {
+    FP_CONN *c = arg;
+    if(hdr == NULL) {
+        c->lost = 1;
+    } else if(hdr->type == JEUX_INVITED_PKT) {
+        c->invited = hdr->id;
+    } else if(hdr->type == JEUX_ACCEPTED_PKT) {
+        c->accepted = 1;
+    }
+}
+
+/* Run the loop until *flag changes from what it was, or nothing arrives for a while. */
+static int await(int *flag, int from) {
+    while(*flag == from) {
+        if(jc_loop_run(loop, FP_REPLY_TIMEOUT_MS) <= 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Make a request and wait for its reply.
+ *
+ * @return the type of the reply, or -1 if none came.
+ */
+static int request(FP_CONN *c, int type, int id, int role, char *payload) {
+    c->reply = FP_PENDING;
+    if(jc_request(c->conn, type, id, role, payload, payload == NULL ? 0 : strlen(payload),
+                  got_reply, c) == -1 || await(&c->reply, FP_PENDING) == -1) {
+        return -1;
+    }
+    return c->reply;
+}
+
+static pid_t start_server(void) {
+    pid_t pid = fork();
+    if(pid == 0) {
+        execl(server, "jeux", "-p", port, NULL);
+        fprintf(stderr, "footprint_bench: cannot run %s\n", server);
+        _exit(EXIT_FAILURE);
+    }
+    return pid;
+}
+
+static void stop_server(pid_t pid) {
+    kill(pid, SIGHUP);
+    waitpid(pid, NULL, 0);
+}
+
+static void run_step(int nconns, int ngames) {
+    pid_t pid = start_server();
+    FP_CONN *conns = calloc(nconns, sizeof(FP_CONN));
+    loop = jc_loop_create();
+    if(pid == -1 || conns == NULL || loop == NULL) {
+        fprintf(stderr, "footprint_bench: cannot set up\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* wait for the server to listen; the probe's own session is gone before the baseline */
+    JC_CONN *probe = NULL;
+    for(int i = 0; i < 50 && (probe = jc_connect(loop, "127.0.0.1", port, NULL, NULL)) == NULL; i++) {
+        usleep(100000);
+    }
+    if(probe == NULL) {
+        fprintf(stderr, "footprint_bench: server did not start\n");
+        exit(EXIT_FAILURE);
+    }
+    jc_close(probe);
+    usleep(FP_SETTLE_US);
+    int64_t rss_base = census_rss_bytes(pid);
+
+    int served = 0;
+    for(; served < nconns; served++) {
+        FP_CONN *c = &conns[served];
+        c->invited = -1;
+        if((c->conn = jc_connect(loop, "127.0.0.1", port, got_event, c)) == NULL) {
+            break;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "idle%d", served);
+        if(request(c, JEUX_LOGIN_PKT, 0, 0, name) != JEUX_ACK_PKT) {
+            if(!c->lost) {
+                jc_close(c->conn);
+            }
+            break;
+        }
+    }
+    usleep(FP_SETTLE_US);
+    int64_t rss_idle = census_rss_bytes(pid);
+
+    int games = 0;
+    for(; games < ngames && 2 * games + 1 < served; games++) {
+        FP_CONN *a = &conns[2 * games], *b = &conns[2 * games + 1];
+        char name[32];
+        snprintf(name, sizeof(name), "idle%d", 2 * games + 1);
+        if(request(a, JEUX_INVITE_PKT, 0, SECOND_PLAYER_ROLE, name) != JEUX_ACK_PKT ||
+                await(&b->invited, -1) == -1 ||
+                request(b, JEUX_ACCEPT_PKT, b->invited, 0, NULL) != JEUX_ACK_PKT ||
+                await(&a->accepted, 0) == -1) {
+            fprintf(stderr, "footprint_bench: game %d could not be started\n", games);
+            break;
+        }
+    }
+    usleep(FP_SETTLE_US);
+    int64_t rss_games = census_rss_bytes(pid);
+
+    jc_loop_destroy(loop);
+    stop_server(pid);
+    free(conns);
+
+    printf("conns_%d_served\t%d\n", nconns, served);
+    printf("conns_%d_rss_base_bytes\t%ld\n", nconns, rss_base);
+    printf("conns_%d_rss_idle_bytes\t%ld\n", nconns, rss_idle);
+    printf("conns_%d_bytes_per_idle_connection\t%.0f\n", nconns,
+           served > 0 ? (double)(rss_idle - rss_base) / served : 0.0);
+    printf("conns_%d_games\t%d\n", nconns, games);
+    printf("conns_%d_rss_games_bytes\t%ld\n", nconns, rss_games);
+    printf("conns_%d_bytes_per_game\t%.0f\n", nconns,
+           games > 0 ? (double)(rss_games - rss_idle) / games : 0.0);
+}
+
+static void usage(char *prog) {
+    fprintf(stderr, "Usage: %s [-s server] [-p port] [-n conns[,conns...]] [-g games]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    char *counts = "10000,50000";
+    int ngames = 16;
+    for(int i = 1; i + 1 < argc; i += 2) {
+        if(strcmp(argv[i], "-s") == 0) {
+            server = argv[i + 1];
+        } else if(strcmp(argv[i], "-p") == 0) {
+            port = argv[i + 1];
+        } else if(strcmp(argv[i], "-n") == 0) {
+            counts = argv[i + 1];
+        } else if(strcmp(argv[i], "-g") == 0) {
+            ngames = atoi(argv[i + 1]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if(argc % 2 == 0 || ngames < 0) {
+        usage(argv[0]);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    /* the server inherits the limit */
+    struct rlimit rl;
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    char *list = strdup(counts);
+    for(char *tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        int nconns = atoi(tok);
+        if(nconns < 1) {
+            usage(argv[0]);
+        }
+        run_step(nconns, ngames);
+    }
+    free(list);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "glicko.h"
+
+/*
+ * Glicko-2 rating period benchmark.
+ *
+ * Usage: glicko_bench [-p players] [-g games] [-r periods]
+ *
+ * Records the given number of random games between the given number of
+ * players into each rating period and reports the time to record them and
+ * the time to close the period.  Defaults to 1M players and 10M games.
+ */
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    long nplayers = 1000000;
+    long ngames = 10000000;
+    int nperiods = 1;
+    for(int i = 1; i + 1 < argc; i += 2) {
+        if(strcmp(argv[i], "-p") == 0) {
+            nplayers = atol(argv[i + 1]);
+        } else if(strcmp(argv[i], "-g") == 0) {
+            ngames = atol(argv[i + 1]);
+        } else if(strcmp(argv[i], "-r") == 0) {
+            nperiods = atoi(argv[i + 1]);
+        } else {
+            fprintf(stderr, "Usage: %s [-p players] [-g games] [-r periods]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if(nplayers < 2 || ngames < 1 || nperiods < 1) {
+        fprintf(stderr, "%s: invalid arguments\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    GLICKO *g = glicko_init(GLICKO_DEFAULT_TAU, 0);
+    if(g == NULL) {
+        fprintf(stderr, "%s: failed to initialize Glicko-2 engine\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    // Make every player known up front so the first period is not a special case.
+    glicko_set(g, nplayers - 1, GLICKO_INITIAL_RATING, GLICKO_INITIAL_RD, GLICKO_INITIAL_VOLATILITY);
+
+    unsigned int seed = 1;
+    for(int period = 0; period < nperiods; period++) {
+        double start = now();
+        for(long i = 0; i < ngames; i++) {
+            int a = rand_r(&seed) % nplayers;
+            int b = rand_r(&seed) % nplayers;
+            if(a == b)
+                b = (b + 1) % nplayers;
+            glicko_record(g, a, b, rand_r(&seed) % 3);
+        }
+        double recorded = now();
+        long n = glicko_close_period(g);
+        double closed = now();
+
+        printf("period_%d_players\t%ld\n", period, nplayers);
+        printf("period_%d_games\t%ld\n", period, n);
+        printf("period_%d_record_sec\t%.3f\n", period, recorded - start);
+        printf("period_%d_close_sec\t%.3f\n", period, closed - recorded);
+        printf("period_%d_close_ns_per_game\t%.1f\n", period, (closed - recorded) * 1e9 / n);
+    }
+    glicko_fini(g);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,435 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "csapp.h"
+#include "protocol.h"
+#include "packet_common.h"
+#include "game.h"
+#include "metrics.h"
+
+/*
+ * Multi-client load generator.
+ *
+ * Usage: load_bench -p port [-h host] [-t max_threads] [-c pairs_per_thread]
+ *                   [-d secs_per_step] [-r game_rate] [-u users_rate]
+ *                   [-R resign_percent] [-m random|scripted]
+ *
+ * Drives a server started separately.  For 1, 2, 4, ... up to max_threads
+ * threads in turn, each thread opens two connections per pair, logs them
+ * in and has each pair play games over and over: the first client invites
+ * the second, the second accepts, and they move in turn (random legal
+ * squares, or a fixed script) until one wins, the board fills, or the
+ * player to move resigns, which in random mode happens with the given
+ * probability per move.  Each client also polls USERS.
+ *
+ * Requests are sent on an open-loop schedule of game_rate per pair and
+ * users_rate per client, per second (defaults 100 and 1).  Latency is
+ * measured from when a request was due to be sent, not from when it was,
+ * so a stall that holds up later requests is charged to them as well;
+ * this corrects for coordinated omission.  A game_rate of 0 sends game
+ * requests as fast as replies arrive, and their latency is then just the
+ * round trip; a users_rate of 0 turns polling off.
+ *
+ * For each thread count it reports the requests completed per second and,
+ * for each packet type, a latency histogram "threads_<n>_latency_ns_<type>"
+ * in the format of metrics_hist_write().
+ */
+
+#define LB_BOARD 9
+
+typedef struct lb_client {
+    int fd;
+    int inv_id;                 /* this client's id for the pair's invitation, or -1 */
+    uint64_t next_users;        /* when the next USERS poll is due */
+    char name[32];
+} LB_CLIENT;
+
+typedef enum {
+    PAIR_IDLE,                  /* next: first client invites */
+    PAIR_INVITED,               /* next: second client accepts */
+    PAIR_PLAYING,               /* next: a move or resignation */
+    PAIR_BROKEN                 /* connection lost */
+} LB_PAIR_STATE;
+
+typedef struct lb_pair {
+    LB_CLIENT c[2];             /* c[0] invites and moves first */
+    LB_PAIR_STATE state;
+    int board[LB_BOARD];        /* 0 empty, else 1 + index of the client */
+    int turn;                   /* index of the client to move */
+    uint64_t next_game;         /* when the next game request is due */
+    unsigned int seed;
+} LB_PAIR;
+
+typedef struct lb_thread {
+    pthread_t tid;
+    int index;
+    LB_PAIR *pairs;
+    uint64_t requests;
+    uint64_t games;
+    uint64_t errors;
+} LB_THREAD;
+
+static char *host = "127.0.0.1";
+static char *port = NULL;
+static int pairs_per_thread = 4;
+static int step_secs = 5;
+static uint64_t game_interval_ns = 10000000;
+static uint64_t users_interval_ns = 1000000000;
+static int resign_percent = 5;
+static int scripted = 0;
+
+static int step_threads;
+static uint64_t deadline_ns;
+static METRICS_HISTOGRAM *hists;    /* per packet type, for the current step */
+
+/* Order in which the scripted game takes squares. */
+static int script[LB_BOARD] = { 5, 1, 9, 3, 7, 2, 8, 4, 6 };
+
+static int lines[8][3] = {
+    {0, 1, 2}, {3, 4, 5}, {6, 7, 8},
+    {0, 3, 6}, {1, 4, 7}, {2, 5, 8},
+    {0, 4, 8}, {2, 4, 6}
+};
+
+static void sleep_until(uint64_t ns) {
+    struct timespec ts = { .tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000 };
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+        ;
+}
+
+/*
+ * Read packets until one of the given type arrives, noting the
+ * invitation id of any INVITED on the way.
+ */
+static int await(LB_CLIENT *c, int want1, int want2, JEUX_PACKET_HEADER *hdr) {
+    while(1) {
+        void *payload = NULL;
+        if(proto_recv_packet(c->fd, hdr, &payload) == -1) {
+            return -1;
+        }
+        unpack_header(hdr);
+        free(payload);
+        if(hdr->type == JEUX_INVITED_PKT) {
+            c->inv_id = hdr->id;
+        }
+        if(hdr->type == want1 || hdr->type == want2) {
+            return 0;
+        }
+    }
+}
+
+/*
+ * Send a request and wait for its reply, recording its latency from the
+ * time it was due.
+ *
+ * @return 0 on ACK, 1 on NACK, -1 if the connection failed.
+ */
+static int request(LB_THREAD *t, LB_CLIENT *c, int type, int id, int role,
+        char *payload, uint64_t due_ns, JEUX_PACKET_HEADER *reply) {
+    JEUX_PACKET_HEADER hdr = {0};
+    size_t size = payload == NULL ? 0 : strlen(payload);
+    pack_header(&hdr, type, id, role, size);
+    if(proto_send_packet(c->fd, &hdr, payload) == -1 ||
+            await(c, JEUX_ACK_PKT, JEUX_NACK_PKT, reply) == -1) {
+        return -1;
+    }
+    metrics_hist_record(&hists[type], metrics_now_ns() - due_ns);
+    t->requests++;
+    return reply->type == JEUX_ACK_PKT ? 0 : 1;
+}
+
+static int game_over(int board[LB_BOARD]) {
+    for(int l = 0; l < 8; l++) {
+        int a = board[lines[l][0]];
+        if(a != 0 && a == board[lines[l][1]] && a == board[lines[l][2]]) {
+            return 1;
+        }
+    }
+    for(int i = 0; i < LB_BOARD; i++) {
+        if(board[i] == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int pick_square(LB_PAIR *p) {
+    if(scripted) {
+        for(int i = 0; i < LB_BOARD; i++) {
+            if(p->board[script[i] - 1] == 0) {
+                return script[i];
+            }
+        }
+        return -1;
+    }
+    int empty[LB_BOARD], n = 0;
+    for(int i = 0; i < LB_BOARD; i++) {
+        if(p->board[i] == 0) {
+            empty[n++] = i + 1;
+        }
+    }
+    return n == 0 ? -1 : empty[rand_r(&p->seed) % n];
+}
+
+/* Make the pair's next game request. */
+static void game_step(LB_THREAD *t, LB_PAIR *p, uint64_t due_ns) {
+    JEUX_PACKET_HEADER reply;
+    int status = 0;
+    switch(p->state) {
+        case PAIR_IDLE:
+            p->c[1].inv_id = -1;
+            status = request(t, &p->c[0], JEUX_INVITE_PKT, 0, SECOND_PLAYER_ROLE,
+                             p->c[1].name, due_ns, &reply);
+            if(status == 0) {
+                p->c[0].inv_id = reply.id;
+                p->state = PAIR_INVITED;
+            }
+            break;
+        case PAIR_INVITED:
+            if(p->c[1].inv_id == -1 && await(&p->c[1], JEUX_INVITED_PKT, JEUX_INVITED_PKT, &reply) == -1) {
+                status = -1;
+                break;
+            }
+            status = request(t, &p->c[1], JEUX_ACCEPT_PKT, p->c[1].inv_id, 0, NULL, due_ns, &reply);
+            if(status == 0) {
+                memset(p->board, 0, sizeof(p->board));
+                p->turn = 0;
+                p->state = PAIR_PLAYING;
+            }
+            break;
+        case PAIR_PLAYING: {
+            LB_CLIENT *mover = &p->c[p->turn];
+            if(!scripted && rand_r(&p->seed) % 100 < resign_percent) {
+                status = request(t, mover, JEUX_RESIGN_PKT, mover->inv_id, 0, NULL, due_ns, &reply);
+                p->state = PAIR_IDLE;
+                t->games++;
+                break;
+            }
+            int square = pick_square(p);
+            char move[2] = { '0' + square, '\0' };
+            status = request(t, mover, JEUX_MOVE_PKT, mover->inv_id, 0, move, due_ns, &reply);
+            if(status != 0) {
+                break;
+            }
+            p->board[square - 1] = 1 + p->turn;
+            p->turn ^= 1;
+            if(game_over(p->board)) {
+                p->state = PAIR_IDLE;
+                t->games++;
+            }
+            break;
+        }
+        case PAIR_BROKEN:
+            return;
+    }
+    if(status == -1) {
+        p->state = PAIR_BROKEN;
+        t->errors++;
+    } else if(status == 1) {
+        /* out of step with the server: give up on this game and start another */
+        t->errors++;
+        if(p->state == PAIR_PLAYING) {
+            request(t, &p->c[0], JEUX_RESIGN_PKT, p->c[0].inv_id, 0, NULL, metrics_now_ns(), &reply);
+        }
+        p->state = PAIR_IDLE;
+    }
+}
+
+static int connect_client(LB_THREAD *t, LB_CLIENT *c, char *name) {
+    snprintf(c->name, sizeof(c->name), "%s", name);
+    c->inv_id = -1;
+    c->fd = open_clientfd(host, port);
+    if(c->fd < 0) {
+        return -1;
+    }
+    struct timeval tv = { .tv_sec = 10, .tv_usec = 0 };
+    setsockopt(c->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    /* each request is written whole and waits for its reply, so Nagle could only delay it */
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    JEUX_PACKET_HEADER reply;
+    return request(t, c, JEUX_LOGIN_PKT, 0, 0, c->name, metrics_now_ns(), &reply) == 0 ? 0 : -1;
+}
+
+static void *load_thread(void *arg) {
+    LB_THREAD *t = arg;
+    uint64_t start = metrics_now_ns();
+    for(int i = 0; i < pairs_per_thread; i++) {
+        LB_PAIR *p = &t->pairs[i];
+        char name[32];
+        p->seed = (t->index + 1) * 7919 + i;
+        p->state = PAIR_IDLE;
+        for(int k = 0; k < 2; k++) {
+            snprintf(name, sizeof(name), "lb%d_%d_%d%c", step_threads, t->index, i, 'a' + k);
+            if(connect_client(t, &p->c[k], name) == -1) {
+                p->state = PAIR_BROKEN;
+                t->errors++;
+            }
+            /* spread polls out so they do not all land at once */
+            p->c[k].next_users = start + (users_interval_ns ? rand_r(&p->seed) % users_interval_ns : 0);
+        }
+        p->next_game = start + (game_interval_ns ? rand_r(&p->seed) % game_interval_ns : 0);
+    }
+
+    while(1) {
+        /* the earliest request due */
+        LB_PAIR *p = NULL;
+        LB_CLIENT *poller = NULL;
+        uint64_t due = UINT64_MAX;
+        for(int i = 0; i < pairs_per_thread; i++) {
+            LB_PAIR *q = &t->pairs[i];
+            if(q->state == PAIR_BROKEN) {
+                continue;
+            }
+            if(q->next_game < due) {
+                due = q->next_game;
+                p = q;
+                poller = NULL;
+            }
+            for(int k = 0; users_interval_ns != 0 && k < 2; k++) {
+                if(q->c[k].next_users < due) {
+                    due = q->c[k].next_users;
+                    p = q;
+                    poller = &q->c[k];
+                }
+            }
+        }
+        if(p == NULL || due >= deadline_ns) {
+            break;
+        }
+        uint64_t now = metrics_now_ns();
+        if(due > now) {
+            sleep_until(due);
+        }
+        if(poller != NULL) {
+            JEUX_PACKET_HEADER reply;
+            if(request(t, poller, JEUX_USERS_PKT, 0, 0, NULL, due, &reply) == -1) {
+                p->state = PAIR_BROKEN;
+                t->errors++;
+            }
+            poller->next_users += users_interval_ns;
+        } else if(game_interval_ns == 0) {
+            game_step(t, p, now);
+            p->next_game = metrics_now_ns();
+        } else {
+            game_step(t, p, due);
+            p->next_game += game_interval_ns;
+        }
+    }
+
+    for(int i = 0; i < pairs_per_thread; i++) {
+        for(int k = 0; k < 2; k++) {
+            if(t->pairs[i].c[k].fd >= 0) {
+                close(t->pairs[i].c[k].fd);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void run_step(int nthreads) {
+    LB_THREAD *threads = calloc(nthreads, sizeof(LB_THREAD));
+    hists = calloc(METRICS_PKT_TYPES, sizeof(METRICS_HISTOGRAM));
+    METRICS_HIST_SNAPSHOT *snap = malloc(sizeof(METRICS_HIST_SNAPSHOT));
+    if(threads == NULL || hists == NULL || snap == NULL) {
+        fprintf(stderr, "load_bench: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    step_threads = nthreads;
+    uint64_t start = metrics_now_ns();
+    deadline_ns = start + (uint64_t)step_secs * 1000000000;
+    for(int i = 0; i < nthreads; i++) {
+        threads[i].index = i;
+        threads[i].pairs = calloc(pairs_per_thread, sizeof(LB_PAIR));
+        pthread_create(&threads[i].tid, NULL, load_thread, &threads[i]);
+    }
+    uint64_t requests = 0, games = 0, errors = 0;
+    for(int i = 0; i < nthreads; i++) {
+        pthread_join(threads[i].tid, NULL);
+        requests += threads[i].requests;
+        games += threads[i].games;
+        errors += threads[i].errors;
+        free(threads[i].pairs);
+    }
+    double elapsed = (metrics_now_ns() - start) / 1e9;
+
+    printf("threads_%d_connections\t%d\n", nthreads, 2 * nthreads * pairs_per_thread);
+    printf("threads_%d_requests\t%lu\n", nthreads, requests);
+    printf("threads_%d_requests_per_sec\t%.0f\n", nthreads, requests / elapsed);
+    printf("threads_%d_games\t%lu\n", nthreads, games);
+    printf("threads_%d_errors\t%lu\n", nthreads, errors);
+    for(int type = 0; type < METRICS_PKT_TYPES; type++) {
+        metrics_hist_read(&hists[type], snap);
+        if(snap->count == 0) {
+            continue;
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "threads_%d_latency_ns_%s", nthreads, metrics_pkt_name(type));
+        metrics_hist_write(stdout, name, snap);
+    }
+    fflush(stdout);
+    free(snap);
+    free(hists);
+    free(threads);
+}
+
+static void usage(char *prog) {
+    fprintf(stderr, "Usage: %s -p port [-h host] [-t max_threads] [-c pairs_per_thread] "
+            "[-d secs_per_step] [-r game_rate] [-u users_rate] [-R resign_percent] "
+            "[-m random|scripted]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    int max_threads = 8;
+    double game_rate = 100, users_rate = 1;
+    for(int i = 1; i + 1 < argc; i += 2) {
+        if(strcmp(argv[i], "-p") == 0) {
+            port = argv[i + 1];
+        } else if(strcmp(argv[i], "-h") == 0) {
+            host = argv[i + 1];
+        } else if(strcmp(argv[i], "-t") == 0) {
+            max_threads = atoi(argv[i + 1]);
+        } else if(strcmp(argv[i], "-c") == 0) {
+            pairs_per_thread = atoi(argv[i + 1]);
+        } else if(strcmp(argv[i], "-d") == 0) {
+            step_secs = atoi(argv[i + 1]);
+        } else if(strcmp(argv[i], "-r") == 0) {
+            game_rate = atof(argv[i + 1]);
+        } else if(strcmp(argv[i], "-u") == 0) {
+            users_rate = atof(argv[i + 1]);
+        } else if(strcmp(argv[i], "-R") == 0) {
+            resign_percent = atoi(argv[i + 1]);
+        } else if(strcmp(argv[i], "-m") == 0 && strcmp(argv[i + 1], "random") == 0) {
+            scripted = 0;
+        } else if(strcmp(argv[i], "-m") == 0 && strcmp(argv[i + 1], "scripted") == 0) {
+            scripted = 1;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if(port == NULL || argc % 2 == 0) {
+        usage(argv[0]);
+    }
+    if(max_threads < 1 || pairs_per_thread < 1 || step_secs < 1 || game_rate < 0 ||
+            users_rate < 0 || resign_percent < 0 || resign_percent > 100) {
+        fprintf(stderr, "%s: invalid arguments\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    game_interval_ns = game_rate == 0 ? 0 : 1e9 / game_rate;
+    users_interval_ns = users_rate == 0 ? 0 : 1e9 / users_rate;
+    signal(SIGPIPE, SIG_IGN);
+
+    for(int nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+        run_step(nthreads);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,421 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "client_registry.h"
+#include "player_registry.h"
+#include "player_registry_ext.h"
+#include "client.h"
+#include "player.h"
+#include "game.h"
+#include "game_ext.h"
+#include "invitation.h"
+#include "packet_common.h"
+#include "jeux_globals.h"
+
+/*
+ * Microbenchmarks of the server's building blocks, without networking.
+ *
+ * Usage: micro_bench [-t threads] [-n ops_per_thread] [-b name_filter]
+ *
+ * Each benchmark runs once on one thread and once on the given number of
+ * threads (default 4) sharing the same objects, so the second run shows
+ * what contention costs.  Output is one "<bench>_threads_<n>_ns_per_op"
+ * and one "<bench>_threads_<n>_ops_per_sec" line per run, for diffing
+ * between commits.  ns_per_op is the time an operation takes on one
+ * thread, averaged over threads; ops_per_sec is the total rate, over
+ * the time the slowest thread took.  Only
+ * benchmarks whose name contains name_filter are run.
+ *
+ * Operations that return a reference or an allocated result include
+ * releasing it.  game_apply_move times only the moves, each applied to
+ * a new game by the thread, since a game takes at most nine.
+ */
+
+/* Logged-in clients, for the client registry benchmarks. */
+#define MB_CLIENTS 32
+
+/* Players registered before the registry hit benchmark. */
+#define MB_PLAYERS 1000
+
+/* New players registered between collections in preg_register_miss. */
+#define MB_MISS_BATCH 1000
+
+/* Games per timed batch in game_apply_move. */
+#define MB_GAME_BATCH 64
+
+typedef struct micro_bench {
+    char *name;
+    int op_divisor;             /* runs ops_per_thread / op_divisor operations */
+    void (*setup)(void);
+    uint64_t (*run)(long n, int thread);    /* returns nanoseconds timed */
+    void (*teardown)(void);
+} MICRO_BENCH;
+
+typedef struct mb_thread {
+    pthread_t tid;
+    int index;
+    long n;
+    MICRO_BENCH *bench;
+    uint64_t ns;
+} MB_THREAD;
+
+static pthread_barrier_t start_barrier;
+
+/* Shared objects. */
+static GAME *game;
+static PLAYER *player1, *player2;
+static PLAYER_REGISTRY *preg;
+static PLAYER *registered[MB_PLAYERS];
+static CLIENT_REGISTRY *creg;
+static CLIENT *clients[MB_CLIENTS];
+static INVITATION *inv;
+
+/* A drawn game, square by square. */
+static char *draw[9] = { "5", "1", "9", "3", "2", "8", "4", "6", "7" };
+
+static volatile uintptr_t sink;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void nothing(void) {
+}
+
+static void make_game(void) {
+    game = game_create();
+}
+
+static void free_game(void) {
+    game_unref(game, "because benchmark is done");
+}
+
+static uint64_t run_parse_move(long n, int thread) {
+    uint64_t start = now_ns();
+    for(long i = 0; i < n; i++) {
+        GAME_MOVE *move = game_parse_move(game, FIRST_PLAYER_ROLE, "5");
+        sink = (uintptr_t)move;
+        game_free_move(move);
+    }
+    return now_ns() - start;
+}
+
+static uint64_t run_apply_move(long n, int thread) {
+    /* the moves of the drawn game, parsed on a scratch game as play goes on */
+    GAME_MOVE *moves[9];
+    GAME *scratch = game_create();
+    for(int m = 0; m < 9; m++) {
+        moves[m] = game_parse_move(scratch, m % 2 == 0 ? FIRST_PLAYER_ROLE : SECOND_PLAYER_ROLE, draw[m]);
+        game_apply_move(scratch, moves[m]);
+    }
+    game_unref(scratch, "because moves are parsed");
+
+    GAME *games[MB_GAME_BATCH];
+    uint64_t ns = 0;
+    for(long done = 0; done < n; ) {
+        for(int g = 0; g < MB_GAME_BATCH; g++) {
+            games[g] = game_create();
+        }
+        uint64_t start = now_ns();
+        for(int g = 0; g < MB_GAME_BATCH && done < n; g++) {
+            for(int m = 0; m < 9 && done < n; m++, done++) {
+                game_apply_move(games[g], moves[m]);
+            }
+        }
+        ns += now_ns() - start;
+        for(int g = 0; g < MB_GAME_BATCH; g++) {
+            game_unref(games[g], "because batch is done");
+        }
+    }
+    for(int m = 0; m < 9; m++) {
+        game_free_move(moves[m]);
+    }
+    return ns;
+}
+
+static void make_game_in_progress(void) {
+    game = game_create();
+    for(int m = 0; m < 4; m++) {
+        GAME_MOVE *move = game_parse_move(game, m % 2 == 0 ? FIRST_PLAYER_ROLE : SECOND_PLAYER_ROLE, draw[m]);
+        game_apply_move(game, move);
+        game_free_move(move);
+    }
+}
+
+static uint64_t run_unparse_state(long n, int thread) {
+    uint64_t start = now_ns();
+    for(long i = 0; i < n; i++) {
+        char *state = game_unparse_state(game);
+        sink = (uintptr_t)state;
+        free(state);
+    }
+    return now_ns() - start;
+}
+
+static void make_players(void) {
+    player1 = player_create("alice");
+    player2 = player_create("bob");
+}
+
+static void free_players(void) {
+    player_unref(player1, "because benchmark is done");
+    player_unref(player2, "because benchmark is done");
+}
+
+static uint64_t run_post_result(long n, int thread) {
+    uint64_t start = now_ns();
+    for(long i = 0; i < n; i++) {
+        player_post_result(player1, player2, i % 3);
+    }
+    return now_ns() - start;
+}
+
+static void make_player_registry(void) {
+    preg = preg_init();
+    char name[32];
+    for(int i = 0; i < MB_PLAYERS; i++) {
+        snprintf(name, sizeof(name), "p%d", i);
+        /* held, so that collecting idle players leaves them registered */
+        registered[i] = preg_register(preg, name);
+    }
+}
+
+static void free_player_registry(void) {
+    for(int i = 0; i < MB_PLAYERS; i++) {
+        player_unref(registered[i], "because benchmark is done");
+    }
+    preg_fini(preg);
+}
+
+static uint64_t run_preg_hit(long n, int thread) {
+    char names[16][32];
+    for(int k = 0; k < 16; k++) {
+        snprintf(names[k], sizeof(names[k]), "p%d", (thread * 16 + k) % MB_PLAYERS);
+    }
+    uint64_t start = now_ns();
+    for(long i = 0; i < n; i++) {
+        player_unref(preg_register(preg, names[i % 16]), "because benchmark is done with it");
+    }
+    return now_ns() - start;
+}
+
+/*
+ * The registry is searched linearly, so new players are collected every
+ * MB_MISS_BATCH registrations to keep the cost from depending on n.
+ */
+static uint64_t run_preg_miss(long n, int thread) {
+    char name[32];
+    uint64_t ns = 0;
+    for(long i = 0; i < n; i++) {
+        snprintf(name, sizeof(name), "m%d_%ld", thread, i);
+        uint64_t start = now_ns();
+        PLAYER *player = preg_register(preg, name);
+        ns += now_ns() - start;
+        player_unref(player, "because benchmark is done with it");
+        if(i % MB_MISS_BATCH == MB_MISS_BATCH - 1) {
+            preg_collect_idle(preg);
+        }
+    }
+    return ns;
+}
+
+/* client_login() checks the server's client registry for the player. */
+static void make_client_registry(void) {
+    creg = client_registry = creg_init();
+    char name[32];
+    for(int i = 0; i < MB_CLIENTS; i++) {
+        clients[i] = creg_register(creg, open("/dev/null", O_RDWR));
+        snprintf(name, sizeof(name), "c%d", i);
+        PLAYER *player = player_create(name);
+        client_login(clients[i], player);
+        player_unref(player, "because client holds it");
+    }
+}
+
+static void free_client_registry(void) {
+    for(int i = 0; i < MB_CLIENTS; i++) {
+        client_logout(clients[i]);
+        creg_unregister(creg, clients[i]);
+    }
+    creg_fini(creg);
+    client_registry = NULL;
+}
+
+static uint64_t run_creg_lookup(long n, int thread) {
+    char names[MB_CLIENTS][32];
+    for(int k = 0; k < MB_CLIENTS; k++) {
+        snprintf(names[k], sizeof(names[k]), "c%d", k);
+    }
+    uint64_t start = now_ns();
+    for(long i = 0; i < n; i++) {
+        CLIENT *client = creg_lookup(creg, names[(i + thread) % MB_CLIENTS]);
+        client_unref(client, "because benchmark is done with it");
+    }
+    return now_ns() - start;
+}
+
+static uint64_t run_creg_all_players(long n, int thread) {
+    uint64_t start = now_ns();
+    for(long i = 0; i < n; i++) {
+        PLAYER **players = creg_all_players(creg);
+        for(PLAYER **p = players; *p != NULL; p++) {
+            player_unref(*p, "because benchmark is done with it");
+        }
+        free(players);
+    }
+    return now_ns() - start;
+}
+
+static uint64_t run_pack_unpack(long n, int thread) {
+    JEUX_PACKET_HEADER hdr;
+    uint64_t start = now_ns();
+    for(long i = 0; i < n; i++) {
+        pack_header(&hdr, JEUX_MOVED_PKT, i, 0, i);
+        unpack_header(&hdr);
+        sink = hdr.size;
+    }
+    return now_ns() - start;
+}
+
+static uint64_t run_client_ref(long n, int thread) {
+    uint64_t start = now_ns();
+    for(long i = 0; i < n; i++) {
+        client_ref(clients[0], "for benchmark");
+        client_unref(clients[0], "for benchmark");
+    }
+    return now_ns() - start;
+}
+
+static uint64_t run_player_ref(long n, int thread) {
+    uint64_t start = now_ns();
+    for(long i = 0; i < n; i++) {
+        player_ref(player1, "for benchmark");
+        player_unref(player1, "for benchmark");
+    }
+    return now_ns() - start;
+}
+
+static uint64_t run_game_ref(long n, int thread) {
+    uint64_t start = now_ns();
+    for(long i = 0; i < n; i++) {
+        game_ref(game, "for benchmark");
+        game_unref(game, "for benchmark");
+    }
+    return now_ns() - start;
+}
+
+static void make_invitation(void) {
+    make_client_registry();
+    inv = inv_create(clients[0], clients[1], FIRST_PLAYER_ROLE, SECOND_PLAYER_ROLE);
+}
+
+static void free_invitation(void) {
+    inv_unref(inv, "because benchmark is done");
+    free_client_registry();
+}
+
+static uint64_t run_inv_ref(long n, int thread) {
+    uint64_t start = now_ns();
+    for(long i = 0; i < n; i++) {
+        inv_ref(inv, "for benchmark");
+        inv_unref(inv, "for benchmark");
+    }
+    return now_ns() - start;
+}
+
+static MICRO_BENCH benches[] = {
+    { "game_parse_move", 1, make_game, run_parse_move, free_game },
+    { "game_apply_move", 1, nothing, run_apply_move, nothing },
+    { "game_unparse_state", 1, make_game_in_progress, run_unparse_state, free_game },
+    { "player_post_result", 1, make_players, run_post_result, free_players },
+    { "preg_register_hit", 1, make_player_registry, run_preg_hit, free_player_registry },
+    { "preg_register_miss", 100, make_player_registry, run_preg_miss, free_player_registry },
+    { "creg_lookup", 1, make_client_registry, run_creg_lookup, free_client_registry },
+    { "creg_all_players", 10, make_client_registry, run_creg_all_players, free_client_registry },
+    { "pack_unpack_header", 1, nothing, run_pack_unpack, nothing },
+    { "client_ref_unref", 1, make_client_registry, run_client_ref, free_client_registry },
+    { "player_ref_unref", 1, make_players, run_player_ref, free_players },
+    { "game_ref_unref", 1, make_game, run_game_ref, free_game },
+    { "inv_ref_unref", 1, make_invitation, run_inv_ref, free_invitation },
+};
+
+static void *bench_thread(void *arg) {
+    MB_THREAD *t = arg;
+    pthread_barrier_wait(&start_barrier);
+    t->ns = t->bench->run(t->n, t->index);
+    return NULL;
+}
+
+static void run_bench(MICRO_BENCH *bench, int nthreads, long n) {
+    MB_THREAD *threads = calloc(nthreads, sizeof(MB_THREAD));
+    if(threads == NULL) {
+        fprintf(stderr, "micro_bench: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    n /= bench->op_divisor;
+    bench->setup();
+    pthread_barrier_init(&start_barrier, NULL, nthreads);
+    for(int i = 0; i < nthreads; i++) {
+        threads[i].index = i;
+        threads[i].n = n;
+        threads[i].bench = bench;
+        pthread_create(&threads[i].tid, NULL, bench_thread, &threads[i]);
+    }
+    double ns_per_op = 0;
+    uint64_t longest = 0;
+    for(int i = 0; i < nthreads; i++) {
+        pthread_join(threads[i].tid, NULL);
+        ns_per_op += (double)threads[i].ns / n / nthreads;
+        if(threads[i].ns > longest) {
+            longest = threads[i].ns;
+        }
+    }
+    pthread_barrier_destroy(&start_barrier);
+    bench->teardown();
+
+    printf("%s_threads_%d_ns_per_op\t%.1f\n", bench->name, nthreads, ns_per_op);
+    printf("%s_threads_%d_ops_per_sec\t%.0f\n", bench->name, nthreads, nthreads * n * 1e9 / longest);
+    fflush(stdout);
+    free(threads);
+}
+
+int main(int argc, char *argv[]) {
+    int nthreads = 4;
+    long n = 1000000;
+    char *filter = "";
+    for(int i = 1; i + 1 < argc; i += 2) {
+        if(strcmp(argv[i], "-t") == 0) {
+            nthreads = atoi(argv[i + 1]);
+        } else if(strcmp(argv[i], "-n") == 0) {
+            n = atol(argv[i + 1]);
+        } else if(strcmp(argv[i], "-b") == 0) {
+            filter = argv[i + 1];
+        } else {
+            fprintf(stderr, "Usage: %s [-t threads] [-n ops_per_thread] [-b name_filter]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if(nthreads < 1 || n < 100) {
+        fprintf(stderr, "%s: invalid arguments\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+        if(strstr(benches[b].name, filter) == NULL) {
+            continue;
+        }
+        run_bench(&benches[b], 1, n);
+        if(nthreads > 1) {
+            run_bench(&benches[b], nthreads, n);
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,420 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "client_registry.h"
+#include "session.h"
+#include "protocol.h"
+#include "protocol_ext.h"
+#include "packet_common.h"
+#include "game.h"
+#include "metrics.h"
+
+/*
+ * Throughput of receiving packets and of dispatching requests.
+ *
+ * Usage: proto_bench [-n packets] [-u users] [-l name_length] [-r rsrc_dir]
+ *
+ * Three stages are timed:
+ *
+ *   recv           A thread writes a stream of frames into a pipe or a
+ *                  socketpair while the main thread takes them out of the
+ *                  other end with proto_recv_packet() and releases their
+ *                  payloads, as a service thread does.
+ *   dispatch       Requests are handed to sessions with session_push(),
+ *                  with no descriptor involved.
+ *   recv_dispatch  Both: each request read with proto_recv_packet() goes
+ *                  on to session_push().
+ *
+ * The recv streams are the fixtures pkt_login, pkt_ack_with_payload and
+ * pkt_revoke_no_payload from rsrc_dir (default tests/rsrc), each repeated;
+ * "move", MOVE requests with one-character payloads; and "users_reply",
+ * ACKs carrying the reply the server gives to USERS.  The login stream
+ * ends with pkt_short_payload and the revoke stream with pkt_short_header,
+ * which must be rejected.  The dispatch streams are "game", whole games
+ * (INVITE, ACCEPT and nine MOVEs to a draw) between two sessions, and
+ * "users", USERS requests.  Every dispatched request must be ACKed.
+ *
+ * The number of users (default MAX_CLIENTS) logged in, and the length of
+ * their names (default 32), set the size of the USERS replies.  Each
+ * stream runs about the given number of packets (default 100000) and
+ * prints "<stage>_<transport>_<stream>_packets", "..._packets_per_sec"
+ * and "..._bytes_per_sec" lines, for diffing between commits.  Bytes are
+ * whole frames, header and payload.  For the dispatch stages packets are
+ * the requests, and bytes include the replies and notifications sent.
+ */
+
+/* Bytes of frames written at a time by the writer thread. */
+#define PB_WRITE_BLOCK (64 * 1024)
+
+/* Most frames in one unit of a stream. */
+#define PB_MAX_FRAMES 16
+
+#define PB_MAX_NAME 200
+
+typedef struct pb_stream {
+    char *name;
+    char *unit;                 /* frames written back to back, repeated */
+    size_t unit_len;
+    int frames;                 /* frames in one unit */
+    int who[PB_MAX_FRAMES];     /* session each frame of a unit is pushed to */
+    char *tail;                 /* written after the last unit, and must be rejected */
+    size_t tail_len;
+} PB_STREAM;
+
+typedef struct pb_writer {
+    pthread_t tid;
+    int fd;
+    PB_STREAM *stream;
+    long units;
+} PB_WRITER;
+
+/* What the sessions were given and what they sent. */
+typedef struct pb_sink {
+    uint64_t requests;
+    uint64_t request_bytes;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t nacks;
+    char *keep;                 /* payload of the last packet, when keeping */
+    size_t keep_len;
+    int keeping;
+} PB_SINK;
+
+static char *rsrc = "tests/rsrc";
+static PB_SINK sink;
+static SESSION *sessions[MAX_CLIENTS];
+static char names[MAX_CLIENTS][PB_MAX_NAME + 1];
+
+static int sink_send(void *arg, JEUX_PACKET_HEADER *hdr, void *data) {
+    PB_SINK *s = arg;
+    size_t size = ntohs(hdr->size);
+    s->packets++;
+    s->bytes += sizeof(JEUX_PACKET_HEADER) + size;
+    if(hdr->type == JEUX_NACK_PKT) {
+        s->nacks++;
+    }
+    if(s->keeping) {
+        free(s->keep);
+        s->keep = malloc(size > 0 ? size : 1);
+        memcpy(s->keep, data, size);
+        s->keep_len = size;
+    }
+    return 0;
+}
+
+static void *read_fixture(char *name, size_t *lenp) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", rsrc, name);
+    FILE *f = fopen(path, "r");
+    if(f == NULL) {
+        fprintf(stderr, "proto_bench: cannot read %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    char *buf = NULL;
+    size_t len = 0, n;
+    char chunk[4096];
+    while((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        buf = realloc(buf, len + n);
+        memcpy(buf + len, chunk, n);
+        len += n;
+    }
+    fclose(f);
+    *lenp = len;
+    return buf;
+}
+
+/* Append a frame to a stream's unit, to be pushed to the given session. */
+static void add_frame(PB_STREAM *s, int who, int type, int id, int role, void *payload, size_t size) {
+    JEUX_PACKET_HEADER hdr = {0};
+    pack_header(&hdr, type, id, role, size);
+    s->unit = realloc(s->unit, s->unit_len + sizeof(hdr) + size);
+    memcpy(s->unit + s->unit_len, &hdr, sizeof(hdr));
+    if(size > 0) {
+        memcpy(s->unit + s->unit_len + sizeof(hdr), payload, size);
+    }
+    s->unit_len += sizeof(hdr) + size;
+    s->who[s->frames++] = who;
+}
+
+static void fixture_stream(PB_STREAM *s, char *name, char *fixture, char *tail) {
+    memset(s, 0, sizeof(*s));
+    s->name = name;
+    s->unit = read_fixture(fixture, &s->unit_len);
+    s->frames = 1;
+    if(tail != NULL) {
+        s->tail = read_fixture(tail, &s->tail_len);
+    }
+}
+
+static int write_all(int fd, char *buf, size_t len) {
+    while(len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if(n == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Write a stream's units in blocks, then its tail, and close the descriptor. */
+static void *writer_thread(void *arg) {
+    PB_WRITER *w = arg;
+    PB_STREAM *s = w->stream;
+    long per_block = PB_WRITE_BLOCK / s->unit_len > 0 ? PB_WRITE_BLOCK / s->unit_len : 1;
+    char *block = malloc(per_block * s->unit_len);
+    for(long i = 0; i < per_block; i++) {
+        memcpy(block + i * s->unit_len, s->unit, s->unit_len);
+    }
+    for(long left = w->units; left > 0; left -= per_block) {
+        long n = left < per_block ? left : per_block;
+        if(write_all(w->fd, block, n * s->unit_len) == -1) {
+            break;
+        }
+    }
+    if(s->tail != NULL) {
+        write_all(w->fd, s->tail, s->tail_len);
+    }
+    free(block);
+    close(w->fd);
+    return NULL;
+}
+
+static int open_channel(char *transport, int fds[2]) {
+    if(strcmp(transport, "pipe") == 0) {
+        return pipe(fds);
+    }
+    /* fds[0] is read and fds[1] written, as for a pipe */
+    return socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+}
+
+static void report(char *stage, char *transport, char *stream, uint64_t packets, uint64_t bytes,
+                   uint64_t ns) {
+    char name[128];
+    if(transport != NULL) {
+        snprintf(name, sizeof(name), "%s_%s_%s", stage, transport, stream);
+    } else {
+        snprintf(name, sizeof(name), "%s_%s", stage, stream);
+    }
+    double secs = ns > 0 ? ns / 1e9 : 1e-9;
+    printf("%s_packets\t%" PRIu64 "\n", name, packets);
+    printf("%s_packets_per_sec\t%.0f\n", name, packets / secs);
+    printf("%s_bytes_per_sec\t%.0f\n", name, bytes / secs);
+}
+
+/* Dispatch a request, with its payload in storage from proto_alloc_payload(). */
+static void dispatch(int who, JEUX_PACKET_HEADER *hdr, void *payload) {
+    sink.requests++;
+    sink.request_bytes += sizeof(JEUX_PACKET_HEADER) + ntohs(hdr->size);
+    session_push(sessions[who], hdr, payload);
+}
+
+static void check_acked(char *stream) {
+    if(sink.nacks > 0) {
+        fprintf(stderr, "proto_bench: %" PRIu64 " requests in stream %s were not ACKed\n", sink.nacks, stream);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Time a stream through a pipe or socketpair, either receiving and
+ * releasing each frame or receiving and dispatching it.
+ */
+static void run_recv(PB_STREAM *s, char *transport, long packets, int dispatching) {
+    int fds[2];
+    if(open_channel(transport, fds) == -1) {
+        fprintf(stderr, "proto_bench: cannot open %s\n", transport);
+        exit(EXIT_FAILURE);
+    }
+    PB_WRITER w = { .fd = fds[1], .stream = s, .units = packets / s->frames > 0 ? packets / s->frames : 1 };
+    uint64_t want = w.units * s->frames;
+    uint64_t got = 0, bytes = 0;
+    memset(&sink, 0, sizeof(sink));
+
+    uint64_t start = metrics_now_ns();
+    pthread_create(&w.tid, NULL, writer_thread, &w);
+    JEUX_PACKET_HEADER hdr;
+    void *payload = NULL;
+    while(proto_recv_packet(fds[0], &hdr, &payload) == 0) {
+        size_t size = ntohs(hdr.size);
+        if(dispatching) {
+            dispatch(s->who[got % s->frames], &hdr, payload);
+        } else {
+            proto_free_payload(payload, size);
+            bytes += sizeof(JEUX_PACKET_HEADER) + size;
+        }
+        payload = NULL;
+        got++;
+    }
+    uint64_t ns = metrics_now_ns() - start;
+    /* a payload cut short is left allocated */
+    proto_free_payload(payload, ntohs(hdr.size));
+    pthread_join(w.tid, NULL);
+    close(fds[0]);
+
+    if(got != want) {
+        fprintf(stderr, "proto_bench: received %" PRIu64 " of %" PRIu64 " frames in stream %s\n", got, want, s->name);
+        exit(EXIT_FAILURE);
+    }
+    if(dispatching) {
+        check_acked(s->name);
+        report("recv_dispatch", transport, s->name, sink.requests, sink.request_bytes + sink.bytes, ns);
+    } else {
+        report("recv", transport, s->name, got, bytes, ns);
+    }
+}
+
+/* Time a stream pushed straight to the sessions. */
+static void run_dispatch(PB_STREAM *s, long packets) {
+    long units = packets / s->frames > 0 ? packets / s->frames : 1;
+    memset(&sink, 0, sizeof(sink));
+    uint64_t start = metrics_now_ns();
+    for(long u = 0; u < units; u++) {
+        char *p = s->unit;
+        for(int f = 0; f < s->frames; f++) {
+            JEUX_PACKET_HEADER hdr;
+            memcpy(&hdr, p, sizeof(hdr));
+            p += sizeof(hdr);
+            size_t size = ntohs(hdr.size);
+            void *payload = NULL;
+            if(size > 0) {
+                payload = proto_alloc_payload(size);
+                memcpy(payload, p, size);
+                p += size;
+            }
+            dispatch(s->who[f], &hdr, payload);
+        }
+    }
+    uint64_t ns = metrics_now_ns() - start;
+    check_acked(s->name);
+    report("dispatch", NULL, s->name, sink.requests, sink.request_bytes + sink.bytes, ns);
+}
+
+static void login_users(int nusers, int name_length) {
+    if(jeux_core_init() == -1) {
+        fprintf(stderr, "proto_bench: cannot start the server core\n");
+        exit(EXIT_FAILURE);
+    }
+    for(int i = 0; i < nusers; i++) {
+        snprintf(names[i], sizeof(names[i]), "u%0*d", name_length - 1, i);
+        if((sessions[i] = session_open(sink_send, &sink)) == NULL) {
+            fprintf(stderr, "proto_bench: cannot open session %d\n", i);
+            exit(EXIT_FAILURE);
+        }
+        JEUX_PACKET_HEADER hdr = {0};
+        pack_header(&hdr, JEUX_LOGIN_PKT, 0, 0, name_length);
+        void *payload = proto_alloc_payload(name_length);
+        memcpy(payload, names[i], name_length);
+        session_push(sessions[i], &hdr, payload);
+    }
+    check_acked("login");
+}
+
+static void logout_users(int nusers) {
+    for(int i = 0; i < nusers; i++) {
+        session_close(sessions[i]);
+    }
+    jeux_core_fini();
+}
+
+static void usage(char *prog) {
+    fprintf(stderr, "Usage: %s [-n packets] [-u users] [-l name_length] [-r rsrc_dir]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    long packets = 100000;
+    int nusers = MAX_CLIENTS;
+    int name_length = 32;
+    for(int i = 1; i + 1 < argc; i += 2) {
+        if(strcmp(argv[i], "-n") == 0) {
+            packets = atol(argv[i + 1]);
+        } else if(strcmp(argv[i], "-u") == 0) {
+            nusers = atoi(argv[i + 1]);
+        } else if(strcmp(argv[i], "-l") == 0) {
+            name_length = atoi(argv[i + 1]);
+        } else if(strcmp(argv[i], "-r") == 0) {
+            rsrc = argv[i + 1];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if(argc % 2 == 0 || packets < 1 || nusers < 2 || nusers > MAX_CLIENTS ||
+            name_length < 2 || name_length > PB_MAX_NAME) {
+        usage(argv[0]);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    login_users(nusers, name_length);
+
+    PB_STREAM login, ack, revoke, move, users_reply, game, users;
+    fixture_stream(&login, "login", "pkt_login", "pkt_short_payload");
+    fixture_stream(&ack, "ack", "pkt_ack_with_payload", NULL);
+    fixture_stream(&revoke, "revoke", "pkt_revoke_no_payload", "pkt_short_header");
+
+    memset(&move, 0, sizeof(move));
+    move.name = "move";
+    add_frame(&move, 0, JEUX_MOVE_PKT, 0, 0, "5", 1);
+
+    /* the reply to USERS, as the server makes it */
+    memset(&users, 0, sizeof(users));
+    users.name = "users";
+    add_frame(&users, 0, JEUX_USERS_PKT, 0, 0, NULL, 0);
+    JEUX_PACKET_HEADER hdr;
+    memcpy(&hdr, users.unit, sizeof(hdr));
+    sink.keeping = 1;
+    session_push(sessions[0], &hdr, NULL);
+    memset(&users_reply, 0, sizeof(users_reply));
+    users_reply.name = "users_reply";
+    add_frame(&users_reply, 0, JEUX_ACK_PKT, 0, 0, sink.keep, sink.keep_len);
+    free(sink.keep);
+    sink.keep = NULL;
+    sink.keeping = 0;
+
+    /* sessions 0 and 1 play a draw; invitation IDs are free again once it ends */
+    char *draw[] = { "5", "1", "9", "3", "2", "8", "4", "6", "7" };
+    memset(&game, 0, sizeof(game));
+    game.name = "game";
+    add_frame(&game, 0, JEUX_INVITE_PKT, 0, SECOND_PLAYER_ROLE, names[1], name_length);
+    add_frame(&game, 1, JEUX_ACCEPT_PKT, 0, 0, NULL, 0);
+    for(int i = 0; i < 9; i++) {
+        add_frame(&game, i % 2, JEUX_MOVE_PKT, 0, 0, draw[i], 1);
+    }
+
+    char *transports[] = { "pipe", "socketpair" };
+    PB_STREAM *recv_streams[] = { &login, &ack, &revoke, &move, &users_reply };
+    PB_STREAM *dispatch_streams[] = { &game, &users };
+    for(int t = 0; t < 2; t++) {
+        for(int i = 0; i < 5; i++) {
+            run_recv(recv_streams[i], transports[t], packets, 0);
+        }
+    }
+    for(int i = 0; i < 2; i++) {
+        run_dispatch(dispatch_streams[i], packets);
+    }
+    for(int t = 0; t < 2; t++) {
+        for(int i = 0; i < 2; i++) {
+            run_recv(dispatch_streams[i], transports[t], packets, 1);
+        }
+    }
+
+    logout_users(nusers);
+    PB_STREAM *all[] = { &login, &ack, &revoke, &move, &users_reply, &game, &users };
+    for(int i = 0; i < 7; i++) {
+        free(all[i]->unit);
+        free(all[i]->tail);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,112 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#include "player.h"
+#include "rating.h"
+
+/*
+ * Rating throughput benchmark.
+ *
+ * Usage: rating_bench [-t max_threads] [-n results_per_thread] [-p players]
+ *
+ * Measures the cost of one expected-score evaluation (table vs. pow()) and
+ * the throughput of player_post_result() with 1..max_threads threads posting
+ * results between random pairs of players.
+ */
+
+static PLAYER **players;
+static int nplayers = 1000;
+static long niter = 1000000;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *post_thread(void *arg) {
+    unsigned int seed = (unsigned long)arg;
+    for(long i = 0; i < niter; i++) {
+        PLAYER *p1 = players[rand_r(&seed) % nplayers];
+        PLAYER *p2 = players[rand_r(&seed) % nplayers];
+        if(p1 == p2)
+            continue;
+        player_post_result(p1, p2, rand_r(&seed) % 3);
+    }
+    return NULL;
+}
+
+static void bench_expect(void) {
+    volatile double dsink = 0;
+    volatile int64_t isink = 0;
+    long n = 10000000;
+
+    double start = now();
+    for(long i = 0; i < n; i++) {
+        dsink += 1.0 / (1.0 + pow(10.0, (double)(i % 1600 - 800) / 400.0));
+    }
+    double t_pow = now() - start;
+
+    start = now();
+    for(long i = 0; i < n; i++) {
+        isink += rating_expect(RATING_TO_FIXED(i % 1600 - 800) + (i & 0xffff));
+    }
+    double t_table = now() - start;
+
+    printf("expect_pow_ns\t%.2f\n", t_pow * 1e9 / n);
+    printf("expect_table_ns\t%.2f\n", t_table * 1e9 / n);
+}
+
+int main(int argc, char *argv[]) {
+    int max_threads = 8;
+    for(int i = 1; i + 1 < argc; i += 2) {
+        if(strcmp(argv[i], "-t") == 0) {
+            max_threads = atoi(argv[i + 1]);
+        } else if(strcmp(argv[i], "-n") == 0) {
+            niter = atol(argv[i + 1]);
+        } else if(strcmp(argv[i], "-p") == 0) {
+            nplayers = atoi(argv[i + 1]);
+        } else {
+            fprintf(stderr, "Usage: %s [-t max_threads] [-n results_per_thread] [-p players]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if(max_threads < 1 || niter < 1 || nplayers < 2) {
+        fprintf(stderr, "%s: invalid arguments\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    bench_expect();
+
+    players = calloc(nplayers, sizeof(PLAYER *));
+    char name[32];
+    for(int i = 0; i < nplayers; i++) {
+        sprintf(name, "p%d", i);
+        players[i] = player_create(name);
+    }
+
+    pthread_t *tids = calloc(max_threads, sizeof(pthread_t));
+    for(int nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+        double start = now();
+        for(long t = 0; t < nthreads; t++)
+            pthread_create(&tids[t], NULL, post_thread, (void *)(t + 1));
+        for(int t = 0; t < nthreads; t++)
+            pthread_join(tids[t], NULL);
+        double elapsed = now() - start;
+        printf("post_result_threads_%d\t%.0f\tresults/sec\n", nthreads, nthreads * niter / elapsed);
+    }
+
+    long sum = 0;
+    for(int i = 0; i < nplayers; i++) {
+        sum += player_get_rating(players[i]);
+        player_unref(players[i], "benchmark done");
+    }
+    printf("rating_drift\t%ld\n", sum - (long)nplayers * PLAYER_INITIAL_RATING);
+    free(players);
+    free(tids);
+    return EXIT_SUCCESS;
+}
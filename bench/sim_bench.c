@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "sim.h"
+#include "metrics.h"
+
+/*
+ * Simulated games through the request handlers, without sockets.
+ *
+ * Usage: sim_bench [-s seed] [-c clients] [-g games]
+ *
+ * Runs a deterministic simulation (see sim.h) of the given number of
+ * clients (default 16) until the given number of games (default 100000)
+ * have ended, and reports how long that took in real time, along with
+ * the simulation's own counts.  Two runs with the same seed and number
+ * of clients print the same "digest", however fast the machine; a
+ * different digest means the handlers behaved differently.
+ */
+
+static void usage(char *prog) {
+    fprintf(stderr, "Usage: %s [-s seed] [-c clients] [-g games]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t seed = 1;
+    int nclients = 16;
+    uint64_t games = 100000;
+    for(int i = 1; i < argc; i += 2) {
+        if(i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        if(strcmp(argv[i], "-s") == 0) {
+            seed = strtoull(argv[i + 1], NULL, 0);
+        } else if(strcmp(argv[i], "-c") == 0) {
+            nclients = atoi(argv[i + 1]);
+        } else if(strcmp(argv[i], "-g") == 0) {
+            games = strtoull(argv[i + 1], NULL, 0);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if(nclients < 2 || nclients > SIM_MAX_CLIENTS || games == 0) {
+        usage(argv[0]);
+    }
+
+    SIM *sim = sim_init(nclients, seed);
+    if(sim == NULL) {
+        fprintf(stderr, "sim_bench: cannot set up simulation\n");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t start = metrics_now_ns();
+    int status = sim_run(sim, games);
+    double elapsed = (metrics_now_ns() - start) / 1e9;
+    SIM_STATS stats;
+    sim_stats(sim, &stats);
+    sim_fini(sim);
+    if(status == -1) {
+        fprintf(stderr, "sim_bench: simulation stalled\n");
+    }
+
+    printf("seed\t%" PRIu64 "\n", seed);
+    printf("clients\t%d\n", nclients);
+    printf("games\t%" PRIu64 "\n", stats.games);
+    printf("requests\t%" PRIu64 "\n", stats.requests);
+    printf("acks\t%" PRIu64 "\n", stats.acks);
+    printf("nacks\t%" PRIu64 "\n", stats.nacks);
+    printf("notifications\t%" PRIu64 "\n", stats.notifications);
+    printf("steps\t%" PRIu64 "\n", stats.steps);
+    printf("virtual_ns\t%" PRIu64 "\n", stats.now_ns);
+    printf("digest\t%016" PRIx64 "\n", stats.digest);
+    printf("elapsed_ns\t%.0f\n", elapsed * 1e9);
+    printf("games_per_sec\t%.0f\n", stats.games / elapsed);
+    printf("requests_per_sec\t%.0f\n", stats.requests / elapsed);
+    return status == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,77 @@
+#ifndef ADMIN_H
+#define ADMIN_H
+
+#include <stdatomic.h>
+
+/*
+ * Local administration endpoint.
+ *
+ * An ADMIN_SERVER listens on a UNIX domain socket or a loopback TCP port,
+ * separately from the Jeux listener, and is served by its own thread.
+ * Connections are handled one at a time.  Each line received is a
+ * command, and the reply is text terminated by a line containing only
+ * ".":
+ *
+ *   stats          Every server metric, one "<name>\t<value>" line each
+ *                  (see metrics.h).
+ *   players        Every registered player: "<name>\t<rating>\t<refs>".
+ *   clients        Every logged-in player: "<name>".
+ *   gc             Remove idle players from the player registry and
+ *                  reply "collected <n>".
+ *   trace on|off   Start or stop tracing requests to the log (see
+ *                  logger.h).
+ *   locks          Mutex contention profile (see lock_prof.h).
+ *   locks on|off   Start or stop profiling mutex contention.
+ *   flight         Dump the flight recorder (see flight.h).
+ *   log            The lowest log level being written (see logger.h).
+ *   log <level>    Change it.
+ *   perf on|off    Start or stop counting CPU events per request type
+ *                  (see perfctr.h).
+ *   watchdog       Whether the slow-request watchdog is on, and the budget
+ *                  in milliseconds for each packet type: "<type>\t<ms>"
+ *                  (see watchdog.h).
+ *   watchdog <ms>  Start it, or change the budget for every packet type.
+ *   watchdog <type> <ms>
+ *                  Change the budget for one packet type; 0 never flags.
+ *   watchdog off   Stop it.
+ *   help           List the commands.
+ *   quit           Close the connection.
+ *
+ * A command that fails or is not understood gets a reply starting with
+ * "error:".
+ */
+typedef struct admin_server ADMIN_SERVER;
+
+/*
+ * Admin endpoint used by the server, or NULL if none was requested.
+ */
+extern ADMIN_SERVER *admin_server;
+
+/*
+ * Nonzero while request tracing is on.  When tracing, the server logs
+ * one line for each request it handles, whatever the log level.
+ */
+extern atomic_int admin_tracing;
+
+/*
+ * Start an admin endpoint.
+ *
+ * @param addr  A TCP port number, to listen on the loopback interface,
+ * or otherwise the path of a UNIX domain socket to create.  An existing
+ * socket at that path is replaced; any other file there makes this fail.
+ * @return  the newly started ADMIN_SERVER, or NULL if the endpoint could
+ * not be set up.
+ */
+ADMIN_SERVER *admin_start(char *addr);
+
+/*
+ * Stop an admin endpoint.  The connection being served, if any, is shut
+ * down, the admin thread is joined, a UNIX domain socket is removed, and
+ * all associated resources are freed.
+ *
+ * @param admin  The ADMIN_SERVER to stop, which must not be referenced
+ * again.
+ */
+void admin_stop(ADMIN_SERVER *admin);
+
+#endif /* ADMIN_H */
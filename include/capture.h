@@ -0,0 +1,110 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+/*
+ * A CAPTURE records every packet the server receives, as it arrived, so
+ * that the same traffic can later be driven into a server again by the
+ * capture_replay tool.  Packets are recorded by proto_recv_packet() while
+ * the global packet_capture is set, together with the connection they
+ * arrived on and when; the end of each connection is recorded too, so a
+ * file descriptor reused by a later connection is not mistaken for the
+ * earlier one.
+ *
+ * File format (all multi-byte fields in network byte order, save for the
+ * packet headers, which are stored exactly as they arrived):
+ *   header:  the 8 bytes "JEUXCAPT", followed by a uint32_t version.
+ *   record:  uint64_t time_ns (CLOCK_MONOTONIC, since the capture was
+ *            opened), uint32_t conn (the server's file descriptor),
+ *            uint8_t event; for CAPTURE_PACKET this is followed by the
+ *            JEUX_PACKET_HEADER and its payload.
+ */
+typedef struct capture CAPTURE;
+
+/* Version number written in the header of a capture file. */
+#define CAPTURE_VERSION 1
+
+/* Events recorded in a capture. */
+#define CAPTURE_PACKET 0        /* a packet arrived */
+#define CAPTURE_CLOSE 1         /* the connection ended */
+
+/*
+ * Capture used by the server.  If NULL, packets are not recorded.
+ */
+extern CAPTURE *packet_capture;
+
+/*
+ * A single decoded capture record.
+ */
+typedef struct capture_record {
+    uint64_t time_ns;
+    int conn;
+    int event;
+    JEUX_PACKET_HEADER hdr;     /* as received, in network byte order */
+    void *payload;              /* malloc'ed, NULL if the packet has none */
+} CAPTURE_RECORD;
+
+/*
+ * Create a capture file, replacing any existing file of the same name.
+ *
+ * @param path  The path of the capture file.
+ * @return  the opened CAPTURE, or NULL if the file could not be created.
+ */
+CAPTURE *capture_open(char *path);
+
+/*
+ * Flush and close a capture.
+ *
+ * @param cap  The CAPTURE to be closed, which must not be referenced again.
+ */
+void capture_close(CAPTURE *cap);
+
+/*
+ * Record a packet received on a connection.  Records are buffered per
+ * connection, and written out, merged in time order, when a connection
+ * ends, when a connection's buffer fills, or when the capture is closed.
+ * A connection is taken to be served by a single thread.
+ *
+ * @param cap  The CAPTURE to record to.
+ * @param conn  The file descriptor the packet arrived on.
+ * @param hdr  The packet header, in network byte order.
+ * @param payload  The payload, or NULL if there is none.
+ * @return 0 if successful, -1 otherwise.
+ */
+int capture_packet(CAPTURE *cap, int conn, JEUX_PACKET_HEADER *hdr, void *payload);
+
+/*
+ * Record the end of a connection, and write out what has been buffered.
+ * Must be called from the thread that recorded the connection's packets.
+ *
+ * @param cap  The CAPTURE to record to.
+ * @param conn  The file descriptor of the connection.
+ * @return 0 if successful, -1 otherwise.
+ */
+int capture_end(CAPTURE *cap, int conn);
+
+/*
+ * Open a capture file for reading and check its header.
+ *
+ * @param path  The path of the capture file.
+ * @return  a stream positioned at the first record, or NULL if the file
+ * could not be opened or is not a capture.
+ */
+FILE *capture_open_read(char *path);
+
+/*
+ * Read the next record from a capture stream.
+ *
+ * @param in  A stream returned by capture_open_read().
+ * @param rec  Storage for the decoded record.  If a record is returned,
+ * the caller must free rec->payload.
+ * @return 0 if a record was read, 1 at end of file, -1 if the file is
+ * truncated or corrupt.
+ */
+int capture_read(FILE *in, CAPTURE_RECORD *rec);
+
+#endif /* CAPTURE_H */
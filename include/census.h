@@ -0,0 +1,111 @@
+#ifndef CENSUS_H
+#define CENSUS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Census of live objects and the memory they hold.
+ *
+ * Each object type has a live count, the highest live count seen and
+ * the number ever created; each kind of memory has a live and a peak
+ * byte count.  They are updated in the create and free paths of the
+ * objects with relaxed atomic adds; the peak is only written when it is
+ * exceeded, so once a server has warmed up a census update is two adds.
+ * A steadily climbing live count, or a live count that does not return
+ * to its idle level, is a leak.
+ *
+ * Objects that are released with free() by their users (GAME_MOVEs and
+ * packet payloads) are only counted correctly when they are released
+ * with game_free_move() and proto_free_payload().
+ */
+
+typedef enum {
+    CENSUS_CLIENT,
+    CENSUS_PLAYER,
+    CENSUS_INVITATION,
+    CENSUS_GAME,
+    CENSUS_GAME_MOVE,
+    CENSUS_PAYLOAD,             /* packet payload received by proto_recv_packet() */
+    CENSUS_NOBJECTS
+} CENSUS_OBJECT;
+
+typedef enum {
+    CENSUS_MEM_CLIENT,          /* CLIENT structures */
+    CENSUS_MEM_CLIENT_INVITATIONS,  /* each client's invitation table */
+    CENSUS_MEM_PLAYER,          /* PLAYER structures, rating history included */
+    CENSUS_MEM_PLAYER_NAMES,
+    CENSUS_MEM_INVITATION,
+    CENSUS_MEM_GAME,            /* GAME structures and their boards */
+    CENSUS_MEM_GAME_MOVE,
+    CENSUS_MEM_PAYLOAD,
+    CENSUS_NMEMS
+} CENSUS_MEM;
+
+typedef struct census_counts {
+    int64_t live;
+    int64_t peak;
+    uint64_t total;
+} CENSUS_COUNTS;
+
+/*
+ * Count an object as created, along with the bytes it holds.
+ *
+ * @param object  The type of object.
+ * @param mem  The kind of memory it is.
+ * @param bytes  The size of the object.
+ */
+void census_create(CENSUS_OBJECT object, CENSUS_MEM mem, size_t bytes);
+
+/*
+ * Count an object as freed; the arguments must match census_create().
+ */
+void census_free(CENSUS_OBJECT object, CENSUS_MEM mem, size_t bytes);
+
+/*
+ * Account for memory that is not an object of its own, such as a buffer
+ * hanging off one.
+ *
+ * @param mem  The kind of memory.
+ * @param delta  Bytes allocated, or minus bytes freed.
+ */
+void census_bytes(CENSUS_MEM mem, int64_t delta);
+
+/*
+ * Read the counts for an object type.
+ */
+void census_read(CENSUS_OBJECT object, CENSUS_COUNTS *counts);
+
+/*
+ * Read the live and peak byte counts for a kind of memory.
+ */
+void census_read_bytes(CENSUS_MEM mem, int64_t *live, int64_t *peak);
+
+/*
+ * Write the census as "<name>\t<value>" lines: census_<object>_live,
+ * _peak and _total for each object type, then mem_<kind>_bytes and
+ * _peak_bytes for each kind of memory.
+ */
+void census_write(FILE *out);
+
+/*
+ * Check that nothing is live, as it should be once the server has shut
+ * down, writing a line to out for each object type or kind of memory
+ * that is not.
+ *
+ * @return 0 if nothing is live, -1 otherwise.
+ */
+int census_check_empty(FILE *out);
+
+/*
+ * The resident set size of a process: memory the census does not see,
+ * such as thread stacks and allocator overhead, included.
+ *
+ * @param pid  The process, or 0 for this one.
+ * @return the resident set size in bytes, or -1 if it could not be read.
+ */
+int64_t census_rss_bytes(pid_t pid);
+
+#endif /* CENSUS_H */
@@ -0,0 +1,68 @@
+#ifndef CLIENT_EXT_H
+#define CLIENT_EXT_H
+
+#include "client.h"
+#include "protocol.h"
+
+/*
+ * Additional CLIENT operations that are not part of client.h.
+ */
+
+/*
+ * A transport for packets sent to a client by some other means than its
+ * file descriptor.  It is called with the client's output lock held, so
+ * calls for one client never overlap, and must not send to the same
+ * client again.
+ *
+ * @param arg  The argument given to client_set_transport().
+ * @param hdr  The packet header, in network byte order.
+ * @param data  The payload, or NULL.  It belongs to the caller.
+ * @return 0 if the packet was taken, -1 otherwise.
+ */
+typedef int (*CLIENT_SEND_FN)(void *arg, JEUX_PACKET_HEADER *hdr, void *data);
+
+/*
+ * Have client_send_packet() hand a client's packets to a function rather
+ * than write them to its file descriptor.  This must be done before
+ * anything is sent to the client.
+ *
+ * @param client  The client.
+ * @param send  The function, or NULL to go back to the file descriptor.
+ * @param arg  An argument passed to every call of the function.
+ */
+void client_set_transport(CLIENT *client, CLIENT_SEND_FN send, void *arg);
+
+/*
+ * Mark a client as having no file descriptor: the number it was created
+ * with only names its connection, so it is neither shut down nor closed.
+ * This must be done before the client is registered.
+ *
+ * @param client  The client.
+ */
+void client_set_no_fd(CLIENT *client);
+
+/*
+ * Tell whether a client has a file descriptor of its own.
+ *
+ * @param client  The client.
+ * @return nonzero if client_get_fd() gives a file descriptor, zero if it
+ * only gives a connection number (see client_set_no_fd()).
+ */
+int client_has_fd(CLIENT *client);
+
+/*
+ * Accept an invitation, as client_accept_invitation() does, but give the
+ * state of the new game, if the accepting client is to move first, in a
+ * caller's buffer rather than a newly allocated string.
+ *
+ * @param client  The client accepting the invitation.
+ * @param id  The ID of the invitation.
+ * @param state  A buffer of at least GAME_STATE_SIZE bytes (see
+ * game_ext.h), which is given the state of the game, or an empty string
+ * if the source of the invitation is to move first.
+ * @param size  The size of the buffer.
+ * @return 0 if the invitation was accepted, -1 otherwise.
+ */
+int client_accept_invitation_into(CLIENT *client, int id, char *state, size_t size);
+
+#endif /* CLIENT_EXT_H */
@@ -0,0 +1,38 @@
+#ifndef CLIENT_REGISTRY_EXT_H
+#define CLIENT_REGISTRY_EXT_H
+
+#include "client_registry.h"
+#include "client_ext.h"
+
+/*
+ * Additional CLIENT_REGISTRY operations that are not part of
+ * client_registry.h.
+ */
+
+/*
+ * Call a function for each logged-in player, as creg_all_players() would
+ * list them, without allocating a list.  The registry is locked while the
+ * function runs, so it must be quick and must not use the registry.
+ *
+ * @param cr  The registry.
+ * @param fn  The function, which is given each player, referenced for
+ * the duration of the call, and arg.
+ * @param arg  An argument passed to every call of fn.
+ */
+void creg_foreach_player(CLIENT_REGISTRY *cr, void (*fn)(PLAYER *player, void *arg), void *arg);
+
+/*
+ * Register a client whose packets are carried by a transport (see
+ * client_set_transport()) rather than a file descriptor.  The client is
+ * registered as creg_register() would, but its connection number is not
+ * closed by creg_unregister() nor shut down by creg_shutdown_all().
+ *
+ * @param cr  The registry.
+ * @param conn  The client's connection number.
+ * @param send  The transport.
+ * @param arg  An argument passed to every call of send.
+ * @return the client, or NULL if it could not be registered.
+ */
+CLIENT *creg_register_transport(CLIENT_REGISTRY *cr, int conn, CLIENT_SEND_FN send, void *arg);
+
+#endif /* CLIENT_REGISTRY_EXT_H */
@@ -3,6 +3,8 @@
 
 #include <stdio.h>
 
+#include "logger.h"
+
 #define NL "\n"
 
 #ifdef COLOR
@@ -38,8 +40,9 @@
 #ifdef DEBUG
 #define debug(S, ...)                                                          \
   do {                                                                         \
-    fprintf(stderr, KMAG "DEBUG: %s:%s:%d " KNRM S NL, __FILE__,               \
-            __extension__ __FUNCTION__, __LINE__, ##__VA_ARGS__);                \
+    if (logger_enabled(LOGGER_DEBUG))                                          \
+      logger_write(LOGGER_DEBUG, __FILE__, __extension__ __FUNCTION__,         \
+                   __LINE__, S, ##__VA_ARGS__);                                \
   } while (0)
 #else
 #define debug(S, ...)
@@ -48,8 +51,9 @@
 #ifdef INFO
 #define info(S, ...)                                                           \
   do {                                                                         \
-    fprintf(stderr, KBLU "INFO: %s:%s:%d " KNRM S NL, __FILE__,                \
-            __extension__ __FUNCTION__, __LINE__, ##__VA_ARGS__);                \
+    if (logger_enabled(LOGGER_INFO))                                           \
+      logger_write(LOGGER_INFO, __FILE__, __extension__ __FUNCTION__,          \
+                   __LINE__, S, ##__VA_ARGS__);                                \
   } while (0)
 #else
 #define info(S, ...)
@@ -58,8 +62,9 @@
 #ifdef WARN
 #define warn(S, ...)                                                           \
   do {                                                                         \
-    fprintf(stderr, KYEL "WARN: %s:%s:%d " KNRM S NL, __FILE__,                \
-            __extension__ __FUNCTION__, __LINE__, ##__VA_ARGS__);                \
+    if (logger_enabled(LOGGER_WARN))                                           \
+      logger_write(LOGGER_WARN, __FILE__, __extension__ __FUNCTION__,          \
+                   __LINE__, S, ##__VA_ARGS__);                                \
   } while (0)
 #else
 #define warn(S, ...)
@@ -68,8 +73,9 @@
 #ifdef SUCCESS
 #define success(S, ...)                                                        \
   do {                                                                         \
-    fprintf(stderr, KGRN "SUCCESS: %s:%s:%d " KNRM S NL, __FILE__,             \
-            __extension__ __FUNCTION__, __LINE__, ##__VA_ARGS__);                \
+    if (logger_enabled(LOGGER_SUCCESS))                                        \
+      logger_write(LOGGER_SUCCESS, __FILE__, __extension__ __FUNCTION__,       \
+                   __LINE__, S, ##__VA_ARGS__);                                \
   } while (0)
 #else
 #define success(S, ...)
@@ -78,8 +84,9 @@
 #ifdef ERROR
 #define error(S, ...)                                                          \
   do {                                                                         \
-    fprintf(stderr, KRED "ERROR: %s:%s:%d " KNRM S NL, __FILE__,               \
-            __extension__ __FUNCTION__, __LINE__, ##__VA_ARGS__);                \
+    if (logger_enabled(LOGGER_ERROR))                                          \
+      logger_write(LOGGER_ERROR, __FILE__, __extension__ __FUNCTION__,         \
+                   __LINE__, S, ##__VA_ARGS__);                                \
   } while (0)
 #else
 #define error(S, ...)
@@ -0,0 +1,115 @@
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Flight recorder for object lifecycle events.
+ *
+ * Every create, ref, unref and free of a CLIENT, GAME, INVITATION or
+ * PLAYER is recorded as a fixed-size binary event in a ring owned by the
+ * calling thread.  A ring has a single writer, so recording is a few
+ * stores and no locks.  When a thread exits its ring is kept, with its
+ * events, and handed to the next new thread.
+ *
+ * The reason for a ref or unref is identified by the address of its
+ * "why" string, which is always a string literal; the dump carries the
+ * text of every reason it refers to.  The rings are dumped to a file on
+ * SIGUSR1, on SIGABRT, or by flight_dump(), and decoded offline by
+ * bin/flight_decode.  Events being written while a dump is taken may
+ * appear torn.
+ */
+
+/* Number of events each ring holds; older events are overwritten. */
+#define FLIGHT_RING_EVENTS 4096
+
+#define FLIGHT_DUMP_MAGIC "JEUXFLT"
+#define FLIGHT_DUMP_MAGIC_LEN 8
+#define FLIGHT_DUMP_VERSION 1
+
+typedef enum {
+    FLIGHT_CLIENT,
+    FLIGHT_GAME,
+    FLIGHT_INVITATION,
+    FLIGHT_PLAYER
+} FLIGHT_OBJECT;
+
+typedef enum {
+    FLIGHT_CREATE,
+    FLIGHT_REF,
+    FLIGHT_UNREF,
+    FLIGHT_FREE
+} FLIGHT_EVENT_TYPE;
+
+typedef struct flight_event {
+    uint64_t timestamp_ns;      /* CLOCK_MONOTONIC */
+    uint64_t object;            /* address of the object */
+    uint64_t why;               /* address of the reason string, or 0 */
+    uint32_t thread;            /* serial number of the recording thread */
+    uint16_t ref_count;         /* reference count after the event, saturated */
+    uint8_t object_type;        /* FLIGHT_OBJECT */
+    uint8_t event_type;         /* FLIGHT_EVENT_TYPE */
+} FLIGHT_EVENT;
+
+/*
+ * A dump is in host byte order: the magic, a uint32_t version and a
+ * uint32_t ring size, then a sequence of records each starting with a
+ * FLIGHT_DUMP_RECORD.  A FLIGHT_DUMP_RING record is followed by the
+ * ring's FLIGHT_RING_EVENTS slots, of which the ones before index
+ * (count % FLIGHT_RING_EVENTS) are the newest; count is the number of
+ * events ever written to the ring.  A FLIGHT_DUMP_STRING record is
+ * followed by count bytes of the string at address value.  The last
+ * record is a FLIGHT_DUMP_END.
+ */
+#define FLIGHT_DUMP_RING   1
+#define FLIGHT_DUMP_STRING 2
+#define FLIGHT_DUMP_END    3
+
+typedef struct flight_dump_record {
+    uint32_t tag;
+    uint32_t pad;
+    uint64_t value;
+    uint64_t count;
+} FLIGHT_DUMP_RECORD;
+
+/* Nonzero while events are being recorded. */
+extern atomic_int flight_enabled;
+
+void flight_record_slow(FLIGHT_OBJECT object_type, FLIGHT_EVENT_TYPE event_type,
+        void *object, char *why, size_t ref_count);
+
+/*
+ * Record an event if the flight recorder is enabled.
+ *
+ * @param object_type  The kind of object.
+ * @param event_type  What happened to it.
+ * @param object  The object.
+ * @param why  The reason given for a ref or unref, or NULL.
+ * @param ref_count  The object's reference count after the event.
+ */
+static inline void flight_record(FLIGHT_OBJECT object_type, FLIGHT_EVENT_TYPE event_type,
+        void *object, char *why, size_t ref_count) {
+    if(atomic_load_explicit(&flight_enabled, memory_order_relaxed)) {
+        flight_record_slow(object_type, event_type, object, why, ref_count);
+    }
+}
+
+/*
+ * Start recording, and arrange for the rings to be dumped to the given
+ * file on SIGUSR1 or SIGABRT.
+ *
+ * @param dump_path  The file to dump to; it is replaced by each dump.
+ * @return 0 if successful, -1 otherwise.
+ */
+int flight_init(char *dump_path);
+
+/*
+ * Dump the rings now.  Safe to call from a signal handler.
+ *
+ * @return 0 if successful, -1 if the recorder was never initialized or
+ * the dump could not be written.
+ */
+int flight_dump(void);
+
+#endif /* FLIGHT_H */
@@ -0,0 +1,54 @@
+#ifndef GAME_EXT_H
+#define GAME_EXT_H
+
+#include "game.h"
+
+/*
+ * Additional GAME operations that are not part of game.h.
+ */
+
+/*
+ * Free a GAME_MOVE returned by game_parse_move().  Moves may still be
+ * released with free(), but are then missed by the object census (see
+ * census.h).
+ *
+ * @param move  The GAME_MOVE to be freed, or NULL.
+ */
+void game_free_move(GAME_MOVE *move);
+
+/*
+ * Bytes needed for the state of a game as game_unparse_state() gives it,
+ * the terminating null included.
+ */
+#define GAME_STATE_SIZE 41
+
+/*
+ * Write the state of a game, as game_unparse_state() does, into a
+ * caller's buffer rather than a newly allocated one.
+ *
+ * @param game  The game.
+ * @param buf  The buffer.
+ * @param size  The size of the buffer, at least GAME_STATE_SIZE.
+ * @return the length of the state, not counting the terminating null, or
+ * -1 if the game or buffer is not valid.
+ */
+int game_unparse_state_into(GAME *game, char *buf, size_t size);
+
+/*
+ * Parse a move and apply it to a game, as game_parse_move() followed by
+ * game_apply_move() does, without allocating a GAME_MOVE.
+ *
+ * @param game  The game.
+ * @param role  The role of the player making the move, or NULL_ROLE.
+ * @param str  The move.
+ * @return 0 if the move was parsed and applied, -1 otherwise.
+ */
+int game_play_move(GAME *game, GAME_ROLE role, char *str);
+
+/*
+ * Free the games game_create() keeps for reuse, as is done when the
+ * server core shuts down.  Games in use are not affected.
+ */
+void game_pool_drain(void);
+
+#endif /* GAME_EXT_H */
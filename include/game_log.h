@@ -0,0 +1,95 @@
+#ifndef GAME_LOG_H
+#define GAME_LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * A GAME_LOG is an append-only file recording the result of every rated
+ * game, in the order the results were applied.  It is the input to the
+ * rating_recompute tool, which replays the whole history through the
+ * rating code to rebuild every player's rating.
+ *
+ * File format (all multi-byte fields in network byte order):
+ *   header:  the 8 bytes "JEUXHIST", followed by a uint32_t version.
+ *   record:  uint32_t timestamp_sec, uint32_t timestamp_nsec (CLOCK_REALTIME),
+ *            uint8_t result, uint16_t name1_len, uint16_t name2_len,
+ *            followed by the two usernames (not NUL-terminated).
+ */
+typedef struct game_log GAME_LOG;
+
+/* Version number written in the header of a game log file. */
+#define GAME_LOG_VERSION 1
+
+/*
+ * Game log used by the server.  If NULL, results are not recorded.
+ */
+extern GAME_LOG *game_log;
+
+/*
+ * A single decoded game log record.
+ */
+typedef struct game_log_record {
+    uint32_t timestamp_sec;
+    uint32_t timestamp_nsec;
+    int result;     /* 0 if draw, 1 if name1 won, 2 if name2 won */
+    char *name1;    /* first player role, malloc'ed, NUL-terminated */
+    char *name2;    /* second player role, malloc'ed, NUL-terminated */
+} GAME_LOG_RECORD;
+
+/*
+ * Open a game log for appending, creating it if it does not exist.
+ *
+ * @param path  The path of the game log file.
+ * @return  the opened GAME_LOG, or NULL if the file could not be opened
+ * or is not a game log.
+ */
+GAME_LOG *glog_open(char *path);
+
+/*
+ * Flush and close a game log.
+ *
+ * @param log  The GAME_LOG to be closed, which must not be referenced again.
+ */
+void glog_close(GAME_LOG *log);
+
+/*
+ * Append the result of a game to a game log.  The record is buffered
+ * until the next call to glog_flush().
+ *
+ * @param log  The GAME_LOG to append to.
+ * @param name1  The username of the player in the first player role.
+ * @param name2  The username of the player in the second player role.
+ * @param result  0 if draw, 1 if player1 won, 2 if player2 won.
+ * @return 0 if successful, -1 otherwise.
+ */
+int glog_append(GAME_LOG *log, char *name1, char *name2, int result);
+
+/*
+ * Write any buffered records to the game log file.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int glog_flush(GAME_LOG *log);
+
+/*
+ * Open a game log file for reading and check its header.
+ *
+ * @param path  The path of the game log file.
+ * @return  a stream positioned at the first record, or NULL if the file
+ * could not be opened or is not a game log.
+ */
+FILE *glog_open_read(char *path);
+
+/*
+ * Read the next record from a game log stream.
+ *
+ * @param in  A stream returned by glog_open_read().
+ * @param rec  Storage for the decoded record.  If a record is returned,
+ * the caller must free rec->name1 and rec->name2.
+ * @return 0 if a record was read, 1 at end of file, -1 if the file is
+ * truncated or corrupt.
+ */
+int glog_read(FILE *in, GAME_LOG_RECORD *rec);
+
+#endif /* GAME_LOG_H */
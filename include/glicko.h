@@ -0,0 +1,93 @@
+#ifndef GLICKO_H
+#define GLICKO_H
+
+/*
+ * Glicko-2 rating engine.
+ *
+ * Results are recorded into the current rating period and have no effect
+ * until the period is closed.  Closing a period recomputes every known
+ * player in one batch: players who played have their rating, deviation
+ * and volatility updated from all of their games in the period, and
+ * players who did not play have their deviation widened, though never
+ * past GLICKO_INITIAL_RD.  Players are
+ * identified by their player id (see player_ext.h), which indexes the
+ * engine's per-player arrays.
+ */
+typedef struct glicko GLICKO;
+
+/*
+ * Glicko-2 engine used by the server in place of Elo.  If NULL, ratings
+ * are maintained by player_post_result().
+ */
+extern GLICKO *glicko_engine;
+
+/* The rating and rating deviation given to a player who has never played. */
+#define GLICKO_INITIAL_RATING 1500.0
+#define GLICKO_INITIAL_RD 350.0
+
+/* The volatility given to a player who has never played. */
+#define GLICKO_INITIAL_VOLATILITY 0.06
+
+/* Default system constant constraining the change in volatility. */
+#define GLICKO_DEFAULT_TAU 0.5
+
+/*
+ * Initialize a new Glicko-2 engine.
+ *
+ * @param tau  The system constant (typically 0.3 .. 1.2).
+ * @param period_secs  If positive, a thread is started that closes the
+ * rating period every period_secs seconds.  If zero, periods are only
+ * closed by calls to glicko_close_period().
+ * @return  the newly initialized GLICKO, or NULL if initialization fails.
+ */
+GLICKO *glicko_init(double tau, int period_secs);
+
+/*
+ * Finalize a Glicko-2 engine, stopping its period thread if any and
+ * freeing all associated resources.  Results recorded in the open
+ * period are discarded.
+ *
+ * @param g  The GLICKO to be finalized, which must not be referenced again.
+ */
+void glicko_fini(GLICKO *g);
+
+/*
+ * Record the result of a game in the current rating period.
+ *
+ * @param g  The GLICKO engine.
+ * @param id1  The id of the player in the first player role.
+ * @param id2  The id of the player in the second player role.
+ * @param result  0 if draw, 1 if id1 won, 2 if id2 won.
+ * @return 0 if the result was recorded, -1 otherwise.
+ */
+int glicko_record(GLICKO *g, int id1, int id2, int result);
+
+/*
+ * Close the current rating period and recompute all players.
+ *
+ * @param g  The GLICKO engine.
+ * @return the number of results that were applied.
+ */
+long glicko_close_period(GLICKO *g);
+
+/*
+ * Set a player's rating parameters, e.g. to seed the engine from a
+ * snapshot.  Takes effect immediately.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int glicko_set(GLICKO *g, int id, double rating, double rd, double volatility);
+
+/*
+ * Get a player's rating parameters as of the last closed period.  Any
+ * of the output pointers may be NULL.
+ */
+void glicko_get(GLICKO *g, int id, double *rating, double *rd, double *volatility);
+
+/*
+ * Get a player's rating as of the last closed period, rounded to the
+ * nearest whole point.
+ */
+int glicko_get_rating(GLICKO *g, int id);
+
+#endif /* GLICKO_H */
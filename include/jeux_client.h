@@ -0,0 +1,154 @@
+#ifndef JEUX_CLIENT_H
+#define JEUX_CLIENT_H
+
+#include <stddef.h>
+
+#include "protocol.h"
+
+/*
+ * An event-driven client library for the Jeux protocol.
+ *
+ * A JC_LOOP holds any number of connections (JC_CONN) to servers and is
+ * driven by one thread calling jc_loop_run(), which waits for any of them
+ * to become readable or writable and dispatches what arrived.  Sockets are
+ * non-blocking once connected: requests are queued and written as the
+ * socket takes them, so a connection may have any number of requests
+ * outstanding.
+ *
+ * The server handles the requests on a connection in order and replies to
+ * each with an ACK or NACK, so replies are matched to requests first in,
+ * first out, and each goes to the callback given with its request.  Every
+ * other packet (INVITED, MOVED, ENDED and so on) is a notification and
+ * goes to the connection's event callback, in the order it arrived
+ * relative to the replies.
+ *
+ * Headers passed to callbacks are in host byte order, and they and their
+ * payloads are valid only until the callback returns.  Callbacks may make
+ * requests and close connections, including their own.
+ *
+ * Nothing here is thread-safe: a loop and its connections belong to the
+ * thread that runs it.  Threads with loops of their own may run side by
+ * side.
+ */
+
+typedef struct jc_loop JC_LOOP;
+typedef struct jc_conn JC_CONN;
+
+/*
+ * Called with the reply to a request.
+ *
+ * @param conn  The connection the request was made on.
+ * @param arg  The argument given with the request.
+ * @param hdr  The ACK or NACK, or NULL if the connection was closed or
+ * lost before the reply arrived.
+ * @param payload  The payload of the reply, or NULL if it had none.
+ */
+typedef void (*JC_REPLY_FN)(JC_CONN *conn, void *arg, JEUX_PACKET_HEADER *hdr, void *payload);
+
+/*
+ * Called with each notification on a connection, and once more when the
+ * connection is lost: the server closed it, or it could not be read or
+ * written.  A lost connection is freed when jc_loop_run() returns and
+ * must not be used after.  Closing a connection with jc_close() does not
+ * call this.
+ *
+ * @param conn  The connection.
+ * @param arg  The argument given to jc_connect().
+ * @param hdr  The notification, or NULL if the connection was lost.
+ * @param payload  The payload of the notification, or NULL if it had none.
+ */
+typedef void (*JC_EVENT_FN)(JC_CONN *conn, void *arg, JEUX_PACKET_HEADER *hdr, void *payload);
+
+/*
+ * Create an empty loop.
+ *
+ * @return the loop, or NULL if memory could not be allocated.
+ */
+JC_LOOP *jc_loop_create(void);
+
+/*
+ * Close every connection in a loop, as with jc_close(), and free it.
+ *
+ * @param loop  The loop, which must not be running.
+ */
+void jc_loop_destroy(JC_LOOP *loop);
+
+/*
+ * Wait for something to happen on the connections in a loop and dispatch
+ * it: write what queued requests the sockets will take, and read whatever
+ * has arrived, calling the callbacks for every complete packet.
+ *
+ * @param loop  The loop.
+ * @param timeout_ms  The longest to wait for something to happen, in
+ * milliseconds, or -1 to wait indefinitely.
+ * @return the number of connections on which something happened, which
+ * may be only a write or part of a packet, so is positive even if no
+ * callback was called; 0 only if the timeout expired with nothing
+ * happening; or -1 if the loop has no connections or poll() failed.
+ */
+int jc_loop_run(JC_LOOP *loop, int timeout_ms);
+
+/*
+ * Connect to a server and add the connection to a loop.  Connecting
+ * blocks; nothing else does.
+ *
+ * @param loop  The loop.
+ * @param host  The server's host name or address.
+ * @param port  The server's port.
+ * @param event  The function notifications are given to, or NULL to
+ * ignore them.
+ * @param arg  An argument passed to every call of event.
+ * @return the connection, or NULL if it could not be made.
+ */
+JC_CONN *jc_connect(JC_LOOP *loop, char *host, char *port, JC_EVENT_FN event, void *arg);
+
+/*
+ * Queue a request on a connection.
+ *
+ * @param conn  The connection.
+ * @param type  The packet type.
+ * @param id  The invitation ID, for requests that take one.
+ * @param role  The role, for requests that take one.
+ * @param payload  The payload, which is copied, or NULL.
+ * @param size  The size of the payload.
+ * @param done  The function the reply is given to, or NULL to ignore it.
+ * @param arg  An argument passed to done.
+ * @return 0 if the request was queued, -1 if the connection is closed or
+ * memory could not be allocated.
+ */
+int jc_request(JC_CONN *conn, int type, int id, int role, void *payload, size_t size,
+               JC_REPLY_FN done, void *arg);
+
+/*
+ * Queue a request whose header has already been made, such as one read
+ * back from a packet capture (see capture.h), to be sent unchanged.
+ *
+ * @param conn  The connection.
+ * @param hdr  The header, in network byte order.
+ * @param payload  The payload, which is copied, or NULL.  Its size is the
+ * one in the header, which must be zero if it is NULL.
+ * @param done  The function the reply is given to, or NULL to ignore it.
+ * @param arg  An argument passed to done.
+ * @return 0 if the request was queued, -1 if the connection is closed,
+ * the header gives a size but there is no payload, or memory could not
+ * be allocated.
+ */
+int jc_send(JC_CONN *conn, JEUX_PACKET_HEADER *hdr, void *payload, JC_REPLY_FN done, void *arg);
+
+/*
+ * The number of requests on a connection still waiting for their reply.
+ *
+ * @param conn  The connection.
+ * @return the number of requests.
+ */
+int jc_outstanding(JC_CONN *conn);
+
+/*
+ * Close a connection and remove it from its loop.  The replies of any
+ * outstanding requests are given to their callbacks as NULL first.
+ *
+ * @param conn  The connection, which must not be used again.
+ */
+void jc_close(JC_CONN *conn);
+
+#endif /* JEUX_CLIENT_H */
@@ -0,0 +1,109 @@
+#ifndef LOCK_PROF_H
+#define LOCK_PROF_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "watchdog.h"
+
+/*
+ * Mutex contention profiler.
+ *
+ * The server's mutexes are taken through lprof_lock() and released
+ * through lprof_unlock(), each lock naming the site (which mutex of which
+ * kind of object) it belongs to.  While profiling is enabled, every
+ * acquisition records how long the thread waited for the mutex and,
+ * when it is released, how long it was held, in per-site histograms.
+ * While profiling is disabled the wrappers add one relaxed atomic load
+ * to a lock and one thread-local read to an unlock.
+ *
+ * Hold times are tracked on a small per-thread stack of mutexes held, so
+ * nested and recursive locking is measured correctly up to
+ * LPROF_MAX_HELD levels; deeper acquisitions are counted without a hold
+ * time.  A mutex locked before profiling was enabled gets no hold time.
+ *
+ * Whether or not profiling is enabled, a thread waiting in lprof_lock()
+ * shows the site to the slow-request watchdog (see watchdog.h).
+ */
+
+/* Depth of the per-thread stack of held mutexes. */
+#define LPROF_MAX_HELD 16
+
+typedef enum {
+    LOCK_SITE_CREG,             /* client registry */
+    LOCK_SITE_PREG,             /* player registry */
+    LOCK_SITE_CLIENT,           /* client reference count */
+    LOCK_SITE_CLIENT_FD,        /* client socket */
+    LOCK_SITE_CLIENT_INV,       /* client invitation list */
+    LOCK_SITE_CLIENT_PLAYER,    /* client logged-in player */
+    LOCK_SITE_GAME,             /* game reference count */
+    LOCK_SITE_GAME_BOARD,
+    LOCK_SITE_GAME_TURN,
+    LOCK_SITE_GAME_STATUS,
+    LOCK_SITE_GAME_WINNER,
+    LOCK_SITE_INV,              /* invitation reference count */
+    LOCK_SITE_INV_STATE,
+    LOCK_SITE_INV_GAME,
+    LOCK_SITE_PLAYER,           /* player reference count */
+    LOCK_SITES
+} LOCK_SITE;
+
+/* Nonzero while profiling is enabled; use lprof_enable() to change. */
+extern atomic_int lprof_enabled;
+
+/* Number of entries on the calling thread's stack of held mutexes. */
+extern __thread int lprof_depth;
+
+void lprof_lock_slow(pthread_mutex_t *mutex, LOCK_SITE site);
+void lprof_unlock_slow(pthread_mutex_t *mutex);
+
+/*
+ * Lock a mutex, recording contention for the given site if profiling is
+ * enabled.
+ */
+static inline void lprof_lock(pthread_mutex_t *mutex, LOCK_SITE site) {
+    watchdog_wait(WATCHDOG_WAIT_LOCK, site);
+    if(!atomic_load_explicit(&lprof_enabled, memory_order_relaxed)) {
+        pthread_mutex_lock(mutex);
+    } else {
+        lprof_lock_slow(mutex, site);
+    }
+    watchdog_wait(WATCHDOG_WAIT_NONE, 0);
+}
+
+/*
+ * Unlock a mutex locked with lprof_lock(), recording how long it was held
+ * if its acquisition was profiled.
+ */
+static inline void lprof_unlock(pthread_mutex_t *mutex) {
+    if(lprof_depth == 0) {
+        pthread_mutex_unlock(mutex);
+        return;
+    }
+    lprof_unlock_slow(mutex);
+}
+
+/*
+ * Turn profiling on or off.  Results collected so far are kept.
+ *
+ * @param on  Nonzero to turn profiling on.
+ */
+void lprof_enable(int on);
+
+/*
+ * @return the name of a site, as used by lprof_write().
+ */
+char *lprof_site_name(LOCK_SITE site);
+
+/*
+ * Write the results for every site that has been profiled, as
+ * "lock_<site>_acquired" and "lock_<site>_contended" counts followed by
+ * "lock_<site>_wait_ns" and "lock_<site>_hold_ns" histograms, in the
+ * format of metrics_write().
+ *
+ * @param out  The stream to write to.
+ */
+void lprof_write(FILE *out);
+
+#endif /* LOCK_PROF_H */
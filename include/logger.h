@@ -0,0 +1,95 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Asynchronous logger behind the debug(), info(), success(), warn() and
+ * error() macros of debug.h.
+ *
+ * Once logger_start() has been called, a log call does not format
+ * anything: it copies the format pointer, its source location and its
+ * arguments into a ring owned by the calling thread and returns.  A
+ * background thread formats the records and writes them out.  Format
+ * strings, file names and function names must therefore be string
+ * literals, which they always are when the macros are used.  String
+ * arguments are copied, truncated to LOGGER_MAX_STRING bytes.  If the
+ * caller's ring is full the record is dropped and counted in the
+ * METRIC_LOG_DROPPED metric; a log call never blocks.
+ *
+ * Before logger_start(), and after logger_stop(), log calls are formatted
+ * and written to stderr by the caller, as they were originally.
+ *
+ * Which macros exist is still chosen at compile time by debug.h; which
+ * of those are written is chosen at run time by logger_level.
+ */
+
+/* Size in bytes of each thread's ring; a power of two. */
+#define LOGGER_RING_BYTES (64 * 1024)
+
+/* Longest string argument copied into a record, in bytes. */
+#define LOGGER_MAX_STRING 256
+
+/* How often the background thread looks for new records while busy, and while idle. */
+#define LOGGER_POLL_MS 5
+#define LOGGER_IDLE_POLL_MS 320
+
+typedef enum {
+    LOGGER_DEBUG,
+    LOGGER_INFO,
+    LOGGER_SUCCESS,
+    LOGGER_WARN,
+    LOGGER_ERROR,
+    LOGGER_OFF
+} LOGGER_LEVEL;
+
+/* Records below this level are discarded by the caller. */
+extern atomic_int logger_level;
+
+static inline int logger_enabled(LOGGER_LEVEL level) {
+    return atomic_load_explicit(&logger_level, memory_order_relaxed) <= (int)level;
+}
+
+/*
+ * Log a record.  Use the macros in debug.h rather than calling this,
+ * unless the record is to be written whatever the level and whichever
+ * macros are compiled in, as request tracing is (see admin.h).
+ */
+void logger_write(LOGGER_LEVEL level, const char *file, const char *func, int line,
+        const char *fmt, ...) __attribute__((format(printf, 5, 6)));
+
+/*
+ * Start the background thread.
+ *
+ * @param out  The stream records are written to.
+ * @return 0 if successful, -1 otherwise.
+ */
+int logger_start(FILE *out);
+
+/*
+ * Write every record logged before the call, then stop the background
+ * thread.  Later log calls are written synchronously to stderr.
+ */
+void logger_stop(void);
+
+/*
+ * Block until every record logged before the call has been written.
+ */
+void logger_flush(void);
+
+/*
+ * Look up a level by name ("debug", "info", "success", "warn", "error"
+ * or "off").
+ *
+ * @return the level, or -1 if there is no such level.
+ */
+int logger_parse_level(char *name);
+
+/*
+ * @return the name of a level, as accepted by logger_parse_level().
+ */
+char *logger_level_name(int level);
+
+#endif /* LOGGER_H */
@@ -0,0 +1,221 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Server metrics: counters, gauges and latency histograms.
+ *
+ * Every metric is split into METRICS_SHARDS cache-line-aligned shards.
+ * Each thread picks a shard the first time it records anything and only
+ * ever updates that shard, with relaxed atomic adds, so threads rarely
+ * share a cache line.  Readers add up the shards with atomic loads and
+ * never take a lock; a snapshot is therefore not an instant in time, but
+ * every individual value in it is exact.
+ */
+
+/* Number of shards per metric. */
+#define METRICS_SHARDS 16
+
+/*
+ * Histograms are log-linear: values below 2^METRICS_HIST_SUB_BITS get a
+ * bucket each, and every power of two above that is split into
+ * 2^METRICS_HIST_SUB_BITS equal buckets, for a relative error of at most
+ * 1/2^METRICS_HIST_SUB_BITS.  Values of 2^METRICS_HIST_MAX_BITS or more
+ * go into the last bucket.
+ */
+#define METRICS_HIST_SUB_BITS 3
+#define METRICS_HIST_MAX_BITS 36
+#define METRICS_HIST_BUCKETS \
+    ((METRICS_HIST_MAX_BITS - METRICS_HIST_SUB_BITS + 2) << METRICS_HIST_SUB_BITS)
+
+/* Histograms are kept for packet types below this value. */
+#define METRICS_PKT_TYPES 24
+
+/*
+ * Client timestamps further than this in the past are assumed to come
+ * from a clock other than the server's CLOCK_MONOTONIC (for example a
+ * client on another host) and are not used.
+ */
+#define METRICS_MAX_CLIENT_DELAY_NS (60ULL * 1000000000)
+
+/*
+ * Latencies kept as one histogram per packet type.
+ */
+typedef enum {
+    METRIC_LATENCY_HANDLE,  /* handling a request, from dispatch to reply */
+    METRIC_LATENCY_DELAY,   /* client send timestamp to dispatch */
+    METRIC_LATENCY_QUEUE,   /* part of the delay spent behind the previous request */
+    METRIC_LATENCY_FANOUT,  /* receipt of a request to a notification it caused */
+    METRIC_LATENCY_KINDS
+} METRIC_LATENCY;
+
+/*
+ * Counters and gauges.  Gauges go up and down; counters only go up.
+ */
+typedef enum {
+    METRIC_PACKETS_IN,
+    METRIC_PACKETS_OUT,
+    METRIC_BYTES_IN,
+    METRIC_BYTES_OUT,
+    METRIC_ACTIVE_CLIENTS,      /* gauge */
+    METRIC_ACTIVE_GAMES,        /* gauge */
+    METRIC_ACTIVE_INVITATIONS,  /* gauge */
+    METRIC_LOG_DROPPED,         /* log records lost to a full ring */
+    METRIC_NCOUNTERS
+} METRIC_COUNTER;
+
+/*
+ * Reasons a request was answered with NACK.
+ */
+typedef enum {
+    METRIC_NACK_NOT_LOGGED_IN,
+    METRIC_NACK_ALREADY_LOGGED_IN,
+    METRIC_NACK_LOGIN,
+    METRIC_NACK_INVITE,
+    METRIC_NACK_REVOKE,
+    METRIC_NACK_DECLINE,
+    METRIC_NACK_ACCEPT,
+    METRIC_NACK_MOVE,
+    METRIC_NACK_RESIGN,
+    METRIC_NACK_HISTORY,
+    METRIC_NACK_STATS,
+    METRIC_NACK_USERS,
+    METRIC_NACK_REASONS
+} METRIC_NACK_REASON;
+
+struct metrics_hist_shard {
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+    _Atomic uint64_t buckets[METRICS_HIST_BUCKETS];
+} __attribute__((aligned(64)));
+
+/*
+ * A sharded log-linear histogram.  Zero-initialized storage is an empty
+ * histogram.
+ */
+typedef struct metrics_histogram {
+    struct metrics_hist_shard shards[METRICS_SHARDS];
+} METRICS_HISTOGRAM;
+
+/*
+ * The sum of all shards of a histogram.
+ */
+typedef struct metrics_hist_snapshot {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[METRICS_HIST_BUCKETS];
+} METRICS_HIST_SNAPSHOT;
+
+/*
+ * Get the current time from CLOCK_MONOTONIC, in nanoseconds.
+ */
+uint64_t metrics_now_ns(void);
+
+/*
+ * Add delta to a counter or gauge.
+ */
+void metrics_count(METRIC_COUNTER counter, int64_t delta);
+
+/*
+ * Read the current value of a counter or gauge.
+ */
+int64_t metrics_read(METRIC_COUNTER counter);
+
+/*
+ * Count a NACK sent for the given reason.
+ */
+void metrics_nack(METRIC_NACK_REASON reason);
+
+/*
+ * Read the number of NACKs sent for the given reason.
+ */
+uint64_t metrics_read_nacks(METRIC_NACK_REASON reason);
+
+/*
+ * Record a latency for the given packet type.
+ *
+ * @param kind  Which latency is being recorded.
+ * @param type  The packet type.
+ * @param ns  The latency, in nanoseconds.
+ */
+void metrics_record_latency(METRIC_LATENCY kind, int type, uint64_t ns);
+
+/*
+ * Add up the shards of the latency histogram for the given packet type.
+ */
+void metrics_read_latency(METRIC_LATENCY kind, int type, METRICS_HIST_SNAPSHOT *snap);
+
+/*
+ * Note that the calling thread has received a request and is about to
+ * dispatch it.  The time between the client's send timestamp and now is
+ * recorded as the request's delay, and the part of it during which the
+ * thread was still busy with its previous request as its queueing delay.
+ * Timestamps that cannot have come from the server's clock are ignored.
+ *
+ * @param type  The packet type of the request.
+ * @param sent_sec  The timestamp_sec field of the request, in host order.
+ * @param sent_nsec  The timestamp_nsec field of the request, in host order.
+ * @return the time of dispatch, as from metrics_now_ns().
+ */
+uint64_t metrics_request_begin(int type, uint32_t sent_sec, uint32_t sent_nsec);
+
+/*
+ * Note that the calling thread has finished handling its current request,
+ * and record how long that took.
+ *
+ * @param type  The packet type of the request.
+ * @return the handling time, in nanoseconds.
+ */
+uint64_t metrics_request_end(int type);
+
+/*
+ * Get the time at which the calling thread began handling its current
+ * request, as from metrics_now_ns(), or 0 if it is not handling one.
+ * Notifications are stamped with this time so that their receivers can
+ * measure fan-out latency.
+ */
+uint64_t metrics_request_time(void);
+
+/*
+ * Record a value in a histogram.
+ */
+void metrics_hist_record(METRICS_HISTOGRAM *hist, uint64_t value);
+
+/*
+ * Add up the shards of a histogram.
+ */
+void metrics_hist_read(METRICS_HISTOGRAM *hist, METRICS_HIST_SNAPSHOT *snap);
+
+/*
+ * Estimate a quantile of a histogram snapshot.
+ *
+ * @param snap  The histogram snapshot.
+ * @param q  The quantile, between 0 and 1.
+ * @return the upper bound of the bucket containing the quantile, or 0
+ * if the histogram is empty.
+ */
+uint64_t metrics_hist_quantile(METRICS_HIST_SNAPSHOT *snap, double q);
+
+/*
+ * Write a histogram snapshot as "<name>_count", "_sum", "_max", "_p50",
+ * "_p90", "_p99" and "_p999" lines, each "<name>_<stat>\t<value>".
+ */
+void metrics_hist_write(FILE *out, char *name, METRICS_HIST_SNAPSHOT *snap);
+
+/*
+ * Get a short name for a packet type, for use in metric names.
+ */
+char *metrics_pkt_name(int type);
+
+/*
+ * Write every metric in text form, one "<name>\t<value>" line each.
+ *
+ * @param out  The stream to write to.
+ */
+void metrics_write(FILE *out);
+
+#endif /* METRICS_H */
@@ -1,8 +1,17 @@
 #ifndef PACKET_COMMON_H
 #define PACKET_COMMON_H
 
+#include <stdint.h>
+
 #include "protocol.h"
 
+/*
+ * If set, pack_header() stamps every packet with the time returned by
+ * this function, in nanoseconds, instead of reading CLOCK_MONOTONIC.  The
+ * simulator (see sim.h) sets it to its virtual clock.
+ */
+extern uint64_t (*packet_clock)(void);
+
 extern void pack_header(JEUX_PACKET_HEADER *jph, 
         uint8_t type, 
         uint8_t id,
@@ -0,0 +1,83 @@
+#ifndef PERFCTR_H
+#define PERFCTR_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Hardware performance counters per request handler.
+ *
+ * When enabled, each service thread opens its own perf_event_open()
+ * counters the first time it handles a request, reads them before and
+ * after each request it dispatches, and adds the differences to totals
+ * kept per packet type.  Only user-space events are counted when the
+ * kernel does not allow more.  Counters the kernel or the machine does
+ * not provide (virtual machines often have no PMU) are left out; if none
+ * can be opened the feature stays off.  Counts are not scaled for
+ * multiplexing, so they are low if more counters are in use on the CPU
+ * than it has.
+ */
+
+typedef enum {
+    PERFCTR_CYCLES,
+    PERFCTR_INSTRUCTIONS,
+    PERFCTR_CACHE_MISSES,
+    PERFCTR_CONTEXT_SWITCHES,
+    PERFCTR_NEVENTS
+} PERFCTR_EVENT;
+
+/* Nonzero while requests are being counted. */
+extern atomic_int perfctr_enabled;
+
+void perfctr_begin_slow(void);
+void perfctr_end_slow(int type);
+
+/*
+ * Start counting a request, if enabled.
+ */
+static inline void perfctr_begin(void) {
+    if(atomic_load_explicit(&perfctr_enabled, memory_order_relaxed)) {
+        perfctr_begin_slow();
+    }
+}
+
+/*
+ * Stop counting a request, if enabled, and charge it to its packet type.
+ *
+ * @param type  The packet type of the request.
+ */
+static inline void perfctr_end(int type) {
+    if(atomic_load_explicit(&perfctr_enabled, memory_order_relaxed)) {
+        perfctr_end_slow(type);
+    }
+}
+
+/*
+ * Start or stop counting.  Starting checks that the calling thread can
+ * open at least one counter.
+ *
+ * @param on  Nonzero to start, zero to stop.
+ * @return 0 if successful, -1 if no counter could be opened, in which
+ * case counting stays off.
+ */
+int perfctr_enable(int on);
+
+/*
+ * Read the totals for a packet type.
+ *
+ * @param type  The packet type.
+ * @param totals  Set to the total of each event over the requests counted.
+ * @param available  Set to nonzero for each event that was actually
+ * counted by at least one thread.
+ * @return the number of requests counted.
+ */
+uint64_t perfctr_read(int type, uint64_t totals[PERFCTR_NEVENTS], int available[PERFCTR_NEVENTS]);
+
+/*
+ * Write "perf_requests_<type>" and "perf_<event>_<type>" lines for every
+ * packet type that has been counted and every event that was available.
+ */
+void perfctr_write(FILE *out);
+
+#endif /* PERFCTR_H */
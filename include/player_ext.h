@@ -0,0 +1,73 @@
+#ifndef PLAYER_EXT_H
+#define PLAYER_EXT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "player.h"
+
+/*
+ * Additional PLAYER operations that are not part of player.h.
+ */
+
+/*
+ * Number of rated games kept in each player's rating history.  Older
+ * games are overwritten.
+ */
+#define PLAYER_HISTORY_LEN 32
+
+/* Outcome of a game from the point of view of the player whose history it is. */
+#define PLAYER_HISTORY_LOSS 0
+#define PLAYER_HISTORY_DRAW 1
+#define PLAYER_HISTORY_WIN  2
+
+/*
+ * One game in a player's rating history, as returned by player_get_history().
+ */
+typedef struct player_history_entry {
+    uint32_t timestamp_sec;   /* CLOCK_REALTIME seconds when the result was posted */
+    int opponent_id;          /* id of the opponent (see player_get_id()) */
+    int outcome;              /* PLAYER_HISTORY_LOSS, _DRAW or _WIN */
+    int rating;               /* the player's rating after the game */
+} PLAYER_HISTORY_ENTRY;
+
+/*
+ * Get the id of a player.  Ids are assigned in creation order starting
+ * from zero and are never reused, so they can index per-player tables.
+ *
+ * @param player  The PLAYER that is to be queried.
+ * @return the id of the player.
+ */
+int player_get_id(PLAYER *player);
+
+/*
+ * Get the current reference count of a player.  The count can change as
+ * soon as it has been read unless the caller otherwise prevents new
+ * references from being taken.
+ *
+ * @param player  The PLAYER that is to be queried.
+ * @return the number of references to the player.
+ */
+size_t player_get_ref_count(PLAYER *player);
+
+/*
+ * Get the most recent games in a player's rating history.  Only results
+ * posted through player_post_result() are recorded, so the history stays
+ * empty while the Glicko-2 engine (see glicko.h) rates games.  The
+ * history is read without locking; a game being recorded while it is
+ * read may be left out.
+ *
+ * @param player  The PLAYER that is to be queried.
+ * @param entries  Storage for at most max entries, filled oldest first.
+ * @param max  The number of entries there is room for.
+ * @return the number of entries stored.
+ */
+int player_get_history(PLAYER *player, PLAYER_HISTORY_ENTRY *entries, int max);
+
+/*
+ * Get the number of bytes currently held by rating histories, summed
+ * over all live players.
+ */
+size_t player_history_bytes(void);
+
+#endif /* PLAYER_EXT_H */
@@ -0,0 +1,67 @@
+#ifndef PLAYER_REGISTRY_EXT_H
+#define PLAYER_REGISTRY_EXT_H
+
+#include "player_registry.h"
+
+/*
+ * Additional PLAYER_REGISTRY operations that are not part of
+ * player_registry.h.
+ */
+
+/*
+ * Look up a registered player by username, without registering it if it
+ * is not found.
+ *
+ * @param preg  The PLAYER_REGISTRY to search.
+ * @param name  The username to look for.
+ * @return  the PLAYER, with its reference count increased by one for the
+ * returned pointer, or NULL if no such player is registered.
+ */
+PLAYER *preg_lookup(PLAYER_REGISTRY *preg, char *name);
+
+/*
+ * Look up a registered player by id (see player_get_id()).
+ *
+ * @param preg  The PLAYER_REGISTRY to search.
+ * @param id  The player id to look for.
+ * @return  the PLAYER, with its reference count increased by one for the
+ * returned pointer, or NULL if no such player is registered.
+ */
+PLAYER *preg_lookup_id(PLAYER_REGISTRY *preg, int id);
+
+/*
+ * Look up a number of registered players by id, in one pass over the
+ * registry.
+ *
+ * @param preg  The PLAYER_REGISTRY to search.
+ * @param ids  The player ids to look for.
+ * @param n  The number of ids.
+ * @param players  Storage for n players: players[i] is set to the player
+ * with id ids[i], with its reference count increased by one, or NULL if no
+ * such player is registered.
+ * @return  the number of players found.
+ */
+int preg_lookup_ids(PLAYER_REGISTRY *preg, int *ids, int n, PLAYER **players);
+
+/*
+ * Get all registered players.
+ *
+ * @param preg  The PLAYER_REGISTRY to list.
+ * @return  a NULL-terminated array of players, each with its reference
+ * count increased by one, or NULL if memory could not be allocated.
+ * The caller must unref each player and free the array.
+ */
+PLAYER **preg_all_players(PLAYER_REGISTRY *preg);
+
+/*
+ * Remove idle players from a registry.  A player is idle if the only
+ * reference to it is the registry's own, so it is not logged in and no
+ * game or rating result refers to it.  Idle players are freed, and their
+ * ratings are lost.
+ *
+ * @param preg  The PLAYER_REGISTRY to collect.
+ * @return  the number of players removed.
+ */
+int preg_collect_idle(PLAYER_REGISTRY *preg);
+
+#endif /* PLAYER_REGISTRY_EXT_H */
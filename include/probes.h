@@ -0,0 +1,64 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+ * Static tracepoints (USDT probes, provider "jeux").
+ *
+ * When <sys/sdt.h> (systemtap-sdt-dev or systemtap-sdt-devel) is
+ * installed at build time, each probe is a single nop in the code and a
+ * note in the ELF file naming it and locating its arguments; nothing
+ * happens unless a tracer attaches.  For example:
+ *
+ *   bpftrace -e 'usdt:bin/jeux:jeux:request__done { @[arg1] = hist(arg2); }'
+ *
+ * Without <sys/sdt.h>, or when built with -DJEUX_NO_PROBES, the probes
+ * compile to nothing.  List them with "readelf -n bin/jeux".
+ *
+ * Probe                 Arguments
+ * packet__received      fd, packet type, payload size
+ * request__start        fd, packet type
+ * request__done         fd, packet type, nanoseconds spent handling it
+ * invitation__accept    invitation, game created for it
+ * invitation__close     invitation, role that closed it (0 if none), game or NULL
+ * game__move            game, role moving, square (1-9), nonzero if the move ended the game
+ * player__result        player1 id, player2 id, result (0 draw, 1 or 2 winner),
+ *                       rating change for player1 in fixed point (see player.c)
+ * client__send          fd, packet type, id, payload size, 0 if sent or -1
+ */
+
+#if !defined(JEUX_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define JEUX_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef JEUX_HAVE_PROBES
+#define TRACE_JEUX_PACKET_RECEIVED(fd, type, size) \
+    DTRACE_PROBE3(jeux, packet__received, fd, type, size)
+#define TRACE_JEUX_REQUEST_START(fd, type) \
+    DTRACE_PROBE2(jeux, request__start, fd, type)
+#define TRACE_JEUX_REQUEST_DONE(fd, type, ns) \
+    DTRACE_PROBE3(jeux, request__done, fd, type, ns)
+#define TRACE_JEUX_INVITATION_ACCEPT(inv, game) \
+    DTRACE_PROBE2(jeux, invitation__accept, inv, game)
+#define TRACE_JEUX_INVITATION_CLOSE(inv, role, game) \
+    DTRACE_PROBE3(jeux, invitation__close, inv, role, game)
+#define TRACE_JEUX_GAME_MOVE(game, role, square, over) \
+    DTRACE_PROBE4(jeux, game__move, game, role, square, over)
+#define TRACE_JEUX_PLAYER_RESULT(id1, id2, result, delta) \
+    DTRACE_PROBE4(jeux, player__result, id1, id2, result, delta)
+#define TRACE_JEUX_CLIENT_SEND(fd, type, id, size, status) \
+    DTRACE_PROBE5(jeux, client__send, fd, type, id, size, status)
+#else
+#define TRACE_JEUX_PACKET_RECEIVED(fd, type, size) do { } while(0)
+#define TRACE_JEUX_REQUEST_START(fd, type) do { } while(0)
+#define TRACE_JEUX_REQUEST_DONE(fd, type, ns) do { } while(0)
+#define TRACE_JEUX_INVITATION_ACCEPT(inv, game) do { } while(0)
+#define TRACE_JEUX_INVITATION_CLOSE(inv, role, game) do { } while(0)
+#define TRACE_JEUX_GAME_MOVE(game, role, square, over) do { } while(0)
+#define TRACE_JEUX_PLAYER_RESULT(id1, id2, result, delta) do { } while(0)
+#define TRACE_JEUX_CLIENT_SEND(fd, type, id, size, status) do { } while(0)
+#endif
+
+#endif /* PROBES_H */
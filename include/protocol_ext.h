@@ -0,0 +1,75 @@
+#ifndef PROTOCOL_EXT_H
+#define PROTOCOL_EXT_H
+
+#include "protocol.h"
+
+/*
+ * Extensions to the "Jeux" protocol in protocol.h.
+ *
+ * Extension packet types are numbered after the last packet type in
+ * protocol.h and use the same JEUX_PACKET_HEADER framing.  Servers that
+ * do not know an extension packet type ignore it.
+ *
+ * Client-to-server requests:
+ *   HISTORY:  Request the recent rating history of a player
+ *             Payload: username (the requesting player if empty)
+ *             Response: ACK with one line per game, oldest first:
+ *                       <time>\t<opponent>\t<W|L|D>\t<rating after>\n
+ *                       where <time> is in seconds since the epoch,
+ *                       or NACK if there is no such player or the
+ *                       server rates with Glicko-2 (-r glicko2),
+ *                       which keeps no per-game history.
+ *   STATS:    Request a snapshot of the server metrics
+ *             Payload: none
+ *             Response: ACK with one line per metric:
+ *                       <name>\t<value>\n
+ *                       Latencies are in nanoseconds; see metrics.h.
+ *
+ * Timestamps:
+ *   Requests should carry the client's CLOCK_MONOTONIC send time.  When
+ *   client and server share a clock, the server uses it to measure how
+ *   long requests take to reach dispatch.  Notifications (INVITED through
+ *   ENDED) caused by a request are stamped with the server's
+ *   CLOCK_MONOTONIC time of receipt of that request, not the time they
+ *   were sent, so a receiver can measure fan-out latency.
+ */
+
+#define JEUX_HISTORY_PKT (JEUX_ENDED_PKT + 1)
+#define JEUX_STATS_PKT (JEUX_ENDED_PKT + 2)
+
+/*
+ * Allocate storage for a payload of the given size, as proto_recv_packet()
+ * does, so that it can be released with proto_free_payload().  Small
+ * payloads released with proto_free_payload() are kept by the releasing
+ * thread and handed out again here, so that a thread that has warmed up
+ * receives requests without allocating.
+ *
+ * @param size  The payload size in bytes, which must be nonzero.
+ * @return the storage, or NULL if it could not be allocated.
+ */
+void *proto_alloc_payload(size_t size);
+
+/*
+ * Free a payload returned by proto_recv_packet() or proto_alloc_payload(),
+ * or any other payload allocated with malloc().  Storage is kept for reuse
+ * only if it has room for any small payload, so a payload allocated at
+ * its exact size is simply freed.  Payloads may still be released with
+ * free(), but are then missed by the object census (see census.h).
+ *
+ * @param payload  The payload, or NULL.
+ * @param size  The payload size from its packet header, in host byte order.
+ */
+void proto_free_payload(void *payload, size_t size);
+
+/*
+ * Storage belonging to the calling thread in which to build a payload to
+ * be sent.  It is kept from call to call and only grows, so a thread
+ * that has warmed up builds payloads without allocating.  Growing it
+ * keeps its contents, and it is only valid until the thread's next call.
+ *
+ * @param size  The number of bytes needed.
+ * @return the storage, or NULL if it could not be allocated.
+ */
+void *proto_scratch_payload(size_t size);
+
+#endif /* PROTOCOL_EXT_H */
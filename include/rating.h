@@ -0,0 +1,60 @@
+#ifndef RATING_H
+#define RATING_H
+
+#include <stdint.h>
+
+/*
+ * Fixed-point Elo arithmetic shared by the player module and the tools
+ * that recompute ratings.  A rating is held as a signed 64-bit integer
+ * with RATING_FRAC_BITS fractional bits, and expected scores are looked
+ * up in a precomputed table instead of calling pow().
+ */
+
+/* Number of fractional bits in a fixed-point rating. */
+#define RATING_FRAC_BITS 16
+
+/* The fixed-point representation of 1 (one rating point, or a score of 1). */
+#define RATING_ONE ((int64_t)1 << RATING_FRAC_BITS)
+
+/* Convert a whole number of rating points to fixed point. */
+#define RATING_TO_FIXED(r) ((int64_t)(r) * RATING_ONE)
+
+/*
+ * Rating differences are clamped to +/- RATING_EXPECT_SPAN points before
+ * the expectation table is consulted.  Beyond that the expected score is
+ * within 0.003 of 0 or 1.
+ */
+#define RATING_EXPECT_SPAN 1024
+
+/* The K factor used for Elo updates. */
+#define RATING_ELO_K 32
+
+/*
+ * Round a fixed-point rating to the nearest whole rating point.
+ *
+ * @param r  The fixed-point rating.
+ * @return the rounded rating.
+ */
+int rating_round(int64_t r);
+
+/*
+ * Look up the expected score of a player whose opponent is rated diff
+ * higher, i.e. 1/(1 + 10**(diff/400)).
+ *
+ * @param diff  The opponent's rating minus the player's rating, in fixed point.
+ * @return the expected score, in fixed point (0 .. RATING_ONE).
+ */
+int64_t rating_expect(int64_t diff);
+
+/*
+ * Compute the Elo adjustment for player1 after a game against player2.
+ * The adjustment for player2 is the negation of the returned value.
+ *
+ * @param r1  The fixed-point rating of player1.
+ * @param r2  The fixed-point rating of player2.
+ * @param result  0 if draw, 1 if player1 won, 2 if player2 won.
+ * @return the fixed-point amount to add to player1's rating.
+ */
+int64_t rating_elo_delta(int64_t r1, int64_t r2, int result);
+
+#endif /* RATING_H */
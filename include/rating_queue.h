@@ -0,0 +1,59 @@
+#ifndef RATING_QUEUE_H
+#define RATING_QUEUE_H
+
+#include "player.h"
+
+/*
+ * A RATING_QUEUE defers rating updates off the game-end path.  Results
+ * posted to the queue are applied by a dedicated rating thread, in the
+ * order they were posted, by player_post_result() or, if the server
+ * was started with Glicko-2 ratings, by recording them in the current
+ * rating period.  The thread drains every pending result in one batch
+ * each time it wakes up.
+ */
+typedef struct rating_queue RATING_QUEUE;
+
+/*
+ * Rating queue used by the server.  If NULL, results are applied
+ * synchronously by the caller.
+ */
+extern RATING_QUEUE *rating_queue;
+
+/*
+ * Initialize a new rating queue and start its rating thread.
+ *
+ * @return  the newly initialized RATING_QUEUE, or NULL if initialization
+ * fails.
+ */
+RATING_QUEUE *rq_init(void);
+
+/*
+ * Finalize a rating queue.  All pending results are applied, the rating
+ * thread is joined, and all associated resources are freed.
+ *
+ * @param rq  The RATING_QUEUE to be finalized, which must not be
+ * referenced again.
+ */
+void rq_fini(RATING_QUEUE *rq);
+
+/*
+ * Post the result of a game to be applied later by the rating thread.
+ * A reference is taken on each PLAYER until the result has been applied.
+ * If rq is NULL, the result is applied immediately.
+ *
+ * @param rq  The RATING_QUEUE to post to.
+ * @param player1  The PLAYER in the first player role.
+ * @param player2  The PLAYER in the second player role.
+ * @param result   0 if draw, 1 if player1 won, 2 if player2 won.
+ * @return 0 if the result was posted or applied, -1 otherwise.
+ */
+int rq_post_result(RATING_QUEUE *rq, PLAYER *player1, PLAYER *player2, int result);
+
+/*
+ * Block until every result posted before this call has been applied.
+ *
+ * @param rq  The RATING_QUEUE to flush.
+ */
+void rq_flush(RATING_QUEUE *rq);
+
+#endif /* RATING_QUEUE_H */
@@ -0,0 +1,33 @@
+#ifndef SERVER_EXT_H
+#define SERVER_EXT_H
+
+#include "client.h"
+#include "player.h"
+#include "protocol.h"
+
+/*
+ * Extensions to server.h: the step of jeux_client_service() that does not
+ * touch the connection, so that requests can be fed to the server by
+ * other means than a socket.  Hosts use them through sessions (see
+ * session.h).
+ */
+
+/*
+ * Handle one request from a client, as jeux_client_service() does for
+ * each packet it receives: check the client is logged in, carry out the
+ * request and send the reply and any notifications with
+ * client_send_packet().
+ *
+ * @param client  The client the request came from.
+ * @param player  The player the client is logged in as, or NULL if it has
+ * not logged in.
+ * @param hdr  The request header, in network byte order.  It is converted
+ * to host byte order in place.
+ * @param payload  The request payload, or NULL.  It is freed with
+ * proto_free_payload().
+ * @return the player the client is logged in as after the request, which
+ * is the player passed in unless the request logged it in.
+ */
+PLAYER *jeux_handle_request(CLIENT *client, PLAYER *player, JEUX_PACKET_HEADER *hdr, void *payload);
+
+#endif /* SERVER_EXT_H */
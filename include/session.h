@@ -0,0 +1,102 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "client_ext.h"
+#include "protocol.h"
+
+/*
+ * The Jeux server core as a library, independent of how packets travel.
+ *
+ * A host sets up the core once with jeux_core_init(), then opens a
+ * session for each client connection it has, pushes the client's packets
+ * into the session as they arrive, and closes the session when the
+ * connection ends.  Whatever the server sends to the client, replies and
+ * notifications caused by other sessions alike, goes to the host through
+ * the function it gave when opening the session.  jeux_client_service()
+ * is the host for TCP connections; the simulator (see sim.h) is another.
+ *
+ * The core is everything in build/ but main.o.  "make libjeux" archives
+ * it as build/libjeux.a, which a host links along with lib/jeux.a,
+ * -lpthread and -lm.
+ *
+ * Sessions may be used from any number of threads, but packets for any
+ * one session must be pushed one at a time, in the order the client sent
+ * them.
+ */
+
+typedef struct session SESSION;
+
+/* Connection numbers given to sessions that have no file descriptor. */
+#define SESSION_CONN_BASE (1 << 24)
+
+/*
+ * Set up the core: the client and player registries and the rating queue.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int jeux_core_init(void);
+
+/*
+ * Shut the core down once every session is closed: apply any ratings
+ * still queued, then finalize the registries.
+ */
+void jeux_core_fini(void);
+
+/*
+ * Open a session for a client whose packets the host carries itself.
+ * The session has a connection number of its own, from SESSION_CONN_BASE
+ * up, which appears where a file descriptor would in logs and traces, but
+ * is never used as one.
+ *
+ * @param send  The function packets for the client are given to.
+ * @param arg  An argument passed to every call of send.
+ * @return the session, or NULL if the client could not be registered.
+ */
+SESSION *session_open(CLIENT_SEND_FN send, void *arg);
+
+/*
+ * Open a session for a client connected through a file descriptor, to
+ * which packets for it are written with proto_send_packet().
+ *
+ * @param fd  The file descriptor.  The host still reads from it, but
+ * the session takes it over: session_close() closes it.
+ * @return the session, or NULL if the client could not be registered.
+ */
+SESSION *session_open_fd(int fd);
+
+/*
+ * Have the server handle a packet from a session's client.  The reply,
+ * and any notifications for this or other clients, are sent before this
+ * returns.
+ *
+ * @param session  The session.
+ * @param hdr  The packet header, in network byte order.  It is converted
+ * to host byte order in place.
+ * @param payload  The payload, allocated with malloc() or, to be counted
+ * by the object census, proto_alloc_payload() (see protocol_ext.h), or
+ * NULL.  The session takes it over and frees it with proto_free_payload().
+ * @return 0 if successful, -1 if the header is missing.
+ */
+int session_push(SESSION *session, JEUX_PACKET_HEADER *hdr, void *payload);
+
+/*
+ * The connection number of a session: its file descriptor, or the number
+ * given to it by session_open().
+ *
+ * @param session  The session.
+ * @return the connection number.
+ */
+int session_conn(SESSION *session);
+
+/*
+ * Close a session, as when its connection ends: the client is logged out,
+ * which resigns its games and revokes or declines its invitations, and
+ * unregistered, and the file descriptor of a session_open_fd() session
+ * is closed.  Notifications to other clients are sent before this
+ * returns, and the session's send function is not called again after.
+ *
+ * @param session  The session, which must not be used again.
+ */
+void session_close(SESSION *session);
+
+#endif /* SESSION_H */
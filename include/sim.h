@@ -0,0 +1,93 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+/*
+ * Deterministic simulation of clients playing against the server's
+ * request handlers, in one thread and without sockets.
+ *
+ * Each simulated client has a session (see session.h) with an in-memory
+ * channel to the server and one back.  Requests are pushed into the
+ * session and whatever the server sends goes into the receiving client's
+ * channel.  Every step a scheduler driven by a seeded
+ * generator picks a client and one of the things it could do next: send
+ * its next request, have the server handle the request it sent, or read
+ * the next packet sent to it.  A virtual clock, which pack_header() uses
+ * through packet_clock, advances by a fixed amount each step.
+ *
+ * Clients log in, then invite random other clients, accept or decline
+ * invitations, move on random empty squares, and now and then resign,
+ * revoke or ask for the USERS list, keeping at most one request
+ * outstanding but playing several games at once.  The run is a function
+ * of the seed and the number of clients alone, so a seed that shows a
+ * problem replays the same interleaving every time.  A digest of every
+ * packet exchanged, timestamps included, makes that easy to check.
+ *
+ * The simulation installs its own client and player registries and the
+ * packet clock, so only one can exist at a time, and no server threads
+ * may be running.  Ratings are applied as each game ends rather than by
+ * a rating queue, which would add a thread.
+ */
+
+typedef struct sim SIM;
+
+/* Virtual time that passes with each scheduler step. */
+#define SIM_STEP_NS 1000
+
+/* Most clients in a simulation (the client registry's limit). */
+#define SIM_MAX_CLIENTS 64
+
+/*
+ * What a simulation has done so far.
+ */
+typedef struct sim_stats {
+    uint64_t steps;             /* scheduler steps taken */
+    uint64_t requests;          /* requests handled by the server */
+    uint64_t acks;
+    uint64_t nacks;
+    uint64_t notifications;     /* other packets delivered to clients */
+    uint64_t games;             /* games ended */
+    uint64_t now_ns;            /* the virtual clock */
+    uint64_t digest;            /* FNV-1a of every packet delivered */
+} SIM_STATS;
+
+/*
+ * Set up a simulation: fresh client and player registries, the packet
+ * clock, and a session for each of the given number of clients, not yet
+ * logged in.
+ *
+ * @param nclients  The number of clients, 2 to SIM_MAX_CLIENTS.
+ * @param seed  The seed for the scheduler and the clients' choices.
+ * @return the simulation, or NULL if the arguments are out of range or
+ * a simulation already exists.
+ */
+SIM *sim_init(int nclients, uint64_t seed);
+
+/*
+ * Run a simulation until the given number of games have ended in total.
+ *
+ * @param sim  The simulation.
+ * @param games  The number of games.
+ * @return 0 if that many games ended, -1 if the simulation stalled, with
+ * nothing left that any client could do.
+ */
+int sim_run(SIM *sim, uint64_t games);
+
+/*
+ * Read what a simulation has done so far.
+ *
+ * @param sim  The simulation.
+ * @param stats  Where to store the counts.
+ */
+void sim_stats(SIM *sim, SIM_STATS *stats);
+
+/*
+ * End a simulation: every client's session is closed, the registries are
+ * finalized and the packet clock is removed.
+ *
+ * @param sim  The simulation, which must not be referenced again.
+ */
+void sim_fini(SIM *sim);
+
+#endif /* SIM_H */
@@ -0,0 +1,116 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Slow-request watchdog.
+ *
+ * Each service thread publishes the start time, packet type and fd of
+ * the request it is handling in a slot of its own, and notes there what
+ * it is waiting for: a mutex (in lprof_lock()) or a send to a client's
+ * socket (in client_send_packet()).  A watchdog thread scans the slots
+ * and flags every request that has been running longer than the budget
+ * for its packet type: it is counted, by packet type and by what it was
+ * waiting for when it was caught, and a line is logged at warn level
+ * (see logger.h).  When a flagged request finishes, its total time is
+ * logged too.
+ *
+ * Publishing costs the service thread a few relaxed stores to its own
+ * slot per request and per lock; while the watchdog is not running it
+ * costs a thread-local read.
+ */
+
+/* What a thread is waiting for; the argument is in the low 16 bits. */
+#define WATCHDOG_WAIT_NONE 0
+#define WATCHDOG_WAIT_LOCK 1    /* argument: LOCK_SITE */
+#define WATCHDOG_WAIT_SEND 2    /* argument: fd being written */
+
+/* Bounds on how often the watchdog thread scans, in milliseconds. */
+#define WATCHDOG_MIN_SCAN_MS 1
+#define WATCHDOG_MAX_SCAN_MS 100
+
+/* Nonzero while the watchdog thread is running. */
+extern atomic_int watchdog_running;
+
+/* The calling thread's wait word while it is handling a request, else NULL. */
+extern __thread atomic_int *watchdog_waiting;
+
+void watchdog_begin_slow(int type, int fd);
+void watchdog_end_slow(void);
+
+/*
+ * Note what the calling thread is about to wait for, or WATCHDOG_WAIT_NONE
+ * once it is no longer waiting.
+ */
+static inline void watchdog_wait(int kind, int arg) {
+    atomic_int *w = watchdog_waiting;
+    if(w != NULL) {
+        atomic_store_explicit(w, (kind << 16) | (arg & 0xffff), memory_order_relaxed);
+    }
+}
+
+/*
+ * Mark the start of handling a request.
+ *
+ * @param type  The packet type of the request.
+ * @param fd  The connection it came from.
+ */
+static inline void watchdog_begin(int type, int fd) {
+    if(atomic_load_explicit(&watchdog_running, memory_order_relaxed)) {
+        watchdog_begin_slow(type, fd);
+    }
+}
+
+/*
+ * Mark the end of handling the calling thread's request.
+ */
+static inline void watchdog_end(void) {
+    if(watchdog_waiting != NULL) {
+        watchdog_end_slow();
+    }
+}
+
+/*
+ * Start the watchdog thread, or change the budgets if it is running.
+ *
+ * @param budget_ns  The budget for every packet type, in nanoseconds.
+ * @return 0 if successful, -1 otherwise.
+ */
+int watchdog_start(uint64_t budget_ns);
+
+/*
+ * Stop the watchdog thread.  Counts are kept.
+ */
+void watchdog_stop(void);
+
+/*
+ * Set the budget for one packet type.
+ *
+ * @param type  The packet type.
+ * @param budget_ns  The budget in nanoseconds; 0 means never flag.
+ * @return 0 if successful, -1 if the type is out of range.
+ */
+int watchdog_set_budget(int type, uint64_t budget_ns);
+
+/*
+ * @return the budget for a packet type, in nanoseconds.
+ */
+uint64_t watchdog_get_budget(int type);
+
+/*
+ * @return the number of requests of a packet type that have been flagged.
+ */
+uint64_t watchdog_read_slow(int type);
+
+/*
+ * Write "watchdog_slow_<type>" counts for each packet type with flagged
+ * requests, then "watchdog_waiting_<what>" counts of what flagged
+ * requests were waiting for: "lock_<site>", "send", or "none" when they
+ * were running.
+ */
+void watchdog_write(FILE *out);
+
+#endif /* WATCHDOG_H */
@@ -0,0 +1,358 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <ctype.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+#include "admin.h"
+#include "metrics.h"
+#include "protocol.h"
+#include "protocol_ext.h"
+#include "lock_prof.h"
+#include "flight.h"
+#include "logger.h"
+#include "perfctr.h"
+#include "watchdog.h"
+#include "player_ext.h"
+#include "player_registry_ext.h"
+#include "jeux_globals.h"
+#include "debug.h"
+
+ADMIN_SERVER *admin_server = NULL;
+atomic_int admin_tracing = 0;
+
+struct admin_server {
+    pthread_mutex_t mutex;
+    int listenfd;
+    int connfd;                 /* connection being served, or -1 */
+    atomic_int stop;
+    char *path;                 /* UNIX domain socket path, or NULL for TCP */
+    pthread_t tid;
+};
+
+static int is_port(char *addr) {
+    if(*addr == '\0') {
+        return 0;
+    }
+    for(char *c = addr; *c != '\0'; c++) {
+        if(!isdigit(*c)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int listen_tcp(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd == -1) {
+        return -1;
+    }
+    int optval = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sa.sin_port = htons(port);
+    if(bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1 || listen(fd, 8) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int listen_unix(char *path) {
+    struct sockaddr_un sa;
+    memset(&sa, 0, sizeof(sa));
+    if(strlen(path) >= sizeof(sa.sun_path)) {
+        return -1;
+    }
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1) {
+        return -1;
+    }
+    /* replace a stale socket, but never anything else at a mistyped path */
+    struct stat st;
+    if(lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+    if(bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1 || listen(fd, 8) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void list_players(FILE *out) {
+    PLAYER **players = preg_all_players(player_registry);
+    if(players == NULL) {
+        fprintf(out, "error: out of memory\n");
+        return;
+    }
+    for(int i = 0; players[i] != NULL; i++) {
+        /* not counting the reference held by the list itself */
+        fprintf(out, "%s\t%d\t%lu\n", player_get_name(players[i]),
+                player_get_rating(players[i]), player_get_ref_count(players[i]) - 1);
+        player_unref(players[i], "for player removed from player's list");
+    }
+    free(players);
+}
+
+static void list_clients(FILE *out) {
+    PLAYER **players = creg_all_players(client_registry);
+    if(players == NULL) {
+        fprintf(out, "error: out of memory\n");
+        return;
+    }
+    for(int i = 0; players[i] != NULL; i++) {
+        fprintf(out, "%s\n", player_get_name(players[i]));
+        player_unref(players[i], "for player removed from player's list");
+    }
+    free(players);
+}
+
+/* Packet types a server thread handles; the rest are only sent to clients. */
+static int is_request_type(int type) {
+    return type == JEUX_NO_PKT || (type >= JEUX_LOGIN_PKT && type <= JEUX_RESIGN_PKT) ||
+        type == JEUX_HISTORY_PKT || type == JEUX_STATS_PKT;
+}
+
+/*
+ * Show the watchdog's budgets, or stop it, or start it with one budget for
+ * every packet type, or change the budget for one type.
+ */
+static void watchdog_command(char *arg, char *ms, FILE *out) {
+    if(arg == NULL) {
+        fprintf(out, "%s\n", atomic_load(&watchdog_running) ? "on" : "off");
+        for(int type = 0; type < METRICS_PKT_TYPES; type++) {
+            uint64_t budget = watchdog_get_budget(type);
+            if(budget != 0 && is_request_type(type)) {
+                fprintf(out, "%s\t%lu\n", metrics_pkt_name(type), budget / 1000000);
+            }
+        }
+        return;
+    }
+    if(strcmp(arg, "off") == 0) {
+        watchdog_stop();
+        return;
+    }
+    char *end;
+    if(ms == NULL) {
+        long n = strtol(arg, &end, 10);
+        if(*end != '\0' || n <= 0) {
+            fprintf(out, "error: bad budget\n");
+        } else if(watchdog_start((uint64_t)n * 1000000) == -1) {
+            fprintf(out, "error: watchdog not started\n");
+        }
+        return;
+    }
+    int type;
+    for(type = 1; type < METRICS_PKT_TYPES; type++) {
+        if(is_request_type(type) && strcmp(arg, metrics_pkt_name(type)) == 0) {
+            break;
+        }
+    }
+    long n = strtol(ms, &end, 10);
+    if(type == METRICS_PKT_TYPES || *end != '\0' || n < 0) {
+        fprintf(out, "error: bad packet type or budget\n");
+        return;
+    }
+    watchdog_set_budget(type, (uint64_t)n * 1000000);
+}
+
+static void print_help(FILE *out) {
+    fprintf(out, "stats\nplayers\nclients\ngc\ntrace on|off\nlocks [on|off]\nflight\nlog [debug|info|success|warn|error|off]\nperf on|off\nwatchdog [off|<ms>|<type> <ms>]\nhelp\nquit\n");
+}
+
+/*
+ * Run one command and write its reply.
+ *
+ * @return 0 to keep the connection open, -1 to close it.
+ */
+static int run_command(char *line, FILE *out) {
+    char *cmd = strtok(line, " \t\r\n");
+    char *arg = strtok(NULL, " \t\r\n");
+    if(cmd == NULL) {
+        return 0;
+    }
+    debug("%ld: Admin command %s", pthread_self(), cmd);
+    if(strcmp(cmd, "quit") == 0) {
+        return -1;
+    } else if(strcmp(cmd, "stats") == 0) {
+        metrics_write(out);
+    } else if(strcmp(cmd, "players") == 0) {
+        list_players(out);
+    } else if(strcmp(cmd, "clients") == 0) {
+        list_clients(out);
+    } else if(strcmp(cmd, "gc") == 0) {
+        fprintf(out, "collected %d\n", preg_collect_idle(player_registry));
+    } else if(strcmp(cmd, "trace") == 0 && arg != NULL && strcmp(arg, "on") == 0) {
+        atomic_store(&admin_tracing, 1);
+    } else if(strcmp(cmd, "trace") == 0 && arg != NULL && strcmp(arg, "off") == 0) {
+        atomic_store(&admin_tracing, 0);
+    } else if(strcmp(cmd, "locks") == 0 && arg == NULL) {
+        lprof_write(out);
+    } else if(strcmp(cmd, "locks") == 0 && strcmp(arg, "on") == 0) {
+        lprof_enable(1);
+    } else if(strcmp(cmd, "locks") == 0 && strcmp(arg, "off") == 0) {
+        lprof_enable(0);
+    } else if(strcmp(cmd, "flight") == 0) {
+        if(flight_dump() == -1) {
+            fprintf(out, "error: flight recorder not dumped\n");
+        }
+    } else if(strcmp(cmd, "perf") == 0 && arg != NULL && strcmp(arg, "on") == 0) {
+        if(perfctr_enable(1) == -1) {
+            fprintf(out, "error: performance counters not available\n");
+        }
+    } else if(strcmp(cmd, "perf") == 0 && arg != NULL && strcmp(arg, "off") == 0) {
+        perfctr_enable(0);
+    } else if(strcmp(cmd, "log") == 0 && arg == NULL) {
+        fprintf(out, "%s\n", logger_level_name(atomic_load(&logger_level)));
+    } else if(strcmp(cmd, "log") == 0) {
+        int level = logger_parse_level(arg);
+        if(level == -1) {
+            fprintf(out, "error: unknown log level\n");
+        } else {
+            atomic_store(&logger_level, level);
+        }
+    } else if(strcmp(cmd, "watchdog") == 0) {
+        watchdog_command(arg, strtok(NULL, " \t\r\n"), out);
+    } else if(strcmp(cmd, "help") == 0) {
+        print_help(out);
+    } else {
+        fprintf(out, "error: unknown command\n");
+    }
+    fprintf(out, ".\n");
+    return fflush(out) == EOF ? -1 : 0;
+}
+
+static void serve_connection(int fd) {
+    int infd = dup(fd), outfd = dup(fd);
+    FILE *in = infd == -1 ? NULL : fdopen(infd, "r");
+    FILE *out = outfd == -1 ? NULL : fdopen(outfd, "w");
+    if(in == NULL || out == NULL) {
+        if(in != NULL) {
+            fclose(in);
+        } else if(infd != -1) {
+            close(infd);
+        }
+        if(out != NULL) {
+            fclose(out);
+        } else if(outfd != -1) {
+            close(outfd);
+        }
+        return;
+    }
+    char *line = NULL;
+    size_t cap = 0;
+    while(getline(&line, &cap, in) != -1) {
+        if(run_command(line, out) == -1) {
+            break;
+        }
+    }
+    free(line);
+    fclose(in);
+    fclose(out);
+}
+
+static void *admin_thread(void *arg) {
+    ADMIN_SERVER *admin = arg;
+    while(1) {
+        int fd = accept(admin->listenfd, NULL, NULL);
+        if(fd == -1) {
+            if(!atomic_load(&admin->stop) && (errno == EINTR || errno == ECONNABORTED)) {
+                continue;
+            }
+            break;
+        }
+        pthread_mutex_lock(&admin->mutex);
+        if(atomic_load(&admin->stop)) {
+            pthread_mutex_unlock(&admin->mutex);
+            close(fd);
+            break;
+        }
+        admin->connfd = fd;
+        pthread_mutex_unlock(&admin->mutex);
+
+        serve_connection(fd);
+
+        pthread_mutex_lock(&admin->mutex);
+        admin->connfd = -1;
+        pthread_mutex_unlock(&admin->mutex);
+        close(fd);
+    }
+    return NULL;
+}
+
+ADMIN_SERVER *admin_start(char *addr) {
+    if(addr == NULL) {
+        return NULL;
+    }
+    ADMIN_SERVER *admin = malloc(sizeof(ADMIN_SERVER));
+    if(admin == NULL) {
+        return NULL;
+    }
+    admin->path = NULL;
+    if(is_port(addr)) {
+        admin->listenfd = listen_tcp(atoi(addr));
+    } else {
+        admin->listenfd = listen_unix(addr);
+        admin->path = strdup(addr);
+    }
+    if(admin->listenfd == -1) {
+        debug("%ld: Failed to open admin endpoint %s", pthread_self(), addr);
+        free(admin->path);
+        free(admin);
+        return NULL;
+    }
+    admin->connfd = -1;
+    atomic_init(&admin->stop, 0);
+    pthread_mutex_init(&admin->mutex, NULL);
+
+    if(pthread_create(&admin->tid, NULL, admin_thread, admin) != 0) {
+        debug("%ld: Failed to start admin thread", pthread_self());
+        pthread_mutex_destroy(&admin->mutex);
+        close(admin->listenfd);
+        if(admin->path != NULL) {
+            unlink(admin->path);
+        }
+        free(admin->path);
+        free(admin);
+        return NULL;
+    }
+    debug("%ld: Admin endpoint listening on %s", pthread_self(), addr);
+    return admin;
+}
+
+void admin_stop(ADMIN_SERVER *admin) {
+    if(admin == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&admin->mutex);
+    atomic_store(&admin->stop, 1);
+    if(admin->connfd != -1) {
+        shutdown(admin->connfd, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&admin->mutex);
+
+    /* wakes the admin thread if it is blocked in accept() */
+    shutdown(admin->listenfd, SHUT_RDWR);
+    pthread_join(admin->tid, NULL);
+
+    close(admin->listenfd);
+    if(admin->path != NULL) {
+        unlink(admin->path);
+        free(admin->path);
+    }
+    pthread_mutex_destroy(&admin->mutex);
+    free(admin);
+}
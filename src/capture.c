@@ -0,0 +1,345 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <endian.h>
+#include <arpa/inet.h>
+
+#include "capture.h"
+#include "metrics.h"
+#include "debug.h"
+
+CAPTURE *packet_capture = NULL;
+
+#define CAPTURE_MAGIC "JEUXCAPT"
+#define CAPTURE_MAGIC_LEN 8
+
+/* A connection's buffer is written out early once it holds this much. */
+#define CAPTURE_FLUSH_BYTES (64 * 1024)
+
+/*
+ * Records are encoded, in file format, into a buffer belonging to the
+ * connection (that is, the service thread) they arrived on, so that
+ * recording a packet only takes a lock no other thread wants.  A flush
+ * swaps every buffer for its spare and merges the swapped-out records by
+ * time into the file.
+ */
+struct capture_buf {
+    pthread_mutex_t mutex;          /* protects data and len */
+    char *data;
+    size_t len, size;
+    char *spare;                    /* owned by the flush in progress */
+    size_t spare_len, spare_size, spare_pos;
+    atomic_int in_use;              /* claimed by a connection */
+    struct capture_buf *next;
+};
+
+struct capture {
+    pthread_mutex_t mutex;          /* serializes flushes and the buffer list */
+    FILE *out;
+    uint64_t start_ns;
+    unsigned long gen;              /* tells this capture from earlier ones */
+    struct capture_buf *bufs;
+};
+
+struct capture_record_header {
+    uint64_t time_ns;
+    uint32_t conn;
+    uint8_t event;
+} __attribute__((packed));
+
+static atomic_ulong capture_gen = 1;
+
+/* The buffer claimed by this thread, and the capture it belongs to. */
+static __thread struct capture_buf *thread_buf;
+static __thread unsigned long thread_gen;
+
+CAPTURE *capture_open(char *path) {
+    if(path == NULL) {
+        return NULL;
+    }
+    FILE *f = fopen(path, "w");
+    if(f == NULL) {
+        perror("fopen");
+        return NULL;
+    }
+    uint32_t version = htonl(CAPTURE_VERSION);
+    if(fwrite(CAPTURE_MAGIC, 1, CAPTURE_MAGIC_LEN, f) != CAPTURE_MAGIC_LEN ||
+            fwrite(&version, sizeof(version), 1, f) != 1 || fflush(f) == EOF) {
+        fclose(f);
+        return NULL;
+    }
+
+    CAPTURE *cap = malloc(sizeof(CAPTURE));
+    if(cap == NULL) {
+        fclose(f);
+        return NULL;
+    }
+    cap->out = f;
+    cap->start_ns = metrics_now_ns();
+    cap->gen = atomic_fetch_add(&capture_gen, 1);
+    cap->bufs = NULL;
+    pthread_mutex_init(&cap->mutex, NULL);
+    return cap;
+}
+
+static size_t record_size(char *rec) {
+    struct capture_record_header rh;
+    memcpy(&rh, rec, sizeof(rh));
+    if(rh.event != CAPTURE_PACKET) {
+        return sizeof(rh);
+    }
+    JEUX_PACKET_HEADER hdr;
+    memcpy(&hdr, rec + sizeof(rh), sizeof(hdr));
+    return sizeof(rh) + sizeof(hdr) + ntohs(hdr.size);
+}
+
+static uint64_t record_time(char *rec) {
+    uint64_t time_ns;
+    memcpy(&time_ns, rec, sizeof(time_ns));
+    return be64toh(time_ns);
+}
+
+/*
+ * Write out everything buffered so far, in time order.
+ * Must be called with cap->mutex held.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+static int flush_locked(CAPTURE *cap) {
+    struct capture_buf *buf;
+    /*
+     * Take every buffer at once, so that whatever is recorded after the
+     * swap is later than everything swapped out, and so belongs after it.
+     */
+    for(buf = cap->bufs; buf != NULL; buf = buf->next) {
+        pthread_mutex_lock(&buf->mutex);
+    }
+    for(buf = cap->bufs; buf != NULL; buf = buf->next) {
+        char *data = buf->data;
+        size_t size = buf->size;
+        buf->spare_len = buf->len;
+        buf->spare_pos = 0;
+        buf->data = buf->spare;
+        buf->size = buf->spare_size;
+        buf->len = 0;
+        buf->spare = data;
+        buf->spare_size = size;
+    }
+    for(buf = cap->bufs; buf != NULL; buf = buf->next) {
+        pthread_mutex_unlock(&buf->mutex);
+    }
+
+    int status = 0;
+    while(1) {
+        struct capture_buf *next = NULL;
+        uint64_t next_ns = 0;
+        for(buf = cap->bufs; buf != NULL; buf = buf->next) {
+            if(buf->spare_pos < buf->spare_len) {
+                uint64_t t = record_time(buf->spare + buf->spare_pos);
+                if(next == NULL || t < next_ns) {
+                    next = buf;
+                    next_ns = t;
+                }
+            }
+        }
+        if(next == NULL) {
+            break;
+        }
+        char *rec = next->spare + next->spare_pos;
+        size_t size = record_size(rec);
+        if(fwrite(rec, 1, size, cap->out) != size) {
+            status = -1;
+        }
+        next->spare_pos += size;
+    }
+    if(fflush(cap->out) == EOF) {
+        status = -1;
+    }
+    return status;
+}
+
+void capture_close(CAPTURE *cap) {
+    if(cap == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&cap->mutex);
+    flush_locked(cap);
+    fclose(cap->out);
+    while(cap->bufs != NULL) {
+        struct capture_buf *buf = cap->bufs;
+        cap->bufs = buf->next;
+        pthread_mutex_destroy(&buf->mutex);
+        free(buf->data);
+        free(buf->spare);
+        free(buf);
+    }
+    pthread_mutex_unlock(&cap->mutex);
+    pthread_mutex_destroy(&cap->mutex);
+    free(cap);
+}
+
+/*
+ * Get the buffer of the calling thread's connection, claiming one if the
+ * thread has none yet.
+ */
+static struct capture_buf *claim_buf(CAPTURE *cap) {
+    if(thread_buf != NULL && thread_gen == cap->gen) {
+        return thread_buf;
+    }
+    pthread_mutex_lock(&cap->mutex);
+    struct capture_buf *buf;
+    for(buf = cap->bufs; buf != NULL; buf = buf->next) {
+        int free_buf = 0;
+        if(atomic_compare_exchange_strong(&buf->in_use, &free_buf, 1)) {
+            break;
+        }
+    }
+    if(buf == NULL && (buf = calloc(1, sizeof(*buf))) != NULL) {
+        pthread_mutex_init(&buf->mutex, NULL);
+        atomic_init(&buf->in_use, 1);
+        /* listed under cap->mutex, so no flush can be part way through */
+        buf->next = cap->bufs;
+        cap->bufs = buf;
+    }
+    pthread_mutex_unlock(&cap->mutex);
+    thread_buf = buf;
+    thread_gen = cap->gen;
+    return buf;
+}
+
+/*
+ * Encode a record into the calling thread's buffer.
+ *
+ * @return 1 if the buffer should now be flushed, 0 if not, -1 on error.
+ */
+static int buffer_record(CAPTURE *cap, int conn, int event, JEUX_PACKET_HEADER *hdr,
+                         void *payload, size_t size) {
+    struct capture_buf *buf = claim_buf(cap);
+    if(buf == NULL) {
+        return -1;
+    }
+    struct capture_record_header rh;
+    size_t need = sizeof(rh) + (hdr != NULL ? sizeof(JEUX_PACKET_HEADER) + size : 0);
+    pthread_mutex_lock(&buf->mutex);
+    if(buf->len + need > buf->size) {
+        size_t new_size = buf->size > 0 ? buf->size : CAPTURE_FLUSH_BYTES / 4;
+        while(new_size < buf->len + need) {
+            new_size *= 2;
+        }
+        char *data = realloc(buf->data, new_size);
+        if(data == NULL) {
+            pthread_mutex_unlock(&buf->mutex);
+            return -1;
+        }
+        buf->data = data;
+        buf->size = new_size;
+    }
+    /* stamped under the buffer's lock, so a flush sees records in time order */
+    rh.time_ns = htobe64(metrics_now_ns() - cap->start_ns);
+    rh.conn = htonl(conn);
+    rh.event = event;
+    char *p = buf->data + buf->len;
+    memcpy(p, &rh, sizeof(rh));
+    if(hdr != NULL) {
+        memcpy(p + sizeof(rh), hdr, sizeof(JEUX_PACKET_HEADER));
+        if(size > 0) {
+            memcpy(p + sizeof(rh) + sizeof(JEUX_PACKET_HEADER), payload, size);
+        }
+    }
+    buf->len += need;
+    int full = buf->len >= CAPTURE_FLUSH_BYTES;
+    pthread_mutex_unlock(&buf->mutex);
+    return full;
+}
+
+int capture_packet(CAPTURE *cap, int conn, JEUX_PACKET_HEADER *hdr, void *payload) {
+    size_t size = hdr != NULL ? ntohs(hdr->size) : 0;
+    if(cap == NULL || hdr == NULL || (size > 0 && payload == NULL)) {
+        return -1;
+    }
+    int status = buffer_record(cap, conn, CAPTURE_PACKET, hdr, payload, size);
+    if(status == 1) {
+        pthread_mutex_lock(&cap->mutex);
+        status = flush_locked(cap);
+        pthread_mutex_unlock(&cap->mutex);
+    }
+    return status;
+}
+
+int capture_end(CAPTURE *cap, int conn) {
+    if(cap == NULL) {
+        return -1;
+    }
+    int status = buffer_record(cap, conn, CAPTURE_CLOSE, NULL, NULL, 0);
+    if(status == -1) {
+        return -1;
+    }
+    /* the connection is over; its buffer can go to the next one */
+    if(thread_buf != NULL) {
+        atomic_store(&thread_buf->in_use, 0);
+        thread_buf = NULL;
+    }
+    pthread_mutex_lock(&cap->mutex);
+    status = flush_locked(cap);
+    pthread_mutex_unlock(&cap->mutex);
+    return status;
+}
+
+FILE *capture_open_read(char *path) {
+    if(path == NULL) {
+        return NULL;
+    }
+    FILE *f = fopen(path, "r");
+    if(f == NULL) {
+        return NULL;
+    }
+    char magic[CAPTURE_MAGIC_LEN];
+    uint32_t version;
+    if(fread(magic, 1, CAPTURE_MAGIC_LEN, f) != CAPTURE_MAGIC_LEN ||
+            fread(&version, sizeof(version), 1, f) != 1 ||
+            memcmp(magic, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN) != 0 ||
+            ntohl(version) != CAPTURE_VERSION) {
+        debug("%ld: %s is not a packet capture", pthread_self(), path);
+        fclose(f);
+        return NULL;
+    }
+    return f;
+}
+
+int capture_read(FILE *in, CAPTURE_RECORD *rec) {
+    struct capture_record_header rh;
+    size_t n = fread(&rh, 1, sizeof(rh), in);
+    if(n == 0 && feof(in)) {
+        return 1;
+    }
+    if(n != sizeof(rh)) {
+        return -1;
+    }
+    rec->time_ns = be64toh(rh.time_ns);
+    rec->conn = ntohl(rh.conn);
+    rec->event = rh.event;
+    rec->payload = NULL;
+    memset(&rec->hdr, 0, sizeof(rec->hdr));
+    if(rec->event == CAPTURE_CLOSE) {
+        return 0;
+    }
+    if(rec->event != CAPTURE_PACKET ||
+            fread(&rec->hdr, sizeof(JEUX_PACKET_HEADER), 1, in) != 1) {
+        return -1;
+    }
+    size_t size = ntohs(rec->hdr.size);
+    if(size == 0) {
+        return 0;
+    }
+    rec->payload = malloc(size);
+    if(rec->payload == NULL) {
+        return -1;
+    }
+    if(fread(rec->payload, 1, size, in) != size) {
+        free(rec->payload);
+        rec->payload = NULL;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "census.h"
+
+struct census_gauge {
+    _Atomic int64_t live;
+    _Atomic int64_t peak;
+    _Atomic uint64_t total;
+} __attribute__((aligned(64)));
+
+static struct census_gauge objects[CENSUS_NOBJECTS];
+static struct census_gauge mems[CENSUS_NMEMS];
+
+static char *object_names[CENSUS_NOBJECTS] = {
+    [CENSUS_CLIENT] = "client",
+    [CENSUS_PLAYER] = "player",
+    [CENSUS_INVITATION] = "invitation",
+    [CENSUS_GAME] = "game",
+    [CENSUS_GAME_MOVE] = "game_move",
+    [CENSUS_PAYLOAD] = "payload",
+};
+
+static char *mem_names[CENSUS_NMEMS] = {
+    [CENSUS_MEM_CLIENT] = "client",
+    [CENSUS_MEM_CLIENT_INVITATIONS] = "client_invitations",
+    [CENSUS_MEM_PLAYER] = "player",
+    [CENSUS_MEM_PLAYER_NAMES] = "player_names",
+    [CENSUS_MEM_INVITATION] = "invitation",
+    [CENSUS_MEM_GAME] = "game",
+    [CENSUS_MEM_GAME_MOVE] = "game_move",
+    [CENSUS_MEM_PAYLOAD] = "payload",
+};
+
+static void gauge_add(struct census_gauge *g, int64_t delta) {
+    int64_t live = atomic_fetch_add_explicit(&g->live, delta, memory_order_relaxed) + delta;
+    if(delta <= 0) {
+        return;
+    }
+    atomic_fetch_add_explicit(&g->total, delta, memory_order_relaxed);
+    int64_t peak = atomic_load_explicit(&g->peak, memory_order_relaxed);
+    while(live > peak &&
+            !atomic_compare_exchange_weak_explicit(&g->peak, &peak, live,
+                memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+void census_create(CENSUS_OBJECT object, CENSUS_MEM mem, size_t bytes) {
+    gauge_add(&objects[object], 1);
+    gauge_add(&mems[mem], bytes);
+}
+
+void census_free(CENSUS_OBJECT object, CENSUS_MEM mem, size_t bytes) {
+    gauge_add(&objects[object], -1);
+    gauge_add(&mems[mem], -(int64_t)bytes);
+}
+
+void census_bytes(CENSUS_MEM mem, int64_t delta) {
+    gauge_add(&mems[mem], delta);
+}
+
+void census_read(CENSUS_OBJECT object, CENSUS_COUNTS *counts) {
+    counts->live = atomic_load_explicit(&objects[object].live, memory_order_relaxed);
+    counts->peak = atomic_load_explicit(&objects[object].peak, memory_order_relaxed);
+    counts->total = atomic_load_explicit(&objects[object].total, memory_order_relaxed);
+}
+
+void census_read_bytes(CENSUS_MEM mem, int64_t *live, int64_t *peak) {
+    *live = atomic_load_explicit(&mems[mem].live, memory_order_relaxed);
+    *peak = atomic_load_explicit(&mems[mem].peak, memory_order_relaxed);
+}
+
+void census_write(FILE *out) {
+    for(int o = 0; o < CENSUS_NOBJECTS; o++) {
+        CENSUS_COUNTS counts;
+        census_read(o, &counts);
+        fprintf(out, "census_%s_live\t%ld\n", object_names[o], counts.live);
+        fprintf(out, "census_%s_peak\t%ld\n", object_names[o], counts.peak);
+        fprintf(out, "census_%s_total\t%lu\n", object_names[o], counts.total);
+    }
+    for(int m = 0; m < CENSUS_NMEMS; m++) {
+        int64_t live, peak;
+        census_read_bytes(m, &live, &peak);
+        fprintf(out, "mem_%s_bytes\t%ld\n", mem_names[m], live);
+        fprintf(out, "mem_%s_peak_bytes\t%ld\n", mem_names[m], peak);
+    }
+}
+
+int census_check_empty(FILE *out) {
+    int status = 0;
+    for(int o = 0; o < CENSUS_NOBJECTS; o++) {
+        CENSUS_COUNTS counts;
+        census_read(o, &counts);
+        if(counts.live != 0) {
+            fprintf(out, "census: %ld %s objects still live\n", counts.live, object_names[o]);
+            status = -1;
+        }
+    }
+    for(int m = 0; m < CENSUS_NMEMS; m++) {
+        int64_t live, peak;
+        census_read_bytes(m, &live, &peak);
+        if(live != 0) {
+            fprintf(out, "census: %ld bytes of %s memory still live\n", live, mem_names[m]);
+            status = -1;
+        }
+    }
+    return status;
+}
+
+int64_t census_rss_bytes(pid_t pid) {
+    char path[64];
+    if(pid == 0) {
+        snprintf(path, sizeof(path), "/proc/self/statm");
+    } else {
+        snprintf(path, sizeof(path), "/proc/%d/statm", pid);
+    }
+    FILE *f = fopen(path, "r");
+    if(f == NULL) {
+        return -1;
+    }
+    long size, resident;
+    int n = fscanf(f, "%ld %ld", &size, &resident);
+    fclose(f);
+    if(n != 2) {
+        return -1;
+    }
+    return (int64_t)resident * sysconf(_SC_PAGESIZE);
+}
@@ -4,14 +4,26 @@
 
 #include "jeux_globals.h"
 #include "client.h"
+#include "client_ext.h"
 #include "debug.h"
+#include "lock_prof.h"
+#include "flight.h"
 #include "packet_common.h"
+#include "rating_queue.h"
+#include "metrics.h"
+#include "census.h"
+#include "game_ext.h"
+#include "probes.h"
+#include "watchdog.h"
 
 struct client {
     pthread_mutex_t player_mutex;
     PLAYER *player; /* if null then is logged out*/
     pthread_mutex_t fd_mutex;
     int fd;
+    int has_fd;             /* if zero then fd is only a connection number */
+    CLIENT_SEND_FN send;    /* if null then packets are written to fd */
+    void *send_arg;
     struct invitation_lst_t {
         INVITATION **lst; 
         pthread_mutex_t inv_mutex;
@@ -46,12 +58,27 @@ static int search_inv_lst_safe(CLIENT *cli, INVITATION *inv) {
     if(cli == NULL) {
         return -1;
     }
-    pthread_mutex_lock(&cli->invs.inv_mutex);
+    lprof_lock(&cli->invs.inv_mutex, LOCK_SITE_CLIENT_INV);
     int id = search_inv_lst(cli, inv);
-    pthread_mutex_unlock(&cli->invs.inv_mutex);
+    lprof_unlock(&cli->invs.inv_mutex);
     return id;
 }
 
+/*
+ * Look up an invitation by ID, taking a reference to it before the list
+ * lock is dropped so that a concurrent removal cannot free it under us.
+ * Returns NULL if the ID is out of range or unused.
+ */
+static INVITATION *get_inv_safe(CLIENT *cli, int id, char *why) {
+    INVITATION *inv = NULL;
+    lprof_lock(&cli->invs.inv_mutex, LOCK_SITE_CLIENT_INV);
+    if(cli->invs.lst != NULL && id >= 0 && id < cli->invs.cap && cli->invs.lst[id] != NULL) {
+        inv = inv_ref(cli->invs.lst[id], why);
+    }
+    lprof_unlock(&cli->invs.inv_mutex);
+    return inv;
+}
+
 static int insert_into_inv_lst(CLIENT *cli, INVITATION *inv) {
     if(cli == NULL) {
         return -1;
@@ -99,9 +126,9 @@ static void destroy_inv_lst_safe(CLIENT *cli) {
     if(cli == NULL) {
         return;
     }
-    pthread_mutex_lock(&cli->invs.inv_mutex);
+    lprof_lock(&cli->invs.inv_mutex, LOCK_SITE_CLIENT_INV);
     if(cli->invs.lst == NULL) {
-        pthread_mutex_unlock(&cli->invs.inv_mutex);
+        lprof_unlock(&cli->invs.inv_mutex);
         return;
     }
     for(int idx = 0; idx < cli->invs.cap; idx++) {
@@ -110,15 +137,16 @@ static void destroy_inv_lst_safe(CLIENT *cli) {
         }
     }
     free(cli->invs.lst);
+    census_bytes(CENSUS_MEM_CLIENT_INVITATIONS, -(int64_t)(cli->invs.cap * sizeof(INVITATION *)));
     cli->invs.lst = NULL;
-    pthread_mutex_unlock(&cli->invs.inv_mutex);
+    lprof_unlock(&cli->invs.inv_mutex);
     pthread_mutex_destroy(&cli->invs.inv_mutex);
 }
 
 static void client_set_player_safe(CLIENT *cli, PLAYER *player) {
-    pthread_mutex_lock(&cli->player_mutex);
+    lprof_lock(&cli->player_mutex, LOCK_SITE_CLIENT_PLAYER);
     cli->player = player;
-    pthread_mutex_unlock(&cli->player_mutex);
+    lprof_unlock(&cli->player_mutex);
 }
 
 CLIENT *client_create(CLIENT_REGISTRY *creg, int fd) {
@@ -130,6 +158,9 @@ CLIENT *client_create(CLIENT_REGISTRY *creg, int fd) {
 
     cli->player = NULL; 
     cli->fd = fd;
+    cli->has_fd = 1;
+    cli->send = NULL;
+    cli->send_arg = NULL;
     cli->invs.lst = calloc((MAX_CLIENTS * 128), sizeof(INVITATION *));
     if(cli->invs.lst == NULL) {
         free(cli);
@@ -150,7 +181,11 @@ CLIENT *client_create(CLIENT_REGISTRY *creg, int fd) {
     pthread_mutex_init(&cli->mutex, NULL);
     pthread_mutex_init(&cli->player_mutex, NULL);
     pthread_mutex_init(&cli->fd_mutex, NULL);
+    metrics_count(METRIC_ACTIVE_CLIENTS, 1);
+    census_create(CENSUS_CLIENT, CENSUS_MEM_CLIENT, sizeof(CLIENT));
+    census_bytes(CENSUS_MEM_CLIENT_INVITATIONS, cli->invs.cap * sizeof(INVITATION *));
 
+    flight_record(FLIGHT_CLIENT, FLIGHT_CREATE, cli, NULL, 0);
     return client_ref(cli, "for newly created client");
 }
 
@@ -158,12 +193,13 @@ CLIENT *client_ref(CLIENT *client, char *why) {
     if(client == NULL) {
         return NULL;
     }
-    pthread_mutex_lock(&client->mutex);
+    lprof_lock(&client->mutex, LOCK_SITE_CLIENT);
     size_t old_ref = client->ref_count;
     client->ref_count = old_ref + 1;
 
     debug("%ld: Increase reference count on client %p (%lu -> %lu) %s", pthread_self(), client, old_ref, client->ref_count, why); 
-    pthread_mutex_unlock(&client->mutex);
+    flight_record(FLIGHT_CLIENT, FLIGHT_REF, client, why, client->ref_count);
+    lprof_unlock(&client->mutex);
 
     return client;
 }
@@ -173,28 +209,32 @@ void client_unref(CLIENT *client, char *why) {
         debug("%ld: Invalid client object!", pthread_self());
         return;
     }
-    pthread_mutex_lock(&client->mutex);
+    lprof_lock(&client->mutex, LOCK_SITE_CLIENT);
 
     size_t old_ref = client->ref_count;
     client->ref_count = old_ref - 1;
 
     debug("%ld: Decrease reference count on client %p (%lu -> %lu) %s", pthread_self(), client, old_ref, client->ref_count, why); 
+    flight_record(FLIGHT_CLIENT, FLIGHT_UNREF, client, why, client->ref_count);
 
     if(client->ref_count == 0) {
         destroy_inv_lst_safe(client);
 
-        pthread_mutex_unlock(&client->mutex);
+        lprof_unlock(&client->mutex);
         pthread_mutex_destroy(&client->mutex);
         pthread_mutex_destroy(&client->fd_mutex);
         client_set_player_safe(client, NULL);
         pthread_mutex_destroy(&client->player_mutex);
 
 
-        free(client);
+        flight_record(FLIGHT_CLIENT, FLIGHT_FREE, client, why, 0);
         debug("%ld: Free client %p", pthread_self(), client);
+        free(client);
+        metrics_count(METRIC_ACTIVE_CLIENTS, -1);
+        census_free(CENSUS_CLIENT, CENSUS_MEM_CLIENT, sizeof(CLIENT));
         return;
     }
-    pthread_mutex_unlock(&client->mutex);
+    lprof_unlock(&client->mutex);
 }
 
 int client_login(CLIENT *client, PLAYER *player) {
@@ -247,9 +287,9 @@ PLAYER *client_get_player(CLIENT *client) {
     if(client == NULL) {
         return NULL;
     }
-    pthread_mutex_lock(&client->player_mutex);
+    lprof_lock(&client->player_mutex, LOCK_SITE_CLIENT_PLAYER);
     PLAYER *ret = client->player;
-    pthread_mutex_unlock(&client->player_mutex);
+    lprof_unlock(&client->player_mutex);
     return ret;
 }
 
@@ -257,6 +297,21 @@ int client_get_fd(CLIENT *client) {
     return client->fd;
 }
 
+void client_set_no_fd(CLIENT *client) {
+    client->has_fd = 0;
+}
+
+int client_has_fd(CLIENT *client) {
+    return client->has_fd;
+}
+
+void client_set_transport(CLIENT *client, CLIENT_SEND_FN send, void *arg) {
+    lprof_lock(&client->fd_mutex, LOCK_SITE_CLIENT_FD);
+    client->send = send;
+    client->send_arg = arg;
+    lprof_unlock(&client->fd_mutex);
+}
+
 int client_send_packet(CLIENT *player, JEUX_PACKET_HEADER *pkt, void *data) {
     if(player == NULL) {
         return -1;
@@ -264,11 +319,20 @@ int client_send_packet(CLIENT *player, JEUX_PACKET_HEADER *pkt, void *data) {
     if(pkt == NULL) {
         return -1;
     }
-    pthread_mutex_lock(&player->fd_mutex);
+    lprof_lock(&player->fd_mutex, LOCK_SITE_CLIENT_FD);
     int fd = player->fd;
-    int status = proto_send_packet(fd, pkt, data);
-    pthread_mutex_unlock(&player->fd_mutex);
-
+    watchdog_wait(WATCHDOG_WAIT_SEND, fd);
+    int status = player->send != NULL ? player->send(player->send_arg, pkt, data)
+                                      : proto_send_packet(fd, pkt, data);
+    watchdog_wait(WATCHDOG_WAIT_NONE, 0);
+    lprof_unlock(&player->fd_mutex);
+    TRACE_JEUX_CLIENT_SEND(fd, pkt->type, pkt->id, ntohs(pkt->size), status);
+
+    uint64_t request_ns = metrics_request_time();
+    if(status == 0 && request_ns != 0 &&
+            pkt->type >= JEUX_INVITED_PKT && pkt->type <= JEUX_ENDED_PKT) {
+        metrics_record_latency(METRIC_LATENCY_FANOUT, pkt->type, metrics_now_ns() - request_ns);
+    }
     return status;
 }
 
@@ -294,9 +358,9 @@ int client_add_invitation(CLIENT *client, INVITATION *inv) {
     if(client == NULL) {
         return -1;
     }
-    pthread_mutex_lock(&client->invs.inv_mutex);
+    lprof_lock(&client->invs.inv_mutex, LOCK_SITE_CLIENT_INV);
     int id = insert_into_inv_lst(client, inv);
-    pthread_mutex_unlock(&client->invs.inv_mutex);
+    lprof_unlock(&client->invs.inv_mutex);
 
     return id;
 }
@@ -305,9 +369,9 @@ int client_remove_invitation(CLIENT *client, INVITATION *inv) {
     if(client == NULL) {
         return -1;
     }
-    pthread_mutex_lock(&client->invs.inv_mutex);
+    lprof_lock(&client->invs.inv_mutex, LOCK_SITE_CLIENT_INV);
     int id = remove_from_inv_lst(client, inv);
-    pthread_mutex_unlock(&client->invs.inv_mutex);
+    lprof_unlock(&client->invs.inv_mutex);
     return id;
 }
 
@@ -317,16 +381,28 @@ int client_make_invitation(CLIENT *source, CLIENT *target, GAME_ROLE source_role
     if(new_inv == NULL) {
         return -1;
     }
-    int src_id, dst_id;
-    src_id = client_add_invitation(source, new_inv);
-    if(src_id == -1) {
-        inv_unref(new_inv, "because source invitation failed.");
-        return src_id;
+    /*
+     * Add to both lists under both locks, taken in address order, so that a
+     * revoke or decline cannot find the invitation in one list and not yet
+     * in the other, which would leave it closed but still listed.
+     */
+    CLIENT *first = source < target ? source : target;
+    CLIENT *second = source < target ? target : source;
+    lprof_lock(&first->invs.inv_mutex, LOCK_SITE_CLIENT_INV);
+    lprof_lock(&second->invs.inv_mutex, LOCK_SITE_CLIENT_INV);
+    int src_id, dst_id = -1;
+    src_id = insert_into_inv_lst(source, new_inv);
+    if(src_id != -1) {
+        dst_id = insert_into_inv_lst(target, new_inv);
+        if(dst_id == -1) {
+            remove_from_inv_lst(source, new_inv);
+        }
     }
-    dst_id = client_add_invitation(target, new_inv);
-    if(dst_id == -1) {
-        inv_unref(new_inv, "because target invitation failed.");
-        return client_remove_invitation(source, new_inv);
+    lprof_unlock(&second->invs.inv_mutex);
+    lprof_unlock(&first->invs.inv_mutex);
+    if(src_id == -1 || dst_id == -1) {
+        inv_unref(new_inv, "because adding invitation to lists failed.");
+        return -1;
     }
     inv_unref(new_inv, "because pointer to invite is being discarded in function");
 
@@ -347,13 +423,10 @@ int client_revoke_invitation(CLIENT *client, int id) {
     if(client == NULL) {
         return -1;
     }
-    pthread_mutex_lock(&client->invs.inv_mutex);
-    INVITATION *inv = client->invs.lst[id];
-    pthread_mutex_unlock(&client->invs.inv_mutex);
+    INVITATION *inv = get_inv_safe(client, id, "because being indexed by revoker");
     if(inv == NULL) {
         return -1;
     }
-    inv_ref(inv, "because being indexed by revoker");
     if(client != inv_get_source(inv)) {
         debug("%ld: ERROR- Source role is not equivalent to client", pthread_self());
         inv_unref(inv, "because pointer is being discarded by revoker");
@@ -393,13 +466,10 @@ int client_decline_invitation(CLIENT *client, int id) {
     if(client == NULL) {
         return -1;
     }
-    pthread_mutex_lock(&client->invs.inv_mutex);
-    INVITATION *inv = client->invs.lst[id];
-    pthread_mutex_unlock(&client->invs.inv_mutex);
+    INVITATION *inv = get_inv_safe(client, id, "because being indexed by decliner");
     if(inv == NULL) {
         return -1;
     }
-    inv_ref(inv, "because being indexed by decliner");
     if(client != inv_get_target(inv)) {
         debug("%ld: ERROR- Target role is not equivalent to client", pthread_self());
         inv_unref(inv, "because pointer is being discarded by decliner");
@@ -440,16 +510,25 @@ int client_decline_invitation(CLIENT *client, int id) {
 }
 
 int client_accept_invitation(CLIENT *client, int id, char **strp) {
-    if(client == NULL) {
+    char state[GAME_STATE_SIZE];
+    if(client_accept_invitation_into(client, id, state, sizeof(state)) == -1) {
+        return -1;
+    }
+    if(state[0] != '\0' && (*strp = strdup(state)) == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+int client_accept_invitation_into(CLIENT *client, int id, char *state, size_t size) {
+    if(client == NULL || size < GAME_STATE_SIZE) {
         return -1;
     }
-    pthread_mutex_lock(&client->invs.inv_mutex);
-    INVITATION *inv = client->invs.lst[id];
-    pthread_mutex_unlock(&client->invs.inv_mutex);
+    state[0] = '\0';
+    INVITATION *inv = get_inv_safe(client, id, "because being indexed by accepter");
     if(inv == NULL) {
         return -1;
     }
-    inv_ref(inv, "because being indexed by accepter");
     if(client != inv_get_target(inv)) {
         debug("%ld: ERROR- Target role is not equivalent to client", pthread_self());
         inv_unref(inv, "because pointer is being discarded by accepter");
@@ -467,8 +546,9 @@ int client_accept_invitation(CLIENT *client, int id, char **strp) {
         return -1;
     }
     GAME_ROLE src_role = inv_get_source_role(inv);
-    size_t datalen = 0;
-    char *str_to_send = NULL;
+    /* the state goes to whoever moves first: the source in ACCEPTED, or the accepter in its ACK */
+    char src_state[GAME_STATE_SIZE];
+    char *str_to_send = src_role == FIRST_PLAYER_ROLE ? src_state : state;
 
     GAME *game = game_ref(inv_get_game(inv), "because need to unparse state");
     if(game == NULL) {
@@ -476,29 +556,23 @@ int client_accept_invitation(CLIENT *client, int id, char **strp) {
         inv_unref(inv, "because pointer is being discarded by accepter");
         return -1;
     }
+    int len = game_unparse_state_into(game, str_to_send, GAME_STATE_SIZE);
+    game_unref(game, "because game needs to be dereferenced by accepter");
+    if(len == -1) {
+        state[0] = '\0';
+        client_unref(client_src, "because source needs to be unrefed");
+        inv_unref(inv, "because pointer is being discarded by accepter");
+        return -1;
+    }
+    size_t datalen = 0;
     if(src_role == FIRST_PLAYER_ROLE) {
-        str_to_send = game_unparse_state(game); 
-        game_unref(game, "because game needs to be dereferenced by accepter");
-        if(str_to_send == NULL) {
-            client_unref(client_src, "because source needs to be unrefed");
-            inv_unref(inv, "because pointer is being discarded by accepter");
-            return -1;
-        }
-        datalen = strlen(str_to_send);
+        datalen = len;
     } else {
-        *strp = game_unparse_state(game);
-        game_unref(game, "because game needs to be dereferenced by accepter");
-        if(*strp == NULL) {
-            client_unref(client_src, "because source needs to be unrefed");
-            inv_unref(inv, "because pointer is being discarded by accepter");
-            return -1;
-        }
+        str_to_send = NULL;
     }
     int src_id = search_inv_lst_safe(client_src, inv);
     if(src_id == -1) {
-        if(str_to_send != NULL) {
-            free(str_to_send);
-        }
+        state[0] = '\0';
         client_unref(client_src, "because source needs to be unrefed");
         inv_unref(inv, "because pointer is being discarded by accepter");
         return -1;
@@ -507,9 +581,6 @@ int client_accept_invitation(CLIENT *client, int id, char **strp) {
     JEUX_PACKET_HEADER jph = {0};
     pack_header(&jph, JEUX_ACCEPTED_PKT, src_id, src_role, datalen);
     int status_ret = client_send_packet(client_src, &jph, str_to_send);  
-    if(str_to_send != NULL) {
-        free(str_to_send);
-    }
     client_unref(client_src, "because source needs to be unrefed");
     return status_ret;
 }
@@ -519,13 +590,10 @@ int client_resign_game(CLIENT *client, int id) {
         debug("%ld: ERROR- Client Source Failed To Reference", pthread_self());
         return -1;
     }
-    pthread_mutex_lock(&client->invs.inv_mutex);
-    INVITATION *inv = client->invs.lst[id];
-    pthread_mutex_unlock(&client->invs.inv_mutex);
+    INVITATION *inv = get_inv_safe(client, id, "because pointer is being indexed by resigner");
     if(inv == NULL) {
         return -1;
     }
-    inv_ref(inv, "because pointer is being indexed by resigner");
 
     if(inv_get_source(inv) == client) {
         if(inv_close(inv, inv_get_source_role(inv)) == -1) {
@@ -584,7 +652,7 @@ int client_resign_game(CLIENT *client, int id) {
             p1 = client_get_player(inv_get_target(inv));
             p2 = client_get_player(inv_get_source(inv));
         }
-        player_post_result(p1, p2, game_get_winner(inv_get_game(inv)));
+        rq_post_result(rating_queue, p1, p2, game_get_winner(inv_get_game(inv)));
 
         client_unref(cli_target, "because target being discarded by resigner");
         inv_unref(inv, "because pointer is being discarded by resigner");
@@ -649,7 +717,7 @@ int client_resign_game(CLIENT *client, int id) {
             p1 = client_get_player(inv_get_source(inv));
             p2 = client_get_player(inv_get_target(inv));
         }
-        player_post_result(p1, p2, game_get_winner(inv_get_game(inv)));
+        rq_post_result(rating_queue, p1, p2, game_get_winner(inv_get_game(inv)));
 
         client_unref(cli_source, "because target being discarded by resigner");
         inv_unref(inv, "because pointer is being discarded by resigner");
@@ -665,15 +733,11 @@ int client_make_move(CLIENT *client, int id, char *move) {
     if(client == NULL) {
         return -1;
     }
-    pthread_mutex_lock(&client->invs.inv_mutex);
-    INVITATION *inv = client->invs.lst[id];
-    // must unref
-    pthread_mutex_unlock(&client->invs.inv_mutex);
+    INVITATION *inv = get_inv_safe(client, id, "because pointer is being indexed by mover");
     if(inv == NULL) {
         debug("%ld: ERROR- Invite could not be found", pthread_self());
         return -1;
     }
-    inv_ref(inv, "because pointer is being indexed by mover");
     GAME *game = inv_get_game(inv);
     // must unref 
 
@@ -702,22 +766,12 @@ int client_make_move(CLIENT *client, int id, char *move) {
     if(inv_get_target(inv) == client) {
         gr = inv_get_target_role(inv);
     }
-    GAME_MOVE *gm = game_parse_move(game, gr, move);
-    // must be freed
-    if(gm == NULL) {
-        inv_unref(inv, "because invite is being discarded by mover");
-        game_unref(game, "because game is being discarded by mover");
-        debug("%ld: ERROR- GAME MOVE could not be parsed", pthread_self());
-        return -1;
-    }
-    if(game_apply_move(game, gm) == -1) {
-        free(gm);
+    if(game_play_move(game, gr, move) == -1) {
         inv_unref(inv, "because invite is being discarded by mover");
         game_unref(game, "because game is being discarded by mover");
-        debug("%ld: ERROR- GAME MOVE was INVALID", pthread_self());
+        debug("%ld: ERROR- GAME MOVE could not be parsed or was INVALID", pthread_self());
         return -1;
     }
-    free(gm);
 
     CLIENT *client_opponent = NULL;
     client_opponent = inv_get_source(inv) == client ? inv_get_target(inv) : inv_get_source(inv);
@@ -742,15 +796,15 @@ int client_make_move(CLIENT *client, int id, char *move) {
         return -1;
     }
 
-    char *cur_game_state = game_unparse_state(game);
+    char cur_game_state[GAME_STATE_SIZE];
+    int state_len = game_unparse_state_into(game, cur_game_state, sizeof(cur_game_state));
     JEUX_PACKET_HEADER jph = {0};
     pack_header(&jph, 
             JEUX_MOVED_PKT, 
             inv_id,
             0, 
-            strlen(cur_game_state));
-    client_send_packet(client_opponent, &jph, cur_game_state);
-    free(cur_game_state);
+            state_len > 0 ? state_len : 0);
+    client_send_packet(client_opponent, &jph, state_len > 0 ? cur_game_state : NULL);
 
 
     if(game_is_over(game)) {
@@ -781,9 +835,9 @@ int client_make_move(CLIENT *client, int id, char *move) {
 
         // gr refers to client role
         if(gr == FIRST_PLAYER_ROLE) {
-            player_post_result(client_player, client_opponent_player, game_get_winner(game));
+            rq_post_result(rating_queue, client_player, client_opponent_player, game_get_winner(game));
         } else if(gr == SECOND_PLAYER_ROLE) {
-            player_post_result(client_opponent_player, client_player, game_get_winner(game));
+            rq_post_result(rating_queue, client_opponent_player, client_player, game_get_winner(game));
         }
         player_unref(client_player, "because pointer being discarded by mover");
         player_unref(client_opponent_player, "because pointer being discarded by mover");
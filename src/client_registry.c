@@ -6,8 +6,11 @@
 #include <sys/socket.h>
 
 #include "client_registry.h"
+#include "client_registry_ext.h"
+#include "client_ext.h"
 #include "jeux_globals.h"
 #include "debug.h"
+#include "lock_prof.h"
 
 struct client_registry {
     CLIENT *creg_arr[MAX_CLIENTS];
@@ -43,8 +46,12 @@ void creg_fini(CLIENT_REGISTRY *cr) {
     free(cr);
 }
 
-CLIENT *creg_register(CLIENT_REGISTRY *cr, int fd) {
-    pthread_mutex_lock(&cr->mutex);
+/*
+ * Register a new client, given a transport if send is not NULL, in which
+ * case fd is only a connection number.
+ */
+static CLIENT *register_client(CLIENT_REGISTRY *cr, int fd, CLIENT_SEND_FN send, void *arg) {
+    lprof_lock(&cr->mutex, LOCK_SITE_CREG);
 
     const size_t cap_sz = cr->cap;
     size_t idx = -1;
@@ -55,25 +62,40 @@ CLIENT *creg_register(CLIENT_REGISTRY *cr, int fd) {
         }
     }
     if(idx == -1) {
-        pthread_mutex_unlock(&cr->mutex);
+        lprof_unlock(&cr->mutex);
         return NULL;
     }
     cr->creg_arr[idx] = client_create(cr, fd);
     if(cr->creg_arr[idx] == NULL) {
-        pthread_mutex_unlock(&cr->mutex);
+        lprof_unlock(&cr->mutex);
         return NULL;
     }
+    if(send != NULL) {
+        client_set_no_fd(cr->creg_arr[idx]);
+        client_set_transport(cr->creg_arr[idx], send, arg);
+    }
     if(cr->len == 0) {
         sem_wait(&cr->count_sem);
     }
     ++cr->len;
     debug("Register client fd %d (total connected: %lu)", fd, cr->len);
-    pthread_mutex_unlock(&cr->mutex);
+    lprof_unlock(&cr->mutex);
     return cr->creg_arr[idx];
 }
 
+CLIENT *creg_register(CLIENT_REGISTRY *cr, int fd) {
+    return register_client(cr, fd, NULL, NULL);
+}
+
+CLIENT *creg_register_transport(CLIENT_REGISTRY *cr, int conn, CLIENT_SEND_FN send, void *arg) {
+    if(send == NULL) {
+        return NULL;
+    }
+    return register_client(cr, conn, send, arg);
+}
+
 int creg_unregister(CLIENT_REGISTRY *cr, CLIENT *client) {
-    pthread_mutex_lock(&cr->mutex);
+    lprof_lock(&cr->mutex, LOCK_SITE_CREG);
     const size_t cap_sz = cr->cap;
     size_t idx = -1;
     for(size_t reg_idx = 0; reg_idx < cap_sz; ++reg_idx) {
@@ -83,12 +105,14 @@ int creg_unregister(CLIENT_REGISTRY *cr, CLIENT *client) {
         }
     }
     if(idx == -1) {
-        pthread_mutex_unlock(&cr->mutex);
+        lprof_unlock(&cr->mutex);
         return -1;
     }
 
     int fd = client_get_fd(client);
-    close(fd);
+    if(client_has_fd(client)) {
+        close(fd);
+    }
     client_unref(cr->creg_arr[idx], "unregistered");
     cr->creg_arr[idx] = NULL;
     --cr->len;
@@ -97,12 +121,12 @@ int creg_unregister(CLIENT_REGISTRY *cr, CLIENT *client) {
     }
     debug("Unregister client fd %d (total connected: %lu)", fd, cr->len);
 
-    pthread_mutex_unlock(&cr->mutex);
+    lprof_unlock(&cr->mutex);
     return 0;
 }
 
 CLIENT *creg_lookup(CLIENT_REGISTRY *cr, char *user) {
-    pthread_mutex_lock(&cr->mutex);
+    lprof_lock(&cr->mutex, LOCK_SITE_CREG);
 
     size_t cap_sz = cr->cap;
     CLIENT *ret = NULL;
@@ -122,12 +146,12 @@ CLIENT *creg_lookup(CLIENT_REGISTRY *cr, char *user) {
             }
         }
     }
-    pthread_mutex_unlock(&cr->mutex);
+    lprof_unlock(&cr->mutex);
     return ret;
 }
 
 PLAYER **creg_all_players(CLIENT_REGISTRY *cr) {
-    pthread_mutex_lock(&cr->mutex);
+    lprof_lock(&cr->mutex, LOCK_SITE_CREG);
 
     PLAYER **p = NULL;
     size_t cap_sz = cr->cap;
@@ -150,10 +174,25 @@ PLAYER **creg_all_players(CLIENT_REGISTRY *cr) {
             }
         }
     }
-    pthread_mutex_unlock(&cr->mutex);
+    lprof_unlock(&cr->mutex);
     return p;
 }
 
+void creg_foreach_player(CLIENT_REGISTRY *cr, void (*fn)(PLAYER *player, void *arg), void *arg) {
+    lprof_lock(&cr->mutex, LOCK_SITE_CREG);
+    for(size_t idx = 0; idx < cr->cap; idx++) {
+        if(cr->creg_arr[idx] != NULL) {
+            PLAYER *player = client_get_player(cr->creg_arr[idx]);
+            if(player != NULL) {
+                player_ref(player, "for player being passed to creg_foreach_player()");
+                fn(player, arg);
+                player_unref(player, "for player passed to creg_foreach_player()");
+            }
+        }
+    }
+    lprof_unlock(&cr->mutex);
+}
+
 void creg_wait_for_empty(CLIENT_REGISTRY *cr) { 
     if(cr == NULL) {
         return;
@@ -167,10 +206,10 @@ void creg_shutdown_all(CLIENT_REGISTRY *cr) {
     if(cr == NULL) {
         return;
     }
-    pthread_mutex_lock(&cr->mutex);
+    lprof_lock(&cr->mutex, LOCK_SITE_CREG);
     size_t cap_sz = cr->cap;
     for(size_t idx = 0; idx < cap_sz; idx++) {
-        if(cr->creg_arr[idx] != NULL) {
+        if(cr->creg_arr[idx] != NULL && client_has_fd(cr->creg_arr[idx])) {
             int fd = client_get_fd(cr->creg_arr[idx]);
             debug("%ld: Shutting down fd %d", pthread_self(), fd);
             shutdown(fd, SHUT_RD);
@@ -178,5 +217,5 @@ void creg_shutdown_all(CLIENT_REGISTRY *cr) {
     }
     // TODO might potentially need some kind of flag or signal or smth 
     // to ensure creg_registers don't actually run
-    pthread_mutex_unlock(&cr->mutex);
+    lprof_unlock(&cr->mutex);
 }
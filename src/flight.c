@@ -0,0 +1,213 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <limits.h>
+
+#include "flight.h"
+#include "metrics.h"
+#include "debug.h"
+
+/* Most distinct reason strings a dump can carry. */
+#define FLIGHT_MAX_STRINGS 1024
+
+struct flight_ring {
+    FLIGHT_EVENT events[FLIGHT_RING_EVENTS];
+    _Atomic uint64_t count;     /* events ever written */
+    atomic_int in_use;          /* owned by a live thread */
+    struct flight_ring *next;
+};
+
+atomic_int flight_enabled = 0;
+
+static struct flight_ring *_Atomic rings = NULL;
+static atomic_uint next_serial = 0;
+static __thread struct flight_ring *my_ring = NULL;
+static __thread uint32_t my_serial;
+
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static char dump_path[PATH_MAX];
+static atomic_int initialized = 0;
+static atomic_flag dumping = ATOMIC_FLAG_INIT;
+static uint64_t dumped_strings[FLIGHT_MAX_STRINGS];
+
+/* Runs at thread exit: hand the ring, events and all, to the next thread. */
+static void release_ring(void *arg) {
+    struct flight_ring *ring = arg;
+    my_ring = NULL;
+    atomic_store(&ring->in_use, 0);
+}
+
+static void make_ring_key(void) {
+    pthread_key_create(&ring_key, release_ring);
+}
+
+static struct flight_ring *claim_ring(void) {
+    pthread_once(&ring_key_once, make_ring_key);
+    struct flight_ring *ring;
+    for(ring = atomic_load(&rings); ring != NULL; ring = ring->next) {
+        int expected = 0;
+        if(atomic_compare_exchange_strong(&ring->in_use, &expected, 1)) {
+            break;
+        }
+    }
+    if(ring == NULL) {
+        ring = calloc(1, sizeof(struct flight_ring));
+        if(ring == NULL) {
+            return NULL;
+        }
+        atomic_init(&ring->in_use, 1);
+        ring->next = atomic_load(&rings);
+        while(!atomic_compare_exchange_weak(&rings, &ring->next, ring))
+            ;
+    }
+    pthread_setspecific(ring_key, ring);
+    my_serial = atomic_fetch_add(&next_serial, 1) + 1;
+    return ring;
+}
+
+void flight_record_slow(FLIGHT_OBJECT object_type, FLIGHT_EVENT_TYPE event_type,
+        void *object, char *why, size_t ref_count) {
+    struct flight_ring *ring = my_ring;
+    if(ring == NULL && (ring = my_ring = claim_ring()) == NULL) {
+        return;
+    }
+    /* this thread is the only writer of its ring */
+    uint64_t n = atomic_load_explicit(&ring->count, memory_order_relaxed);
+    FLIGHT_EVENT *e = &ring->events[n % FLIGHT_RING_EVENTS];
+    e->timestamp_ns = metrics_now_ns();
+    e->object = (uintptr_t)object;
+    e->why = (uintptr_t)why;
+    e->thread = my_serial;
+    e->ref_count = ref_count > UINT16_MAX ? UINT16_MAX : ref_count;
+    e->object_type = object_type;
+    e->event_type = event_type;
+    atomic_store_explicit(&ring->count, n + 1, memory_order_release);
+}
+
+static int write_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while(len > 0) {
+        ssize_t n = write(fd, p, len);
+        if(n == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int write_record(int fd, uint32_t tag, uint64_t value, uint64_t count) {
+    FLIGHT_DUMP_RECORD rec = { .tag = tag, .pad = 0, .value = value, .count = count };
+    return write_all(fd, &rec, sizeof(rec));
+}
+
+/* Returns 1 if the string has not been dumped yet, and marks it dumped. */
+static int first_dump_of(uint64_t why) {
+    size_t slot = (why >> 3) % FLIGHT_MAX_STRINGS;
+    for(size_t i = 0; i < FLIGHT_MAX_STRINGS; i++) {
+        if(dumped_strings[slot] == why) {
+            return 0;
+        }
+        if(dumped_strings[slot] == 0) {
+            dumped_strings[slot] = why;
+            return 1;
+        }
+        slot = (slot + 1) % FLIGHT_MAX_STRINGS;
+    }
+    return 0;
+}
+
+/*
+ * Only async-signal-safe calls are made here.  A slot being overwritten
+ * during the dump is only torn between fields, each of which is stored in
+ * a single aligned write, so every reason address read is that of some
+ * string literal.
+ */
+int flight_dump(void) {
+    if(!atomic_load(&initialized) || atomic_flag_test_and_set(&dumping)) {
+        return -1;
+    }
+    int status = -1;
+    int fd = open(dump_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd == -1) {
+        goto out;
+    }
+    char magic[FLIGHT_DUMP_MAGIC_LEN] = FLIGHT_DUMP_MAGIC;
+    uint32_t header[2] = { FLIGHT_DUMP_VERSION, FLIGHT_RING_EVENTS };
+    if(write_all(fd, magic, sizeof(magic)) == -1 || write_all(fd, header, sizeof(header)) == -1) {
+        goto out_close;
+    }
+    uint64_t index = 0;
+    for(struct flight_ring *ring = atomic_load(&rings); ring != NULL; ring = ring->next) {
+        uint64_t count = atomic_load_explicit(&ring->count, memory_order_acquire);
+        if(write_record(fd, FLIGHT_DUMP_RING, index++, count) == -1 ||
+                write_all(fd, ring->events, sizeof(ring->events)) == -1) {
+            goto out_close;
+        }
+    }
+    memset(dumped_strings, 0, sizeof(dumped_strings));
+    for(struct flight_ring *ring = atomic_load(&rings); ring != NULL; ring = ring->next) {
+        uint64_t count = atomic_load_explicit(&ring->count, memory_order_acquire);
+        uint64_t n = count < FLIGHT_RING_EVENTS ? count : FLIGHT_RING_EVENTS;
+        for(uint64_t i = 0; i < n; i++) {
+            uint64_t why = ring->events[i].why;
+            if(why != 0 && first_dump_of(why)) {
+                size_t len = strlen((char *)(uintptr_t)why);
+                if(write_record(fd, FLIGHT_DUMP_STRING, why, len) == -1 ||
+                        write_all(fd, (char *)(uintptr_t)why, len) == -1) {
+                    goto out_close;
+                }
+            }
+        }
+    }
+    if(write_record(fd, FLIGHT_DUMP_END, 0, 0) == 0) {
+        status = 0;
+    }
+out_close:
+    close(fd);
+out:
+    atomic_flag_clear(&dumping);
+    return status;
+}
+
+static void dump_handler(int sig) {
+    int saved_errno = errno;
+    flight_dump();
+    errno = saved_errno;
+}
+
+int flight_init(char *path) {
+    if(path == NULL || strlen(path) >= sizeof(dump_path)) {
+        return -1;
+    }
+    strcpy(dump_path, path);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = dump_handler;
+    sigemptyset(&sa.sa_mask);
+    /* restart so a dump does not make accept() or read() fail in the server */
+    sa.sa_flags = SA_RESTART;
+    if(sigaction(SIGUSR1, &sa, NULL) == -1) {
+        return -1;
+    }
+    /* abort() raises SIGABRT again with the default action once we return */
+    sa.sa_flags = SA_RESTART | SA_RESETHAND;
+    if(sigaction(SIGABRT, &sa, NULL) == -1) {
+        return -1;
+    }
+    atomic_store(&initialized, 1);
+    atomic_store(&flight_enabled, 1);
+    debug("%ld: Flight recorder dumping to %s", pthread_self(), path);
+    return 0;
+}
@@ -3,11 +3,20 @@
 #include <string.h>
 
 #include "game.h"
+#include "game_ext.h"
+#include "metrics.h"
+#include "census.h"
 #include "debug.h"
+#include "lock_prof.h"
+#include "flight.h"
+#include "probes.h"
 
 #define GAME_RUNNING    0
 #define GAME_TERMINATED 1
 
+/* a GAME and its 5x5 board, as allocated by game_create() */
+#define GAME_BYTES (sizeof(GAME) + 5 * sizeof(char *) + 5 * 6 * sizeof(char *))
+
 struct game {
     pthread_mutex_t board_mutex;
     char **board;
@@ -34,72 +43,109 @@ struct game_move {
 
 // winner setter/getter
 static void set_winner(GAME *game, GAME_ROLE winner) {
-    pthread_mutex_lock(&game->winner_mutex);
+    lprof_lock(&game->winner_mutex, LOCK_SITE_GAME_WINNER);
     game->winner = winner;
-    pthread_mutex_unlock(&game->winner_mutex);
+    lprof_unlock(&game->winner_mutex);
 }
 
 static GAME_ROLE get_winner(GAME *game) {
-    pthread_mutex_lock(&game->winner_mutex);
+    lprof_lock(&game->winner_mutex, LOCK_SITE_GAME_WINNER);
     GAME_ROLE winner = game->winner;
-    pthread_mutex_unlock(&game->winner_mutex);
+    lprof_unlock(&game->winner_mutex);
     return winner;
 }
 
 // game_move setter/getter
 static void set_game_move(GAME *game, GAME_ROLE gr) {
-    pthread_mutex_lock(&game->cur_turn_mutex);
+    lprof_lock(&game->cur_turn_mutex, LOCK_SITE_GAME_TURN);
     game->cur_turn = gr;
-    pthread_mutex_unlock(&game->cur_turn_mutex);
+    lprof_unlock(&game->cur_turn_mutex);
 }
 
 static GAME_ROLE get_game_move(GAME *game) {
-    pthread_mutex_lock(&game->cur_turn_mutex);
+    lprof_lock(&game->cur_turn_mutex, LOCK_SITE_GAME_TURN);
     GAME_ROLE gr = game->cur_turn;
-    pthread_mutex_unlock(&game->cur_turn_mutex);
+    lprof_unlock(&game->cur_turn_mutex);
     return gr;
 }
 
 // game_status setter/getter
 static void set_game_status(GAME *game, int game_status) {
-    pthread_mutex_lock(&game->game_status_mutex);
+    lprof_lock(&game->game_status_mutex, LOCK_SITE_GAME_STATUS);
     game->game_status = game_status;
-    pthread_mutex_unlock(&game->game_status_mutex);
+    lprof_unlock(&game->game_status_mutex);
 }
 
 static int get_game_status(GAME *game) {
-    pthread_mutex_lock(&game->game_status_mutex);
+    lprof_lock(&game->game_status_mutex, LOCK_SITE_GAME_STATUS);
     int gs = game->game_status;
-    pthread_mutex_unlock(&game->game_status_mutex);
+    lprof_unlock(&game->game_status_mutex);
 
     return gs;
 }
 
 
-GAME *game_create() {
-    GAME *new_game = malloc(sizeof(GAME));
-    if(new_game == NULL) {
-        debug("%ld: Initialized game failed.", pthread_self());
+/*
+ * Freed games are kept, boards and all, for game_create() to reuse, so a
+ * server that has warmed up does not allocate to start a game.
+ */
+#define GAME_POOL_MAX 64
+
+static GAME *game_pool[GAME_POOL_MAX];
+static int game_pool_len;
+static pthread_mutex_t game_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static GAME *game_alloc(void) {
+    GAME *game = malloc(sizeof(GAME));
+    if(game == NULL) {
         return NULL;
     }
-    new_game->board = malloc(sizeof(char *) * 5);
-    if(new_game->board == NULL) {
-        free(new_game);
-        debug("%ld: Initialized game failed.", pthread_self());
+    game->board = malloc(sizeof(char *) * 5);
+    if(game->board == NULL) {
+        free(game);
         return NULL;
     }
     for(int i = 0; i < 5; ++i) {
-        new_game->board[i] = calloc(6, sizeof(char *));
-        if(new_game->board[i] == NULL) {
+        game->board[i] = calloc(6, sizeof(char *));
+        if(game->board[i] == NULL) {
             for(int j = i - 1; j >= 0; --j) {
-                free(new_game->board[j]);
+                free(game->board[j]);
             }
-            debug("%ld: Initialized game failed.", pthread_self());
-            free(new_game->board);
-            free(new_game);
+            free(game->board);
+            free(game);
             return NULL;
         }
     }
+    return game;
+}
+
+static void game_release(GAME *game) {
+    for(int i = 0; i < 5; ++i) {
+        free(game->board[i]);
+    }
+    free(game->board);
+    free(game);
+}
+
+void game_pool_drain(void) {
+    pthread_mutex_lock(&game_pool_mutex);
+    while(game_pool_len > 0) {
+        game_release(game_pool[--game_pool_len]);
+    }
+    pthread_mutex_unlock(&game_pool_mutex);
+}
+
+GAME *game_create() {
+    GAME *new_game = NULL;
+    pthread_mutex_lock(&game_pool_mutex);
+    if(game_pool_len > 0) {
+        new_game = game_pool[--game_pool_len];
+    }
+    pthread_mutex_unlock(&game_pool_mutex);
+    if(new_game == NULL && (new_game = game_alloc()) == NULL) {
+        debug("%ld: Initialized game failed.", pthread_self());
+        return NULL;
+    }
     for(int i = 0; i < 5; i++){
         for(int j = 0; j < 5; j++) {
             new_game->board[i][j] = ' ';
@@ -130,7 +176,10 @@ GAME *game_create() {
     pthread_mutex_init(&new_game->winner_mutex, NULL);
 
     new_game->ref_count = 0;
+    metrics_count(METRIC_ACTIVE_GAMES, 1);
+    census_create(CENSUS_GAME, CENSUS_MEM_GAME, GAME_BYTES);
 
+    flight_record(FLIGHT_GAME, FLIGHT_CREATE, new_game, NULL, 0);
     game_ref(new_game, "because new game has been initialized");
 
     return new_game;
@@ -141,13 +190,14 @@ GAME *game_ref(GAME *game, char *why) {
         debug("%ld: Invalid game object!", pthread_self());
         return NULL;
     }
-    pthread_mutex_lock(&game->mutex);
+    lprof_lock(&game->mutex, LOCK_SITE_GAME);
     size_t old_ref = game->ref_count;
     game->ref_count = old_ref + 1;
 
     debug("%ld: Increase reference count on game %p (%lu -> %lu) %s", pthread_self(), game, old_ref, game->ref_count, why); 
+    flight_record(FLIGHT_GAME, FLIGHT_REF, game, why, game->ref_count);
     
-    pthread_mutex_unlock(&game->mutex);
+    lprof_unlock(&game->mutex);
     return game;
 }
 
@@ -157,34 +207,39 @@ void game_unref(GAME *game, char *why) {
         return;
     }
 
-    pthread_mutex_lock(&game->mutex);
+    lprof_lock(&game->mutex, LOCK_SITE_GAME);
     size_t old_ref = game->ref_count;
     game->ref_count = old_ref - 1;
 
     debug("%ld: Decrease reference count on game %p (%lu -> %lu) %s", pthread_self(), game, old_ref, game->ref_count, why); 
+    flight_record(FLIGHT_GAME, FLIGHT_UNREF, game, why, game->ref_count);
     if(game->ref_count == 0) {
-        pthread_mutex_lock(&game->board_mutex);
-        for(int i = 0; i < 5; ++i) {
-            free(game->board[i]);
-            game->board[i] = NULL;
-        }
-        free(game->board);
-        pthread_mutex_unlock(&game->board_mutex);
         pthread_mutex_destroy(&game->board_mutex);
 
-        pthread_mutex_unlock(&game->mutex);
+        lprof_unlock(&game->mutex);
         pthread_mutex_destroy(&game->mutex);
 
         pthread_mutex_destroy(&game->cur_turn_mutex);
         pthread_mutex_destroy(&game->game_status_mutex);
         pthread_mutex_destroy(&game->winner_mutex);
-        free(game);
+        flight_record(FLIGHT_GAME, FLIGHT_FREE, game, why, 0);
         debug("%ld: Free game %p", pthread_self(), game);
+        pthread_mutex_lock(&game_pool_mutex);
+        if(game_pool_len < GAME_POOL_MAX) {
+            game_pool[game_pool_len++] = game;
+            game = NULL;
+        }
+        pthread_mutex_unlock(&game_pool_mutex);
+        if(game != NULL) {
+            game_release(game);
+        }
+        metrics_count(METRIC_ACTIVE_GAMES, -1);
+        census_free(CENSUS_GAME, CENSUS_MEM_GAME, GAME_BYTES);
         return;
     }
 
     
-    pthread_mutex_unlock(&game->mutex);
+    lprof_unlock(&game->mutex);
 }
 
 static int verify_board(GAME *game) {
@@ -245,8 +300,8 @@ static int verify_board(GAME *game) {
     return 0;
 }
 
-static int apply_and_verify_safe(GAME *game, GAME_MOVE *move) {
-    pthread_mutex_lock(&game->board_mutex);
+/* Caller holds board_mutex. */
+static int apply_and_verify(GAME *game, GAME_MOVE *move) {
     int space_exist = 0;
     for(int i = 0; i < 5; i += 2) {
         for(int j = 0; j < 5; j += 2) {
@@ -257,13 +312,11 @@ static int apply_and_verify_safe(GAME *game, GAME_MOVE *move) {
         }
     }
     if(!space_exist) {
-        pthread_mutex_unlock(&game->board_mutex);
         return 33; 
     }
     game->board[move->i_coord][move->j_coord] = move->gr == FIRST_PLAYER_ROLE ? 'X' : 'O'; 
     int ret;
     if((ret = verify_board(game))) {
-        pthread_mutex_unlock(&game->board_mutex);
         return ret;
     }
 
@@ -277,11 +330,9 @@ static int apply_and_verify_safe(GAME *game, GAME_MOVE *move) {
         }
     }
     if(!space_exist) {
-        pthread_mutex_unlock(&game->board_mutex);
         return 33; 
     }
 
-    pthread_mutex_unlock(&game->board_mutex);
     return 0;
 }
 
@@ -289,16 +340,21 @@ int game_apply_move(GAME *game, GAME_MOVE *move) {
     if(move == NULL) {
         return -1;
     }
-    if(game_is_over(game)) {
-        return -1;
-    }
     if(move->gr == NULL_ROLE) {
         return -1;
     }
-    if(game->board[move->i_coord][move->j_coord] != ' ') {
+    /*
+     * The board lock is held from the checks to the status update so that
+     * concurrent moves and resignations see each other's results: only one
+     * move is applied per turn, and only one of them can end the game.
+     */
+    lprof_lock(&game->board_mutex, LOCK_SITE_GAME_BOARD);
+    if(game_is_over(game) || move->gr != get_game_move(game) ||
+            game->board[move->i_coord][move->j_coord] != ' ') {
+        lprof_unlock(&game->board_mutex);
         return -1;
     }
-    int c = apply_and_verify_safe(game, move);
+    int c = apply_and_verify(game, move);
 
     set_game_move(game, FIRST_PLAYER_ROLE == move->gr ? SECOND_PLAYER_ROLE : FIRST_PLAYER_ROLE);
 
@@ -310,6 +366,8 @@ int game_apply_move(GAME *game, GAME_MOVE *move) {
             set_winner(game, SECOND_PLAYER_ROLE);
         }
     }
+    lprof_unlock(&game->board_mutex);
+    TRACE_JEUX_GAME_MOVE(game, move->gr, move->original_num, c != 0);
     return 0;
 }
 
@@ -317,38 +375,43 @@ int game_resign(GAME *game, GAME_ROLE role) {
     if(game == NULL) {
         return -1;
     }
+    lprof_lock(&game->board_mutex, LOCK_SITE_GAME_BOARD);
     if(game_is_over(game)) {
+        lprof_unlock(&game->board_mutex);
         return -1;
     }
     set_game_status(game, GAME_TERMINATED);
     set_winner(game, role == FIRST_PLAYER_ROLE ? SECOND_PLAYER_ROLE : FIRST_PLAYER_ROLE);
+    lprof_unlock(&game->board_mutex);
     return 0;
 }
 
-char *game_unparse_state(GAME *game) {
-    if(game == NULL) {
-        return NULL;
-    }
-    if(game->board == NULL) {
-        return NULL;
+int game_unparse_state_into(GAME *game, char *buf, size_t size) {
+    if(game == NULL || game->board == NULL || size < GAME_STATE_SIZE) {
+        return -1;
     }
-    char *str;
-    size_t sz;
+    int len = 0;
+    lprof_lock(&game->board_mutex, LOCK_SITE_GAME_BOARD);
+    for(int i = 0; i < 5; ++i) {
+        memcpy(buf + len, game->board[i], 6);
+        len += 6;
+    }
+    lprof_unlock(&game->board_mutex);
+    buf[len++] = get_game_move(game) == FIRST_PLAYER_ROLE ? 'X' : 'O';
+    memcpy(buf + len, " to move\n", 10);
+    len += 9;
+    return len;
+}
 
-    FILE *fstream = open_memstream(&str, &sz);
-    if(fstream == NULL) {
+char *game_unparse_state(GAME *game) {
+    char *str = malloc(GAME_STATE_SIZE);
+    if(str == NULL) {
         return NULL;
     }
-    pthread_mutex_lock(&game->board_mutex);
-    for(int i = 0; i < 5; ++i) {
-        for(int j = 0; j < 6; ++j) {
-            fputc(game->board[i][j], fstream);
-        }
+    if(game_unparse_state_into(game, str, GAME_STATE_SIZE) == -1) {
+        free(str);
+        return NULL;
     }
-    pthread_mutex_unlock(&game->board_mutex);
-    fprintf(fstream, "%c to move\n", get_game_move(game) == FIRST_PLAYER_ROLE ? 'X' : 'O');
-    fclose(fstream);
-
     return str;
 }
 
@@ -397,16 +460,28 @@ static int is_valid_move_str(GAME_ROLE cur_role, char *str) {
     }
     return -1;
 }
-GAME_MOVE *game_parse_move(GAME *game, GAME_ROLE role, char *str) {
+static int parse_move(GAME *game, GAME_ROLE role, char *str, GAME_MOVE *gm) {
     if(game == NULL) {
-        return NULL;
+        return -1;
     }
     if(role != NULL_ROLE && role != get_game_move(game)) {
         debug("%ld: Game role turns were not the same!", pthread_self());
-        return NULL;
+        return -1;
     }
     int move = is_valid_move_str(role, str);
     if(move == -1) {
+        return -1;
+    }
+    gm->gr = role;
+    gm->i_coord = ((move - 1) / 3) * 2;
+    gm->j_coord = ((move - 1) % 3) * 2;
+    gm->original_num = move; 
+    return 0;
+}
+
+GAME_MOVE *game_parse_move(GAME *game, GAME_ROLE role, char *str) {
+    GAME_MOVE move;
+    if(parse_move(game, role, str, &move) == -1) {
         return NULL;
     }
     GAME_MOVE *gm = malloc(sizeof(GAME_MOVE));
@@ -414,13 +489,27 @@ GAME_MOVE *game_parse_move(GAME *game, GAME_ROLE role, char *str) {
         debug("%ld: Failed to initialize game move object", pthread_self());
         return NULL;
     }
-    gm->gr = role;
-    gm->i_coord = ((move - 1) / 3) * 2;
-    gm->j_coord = ((move - 1) % 3) * 2;
-    gm->original_num = move; 
+    *gm = move;
+    census_create(CENSUS_GAME_MOVE, CENSUS_MEM_GAME_MOVE, sizeof(GAME_MOVE));
 
     return gm;
 }
+
+int game_play_move(GAME *game, GAME_ROLE role, char *str) {
+    GAME_MOVE move;
+    if(parse_move(game, role, str, &move) == -1) {
+        return -1;
+    }
+    return game_apply_move(game, &move);
+}
+
+void game_free_move(GAME_MOVE *move) {
+    if(move == NULL) {
+        return;
+    }
+    census_free(CENSUS_GAME_MOVE, CENSUS_MEM_GAME_MOVE, sizeof(GAME_MOVE));
+    free(move);
+}
 char *game_unparse_move(GAME_MOVE *move) {
     if(move == NULL) {
         return NULL;
@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "game_log.h"
+#include "debug.h"
+
+GAME_LOG *game_log = NULL;
+
+#define GAME_LOG_MAGIC "JEUXHIST"
+#define GAME_LOG_MAGIC_LEN 8
+
+struct game_log {
+    pthread_mutex_t mutex;
+    FILE *out;
+};
+
+struct game_log_record_header {
+    uint32_t timestamp_sec;
+    uint32_t timestamp_nsec;
+    uint8_t result;
+    uint16_t name1_len;
+    uint16_t name2_len;
+} __attribute__((packed));
+
+static int check_header(FILE *f) {
+    char magic[GAME_LOG_MAGIC_LEN];
+    uint32_t version;
+    if(fread(magic, 1, GAME_LOG_MAGIC_LEN, f) != GAME_LOG_MAGIC_LEN ||
+            fread(&version, sizeof(version), 1, f) != 1) {
+        return -1;
+    }
+    if(memcmp(magic, GAME_LOG_MAGIC, GAME_LOG_MAGIC_LEN) != 0 ||
+            ntohl(version) != GAME_LOG_VERSION) {
+        return -1;
+    }
+    return 0;
+}
+
+GAME_LOG *glog_open(char *path) {
+    if(path == NULL) {
+        return NULL;
+    }
+    FILE *f = fopen(path, "a+");
+    if(f == NULL) {
+        perror("fopen");
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    if(ftell(f) == 0) {
+        uint32_t version = htonl(GAME_LOG_VERSION);
+        if(fwrite(GAME_LOG_MAGIC, 1, GAME_LOG_MAGIC_LEN, f) != GAME_LOG_MAGIC_LEN ||
+                fwrite(&version, sizeof(version), 1, f) != 1 || fflush(f) == EOF) {
+            fclose(f);
+            return NULL;
+        }
+    } else {
+        rewind(f);
+        if(check_header(f) == -1) {
+            debug("%ld: %s is not a game log", pthread_self(), path);
+            fclose(f);
+            return NULL;
+        }
+    }
+
+    GAME_LOG *log = malloc(sizeof(GAME_LOG));
+    if(log == NULL) {
+        fclose(f);
+        return NULL;
+    }
+    log->out = f;
+    pthread_mutex_init(&log->mutex, NULL);
+    return log;
+}
+
+void glog_close(GAME_LOG *log) {
+    if(log == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&log->mutex);
+    fclose(log->out);
+    pthread_mutex_unlock(&log->mutex);
+    pthread_mutex_destroy(&log->mutex);
+    free(log);
+}
+
+int glog_append(GAME_LOG *log, char *name1, char *name2, int result) {
+    if(log == NULL || name1 == NULL || name2 == NULL) {
+        return -1;
+    }
+    size_t len1 = strlen(name1), len2 = strlen(name2);
+    if(len1 > UINT16_MAX || len2 > UINT16_MAX) {
+        return -1;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    struct game_log_record_header hdr;
+    hdr.timestamp_sec = htonl(ts.tv_sec);
+    hdr.timestamp_nsec = htonl(ts.tv_nsec);
+    hdr.result = result;
+    hdr.name1_len = htons(len1);
+    hdr.name2_len = htons(len2);
+
+    pthread_mutex_lock(&log->mutex);
+    int status = 0;
+    if(fwrite(&hdr, sizeof(hdr), 1, log->out) != 1 ||
+            fwrite(name1, 1, len1, log->out) != len1 ||
+            fwrite(name2, 1, len2, log->out) != len2) {
+        status = -1;
+    }
+    pthread_mutex_unlock(&log->mutex);
+    return status;
+}
+
+int glog_flush(GAME_LOG *log) {
+    if(log == NULL) {
+        return -1;
+    }
+    pthread_mutex_lock(&log->mutex);
+    int status = fflush(log->out) == EOF ? -1 : 0;
+    pthread_mutex_unlock(&log->mutex);
+    return status;
+}
+
+FILE *glog_open_read(char *path) {
+    if(path == NULL) {
+        return NULL;
+    }
+    FILE *f = fopen(path, "r");
+    if(f == NULL) {
+        return NULL;
+    }
+    if(check_header(f) == -1) {
+        fclose(f);
+        return NULL;
+    }
+    return f;
+}
+
+static char *read_name(FILE *in, size_t len) {
+    char *name = malloc(len + 1);
+    if(name == NULL) {
+        return NULL;
+    }
+    if(fread(name, 1, len, in) != len) {
+        free(name);
+        return NULL;
+    }
+    name[len] = '\0';
+    return name;
+}
+
+int glog_read(FILE *in, GAME_LOG_RECORD *rec) {
+    struct game_log_record_header hdr;
+    size_t n = fread(&hdr, 1, sizeof(hdr), in);
+    if(n == 0 && feof(in)) {
+        return 1;
+    }
+    if(n != sizeof(hdr)) {
+        return -1;
+    }
+    rec->timestamp_sec = ntohl(hdr.timestamp_sec);
+    rec->timestamp_nsec = ntohl(hdr.timestamp_nsec);
+    rec->result = hdr.result;
+    if(rec->result > 2) {
+        return -1;
+    }
+    rec->name1 = read_name(in, ntohs(hdr.name1_len));
+    if(rec->name1 == NULL) {
+        return -1;
+    }
+    rec->name2 = read_name(in, ntohs(hdr.name2_len));
+    if(rec->name2 == NULL) {
+        free(rec->name1);
+        return -1;
+    }
+    return 0;
+}
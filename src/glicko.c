@@ -0,0 +1,395 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+
+#include "glicko.h"
+#include "debug.h"
+
+GLICKO *glicko_engine = NULL;
+
+/* Conversion factor between the Glicko and Glicko-2 scales. */
+#define GLICKO_SCALE 173.7178
+
+/* Convergence tolerance for the volatility iteration. */
+#define GLICKO_EPSILON 0.000001
+
+/* Largest deviation on the Glicko-2 scale: a player is never less known than a new one. */
+#define GLICKO_MAX_PHI (GLICKO_INITIAL_RD / GLICKO_SCALE)
+
+/* Initial number of players and results the engine has room for. */
+#define GLICKO_INITIAL_CAP 64
+
+struct glicko_result {
+    int id1;
+    int id2;
+    int result;
+};
+
+/* Per-player state on the Glicko-2 scale, one array per field. */
+struct glicko_state {
+    double *mu;
+    double *phi;
+    double *sigma;
+};
+
+struct glicko {
+    double tau;
+
+    /* protects the open period's results and the published state (cur) */
+    pthread_mutex_t mutex;
+    struct glicko_result *results;
+    size_t nresults;
+    size_t results_cap;
+    struct glicko_state cur;
+
+    /*
+     * Serializes period close and glicko_set().  The closer computes into
+     * next and the scratch arrays without holding mutex, then swaps next
+     * with cur.
+     */
+    pthread_mutex_t period_mutex;
+    struct glicko_state next;
+    double *g;        /* g(phi) per player */
+    double *v_inv;    /* sum of g^2 E (1 - E) per player */
+    double *d_sum;    /* sum of g (s - E) per player */
+    size_t nplayers;  /* one more than the largest id seen */
+    size_t cap;
+
+    pthread_t period_tid;
+    pthread_cond_t stop_cond;
+    int period_secs;
+    volatile int stop;
+};
+
+static int grow_array(double **arr, size_t old_cap, size_t new_cap, double init) {
+    double *a = reallocarray(*arr, new_cap, sizeof(double));
+    if(a == NULL) {
+        return -1;
+    }
+    for(size_t i = old_cap; i < new_cap; i++) {
+        a[i] = init;
+    }
+    *arr = a;
+    return 0;
+}
+
+static int grow_state(struct glicko_state *st, size_t old_cap, size_t new_cap) {
+    if(grow_array(&st->mu, old_cap, new_cap, 0.0) == -1 ||
+            grow_array(&st->phi, old_cap, new_cap, GLICKO_INITIAL_RD / GLICKO_SCALE) == -1 ||
+            grow_array(&st->sigma, old_cap, new_cap, GLICKO_INITIAL_VOLATILITY) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+static void free_state(struct glicko_state *st) {
+    free(st->mu);
+    free(st->phi);
+    free(st->sigma);
+}
+
+/* Must be called with both period_mutex and mutex held. */
+static int ensure_players(GLICKO *g, size_t nplayers) {
+    if(nplayers > g->cap) {
+        size_t new_cap = g->cap;
+        while(new_cap < nplayers) {
+            new_cap *= 2;
+        }
+        if(grow_state(&g->cur, g->cap, new_cap) == -1 ||
+                grow_state(&g->next, g->cap, new_cap) == -1 ||
+                grow_array(&g->g, g->cap, new_cap, 0.0) == -1 ||
+                grow_array(&g->v_inv, g->cap, new_cap, 0.0) == -1 ||
+                grow_array(&g->d_sum, g->cap, new_cap, 0.0) == -1) {
+            debug("%ld: Failed to grow Glicko-2 player arrays", pthread_self());
+            return -1;
+        }
+        g->cap = new_cap;
+    }
+    if(nplayers > g->nplayers) {
+        g->nplayers = nplayers;
+    }
+    return 0;
+}
+
+/* Step 5 of Glickman's algorithm: the new volatility, by the Illinois method. */
+static double new_volatility(double phi, double sigma, double v, double delta, double tau) {
+    const double a = log(sigma * sigma);
+    const double phi2 = phi * phi;
+    const double d2 = delta * delta;
+    const double tau2 = tau * tau;
+#define F(x) (exp(x) * (d2 - phi2 - v - exp(x)) / \
+        (2.0 * (phi2 + v + exp(x)) * (phi2 + v + exp(x))) - ((x) - a) / tau2)
+
+    double A = a, B;
+    if(d2 > phi2 + v) {
+        B = log(d2 - phi2 - v);
+    } else {
+        int k = 1;
+        while(F(a - k * tau) < 0) {
+            k++;
+        }
+        B = a - k * tau;
+    }
+    double fA = F(A), fB = F(B);
+    while(fabs(B - A) > GLICKO_EPSILON) {
+        double C = A + (A - B) * fA / (fB - fA);
+        double fC = F(C);
+        if(fC * fB <= 0) {
+            A = B;
+            fA = fB;
+        } else {
+            fA /= 2.0;
+        }
+        B = C;
+        fB = fC;
+    }
+#undef F
+    return exp(A / 2.0);
+}
+
+/* Must be called with period_mutex held and mutex not held. */
+static void compute_period(GLICKO *g, struct glicko_result *results, size_t nresults) {
+    const size_t n = g->nplayers;
+    const double *restrict mu = g->cur.mu;
+    const double *restrict phi = g->cur.phi;
+    const double *restrict sigma = g->cur.sigma;
+    double *restrict gphi = g->g;
+    double *restrict v_inv = g->v_inv;
+    double *restrict d_sum = g->d_sum;
+    double *restrict next_mu = g->next.mu;
+    double *restrict next_phi = g->next.phi;
+    double *restrict next_sigma = g->next.sigma;
+
+    for(size_t i = 0; i < n; i++) {
+        gphi[i] = 1.0 / sqrt(1.0 + 3.0 * phi[i] * phi[i] / (M_PI * M_PI));
+        v_inv[i] = 0.0;
+        d_sum[i] = 0.0;
+    }
+
+    /* every game contributes to both players, using pre-period ratings */
+    for(size_t k = 0; k < nresults; k++) {
+        int a = results[k].id1, b = results[k].id2;
+        double sa = results[k].result == 0 ? 0.5 : results[k].result == 1 ? 1.0 : 0.0;
+        double ea = 1.0 / (1.0 + exp(-gphi[b] * (mu[a] - mu[b])));
+        double eb = 1.0 / (1.0 + exp(-gphi[a] * (mu[b] - mu[a])));
+        v_inv[a] += gphi[b] * gphi[b] * ea * (1.0 - ea);
+        d_sum[a] += gphi[b] * (sa - ea);
+        v_inv[b] += gphi[a] * gphi[a] * eb * (1.0 - eb);
+        d_sum[b] += gphi[a] * ((1.0 - sa) - eb);
+    }
+
+    /* players who did not play only have their deviation widened */
+    for(size_t i = 0; i < n; i++) {
+        next_mu[i] = mu[i];
+        next_phi[i] = fmin(sqrt(phi[i] * phi[i] + sigma[i] * sigma[i]), GLICKO_MAX_PHI);
+        next_sigma[i] = sigma[i];
+    }
+
+    for(size_t i = 0; i < n; i++) {
+        if(v_inv[i] == 0.0) {
+            continue;
+        }
+        double v = 1.0 / v_inv[i];
+        double s = new_volatility(phi[i], sigma[i], v, v * d_sum[i], g->tau);
+        double phi_star2 = phi[i] * phi[i] + s * s;
+        double new_phi = 1.0 / sqrt(1.0 / phi_star2 + v_inv[i]);
+        next_mu[i] = mu[i] + new_phi * new_phi * d_sum[i];
+        next_phi[i] = fmin(new_phi, GLICKO_MAX_PHI);
+        next_sigma[i] = s;
+    }
+}
+
+static void *period_thread(void *arg) {
+    GLICKO *g = arg;
+    pthread_mutex_lock(&g->mutex);
+    while(!g->stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += g->period_secs;
+        int err = 0;
+        while(!g->stop && err != ETIMEDOUT) {
+            err = pthread_cond_timedwait(&g->stop_cond, &g->mutex, &deadline);
+        }
+        if(g->stop) {
+            break;
+        }
+        pthread_mutex_unlock(&g->mutex);
+        glicko_close_period(g);
+        debug("%ld: Closed Glicko-2 rating period", pthread_self());
+        pthread_mutex_lock(&g->mutex);
+    }
+    pthread_mutex_unlock(&g->mutex);
+    return NULL;
+}
+
+GLICKO *glicko_init(double tau, int period_secs) {
+    GLICKO *g = calloc(1, sizeof(GLICKO));
+    if(g == NULL) {
+        debug("%ld: Failed to initialize Glicko-2 engine", pthread_self());
+        return NULL;
+    }
+    g->tau = tau;
+    if(grow_state(&g->cur, 0, GLICKO_INITIAL_CAP) == -1 ||
+            grow_state(&g->next, 0, GLICKO_INITIAL_CAP) == -1 ||
+            grow_array(&g->g, 0, GLICKO_INITIAL_CAP, 0.0) == -1 ||
+            grow_array(&g->v_inv, 0, GLICKO_INITIAL_CAP, 0.0) == -1 ||
+            grow_array(&g->d_sum, 0, GLICKO_INITIAL_CAP, 0.0) == -1) {
+        glicko_fini(g);
+        return NULL;
+    }
+    g->cap = GLICKO_INITIAL_CAP;
+
+    pthread_mutex_init(&g->mutex, NULL);
+    pthread_mutex_init(&g->period_mutex, NULL);
+    pthread_cond_init(&g->stop_cond, NULL);
+
+    g->period_secs = period_secs;
+    if(period_secs > 0 && pthread_create(&g->period_tid, NULL, period_thread, g) != 0) {
+        debug("%ld: Failed to start Glicko-2 period thread", pthread_self());
+        g->period_secs = 0;
+        glicko_fini(g);
+        return NULL;
+    }
+    debug("%ld: Initialize Glicko-2 engine (tau %f, period %ds)", pthread_self(), tau, period_secs);
+    return g;
+}
+
+void glicko_fini(GLICKO *g) {
+    if(g == NULL) {
+        return;
+    }
+    if(g->period_secs > 0) {
+        pthread_mutex_lock(&g->mutex);
+        g->stop = 1;
+        pthread_cond_signal(&g->stop_cond);
+        pthread_mutex_unlock(&g->mutex);
+        pthread_join(g->period_tid, NULL);
+    }
+    if(g->cap > 0) {
+        pthread_cond_destroy(&g->stop_cond);
+        pthread_mutex_destroy(&g->period_mutex);
+        pthread_mutex_destroy(&g->mutex);
+    }
+    free_state(&g->cur);
+    free_state(&g->next);
+    free(g->g);
+    free(g->v_inv);
+    free(g->d_sum);
+    free(g->results);
+    free(g);
+}
+
+int glicko_record(GLICKO *g, int id1, int id2, int result) {
+    if(g == NULL || id1 < 0 || id2 < 0 || id1 == id2) {
+        return -1;
+    }
+    pthread_mutex_lock(&g->mutex);
+    if(g->nresults == g->results_cap) {
+        size_t new_cap = g->results_cap == 0 ? GLICKO_INITIAL_CAP : g->results_cap * 2;
+        struct glicko_result *r = reallocarray(g->results, new_cap, sizeof(struct glicko_result));
+        if(r == NULL) {
+            pthread_mutex_unlock(&g->mutex);
+            return -1;
+        }
+        g->results = r;
+        g->results_cap = new_cap;
+    }
+    struct glicko_result *r = &g->results[g->nresults++];
+    r->id1 = id1;
+    r->id2 = id2;
+    r->result = result;
+    pthread_mutex_unlock(&g->mutex);
+    return 0;
+}
+
+long glicko_close_period(GLICKO *g) {
+    if(g == NULL) {
+        return -1;
+    }
+    pthread_mutex_lock(&g->period_mutex);
+
+    pthread_mutex_lock(&g->mutex);
+    struct glicko_result *results = g->results;
+    size_t nresults = g->nresults;
+    g->results = NULL;
+    g->nresults = g->results_cap = 0;
+
+    size_t nplayers = g->nplayers;
+    for(size_t k = 0; k < nresults; k++) {
+        if(results[k].id1 >= nplayers) {
+            nplayers = results[k].id1 + 1;
+        }
+        if(results[k].id2 >= nplayers) {
+            nplayers = results[k].id2 + 1;
+        }
+    }
+    if(ensure_players(g, nplayers) == -1) {
+        pthread_mutex_unlock(&g->mutex);
+        pthread_mutex_unlock(&g->period_mutex);
+        free(results);
+        return -1;
+    }
+    pthread_mutex_unlock(&g->mutex);
+
+    compute_period(g, results, nresults);
+    free(results);
+
+    pthread_mutex_lock(&g->mutex);
+    struct glicko_state tmp = g->cur;
+    g->cur = g->next;
+    g->next = tmp;
+    pthread_mutex_unlock(&g->mutex);
+
+    pthread_mutex_unlock(&g->period_mutex);
+    return nresults;
+}
+
+int glicko_set(GLICKO *g, int id, double rating, double rd, double volatility) {
+    if(g == NULL || id < 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&g->period_mutex);
+    pthread_mutex_lock(&g->mutex);
+    if(ensure_players(g, id + 1) == -1) {
+        pthread_mutex_unlock(&g->mutex);
+        pthread_mutex_unlock(&g->period_mutex);
+        return -1;
+    }
+    g->cur.mu[id] = (rating - GLICKO_INITIAL_RATING) / GLICKO_SCALE;
+    g->cur.phi[id] = rd / GLICKO_SCALE;
+    g->cur.sigma[id] = volatility;
+    pthread_mutex_unlock(&g->mutex);
+    pthread_mutex_unlock(&g->period_mutex);
+    return 0;
+}
+
+void glicko_get(GLICKO *g, int id, double *rating, double *rd, double *volatility) {
+    double r = GLICKO_INITIAL_RATING, d = GLICKO_INITIAL_RD, s = GLICKO_INITIAL_VOLATILITY;
+    if(g != NULL && id >= 0) {
+        pthread_mutex_lock(&g->mutex);
+        if(id < g->nplayers) {
+            r = GLICKO_INITIAL_RATING + GLICKO_SCALE * g->cur.mu[id];
+            d = GLICKO_SCALE * g->cur.phi[id];
+            s = g->cur.sigma[id];
+        }
+        pthread_mutex_unlock(&g->mutex);
+    }
+    if(rating != NULL) {
+        *rating = r;
+    }
+    if(rd != NULL) {
+        *rd = d;
+    }
+    if(volatility != NULL) {
+        *volatility = s;
+    }
+}
+
+int glicko_get_rating(GLICKO *g, int id) {
+    double r;
+    glicko_get(g, id, &r, NULL, NULL);
+    return (int)round(r);
+}
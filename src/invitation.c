@@ -3,7 +3,12 @@
 
 #include "jeux_globals.h"
 #include "invitation.h"
+#include "metrics.h"
+#include "census.h"
 #include "debug.h"
+#include "lock_prof.h"
+#include "flight.h"
+#include "probes.h"
 
 struct invitation {
     CLIENT *src;
@@ -22,9 +27,9 @@ struct invitation {
 };
 
 static void set_game(INVITATION *inv, GAME *game) {
-    pthread_mutex_lock(&inv->game_mutex);
+    lprof_lock(&inv->game_mutex, LOCK_SITE_INV_GAME);
     inv->game = game;
-    pthread_mutex_unlock(&inv->game_mutex);
+    lprof_unlock(&inv->game_mutex);
 }
 
 INVITATION *
@@ -56,7 +61,10 @@ inv_create(CLIENT *source, CLIENT *target,
     pthread_mutex_init(&inv->game_mutex, NULL);
 
     inv->ref_count = 0;
+    metrics_count(METRIC_ACTIVE_INVITATIONS, 1);
+    census_create(CENSUS_INVITATION, CENSUS_MEM_INVITATION, sizeof(INVITATION));
 
+    flight_record(FLIGHT_INVITATION, FLIGHT_CREATE, inv, NULL, 0);
     inv_ref(inv, "for newly created invitation");
     client_ref(inv->src, "as source of new invitation");
     client_ref(inv->target, "as target of new invitation");
@@ -71,13 +79,14 @@ INVITATION *inv_ref(INVITATION *inv, char *why) {
         return NULL;
     }
 
-    pthread_mutex_lock(&inv->mutex);
+    lprof_lock(&inv->mutex, LOCK_SITE_INV);
     size_t old_ref = inv->ref_count;
     inv->ref_count = old_ref + 1;
 
     debug("%ld: Increase reference count on invitation %p (%lu -> %lu) %s", pthread_self(), inv, old_ref, inv->ref_count, why); 
+    flight_record(FLIGHT_INVITATION, FLIGHT_REF, inv, why, inv->ref_count);
     
-    pthread_mutex_unlock(&inv->mutex);
+    lprof_unlock(&inv->mutex);
     return inv;
 }
 void inv_unref(INVITATION *inv, char *why) {
@@ -85,14 +94,15 @@ void inv_unref(INVITATION *inv, char *why) {
         debug("%ld: Invalid invitation object!", pthread_self());
         return;
     }
-    pthread_mutex_lock(&inv->mutex);
+    lprof_lock(&inv->mutex, LOCK_SITE_INV);
     size_t old_ref = inv->ref_count;
     inv->ref_count = old_ref - 1;
 
     debug("%ld: Decrease reference count on invitation %p (%lu -> %lu) %s", pthread_self(), inv, old_ref, inv->ref_count, why); 
+    flight_record(FLIGHT_INVITATION, FLIGHT_UNREF, inv, why, inv->ref_count);
 
     if(inv->ref_count == 0) {
-        pthread_mutex_unlock(&inv->mutex);
+        lprof_unlock(&inv->mutex);
         pthread_mutex_destroy(&inv->mutex);
 
         pthread_mutex_destroy(&inv->state_mutex);
@@ -105,10 +115,13 @@ void inv_unref(INVITATION *inv, char *why) {
         }
         pthread_mutex_destroy(&inv->game_mutex);
         debug("%ld: Free invitation %p", pthread_self(), inv);
+        flight_record(FLIGHT_INVITATION, FLIGHT_FREE, inv, why, 0);
         free(inv);
+        metrics_count(METRIC_ACTIVE_INVITATIONS, -1);
+        census_free(CENSUS_INVITATION, CENSUS_MEM_INVITATION, sizeof(INVITATION));
         return;
     }
-    pthread_mutex_unlock(&inv->mutex);
+    lprof_unlock(&inv->mutex);
 }
 
 CLIENT *inv_get_source(INVITATION *inv) {
@@ -139,51 +152,58 @@ GAME *inv_get_game(INVITATION *inv) {
     if(inv == NULL) {
         return NULL;
     }
-    pthread_mutex_lock(&inv->game_mutex);
+    lprof_lock(&inv->game_mutex, LOCK_SITE_INV_GAME);
     GAME *game = inv->game;
-    pthread_mutex_unlock(&inv->game_mutex);
+    lprof_unlock(&inv->game_mutex);
     return game;
 }
 int inv_accept(INVITATION *inv) {
     if(inv == NULL) {
         return -1;
     }
-    pthread_mutex_lock(&inv->state_mutex);
+    lprof_lock(&inv->state_mutex, LOCK_SITE_INV_STATE);
     if(inv->state != INV_OPEN_STATE) {
-        pthread_mutex_unlock(&inv->state_mutex);
+        lprof_unlock(&inv->state_mutex);
         return -1;
     }
     set_game(inv, game_create());
-    if(inv_get_game(inv) == NULL) {
+    GAME *game = inv_get_game(inv);
+    if(game == NULL) {
         return -1;
     }
     inv->state = INV_ACCEPTED_STATE;
-    pthread_mutex_unlock(&inv->state_mutex);
+    lprof_unlock(&inv->state_mutex);
+    TRACE_JEUX_INVITATION_ACCEPT(inv, game);
     return 0;
 }
 int inv_close(INVITATION *inv, GAME_ROLE role) {
     if(inv == NULL) {
         return -1;
     }
-    pthread_mutex_lock(&inv->state_mutex);
+    lprof_lock(&inv->state_mutex, LOCK_SITE_INV_STATE);
     if(inv->state != INV_OPEN_STATE && inv->state != INV_ACCEPTED_STATE) {
-        pthread_mutex_unlock(&inv->state_mutex);
+        lprof_unlock(&inv->state_mutex);
         return -1;
     }
     if(role == NULL_ROLE) {
         if(inv_get_game(inv) == NULL) {
             inv->state = INV_CLOSED_STATE;
-            pthread_mutex_unlock(&inv->state_mutex);
+            lprof_unlock(&inv->state_mutex);
+            TRACE_JEUX_INVITATION_CLOSE(inv, NULL_ROLE, NULL);
             return 0;
         } else {
-            pthread_mutex_unlock(&inv->state_mutex);
+            lprof_unlock(&inv->state_mutex);
             return -1;
         }
     }
-    int status = game_resign(inv_get_game(inv), role);
+    GAME *game = inv_get_game(inv);
+    int status = game_resign(game, role);
     if(status != -1) {
         inv->state = INV_CLOSED_STATE;
     }
-    pthread_mutex_unlock(&inv->state_mutex);
+    lprof_unlock(&inv->state_mutex);
+    if(status != -1) {
+        TRACE_JEUX_INVITATION_CLOSE(inv, role, game);
+    }
     return status;
 }
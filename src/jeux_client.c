@@ -0,0 +1,343 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "jeux_client.h"
+#include "packet_common.h"
+#include "csapp.h"
+#include "debug.h"
+
+/* Bytes read from a socket at a time. */
+#define JC_READ_SIZE 4096
+
+typedef struct jc_buf {
+    char *data;
+    size_t off;                 /* bytes already consumed */
+    size_t len;                 /* bytes held, consumed ones included */
+    size_t cap;
+} JC_BUF;
+
+typedef struct jc_reply {
+    JC_REPLY_FN done;
+    void *arg;
+} JC_REPLY;
+
+struct jc_conn {
+    JC_LOOP *loop;
+    JC_CONN *next;
+    int fd;                     /* -1 once closed */
+    JC_EVENT_FN event;
+    void *arg;
+    JC_BUF out;                 /* requests not yet written */
+    JC_BUF in;                  /* bytes of packets not yet complete */
+    JC_REPLY *replies;          /* ring of requests awaiting their reply */
+    size_t reply_head, nreplies, reply_cap;
+};
+
+struct jc_loop {
+    JC_CONN *conns;
+    int running;                /* closed connections are freed after the run */
+    int lost;                   /* connections lost during the run */
+    struct pollfd *pfds;
+    JC_CONN **polled;
+    size_t poll_cap;
+};
+
+/* Make room for at least size more bytes, dropping those consumed. */
+static int buf_reserve(JC_BUF *buf, size_t size) {
+    if(buf->off > 0) {
+        memmove(buf->data, buf->data + buf->off, buf->len - buf->off);
+        buf->len -= buf->off;
+        buf->off = 0;
+    }
+    if(buf->len + size <= buf->cap) {
+        return 0;
+    }
+    size_t cap = buf->cap == 0 ? JC_READ_SIZE : buf->cap;
+    while(cap < buf->len + size) {
+        cap *= 2;
+    }
+    char *data = realloc(buf->data, cap);
+    if(data == NULL) {
+        return -1;
+    }
+    buf->data = data;
+    buf->cap = cap;
+    return 0;
+}
+
+JC_LOOP *jc_loop_create(void) {
+    return calloc(1, sizeof(JC_LOOP));
+}
+
+void jc_loop_destroy(JC_LOOP *loop) {
+    while(loop->conns != NULL) {
+        jc_close(loop->conns);
+    }
+    free(loop->pfds);
+    free(loop->polled);
+    free(loop);
+}
+
+JC_CONN *jc_connect(JC_LOOP *loop, char *host, char *port, JC_EVENT_FN event, void *arg) {
+    JC_CONN *conn = calloc(1, sizeof(JC_CONN));
+    if(conn == NULL) {
+        return NULL;
+    }
+    if((conn->fd = open_clientfd(host, port)) < 0) {
+        debug("%ld: Failed to connect to %s:%s", pthread_self(), host, port);
+        free(conn);
+        return NULL;
+    }
+    /* requests are written whole, so Nagle's algorithm could only delay them */
+    int one = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+    conn->loop = loop;
+    conn->event = event;
+    conn->arg = arg;
+    conn->next = loop->conns;
+    loop->conns = conn;
+    return conn;
+}
+
+int jc_send(JC_CONN *conn, JEUX_PACKET_HEADER *hdr, void *payload, JC_REPLY_FN done, void *arg) {
+    size_t size = ntohs(hdr->size);
+    /* a header promising a payload that is not there would put the server out of step */
+    if(conn->fd < 0 || (payload == NULL && size != 0)) {
+        return -1;
+    }
+    if(conn->nreplies == conn->reply_cap) {
+        size_t cap = conn->reply_cap == 0 ? 16 : conn->reply_cap * 2;
+        JC_REPLY *replies = malloc(cap * sizeof(JC_REPLY));
+        if(replies == NULL) {
+            return -1;
+        }
+        for(size_t i = 0; i < conn->nreplies; i++) {
+            replies[i] = conn->replies[(conn->reply_head + i) % conn->reply_cap];
+        }
+        free(conn->replies);
+        conn->replies = replies;
+        conn->reply_cap = cap;
+        conn->reply_head = 0;
+    }
+    if(buf_reserve(&conn->out, sizeof(JEUX_PACKET_HEADER) + size) == -1) {
+        return -1;
+    }
+    memcpy(conn->out.data + conn->out.len, hdr, sizeof(JEUX_PACKET_HEADER));
+    conn->out.len += sizeof(JEUX_PACKET_HEADER);
+    if(size > 0) {
+        memcpy(conn->out.data + conn->out.len, payload, size);
+        conn->out.len += size;
+    }
+    JC_REPLY *reply = &conn->replies[(conn->reply_head + conn->nreplies) % conn->reply_cap];
+    reply->done = done;
+    reply->arg = arg;
+    conn->nreplies++;
+    return 0;
+}
+
+int jc_request(JC_CONN *conn, int type, int id, int role, void *payload, size_t size,
+               JC_REPLY_FN done, void *arg) {
+    JEUX_PACKET_HEADER hdr;
+    pack_header(&hdr, type, id, role, payload != NULL ? size : 0);
+    return jc_send(conn, &hdr, payload, done, arg);
+}
+
+int jc_outstanding(JC_CONN *conn) {
+    return conn->nreplies;
+}
+
+/* Give the next reply to its request's callback. */
+static void complete(JC_CONN *conn, JEUX_PACKET_HEADER *hdr, void *payload) {
+    JC_REPLY reply = conn->replies[conn->reply_head];
+    conn->reply_head = (conn->reply_head + 1) % conn->reply_cap;
+    conn->nreplies--;
+    if(reply.done != NULL) {
+        reply.done(conn, reply.arg, hdr, payload);
+    }
+}
+
+static void unlink_conn(JC_CONN *conn) {
+    JC_CONN **pp = &conn->loop->conns;
+    while(*pp != conn) {
+        pp = &(*pp)->next;
+    }
+    *pp = conn->next;
+    free(conn->out.data);
+    free(conn->in.data);
+    free(conn->replies);
+    free(conn);
+}
+
+void jc_close(JC_CONN *conn) {
+    if(conn->fd >= 0) {
+        close(conn->fd);
+        conn->fd = -1;
+        while(conn->nreplies > 0) {
+            complete(conn, NULL, NULL);
+        }
+    }
+    if(!conn->loop->running) {
+        unlink_conn(conn);
+    }
+}
+
+/* The connection failed or the server closed it. */
+static void lose(JC_CONN *conn) {
+    if(conn->fd < 0) {
+        return;
+    }
+    debug("%ld: [%d] Connection lost", pthread_self(), conn->fd);
+    close(conn->fd);
+    conn->fd = -1;
+    while(conn->nreplies > 0) {
+        complete(conn, NULL, NULL);
+    }
+    conn->loop->lost++;
+    if(conn->event != NULL) {
+        conn->event(conn, conn->arg, NULL, NULL);
+    }
+}
+
+/* Write what the socket will take of the queued requests. */
+static void flush(JC_CONN *conn) {
+    JC_BUF *out = &conn->out;
+    while(conn->fd >= 0 && out->off < out->len) {
+        ssize_t n = send(conn->fd, out->data + out->off, out->len - out->off, MSG_NOSIGNAL);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                lose(conn);
+            }
+            return;
+        }
+        out->off += n;
+    }
+    if(out->off == out->len) {
+        out->off = out->len = 0;
+    }
+}
+
+/*
+ * Read what has arrived and dispatch every complete packet.
+ */
+static void receive(JC_CONN *conn) {
+    JC_BUF *in = &conn->in;
+    int eof = 0;
+    while(!eof) {
+        if(buf_reserve(in, JC_READ_SIZE) == -1) {
+            lose(conn);
+            return;
+        }
+        ssize_t n = read(conn->fd, in->data + in->len, in->cap - in->len);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                eof = 1;
+            }
+            break;
+        }
+        if(n == 0) {
+            eof = 1;
+        }
+        in->len += n;
+    }
+    while(conn->fd >= 0 && in->len - in->off >= sizeof(JEUX_PACKET_HEADER)) {
+        JEUX_PACKET_HEADER hdr;
+        memcpy(&hdr, in->data + in->off, sizeof(hdr));
+        size_t size = ntohs(hdr.size);
+        if(in->len - in->off < sizeof(hdr) + size) {
+            break;
+        }
+        void *payload = size > 0 ? in->data + in->off + sizeof(hdr) : NULL;
+        in->off += sizeof(hdr) + size;
+        unpack_header(&hdr);
+        if((hdr.type == JEUX_ACK_PKT || hdr.type == JEUX_NACK_PKT) && conn->nreplies > 0) {
+            complete(conn, &hdr, payload);
+        } else if(conn->event != NULL) {
+            conn->event(conn, conn->arg, &hdr, payload);
+        }
+    }
+    if(eof) {
+        lose(conn);
+    }
+}
+
+int jc_loop_run(JC_LOOP *loop, int timeout_ms) {
+    size_t n = 0;
+    for(JC_CONN *conn = loop->conns; conn != NULL; conn = conn->next) {
+        n++;
+    }
+    if(n > loop->poll_cap) {
+        struct pollfd *pfds = realloc(loop->pfds, n * sizeof(struct pollfd));
+        if(pfds != NULL) {
+            loop->pfds = pfds;
+        }
+        JC_CONN **polled = realloc(loop->polled, n * sizeof(JC_CONN *));
+        if(polled != NULL) {
+            loop->polled = polled;
+        }
+        if(pfds == NULL || polled == NULL) {
+            return -1;
+        }
+        loop->poll_cap = n;
+    }
+
+    loop->running = 1;
+    loop->lost = 0;
+    n = 0;
+    for(JC_CONN *conn = loop->conns; conn != NULL; conn = conn->next) {
+        flush(conn);
+        if(conn->fd >= 0) {
+            loop->polled[n] = conn;
+            loop->pfds[n].fd = conn->fd;
+            loop->pfds[n].events = POLLIN | (conn->out.len > 0 ? POLLOUT : 0);
+            loop->pfds[n].revents = 0;
+            n++;
+        }
+    }
+    int count = -1;
+    if(n > 0 && (count = poll(loop->pfds, n, timeout_ms)) > 0) {
+        for(size_t i = 0; i < n; i++) {
+            JC_CONN *conn = loop->polled[i];
+            /* an earlier callback may have closed it */
+            if(conn->fd < 0 || loop->pfds[i].revents == 0) {
+                continue;
+            }
+            if(loop->pfds[i].revents & POLLOUT) {
+                flush(conn);
+            }
+            if(conn->fd >= 0 && (loop->pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                receive(conn);
+            }
+        }
+    }
+    loop->running = 0;
+    /* a connection lost while writing before poll() also counts */
+    if(loop->lost > 0 && count <= 0) {
+        count = loop->lost;
+    }
+
+    JC_CONN *conn = loop->conns;
+    while(conn != NULL) {
+        JC_CONN *next = conn->next;
+        if(conn->fd < 0) {
+            unlink_conn(conn);
+        }
+        conn = next;
+    }
+    return count;
+}
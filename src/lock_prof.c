@@ -0,0 +1,105 @@
+#include <stdlib.h>
+
+#include "lock_prof.h"
+#include "metrics.h"
+
+atomic_int lprof_enabled = 0;
+__thread int lprof_depth = 0;
+
+struct held_lock {
+    pthread_mutex_t *mutex;
+    LOCK_SITE site;
+    uint64_t acquired_ns;
+};
+
+static __thread struct held_lock held[LPROF_MAX_HELD];
+
+/*
+ * An uncontended acquisition is recorded as a wait of zero and a
+ * contended one as a wait of at least one nanosecond, so the first
+ * bucket of a wait histogram counts the uncontended acquisitions.
+ */
+static METRICS_HISTOGRAM wait_hist[LOCK_SITES];
+static METRICS_HISTOGRAM hold_hist[LOCK_SITES];
+
+static char *site_names[LOCK_SITES] = {
+    [LOCK_SITE_CREG] = "creg",
+    [LOCK_SITE_PREG] = "preg",
+    [LOCK_SITE_CLIENT] = "client",
+    [LOCK_SITE_CLIENT_FD] = "client_fd",
+    [LOCK_SITE_CLIENT_INV] = "client_inv",
+    [LOCK_SITE_CLIENT_PLAYER] = "client_player",
+    [LOCK_SITE_GAME] = "game",
+    [LOCK_SITE_GAME_BOARD] = "game_board",
+    [LOCK_SITE_GAME_TURN] = "game_turn",
+    [LOCK_SITE_GAME_STATUS] = "game_status",
+    [LOCK_SITE_GAME_WINNER] = "game_winner",
+    [LOCK_SITE_INV] = "inv",
+    [LOCK_SITE_INV_STATE] = "inv_state",
+    [LOCK_SITE_INV_GAME] = "inv_game",
+    [LOCK_SITE_PLAYER] = "player",
+};
+
+void lprof_lock_slow(pthread_mutex_t *mutex, LOCK_SITE site) {
+    uint64_t wait = 0, acquired;
+    if(pthread_mutex_trylock(mutex) == 0) {
+        acquired = metrics_now_ns();
+    } else {
+        uint64_t start = metrics_now_ns();
+        pthread_mutex_lock(mutex);
+        acquired = metrics_now_ns();
+        wait = acquired > start ? acquired - start : 1;
+    }
+    metrics_hist_record(&wait_hist[site], wait);
+    if(lprof_depth < LPROF_MAX_HELD) {
+        held[lprof_depth].mutex = mutex;
+        held[lprof_depth].site = site;
+        held[lprof_depth].acquired_ns = acquired;
+        lprof_depth++;
+    }
+}
+
+void lprof_unlock_slow(pthread_mutex_t *mutex) {
+    /* mutexes are usually released in reverse order, so search from the top */
+    for(int i = lprof_depth - 1; i >= 0; i--) {
+        if(held[i].mutex == mutex) {
+            metrics_hist_record(&hold_hist[held[i].site], metrics_now_ns() - held[i].acquired_ns);
+            for(int j = i; j < lprof_depth - 1; j++) {
+                held[j] = held[j + 1];
+            }
+            lprof_depth--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(mutex);
+}
+
+void lprof_enable(int on) {
+    atomic_store(&lprof_enabled, on != 0);
+}
+
+char *lprof_site_name(LOCK_SITE site) {
+    return site_names[site];
+}
+
+void lprof_write(FILE *out) {
+    METRICS_HIST_SNAPSHOT *snap = malloc(sizeof(METRICS_HIST_SNAPSHOT));
+    if(snap == NULL) {
+        return;
+    }
+    for(int s = 0; s < LOCK_SITES; s++) {
+        metrics_hist_read(&wait_hist[s], snap);
+        if(snap->count == 0) {
+            continue;
+        }
+        char name[64];
+        fprintf(out, "lock_%s_acquired\t%lu\n", site_names[s], snap->count);
+        fprintf(out, "lock_%s_contended\t%lu\n", site_names[s], snap->count - snap->buckets[0]);
+        snprintf(name, sizeof(name), "lock_%s_wait_ns", site_names[s]);
+        metrics_hist_write(out, name, snap);
+        metrics_hist_read(&hold_hist[s], snap);
+        snprintf(name, sizeof(name), "lock_%s_hold_ns", site_names[s]);
+        metrics_hist_write(out, name, snap);
+    }
+    free(snap);
+}
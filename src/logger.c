@@ -0,0 +1,618 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/types.h>
+
+#include "logger.h"
+#include "metrics.h"
+#include "debug.h"
+
+/* Largest record, header and arguments, that a log call can capture. */
+#define LOGGER_MAX_RECORD 2048
+
+/* Longest line the background thread writes. */
+#define LOGGER_MAX_LINE 4096
+
+#define LOGGER_RING_MASK ((uint64_t)LOGGER_RING_BYTES - 1)
+
+/* level of the filler record that pads a ring out to its end */
+#define LOGGER_PAD 0xff
+
+/*
+ * A record as it sits in a ring.  The arguments follow the header, in
+ * format order, each in an 8-byte slot; a string argument is a slot
+ * holding its length, then its bytes and a NUL padded to a slot boundary.
+ */
+struct logger_record {
+    uint32_t len;               /* whole record, a multiple of 8 */
+    uint8_t level;              /* LOGGER_LEVEL, or LOGGER_PAD */
+    uint8_t pad[3];
+    int32_t line;
+    uint32_t pad2;
+    const char *fmt;
+    const char *file;
+    const char *func;
+};
+
+union logger_slot {
+    int64_t i;
+    uint64_t u;
+    double d;
+    const void *p;
+};
+
+struct logger_ring {
+    char data[LOGGER_RING_BYTES];
+    _Alignas(64) _Atomic uint64_t head;     /* bytes ever written, by the owning thread */
+    _Alignas(64) _Atomic uint64_t tail;     /* bytes ever consumed, by the background thread */
+    atomic_int in_use;                      /* owned by a live thread */
+    atomic_int publishing;                  /* the owner may be adding a record */
+    struct logger_ring *next;
+};
+
+/* a conversion specification in a format string */
+enum { LEN_NONE, LEN_HH, LEN_H, LEN_L, LEN_LL, LEN_J, LEN_Z, LEN_T, LEN_BIG_L };
+
+struct logger_spec {
+    const char *flags;          /* flags, after the '%' */
+    int nflags;
+    const char *width;          /* digits, or "*" */
+    int nwidth;
+    const char *prec;           /* digits after the '.', or "*"; NULL if none */
+    int nprec;
+    int length;
+    char conv;
+};
+
+atomic_int logger_level = LOGGER_DEBUG;
+
+static struct logger_ring *_Atomic rings = NULL;
+static __thread struct logger_ring *my_ring = NULL;
+static __thread union {
+    struct logger_record rec;
+    char bytes[LOGGER_MAX_RECORD];
+} staging;
+
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static atomic_int running = 0;
+static FILE *logger_out;
+static pthread_t logger_tid;
+static pthread_mutex_t logger_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t flush_requested, flush_done;
+static int stopping;
+
+static char *level_names[] = {
+    [LOGGER_DEBUG] = "debug",
+    [LOGGER_INFO] = "info",
+    [LOGGER_SUCCESS] = "success",
+    [LOGGER_WARN] = "warn",
+    [LOGGER_ERROR] = "error",
+    [LOGGER_OFF] = "off",
+};
+
+/* the line prefixes of the original debug.h macros */
+static char *level_prefixes[] = {
+    [LOGGER_DEBUG] = KMAG "DEBUG: ",
+    [LOGGER_INFO] = KBLU "INFO: ",
+    [LOGGER_SUCCESS] = KGRN "SUCCESS: ",
+    [LOGGER_WARN] = KYEL "WARN: ",
+    [LOGGER_ERROR] = KRED "ERROR: ",
+};
+
+/*
+ * Parse the conversion specification at p, which points just past a '%'.
+ * Returns a pointer past the specification, with spec->conv set to 0 if
+ * it is not one that is understood.
+ */
+static const char *parse_spec(const char *p, struct logger_spec *spec) {
+    spec->flags = p;
+    while(*p != '\0' && strchr("-+ #0'", *p) != NULL) {
+        p++;
+    }
+    spec->nflags = p - spec->flags;
+    spec->width = p;
+    if(*p == '*') {
+        p++;
+    } else {
+        while(*p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+    spec->nwidth = p - spec->width;
+    spec->prec = NULL;
+    spec->nprec = 0;
+    if(*p == '.') {
+        spec->prec = ++p;
+        if(*p == '*') {
+            p++;
+        } else {
+            while(*p >= '0' && *p <= '9') {
+                p++;
+            }
+        }
+        spec->nprec = p - spec->prec;
+    }
+    spec->length = LEN_NONE;
+    switch(*p) {
+        case 'h':
+            spec->length = p[1] == 'h' ? LEN_HH : LEN_H;
+            p += p[1] == 'h' ? 2 : 1;
+            break;
+        case 'l':
+            spec->length = p[1] == 'l' ? LEN_LL : LEN_L;
+            p += p[1] == 'l' ? 2 : 1;
+            break;
+        case 'j': spec->length = LEN_J; p++; break;
+        case 'z': spec->length = LEN_Z; p++; break;
+        case 't': spec->length = LEN_T; p++; break;
+        case 'L': spec->length = LEN_BIG_L; p++; break;
+    }
+    if(*p != '\0' && strchr("diuoxXcspfFeEgGaAn%", *p) != NULL) {
+        spec->conv = *p++;
+    } else {
+        spec->conv = 0;
+    }
+    return p;
+}
+
+static int star_width(struct logger_spec *spec) {
+    return spec->nwidth == 1 && spec->width[0] == '*';
+}
+
+static int star_prec(struct logger_spec *spec) {
+    return spec->prec != NULL && spec->nprec == 1 && spec->prec[0] == '*';
+}
+
+static int64_t arg_signed(int length, va_list *ap) {
+    switch(length) {
+        case LEN_HH: return (signed char)va_arg(*ap, int);
+        case LEN_H: return (short)va_arg(*ap, int);
+        case LEN_L: return va_arg(*ap, long);
+        case LEN_LL: return va_arg(*ap, long long);
+        case LEN_J: return va_arg(*ap, intmax_t);
+        case LEN_Z: return va_arg(*ap, ssize_t);
+        case LEN_T: return va_arg(*ap, ptrdiff_t);
+        default: return va_arg(*ap, int);
+    }
+}
+
+static uint64_t arg_unsigned(int length, va_list *ap) {
+    switch(length) {
+        case LEN_HH: return (unsigned char)va_arg(*ap, unsigned int);
+        case LEN_H: return (unsigned short)va_arg(*ap, unsigned int);
+        case LEN_L: return va_arg(*ap, unsigned long);
+        case LEN_LL: return va_arg(*ap, unsigned long long);
+        case LEN_J: return va_arg(*ap, uintmax_t);
+        case LEN_Z: return va_arg(*ap, size_t);
+        case LEN_T: return (uint64_t)va_arg(*ap, ptrdiff_t);
+        default: return va_arg(*ap, unsigned int);
+    }
+}
+
+/*
+ * Copy the arguments into the staging record.  Returns the record length,
+ * or 0 if the arguments do not fit.
+ */
+static size_t capture_args(const char *fmt, va_list *ap) {
+    size_t off = sizeof(struct logger_record);
+    union logger_slot slot;
+    for(const char *p = fmt; *p != '\0'; ) {
+        if(*p++ != '%') {
+            continue;
+        }
+        struct logger_spec spec;
+        p = parse_spec(p, &spec);
+        int nstars = star_width(&spec) + star_prec(&spec);
+        for(int i = 0; i < nstars; i++) {
+            if(off + sizeof(slot) > LOGGER_MAX_RECORD) {
+                return 0;
+            }
+            slot.i = va_arg(*ap, int);
+            memcpy(staging.bytes + off, &slot, sizeof(slot));
+            off += sizeof(slot);
+        }
+        switch(spec.conv) {
+            case 0:
+            case '%':
+                continue;
+            case 'n':
+                (void)va_arg(*ap, void *);
+                continue;
+            case 'd': case 'i': case 'c':
+                slot.i = spec.conv == 'c' ? va_arg(*ap, int) : arg_signed(spec.length, ap);
+                break;
+            case 'u': case 'o': case 'x': case 'X':
+                slot.u = arg_unsigned(spec.length, ap);
+                break;
+            case 'p':
+                slot.p = va_arg(*ap, void *);
+                break;
+            case 's': {
+                const char *s = va_arg(*ap, const char *);
+                if(s == NULL) {
+                    s = "(null)";
+                }
+                size_t room = LOGGER_MAX_RECORD - off;
+                if(room < 2 * sizeof(slot)) {
+                    return 0;
+                }
+                room = (room - sizeof(slot)) & ~(sizeof(slot) - 1);
+                size_t n = strnlen(s, LOGGER_MAX_STRING);
+                if(n > room - 1) {
+                    n = room - 1;
+                }
+                slot.u = n;
+                memcpy(staging.bytes + off, &slot, sizeof(slot));
+                off += sizeof(slot);
+                memcpy(staging.bytes + off, s, n);
+                staging.bytes[off + n] = '\0';
+                off += (n + sizeof(slot)) & ~(sizeof(slot) - 1);
+                continue;
+            }
+            default:
+                slot.d = spec.length == LEN_BIG_L ? (double)va_arg(*ap, long double) : va_arg(*ap, double);
+                break;
+        }
+        if(off + sizeof(slot) > LOGGER_MAX_RECORD) {
+            return 0;
+        }
+        memcpy(staging.bytes + off, &slot, sizeof(slot));
+        off += sizeof(slot);
+    }
+    return off;
+}
+
+/* Runs at thread exit: hand the ring, and any records still in it, to the next thread. */
+static void release_ring(void *arg) {
+    struct logger_ring *ring = arg;
+    my_ring = NULL;
+    atomic_store(&ring->in_use, 0);
+}
+
+static void make_ring_key(void) {
+    pthread_key_create(&ring_key, release_ring);
+}
+
+static struct logger_ring *claim_ring(void) {
+    pthread_once(&ring_key_once, make_ring_key);
+    struct logger_ring *ring;
+    for(ring = atomic_load(&rings); ring != NULL; ring = ring->next) {
+        int expected = 0;
+        if(atomic_compare_exchange_strong(&ring->in_use, &expected, 1)) {
+            break;
+        }
+    }
+    if(ring == NULL) {
+        ring = aligned_alloc(64, sizeof(struct logger_ring));
+        if(ring == NULL) {
+            return NULL;
+        }
+        memset(ring, 0, sizeof(struct logger_ring));
+        atomic_init(&ring->in_use, 1);
+        ring->next = atomic_load(&rings);
+        while(!atomic_compare_exchange_weak(&rings, &ring->next, ring))
+            ;
+    }
+    pthread_setspecific(ring_key, ring);
+    return ring;
+}
+
+/* Copy the staging record into the calling thread's ring.  Returns -1 if it is full. */
+static int publish(struct logger_ring *ring, size_t len) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t pos = head & LOGGER_RING_MASK;
+    size_t to_end = LOGGER_RING_BYTES - pos;
+    size_t need = len > to_end ? to_end + len : len;
+    if(LOGGER_RING_BYTES - (head - tail) < need) {
+        return -1;
+    }
+    if(len > to_end) {
+        /* records are never split: pad out to the end and start again at the front */
+        struct logger_record *filler = (struct logger_record *)(ring->data + pos);
+        filler->len = to_end;
+        filler->level = LOGGER_PAD;
+        pos = 0;
+    }
+    memcpy(ring->data + pos, staging.bytes, len);
+    atomic_store_explicit(&ring->head, head + need, memory_order_release);
+    return 0;
+}
+
+static void write_sync(LOGGER_LEVEL level, const char *file, const char *func, int line,
+        const char *fmt, va_list ap) {
+    flockfile(stderr);
+    fprintf(stderr, "%s%s:%s:%d " KNRM, level_prefixes[level], file, func, line);
+    vfprintf(stderr, fmt, ap);
+    fputs(NL, stderr);
+    funlockfile(stderr);
+}
+
+void logger_write(LOGGER_LEVEL level, const char *file, const char *func, int line,
+        const char *fmt, ...) {
+    if((int)level < 0 || level >= LOGGER_OFF) {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    struct logger_ring *ring = my_ring;
+    if(ring == NULL && atomic_load(&running)) {
+        ring = my_ring = claim_ring();
+    }
+    /*
+     * logger_stop() clears running and then waits for every ring's
+     * publishing flag to clear before the last drain, so a record is
+     * either written here or is in a ring by the time that drain runs.
+     */
+    if(ring != NULL) {
+        atomic_store(&ring->publishing, 1);
+    }
+    if(!atomic_load(&running)) {
+        if(ring != NULL) {
+            atomic_store_explicit(&ring->publishing, 0, memory_order_release);
+        }
+        write_sync(level, file, func, line, fmt, ap);
+        va_end(ap);
+        return;
+    }
+    size_t len = ring == NULL ? 0 : capture_args(fmt, &ap);
+    va_end(ap);
+    if(len != 0) {
+        staging.rec.len = len;
+        staging.rec.level = level;
+        staging.rec.line = line;
+        staging.rec.fmt = fmt;
+        staging.rec.file = file;
+        staging.rec.func = func;
+    }
+    if(len == 0 || publish(ring, len) == -1) {
+        metrics_count(METRIC_LOG_DROPPED, 1);
+    }
+    if(ring != NULL) {
+        atomic_store_explicit(&ring->publishing, 0, memory_order_release);
+    }
+}
+
+/* Append at most what fits of a formatted conversion to the line. */
+#define APPEND(line, off, ...)                                                  \
+    do {                                                                        \
+        if((off) < LOGGER_MAX_LINE) {                                           \
+            int _n = snprintf((line) + (off), LOGGER_MAX_LINE - (off), __VA_ARGS__); \
+            if(_n > 0) {                                                        \
+                (off) += _n < LOGGER_MAX_LINE - (off) ? _n : LOGGER_MAX_LINE - (off) - 1; \
+            }                                                                   \
+        }                                                                       \
+    } while(0)
+
+/*
+ * Format a record, re-parsing its format string to find the type of each
+ * argument slot.  Each conversion is rebuilt with the values of any '*'
+ * filled in and with the length modifier of the slot's type.
+ */
+static void format_record(struct logger_record *rec, FILE *out) {
+    static char line[LOGGER_MAX_LINE];
+    const char *args = (const char *)(rec + 1);
+    const char *end = (const char *)rec + rec->len;
+    size_t off = 0;
+    int bad = 0;
+    union logger_slot slot;
+    APPEND(line, off, "%s%s:%s:%d " KNRM, level_prefixes[rec->level], rec->file, rec->func, rec->line);
+    for(const char *p = rec->fmt; *p != '\0' && off < LOGGER_MAX_LINE - 1; ) {
+        if(*p != '%') {
+            line[off++] = *p++;
+            continue;
+        }
+        struct logger_spec spec;
+        const char *start = p;
+        p = parse_spec(p + 1, &spec);
+        if(spec.conv == 0) {
+            APPEND(line, off, "%.*s", (int)(p - start), start);
+            continue;
+        }
+        if(spec.conv == '%') {
+            line[off++] = '%';
+            continue;
+        }
+        char conv[64];
+        int n = snprintf(conv, sizeof(conv), "%%%.*s", spec.nflags, spec.flags);
+        if(star_width(&spec)) {
+            if(args + sizeof(slot) > end) {
+                bad = 1;
+                break;
+            }
+            memcpy(&slot, args, sizeof(slot));
+            args += sizeof(slot);
+            n += snprintf(conv + n, sizeof(conv) - n, "%d", (int)slot.i);
+        } else {
+            n += snprintf(conv + n, sizeof(conv) - n, "%.*s", spec.nwidth, spec.width);
+        }
+        if(star_prec(&spec)) {
+            if(args + sizeof(slot) > end) {
+                bad = 1;
+                break;
+            }
+            memcpy(&slot, args, sizeof(slot));
+            args += sizeof(slot);
+            if((int)slot.i >= 0) {
+                n += snprintf(conv + n, sizeof(conv) - n, ".%d", (int)slot.i);
+            }
+        } else if(spec.prec != NULL) {
+            n += snprintf(conv + n, sizeof(conv) - n, ".%.*s", spec.nprec, spec.prec);
+        }
+        if(spec.conv == 'n') {
+            continue;
+        }
+        if(args + sizeof(slot) > end) {
+            bad = 1;
+            break;
+        }
+        memcpy(&slot, args, sizeof(slot));
+        args += sizeof(slot);
+        switch(spec.conv) {
+            case 'd': case 'i':
+                snprintf(conv + n, sizeof(conv) - n, "ll%c", spec.conv);
+                APPEND(line, off, conv, (long long)slot.i);
+                break;
+            case 'u': case 'o': case 'x': case 'X':
+                snprintf(conv + n, sizeof(conv) - n, "ll%c", spec.conv);
+                APPEND(line, off, conv, (unsigned long long)slot.u);
+                break;
+            case 'c':
+                snprintf(conv + n, sizeof(conv) - n, "c");
+                APPEND(line, off, conv, (int)slot.i);
+                break;
+            case 'p':
+                snprintf(conv + n, sizeof(conv) - n, "p");
+                APPEND(line, off, conv, slot.p);
+                break;
+            case 's':
+                if(args + slot.u >= end) {
+                    bad = 1;
+                    break;
+                }
+                snprintf(conv + n, sizeof(conv) - n, "s");
+                APPEND(line, off, conv, args);
+                args += (slot.u + sizeof(slot)) & ~(sizeof(slot) - 1);
+                break;
+            default:
+                snprintf(conv + n, sizeof(conv) - n, "%c", spec.conv);
+                APPEND(line, off, conv, slot.d);
+                break;
+        }
+        if(bad) {
+            break;
+        }
+    }
+    /* a record that does not match its format still gets its line */
+    if(bad) {
+        APPEND(line, off, "<bad arg>");
+    }
+    line[off] = '\0';
+    fputs(line, out);
+    fputs(NL, out);
+}
+
+/* Write out everything in the rings.  Only the background thread calls this. */
+static int drain_rings(void) {
+    int n = 0;
+    for(struct logger_ring *ring = atomic_load(&rings); ring != NULL; ring = ring->next) {
+        uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        while(tail < head) {
+            struct logger_record *rec = (struct logger_record *)(ring->data + (tail & LOGGER_RING_MASK));
+            if(rec->level != LOGGER_PAD) {
+                format_record(rec, logger_out);
+                n++;
+            }
+            tail += rec->len;
+            atomic_store_explicit(&ring->tail, tail, memory_order_release);
+        }
+    }
+    return n;
+}
+
+static void *logger_thread(void *arg) {
+    /* back off while there is nothing to write, so an idle logger stays quiet */
+    long poll_ms = LOGGER_POLL_MS;
+    pthread_mutex_lock(&logger_mutex);
+    while(1) {
+        if(!stopping && flush_requested == flush_done) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += poll_ms / 1000;
+            ts.tv_nsec += (poll_ms % 1000) * 1000000L;
+            if(ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&wake_cond, &logger_mutex, &ts);
+        }
+        uint64_t ticket = flush_requested;
+        int last = stopping;
+        pthread_mutex_unlock(&logger_mutex);
+        if(drain_rings() > 0) {
+            poll_ms = LOGGER_POLL_MS;
+        } else if(poll_ms < LOGGER_IDLE_POLL_MS) {
+            poll_ms *= 2;
+        }
+        fflush(logger_out);
+        pthread_mutex_lock(&logger_mutex);
+        flush_done = ticket;
+        pthread_cond_broadcast(&done_cond);
+        if(last) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&logger_mutex);
+    return NULL;
+}
+
+int logger_start(FILE *out) {
+    pthread_mutex_lock(&logger_mutex);
+    if(atomic_load(&running)) {
+        pthread_mutex_unlock(&logger_mutex);
+        return -1;
+    }
+    logger_out = out;
+    stopping = 0;
+    if(pthread_create(&logger_tid, NULL, logger_thread, NULL) != 0) {
+        pthread_mutex_unlock(&logger_mutex);
+        return -1;
+    }
+    atomic_store(&running, 1);
+    pthread_mutex_unlock(&logger_mutex);
+    return 0;
+}
+
+void logger_stop(void) {
+    pthread_mutex_lock(&logger_mutex);
+    if(!atomic_load(&running)) {
+        pthread_mutex_unlock(&logger_mutex);
+        return;
+    }
+    /* from here on callers write for themselves; the last pass picks up the rest */
+    atomic_store(&running, 0);
+    for(struct logger_ring *ring = atomic_load(&rings); ring != NULL; ring = ring->next) {
+        while(atomic_load(&ring->publishing)) {
+            sched_yield();
+        }
+    }
+    stopping = 1;
+    pthread_cond_signal(&wake_cond);
+    pthread_mutex_unlock(&logger_mutex);
+    pthread_join(logger_tid, NULL);
+}
+
+void logger_flush(void) {
+    pthread_mutex_lock(&logger_mutex);
+    if(atomic_load(&running)) {
+        uint64_t ticket = ++flush_requested;
+        pthread_cond_signal(&wake_cond);
+        while(flush_done < ticket && atomic_load(&running)) {
+            pthread_cond_wait(&done_cond, &logger_mutex);
+        }
+    }
+    pthread_mutex_unlock(&logger_mutex);
+}
+
+char *logger_level_name(int level) {
+    return level >= LOGGER_DEBUG && level <= LOGGER_OFF ? level_names[level] : "unknown";
+}
+
+int logger_parse_level(char *name) {
+    for(int level = LOGGER_DEBUG; level <= LOGGER_OFF; level++) {
+        if(strcmp(name, level_names[level]) == 0) {
+            return level;
+        }
+    }
+    return -1;
+}
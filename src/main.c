@@ -17,14 +17,29 @@
 #include "client_registry.h"
 #include "player_registry.h"
 #include "jeux_globals.h"
+#include "glicko.h"
+#include "game_log.h"
+#include "admin.h"
+#include "lock_prof.h"
+#include "flight.h"
+#include "logger.h"
+#include "census.h"
+#include "perfctr.h"
+#include "watchdog.h"
+#include "capture.h"
+#include "session.h"
 
 #ifdef DEBUG
 int _debug_packets_ = 1;
 #endif
 
+/* Length of a Glicko-2 rating period unless overridden with -P. */
+#define DEFAULT_RATING_PERIOD_SECS 3600
+
 static volatile sig_atomic_t terminate_flag = 0;
 static pthread_t MAIN_THREAD_FLAG;
 static int listenfd;
+static int check_census = 0;
 
 static void terminate(int status);
 
@@ -51,7 +66,7 @@ static void set_signals() {
 }
 
 static void print_usage_exit(char *prog) {
-    fprintf(stderr, "Usage: %s -p <port>\n", prog);
+    fprintf(stderr, "Usage: %s -p <port> [-r elo|glicko2] [-P <rating period secs>] [-H <game history file>] [-A <admin port or socket path>] [-L] [-F <flight dump file>] [-l <log level>] [-C] [-E] [-W <request budget ms>] [-T <packet capture file>]\n", prog);
     exit(EXIT_FAILURE);
 }
 
@@ -93,7 +108,7 @@ static void run_server(char *port) {
     terminate(EXIT_SUCCESS);
 }
 
-static int char_to_port_num(char *str) {
+static int char_to_num(char *str) {
     if(str == NULL) {
         return -1;
     }
@@ -112,7 +127,24 @@ static int char_to_port_num(char *str) {
 /*
  * "Jeux" game server.
  *
- * Usage: jeux <port>
+ * Usage: jeux -p <port> [-r elo|glicko2] [-P <rating period secs>]
+ *             [-H <game history file>] [-A <admin port or socket path>] [-L]
+ *             [-F <flight dump file>] [-l <log level>] [-C] [-E]
+ *             [-W <request budget ms>] [-T <packet capture file>]
+ *
+ * -L starts the server with mutex contention profiling enabled.
+ * -F turns on the flight recorder, which is dumped to the given file on
+ * SIGUSR1 or abort.
+ * -l sets the lowest level of log message written: debug, info, success,
+ * warn, error or off.  Only levels compiled in by debug.h are ever written.
+ * -C checks at shutdown that every object has been freed (see census.h),
+ * and makes the server exit with a failure status if not.
+ * -E counts CPU events per request type with perf_event_open(); it does
+ * nothing if the kernel does not allow it (see perfctr.h).
+ * -W starts the slow-request watchdog, which counts and reports requests
+ * taking longer than the given number of milliseconds (see watchdog.h).
+ * -T records every packet received to the given file, for replay with the
+ * capture_replay tool (see capture.h).
  */
 int main(int argc, char* argv[]){
     // Option processing should be performed here.
@@ -121,20 +153,123 @@ int main(int argc, char* argv[]){
 
     // Perform required initializations of the client_registry and
     // player_registry.
-    if(argc != 3) {
-        print_usage_exit(argv[0]);
+    char *port_str = NULL;
+    int use_glicko = 0;
+    int period_secs = DEFAULT_RATING_PERIOD_SECS;
+    char *history_path = NULL;
+    char *capture_path = NULL;
+    char *admin_addr = NULL;
+    int budget_ms = 0;
+    int opt;
+    while((opt = getopt(argc, argv, "p:r:P:H:A:LF:l:CEW:T:")) != -1) {
+        switch(opt) {
+            case 'p':
+                port_str = optarg;
+                break;
+            case 'r':
+                if(strcmp(optarg, "glicko2") == 0) {
+                    use_glicko = 1;
+                } else if(strcmp(optarg, "elo") != 0) {
+                    print_usage_exit(argv[0]);
+                }
+                break;
+            case 'P':
+                period_secs = char_to_num(optarg);
+                if(period_secs <= 0) {
+                    print_usage_exit(argv[0]);
+                }
+                break;
+            case 'H':
+                history_path = optarg;
+                break;
+            case 'A':
+                admin_addr = optarg;
+                break;
+            case 'L':
+                lprof_enable(1);
+                break;
+            case 'F':
+                if(flight_init(optarg) == -1) {
+                    fprintf(stderr, "%s: cannot set up flight recorder\n", argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'C':
+                check_census = 1;
+                break;
+            case 'E':
+                perfctr_enable(1);
+                break;
+            case 'W':
+                budget_ms = char_to_num(optarg);
+                if(budget_ms <= 0) {
+                    print_usage_exit(argv[0]);
+                }
+                break;
+            case 'T':
+                capture_path = optarg;
+                break;
+            case 'l': {
+                int level = logger_parse_level(optarg);
+                if(level == -1) {
+                    print_usage_exit(argv[0]);
+                }
+                atomic_store(&logger_level, level);
+                break;
+            }
+            default:
+                print_usage_exit(argv[0]);
+        }
     }
-    if(strcmp(argv[1], "-p") != 0) {
+    if(port_str == NULL || optind != argc) {
         print_usage_exit(argv[0]);
     }
 
     set_signals();
-    int port = char_to_port_num(argv[2]); 
+    if(logger_start(stderr) == -1) {
+        fprintf(stderr, "%s: cannot start logger\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    int port = char_to_num(port_str);
     if(port == -1) {
         print_usage_exit(argv[0]);
     }
-    client_registry = creg_init();
-    player_registry = preg_init();
+    if(jeux_core_init() == -1) {
+        fprintf(stderr, "%s: cannot initialize server\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if(use_glicko) {
+        glicko_engine = glicko_init(GLICKO_DEFAULT_TAU, period_secs);
+        if(glicko_engine == NULL) {
+            fprintf(stderr, "%s: failed to initialize Glicko-2 ratings\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if(history_path != NULL) {
+        game_log = glog_open(history_path);
+        if(game_log == NULL) {
+            fprintf(stderr, "%s: cannot open game history file %s\n", argv[0], history_path);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if(capture_path != NULL) {
+        packet_capture = capture_open(capture_path);
+        if(packet_capture == NULL) {
+            fprintf(stderr, "%s: cannot create packet capture file %s\n", argv[0], capture_path);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if(budget_ms > 0 && watchdog_start((uint64_t)budget_ms * 1000000) == -1) {
+        fprintf(stderr, "%s: cannot start watchdog\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if(admin_addr != NULL) {
+        admin_server = admin_start(admin_addr);
+        if(admin_server == NULL) {
+            fprintf(stderr, "%s: cannot open admin endpoint %s\n", argv[0], admin_addr);
+            exit(EXIT_FAILURE);
+        }
+    }
 
     // TODO: Set up the server socket and enter a loop to accept connections
     // on this socket.  For each connection, a thread should be started to
@@ -142,13 +277,17 @@ int main(int argc, char* argv[]){
     // a SIGHUP handler, so that receipt of SIGHUP will perform a clean
     // shutdown of the server.
     //while(1) { }
-    run_server(argv[2]);
+    run_server(port_str);
 }
 
 /*
  * Function called to cleanly shut down the server.
  */
 void terminate(int status) {
+    // Stop taking admin commands before the registries start going away.
+    admin_stop(admin_server);
+    watchdog_stop();
+
     // Shutdown all client connections.
     // This will trigger the eventual termination of service threads.
     creg_shutdown_all(client_registry);
@@ -157,10 +296,18 @@ void terminate(int status) {
     creg_wait_for_empty(client_registry);
     debug("%ld: All service threads terminated.", pthread_self());
 
-    // Finalize modules.
-    creg_fini(client_registry);
-    preg_fini(player_registry);
+    // Apply any rating results still pending before the players go away,
+    // and finalize modules.
+    jeux_core_fini();
+    glog_close(game_log);
+    capture_close(packet_capture);
+    glicko_fini(glicko_engine);
+
+    if(check_census && census_check_empty(stderr) == -1) {
+        status = EXIT_FAILURE;
+    }
 
     debug("%ld: Jeux server terminating", pthread_self());
+    logger_stop();
     exit(status);
 }
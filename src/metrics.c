@@ -0,0 +1,310 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "metrics.h"
+#include "protocol_ext.h"
+#include "census.h"
+#include "perfctr.h"
+#include "watchdog.h"
+
+#define METRICS_HIST_SUB_COUNT (1 << METRICS_HIST_SUB_BITS)
+
+struct metrics_shard {
+    _Atomic int64_t counters[METRIC_NCOUNTERS];
+    _Atomic uint64_t nacks[METRIC_NACK_REASONS];
+} __attribute__((aligned(64)));
+
+static struct metrics_shard shards[METRICS_SHARDS];
+
+/* per-packet-type latencies; unknown types are counted under type 0 */
+static METRICS_HISTOGRAM latency[METRIC_LATENCY_KINDS][METRICS_PKT_TYPES];
+
+static _Atomic unsigned int next_shard;
+static __thread int my_shard = -1;
+
+/* the request the calling thread is handling, and when it finished the last one */
+static __thread uint64_t request_start_ns;
+static __thread uint64_t request_done_ns;
+
+static char *latency_names[METRIC_LATENCY_KINDS] = {
+    [METRIC_LATENCY_HANDLE] = "latency_ns",
+    [METRIC_LATENCY_DELAY] = "delay_ns",
+    [METRIC_LATENCY_QUEUE] = "queue_ns",
+    [METRIC_LATENCY_FANOUT] = "fanout_ns",
+};
+
+static char *counter_names[METRIC_NCOUNTERS] = {
+    [METRIC_PACKETS_IN] = "packets_in",
+    [METRIC_PACKETS_OUT] = "packets_out",
+    [METRIC_BYTES_IN] = "bytes_in",
+    [METRIC_BYTES_OUT] = "bytes_out",
+    [METRIC_ACTIVE_CLIENTS] = "active_clients",
+    [METRIC_ACTIVE_GAMES] = "active_games",
+    [METRIC_ACTIVE_INVITATIONS] = "active_invitations",
+    [METRIC_LOG_DROPPED] = "log_dropped",
+};
+
+static char *nack_names[METRIC_NACK_REASONS] = {
+    [METRIC_NACK_NOT_LOGGED_IN] = "not_logged_in",
+    [METRIC_NACK_ALREADY_LOGGED_IN] = "already_logged_in",
+    [METRIC_NACK_LOGIN] = "login",
+    [METRIC_NACK_INVITE] = "invite",
+    [METRIC_NACK_REVOKE] = "revoke",
+    [METRIC_NACK_DECLINE] = "decline",
+    [METRIC_NACK_ACCEPT] = "accept",
+    [METRIC_NACK_MOVE] = "move",
+    [METRIC_NACK_RESIGN] = "resign",
+    [METRIC_NACK_HISTORY] = "history",
+    [METRIC_NACK_STATS] = "stats",
+    [METRIC_NACK_USERS] = "users",
+};
+
+static char *pkt_names[METRICS_PKT_TYPES] = {
+    [JEUX_NO_PKT] = "other",
+    [JEUX_LOGIN_PKT] = "login",
+    [JEUX_USERS_PKT] = "users",
+    [JEUX_INVITE_PKT] = "invite",
+    [JEUX_REVOKE_PKT] = "revoke",
+    [JEUX_ACCEPT_PKT] = "accept",
+    [JEUX_DECLINE_PKT] = "decline",
+    [JEUX_MOVE_PKT] = "move",
+    [JEUX_RESIGN_PKT] = "resign",
+    [JEUX_ACK_PKT] = "ack",
+    [JEUX_NACK_PKT] = "nack",
+    [JEUX_INVITED_PKT] = "invited",
+    [JEUX_REVOKED_PKT] = "revoked",
+    [JEUX_ACCEPTED_PKT] = "accepted",
+    [JEUX_DECLINED_PKT] = "declined",
+    [JEUX_MOVED_PKT] = "moved",
+    [JEUX_RESIGNED_PKT] = "resigned",
+    [JEUX_ENDED_PKT] = "ended",
+    [JEUX_HISTORY_PKT] = "history",
+    [JEUX_STATS_PKT] = "stats",
+};
+
+/*
+ * Threads are assigned shards round-robin the first time they record a
+ * metric.  With more threads than shards some threads share a shard,
+ * which is still correct because every update is an atomic add.
+ */
+static int shard_index(void) {
+    if(my_shard == -1) {
+        my_shard = atomic_fetch_add_explicit(&next_shard, 1, memory_order_relaxed) % METRICS_SHARDS;
+    }
+    return my_shard;
+}
+
+uint64_t metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void metrics_count(METRIC_COUNTER counter, int64_t delta) {
+    if(counter < 0 || counter >= METRIC_NCOUNTERS) {
+        return;
+    }
+    atomic_fetch_add_explicit(&shards[shard_index()].counters[counter], delta, memory_order_relaxed);
+}
+
+int64_t metrics_read(METRIC_COUNTER counter) {
+    if(counter < 0 || counter >= METRIC_NCOUNTERS) {
+        return 0;
+    }
+    int64_t total = 0;
+    for(int i = 0; i < METRICS_SHARDS; i++) {
+        total += atomic_load_explicit(&shards[i].counters[counter], memory_order_relaxed);
+    }
+    return total;
+}
+
+void metrics_nack(METRIC_NACK_REASON reason) {
+    if(reason < 0 || reason >= METRIC_NACK_REASONS) {
+        return;
+    }
+    atomic_fetch_add_explicit(&shards[shard_index()].nacks[reason], 1, memory_order_relaxed);
+}
+
+uint64_t metrics_read_nacks(METRIC_NACK_REASON reason) {
+    if(reason < 0 || reason >= METRIC_NACK_REASONS) {
+        return 0;
+    }
+    uint64_t total = 0;
+    for(int i = 0; i < METRICS_SHARDS; i++) {
+        total += atomic_load_explicit(&shards[i].nacks[reason], memory_order_relaxed);
+    }
+    return total;
+}
+
+static int bucket_index(uint64_t value) {
+    if(value < METRICS_HIST_SUB_COUNT) {
+        return value;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    if(msb >= METRICS_HIST_MAX_BITS) {
+        return METRICS_HIST_BUCKETS - 1;
+    }
+    int shift = msb - METRICS_HIST_SUB_BITS;
+    return ((shift + 1) << METRICS_HIST_SUB_BITS) +
+        ((value >> shift) & (METRICS_HIST_SUB_COUNT - 1));
+}
+
+/* largest value that falls in a bucket */
+static uint64_t bucket_upper(int index) {
+    if(index < METRICS_HIST_SUB_COUNT) {
+        return index;
+    }
+    int shift = (index >> METRICS_HIST_SUB_BITS) - 1;
+    uint64_t sub = index & (METRICS_HIST_SUB_COUNT - 1);
+    return ((METRICS_HIST_SUB_COUNT + sub + 1) << shift) - 1;
+}
+
+void metrics_hist_record(METRICS_HISTOGRAM *hist, uint64_t value) {
+    struct metrics_hist_shard *s = &hist->shards[shard_index()];
+    atomic_fetch_add_explicit(&s->buckets[bucket_index(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->sum, value, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&s->max, memory_order_relaxed);
+    while(value > max &&
+            !atomic_compare_exchange_weak_explicit(&s->max, &max, value,
+                memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+void metrics_hist_read(METRICS_HISTOGRAM *hist, METRICS_HIST_SNAPSHOT *snap) {
+    memset(snap, 0, sizeof(METRICS_HIST_SNAPSHOT));
+    for(int i = 0; i < METRICS_SHARDS; i++) {
+        struct metrics_hist_shard *s = &hist->shards[i];
+        uint64_t max = atomic_load_explicit(&s->max, memory_order_relaxed);
+        if(max > snap->max) {
+            snap->max = max;
+        }
+        snap->sum += atomic_load_explicit(&s->sum, memory_order_relaxed);
+        for(int b = 0; b < METRICS_HIST_BUCKETS; b++) {
+            snap->buckets[b] += atomic_load_explicit(&s->buckets[b], memory_order_relaxed);
+        }
+    }
+    for(int b = 0; b < METRICS_HIST_BUCKETS; b++) {
+        snap->count += snap->buckets[b];
+    }
+}
+
+uint64_t metrics_hist_quantile(METRICS_HIST_SNAPSHOT *snap, double q) {
+    if(snap->count == 0) {
+        return 0;
+    }
+    if(q < 0) {
+        q = 0;
+    } else if(q > 1) {
+        q = 1;
+    }
+    uint64_t rank = q * snap->count;
+    if(rank < q * snap->count || rank == 0) {
+        rank++;
+    }
+    uint64_t seen = 0;
+    for(int b = 0; b < METRICS_HIST_BUCKETS; b++) {
+        seen += snap->buckets[b];
+        if(seen >= rank) {
+            uint64_t upper = b == METRICS_HIST_BUCKETS - 1 ? snap->max : bucket_upper(b);
+            return upper < snap->max ? upper : snap->max;
+        }
+    }
+    return snap->max;
+}
+
+void metrics_record_latency(METRIC_LATENCY kind, int type, uint64_t ns) {
+    if(kind < 0 || kind >= METRIC_LATENCY_KINDS) {
+        return;
+    }
+    if(type < 0 || type >= METRICS_PKT_TYPES) {
+        type = JEUX_NO_PKT;
+    }
+    metrics_hist_record(&latency[kind][type], ns);
+}
+
+void metrics_read_latency(METRIC_LATENCY kind, int type, METRICS_HIST_SNAPSHOT *snap) {
+    if(kind < 0 || kind >= METRIC_LATENCY_KINDS) {
+        memset(snap, 0, sizeof(METRICS_HIST_SNAPSHOT));
+        return;
+    }
+    if(type < 0 || type >= METRICS_PKT_TYPES) {
+        type = JEUX_NO_PKT;
+    }
+    metrics_hist_read(&latency[kind][type], snap);
+}
+
+uint64_t metrics_request_begin(int type, uint32_t sent_sec, uint32_t sent_nsec) {
+    uint64_t now = metrics_now_ns();
+    uint64_t sent = (uint64_t)sent_sec * 1000000000 + sent_nsec;
+    if(sent != 0 && sent <= now && now - sent <= METRICS_MAX_CLIENT_DELAY_NS) {
+        metrics_record_latency(METRIC_LATENCY_DELAY, type, now - sent);
+        /*
+         * Sent while we were still busy with the previous request, so it
+         * sat in the socket buffer at least until that one was done.
+         */
+        metrics_record_latency(METRIC_LATENCY_QUEUE, type,
+                request_done_ns > sent ? request_done_ns - sent : 0);
+    }
+    request_start_ns = now;
+    return now;
+}
+
+uint64_t metrics_request_end(int type) {
+    uint64_t now = metrics_now_ns();
+    uint64_t elapsed = now - request_start_ns;
+    metrics_record_latency(METRIC_LATENCY_HANDLE, type, elapsed);
+    request_start_ns = 0;
+    request_done_ns = now;
+    return elapsed;
+}
+
+uint64_t metrics_request_time(void) {
+    return request_start_ns;
+}
+
+char *metrics_pkt_name(int type) {
+    if(type < 0 || type >= METRICS_PKT_TYPES || pkt_names[type] == NULL) {
+        return pkt_names[JEUX_NO_PKT];
+    }
+    return pkt_names[type];
+}
+
+void metrics_hist_write(FILE *out, char *name, METRICS_HIST_SNAPSHOT *snap) {
+    fprintf(out, "%s_count\t%lu\n", name, snap->count);
+    fprintf(out, "%s_sum\t%lu\n", name, snap->sum);
+    fprintf(out, "%s_max\t%lu\n", name, snap->max);
+    fprintf(out, "%s_p50\t%lu\n", name, metrics_hist_quantile(snap, 0.5));
+    fprintf(out, "%s_p90\t%lu\n", name, metrics_hist_quantile(snap, 0.9));
+    fprintf(out, "%s_p99\t%lu\n", name, metrics_hist_quantile(snap, 0.99));
+    fprintf(out, "%s_p999\t%lu\n", name, metrics_hist_quantile(snap, 0.999));
+}
+
+void metrics_write(FILE *out) {
+    for(int c = 0; c < METRIC_NCOUNTERS; c++) {
+        fprintf(out, "%s\t%ld\n", counter_names[c], metrics_read(c));
+    }
+    for(int r = 0; r < METRIC_NACK_REASONS; r++) {
+        fprintf(out, "nacks_%s\t%lu\n", nack_names[r], metrics_read_nacks(r));
+    }
+    census_write(out);
+    perfctr_write(out);
+    watchdog_write(out);
+
+    METRICS_HIST_SNAPSHOT *snap = malloc(sizeof(METRICS_HIST_SNAPSHOT));
+    if(snap == NULL) {
+        return;
+    }
+    for(int k = 0; k < METRIC_LATENCY_KINDS; k++) {
+        for(int t = 0; t < METRICS_PKT_TYPES; t++) {
+            metrics_read_latency(k, t, snap);
+            if(snap->count == 0) {
+                continue;
+            }
+            char name[64];
+            snprintf(name, sizeof(name), "%s_%s", latency_names[k], metrics_pkt_name(t));
+            metrics_hist_write(out, name, snap);
+        }
+    }
+    free(snap);
+}
@@ -1,6 +1,9 @@
 #include <time.h>
 
 #include "packet_common.h"
+#include "metrics.h"
+
+uint64_t (*packet_clock)(void) = NULL;
 
 void pack_header(JEUX_PACKET_HEADER *jph, 
         uint8_t type,
@@ -12,10 +15,25 @@ void pack_header(JEUX_PACKET_HEADER *jph,
     jph->role = role;
     jph->size = htons(size);
 
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    uint32_t tsec = ts.tv_sec;
-    uint32_t tnsec = ts.tv_nsec;
+    /*
+     * Notifications carry the time the request that caused them was
+     * received, so the receiver can tell how long the fan-out took.
+     */
+    uint64_t request_ns = metrics_request_time();
+    uint32_t tsec, tnsec;
+    if(packet_clock != NULL) {
+        uint64_t now = packet_clock();
+        tsec = now / 1000000000;
+        tnsec = now % 1000000000;
+    } else if(type >= JEUX_INVITED_PKT && type <= JEUX_ENDED_PKT && request_ns != 0) {
+        tsec = request_ns / 1000000000;
+        tnsec = request_ns % 1000000000;
+    } else {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        tsec = ts.tv_sec;
+        tnsec = ts.tv_nsec;
+    }
 
     jph->timestamp_sec = htonl(tsec);
     jph->timestamp_nsec = htonl(tnsec);
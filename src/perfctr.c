@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfctr.h"
+#include "metrics.h"
+#include "debug.h"
+
+struct perfctr_thread {
+    int leader;                     /* group leader, -1 if nothing could be opened */
+    int fds[PERFCTR_NEVENTS];       /* -1 for events not provided */
+    int order[PERFCTR_NEVENTS];     /* events in the order a group read returns them */
+    int nopen;
+    uint64_t start[PERFCTR_NEVENTS];
+    int started;
+};
+
+struct perfctr_read_group {
+    uint64_t nr;
+    uint64_t values[PERFCTR_NEVENTS];
+};
+
+atomic_int perfctr_enabled = 0;
+
+static _Atomic uint64_t requests[METRICS_PKT_TYPES];
+static _Atomic uint64_t totals[METRICS_PKT_TYPES][PERFCTR_NEVENTS];
+static atomic_int available[PERFCTR_NEVENTS];
+
+static __thread struct perfctr_thread *me = NULL;
+static __thread int open_failed = 0;
+
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+
+static struct {
+    uint32_t type;
+    uint64_t config;
+    char *name;
+} events[PERFCTR_NEVENTS] = {
+    [PERFCTR_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+    [PERFCTR_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+    [PERFCTR_CACHE_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache_misses" },
+    [PERFCTR_CONTEXT_SWITCHES] = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context_switches" },
+};
+
+static int open_event(PERFCTR_EVENT event, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[event].type;
+    attr.config = events[event].config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+    if(fd == -1 && (errno == EACCES || errno == EPERM)) {
+        /* perf_event_paranoid may still allow counting our own user-space code */
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+    }
+    return fd;
+}
+
+static void close_counters(struct perfctr_thread *t) {
+    for(int e = 0; e < PERFCTR_NEVENTS; e++) {
+        if(t->fds[e] != -1) {
+            close(t->fds[e]);
+        }
+    }
+}
+
+/* Open the calling thread's counters; returns 0 if at least one could be opened. */
+static int open_counters(struct perfctr_thread *t) {
+    t->leader = -1;
+    t->nopen = 0;
+    t->started = 0;
+    for(int e = 0; e < PERFCTR_NEVENTS; e++) {
+        t->fds[e] = open_event(e, t->leader);
+        if(t->fds[e] == -1) {
+            continue;
+        }
+        if(t->leader == -1) {
+            t->leader = t->fds[e];
+        }
+        t->order[t->nopen++] = e;
+    }
+    return t->leader == -1 ? -1 : 0;
+}
+
+/* Runs at thread exit. */
+static void free_thread(void *arg) {
+    struct perfctr_thread *t = arg;
+    close_counters(t);
+    free(t);
+    me = NULL;
+}
+
+static void make_thread_key(void) {
+    pthread_key_create(&thread_key, free_thread);
+}
+
+static struct perfctr_thread *thread_counters(void) {
+    if(me != NULL || open_failed) {
+        return me;
+    }
+    pthread_once(&thread_key_once, make_thread_key);
+    struct perfctr_thread *t = malloc(sizeof(struct perfctr_thread));
+    if(t == NULL || open_counters(t) == -1) {
+        free(t);
+        open_failed = 1;
+        return NULL;
+    }
+    for(int i = 0; i < t->nopen; i++) {
+        atomic_store_explicit(&available[t->order[i]], 1, memory_order_relaxed);
+    }
+    pthread_setspecific(thread_key, t);
+    return me = t;
+}
+
+static int read_counters(struct perfctr_thread *t, uint64_t values[PERFCTR_NEVENTS]) {
+    struct perfctr_read_group group;
+    ssize_t n = read(t->leader, &group, sizeof(group));
+    if(n != (ssize_t)(sizeof(uint64_t) * (1 + t->nopen)) || group.nr != t->nopen) {
+        return -1;
+    }
+    for(int i = 0; i < t->nopen; i++) {
+        values[t->order[i]] = group.values[i];
+    }
+    return 0;
+}
+
+void perfctr_begin_slow(void) {
+    struct perfctr_thread *t = thread_counters();
+    if(t == NULL) {
+        return;
+    }
+    t->started = read_counters(t, t->start) == 0;
+}
+
+void perfctr_end_slow(int type) {
+    struct perfctr_thread *t = me;
+    if(t == NULL || !t->started) {
+        return;
+    }
+    t->started = 0;
+    uint64_t now[PERFCTR_NEVENTS];
+    if(read_counters(t, now) == -1) {
+        return;
+    }
+    if(type < 0 || type >= METRICS_PKT_TYPES) {
+        type = 0;
+    }
+    for(int i = 0; i < t->nopen; i++) {
+        int e = t->order[i];
+        atomic_fetch_add_explicit(&totals[type][e], now[e] - t->start[e], memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&requests[type], 1, memory_order_relaxed);
+}
+
+int perfctr_enable(int on) {
+    if(!on) {
+        atomic_store(&perfctr_enabled, 0);
+        return 0;
+    }
+    struct perfctr_thread probe;
+    if(open_counters(&probe) == -1) {
+        debug("%ld: No performance counters could be opened (%s)", pthread_self(), strerror(errno));
+        return -1;
+    }
+    close_counters(&probe);
+    atomic_store(&perfctr_enabled, 1);
+    return 0;
+}
+
+uint64_t perfctr_read(int type, uint64_t t[PERFCTR_NEVENTS], int a[PERFCTR_NEVENTS]) {
+    for(int e = 0; e < PERFCTR_NEVENTS; e++) {
+        t[e] = atomic_load_explicit(&totals[type][e], memory_order_relaxed);
+        a[e] = atomic_load_explicit(&available[e], memory_order_relaxed);
+    }
+    return atomic_load_explicit(&requests[type], memory_order_relaxed);
+}
+
+void perfctr_write(FILE *out) {
+    for(int type = 0; type < METRICS_PKT_TYPES; type++) {
+        uint64_t t[PERFCTR_NEVENTS];
+        int a[PERFCTR_NEVENTS];
+        uint64_t n = perfctr_read(type, t, a);
+        if(n == 0) {
+            continue;
+        }
+        fprintf(out, "perf_requests_%s\t%lu\n", metrics_pkt_name(type), n);
+        for(int e = 0; e < PERFCTR_NEVENTS; e++) {
+            if(a[e]) {
+                fprintf(out, "perf_%s_%s\t%lu\n", events[e].name, metrics_pkt_name(type), t[e]);
+            }
+        }
+    }
+}
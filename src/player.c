@@ -1,18 +1,53 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
-#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "player.h"
+#include "player_ext.h"
+#include "rating.h"
+#include "glicko.h"
 #include "debug.h"
+#include "lock_prof.h"
+#include "flight.h"
+#include "census.h"
+#include "probes.h"
 
-static int player_id = 0; /* need this for some kind of hierarchy on mutex locks */
+static int player_id = 0; /* unique id for each player created */
+
+static atomic_size_t history_bytes = 0;
+
+/*
+ * Times player_get_history() reads the ring over while games are being
+ * recorded into it, before it settles for the slots it could read whole.
+ */
+#define HISTORY_READ_TRIES 4
+
+/*
+ * One slot of a player's rating history ring (16 bytes).  seq is n + 1
+ * (mod 2^32) once the slot holds the n-th game recorded for the player,
+ * and 0 while it is being written, so readers can detect slots that are
+ * incomplete or overwritten.  The slot holds the rating the game left the
+ * player with, so it stands on its own whatever order slots are filled in.
+ */
+struct history_slot {
+    _Atomic uint32_t seq;
+    uint32_t timestamp_sec;
+    int32_t opponent_id;
+    int16_t rating;
+    uint8_t outcome;
+};
 
 struct player {
-    pthread_mutex_t rating_mutex;
-    double rating;
+    _Atomic int64_t rating; /* fixed point, see rating.h */
     int id;
 
+    /* Ring of the last PLAYER_HISTORY_LEN games, written without locking. */
+    atomic_uint_fast64_t history_head;
+    struct history_slot history[PLAYER_HISTORY_LEN];
+
     char *name;
     pthread_mutex_t mutex;
     size_t ref_count;
@@ -27,14 +62,21 @@ PLAYER* player_create(char *name) {
         debug("%ld: Player failed to initialize", pthread_self());
         return NULL;
     }
-    p->rating = PLAYER_INITIAL_RATING;
+    atomic_init(&p->rating, RATING_TO_FIXED(PLAYER_INITIAL_RATING));
     p->name = strdup(name);
     p->ref_count = 0;
     p->id = player_id++;
+    atomic_init(&p->history_head, 0);
+    for(int i = 0; i < PLAYER_HISTORY_LEN; i++) {
+        atomic_init(&p->history[i].seq, 0);
+    }
+    atomic_fetch_add(&history_bytes, sizeof(p->history));
+    census_create(CENSUS_PLAYER, CENSUS_MEM_PLAYER, sizeof(PLAYER));
+    census_bytes(CENSUS_MEM_PLAYER_NAMES, strlen(name) + 1);
 
-    pthread_mutex_init(&p->rating_mutex, NULL);
     pthread_mutex_init(&p->mutex, NULL);
 
+    flight_record(FLIGHT_PLAYER, FLIGHT_CREATE, p, NULL, 0);
     player_ref(p, "for newly created player");
 
     return p;
@@ -46,13 +88,14 @@ PLAYER *player_ref(PLAYER *player, char *why) {
         return NULL;
     }
 
-    pthread_mutex_lock(&player->mutex);
+    lprof_lock(&player->mutex, LOCK_SITE_PLAYER);
     size_t old_ref = player->ref_count;
     player->ref_count = old_ref + 1;
 
     debug("%ld: Increase reference count on player %p (%lu -> %lu) %s", pthread_self(), player, old_ref, player->ref_count, why); 
+    flight_record(FLIGHT_PLAYER, FLIGHT_REF, player, why, player->ref_count);
     
-    pthread_mutex_unlock(&player->mutex);
+    lprof_unlock(&player->mutex);
     return player;
 }
 
@@ -63,65 +106,160 @@ void player_unref(PLAYER *player, char *why) {
         return;
     }
 
-    pthread_mutex_lock(&player->mutex);
+    lprof_lock(&player->mutex, LOCK_SITE_PLAYER);
     size_t old_ref = player->ref_count;
     player->ref_count = old_ref - 1;
 
     debug("%ld: Decrease reference count on player %p (%lu -> %lu) %s", pthread_self(), player, old_ref, player->ref_count, why); 
+    flight_record(FLIGHT_PLAYER, FLIGHT_UNREF, player, why, player->ref_count);
 
     if(player->ref_count == 0) {
+        atomic_fetch_sub(&history_bytes, sizeof(player->history));
+        census_free(CENSUS_PLAYER, CENSUS_MEM_PLAYER, sizeof(PLAYER));
+        census_bytes(CENSUS_MEM_PLAYER_NAMES, -(int64_t)(strlen(player->name) + 1));
         free(player->name);
-        pthread_mutex_unlock(&player->mutex);
+        lprof_unlock(&player->mutex);
         pthread_mutex_destroy(&player->mutex);
-
-        pthread_mutex_destroy(&player->rating_mutex);
-        free(player);
+        flight_record(FLIGHT_PLAYER, FLIGHT_FREE, player, why, 0);
         debug("%ld: Free player %p", pthread_self(), player);
+        free(player);
         return;
     }
-    pthread_mutex_unlock(&player->mutex);
+    lprof_unlock(&player->mutex);
 }
 
 char *player_get_name(PLAYER *player) {
     return player->name;
 }
 
-int player_get_rating(PLAYER *player) {
-    pthread_mutex_lock(&player->rating_mutex);
-    int rating = (int)round(player->rating);
-    pthread_mutex_unlock(&player->rating_mutex);
+int player_get_id(PLAYER *player) {
+    return player->id;
+}
 
-    return rating;
+size_t player_get_ref_count(PLAYER *player) {
+    lprof_lock(&player->mutex, LOCK_SITE_PLAYER);
+    size_t ref_count = player->ref_count;
+    lprof_unlock(&player->mutex);
+    return ref_count;
 }
 
-// the 1 2 2 1 deadlock
-void player_post_result(PLAYER *player1, PLAYER *player2, int result) {
-    if(player1 == NULL || player2 == NULL) {
-        return;
+/*
+ * Record a game in a player's history.  The slot is claimed only once the
+ * game's rating has been applied, so while one thread posts results, as
+ * the rating queue does, slots follow the order of the updates.
+ */
+static void history_record(PLAYER *player, uint32_t timestamp_sec, int opponent_id,
+        int64_t rating, int outcome) {
+    uint_fast64_t n = atomic_fetch_add(&player->history_head, 1);
+    struct history_slot *slot = &player->history[n % PLAYER_HISTORY_LEN];
+    int r = rating_round(rating);
+
+    atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->timestamp_sec = timestamp_sec;
+    slot->opponent_id = opponent_id;
+    slot->rating = r > INT16_MAX ? INT16_MAX : r < INT16_MIN ? INT16_MIN : r;
+    slot->outcome = outcome;
+    atomic_store_explicit(&slot->seq, (uint32_t)(n + 1), memory_order_release);
+}
+
+/*
+ * Copy the n-th game recorded for a player, if its slot holds it whole.
+ *
+ * @return 1 if the slot was copied, 0 if it is being written or was
+ * overwritten by a later game.
+ */
+static int history_read(PLAYER *player, uint_fast64_t n, struct history_slot *copy) {
+    struct history_slot *slot = &player->history[n % PLAYER_HISTORY_LEN];
+    if(atomic_load_explicit(&slot->seq, memory_order_acquire) != (uint32_t)(n + 1)) {
+        return 0;
     }
-    if(player1->id < player2->id) {
-        pthread_mutex_lock(&player1->rating_mutex);
-        pthread_mutex_lock(&player2->rating_mutex);
-    } else {
-        pthread_mutex_lock(&player2->rating_mutex);
-        pthread_mutex_lock(&player1->rating_mutex);
+    copy->timestamp_sec = slot->timestamp_sec;
+    copy->opponent_id = slot->opponent_id;
+    copy->rating = slot->rating;
+    copy->outcome = slot->outcome;
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&slot->seq, memory_order_relaxed) == (uint32_t)(n + 1);
+}
+
+/*
+ * The ring is read without locking.  If games are recorded meanwhile, it
+ * is read over, but only HISTORY_READ_TRIES times, so a busy player cannot
+ * starve readers; after that, only the games newer than the newest slot
+ * caught being written are returned, so no game is missing in between.
+ */
+int player_get_history(PLAYER *player, PLAYER_HISTORY_ENTRY *entries, int max) {
+    if(player == NULL || entries == NULL || max <= 0) {
+        return 0;
+    }
+    struct history_slot copy[PLAYER_HISTORY_LEN];
+    int valid[PLAYER_HISTORY_LEN];
+    int count = 0, complete = 0;
+    for(int tries = 0; tries < HISTORY_READ_TRIES && !complete; tries++) {
+        uint_fast64_t head = atomic_load(&player->history_head);
+        count = head < PLAYER_HISTORY_LEN ? head : PLAYER_HISTORY_LEN;
+        if(count > max) {
+            count = max;
+        }
+        complete = 1;
+        /* copy is newest first */
+        for(int i = 0; i < count; i++) {
+            valid[i] = history_read(player, head - 1 - i, &copy[i]);
+            complete &= valid[i];
+        }
     }
 
-    double s1 = result == 0 ? 0.5 : result == 1 ? 1 : 0;
-    double s2 = result == 0 ? 0.5 : result == 2 ? 1 : 0;
+    int n = 0;
+    while(n < count && valid[n]) {
+        n++;
+    }
+    for(int i = 0; i < n; i++) {
+        PLAYER_HISTORY_ENTRY *e = &entries[n - 1 - i];
+        e->timestamp_sec = copy[i].timestamp_sec;
+        e->opponent_id = copy[i].opponent_id;
+        e->outcome = copy[i].outcome;
+        e->rating = copy[i].rating;
+    }
+    return n;
+}
 
-    double r1 = player1->rating;
-    double r2 = player2->rating;
+size_t player_history_bytes(void) {
+    return atomic_load(&history_bytes);
+}
 
-    double e1 = 1.0 / (1.0 + (pow(10.0, (r2 - r1) / 400.0))); 
-    double e2 = 1.0 / (1.0 + (pow(10.0, (r1 - r2) / 400.0)));
+int player_get_rating(PLAYER *player) {
+    if(glicko_engine != NULL) {
+        return glicko_get_rating(glicko_engine, player->id);
+    }
+    return rating_round(atomic_load(&player->rating));
+}
 
-    double player1_new_rating = r1 + 32 * (s1 - e1); 
-    double player2_new_rating = r2 + 32 * (s2 - e2); 
+/*
+ * Both ratings are snapshotted, the adjustment is computed from the
+ * snapshot, and player1 is updated with a CAS that fails if player1 moved
+ * in the meantime, in which case the whole update is retried.  player2 then
+ * receives exactly the negated adjustment, so rating points are conserved
+ * even if player2 was updated concurrently after the snapshot.  Each game
+ * goes into the histories with the ratings the CASes installed.
+ */
+void player_post_result(PLAYER *player1, PLAYER *player2, int result) {
+    if(player1 == NULL || player2 == NULL || player1 == player2) {
+        return;
+    }
+    int64_t r1, r2, delta;
+    do {
+        r1 = atomic_load(&player1->rating);
+        r2 = atomic_load(&player2->rating);
+        delta = rating_elo_delta(r1, r2, result);
+    } while(!atomic_compare_exchange_weak(&player1->rating, &r1, r1 + delta));
 
-    player1->rating = player1_new_rating;
-    player2->rating = player2_new_rating;
-    
-    pthread_mutex_unlock(&player1->rating_mutex);
-    pthread_mutex_unlock(&player2->rating_mutex);
+    while(!atomic_compare_exchange_weak(&player2->rating, &r2, r2 - delta))
+        ;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    int outcome1 = result == 0 ? PLAYER_HISTORY_DRAW : result == 1 ? PLAYER_HISTORY_WIN : PLAYER_HISTORY_LOSS;
+    history_record(player1, ts.tv_sec, player2->id, r1 + delta, outcome1);
+    history_record(player2, ts.tv_sec, player1->id, r2 - delta, PLAYER_HISTORY_WIN - outcome1);
+    TRACE_JEUX_PLAYER_RESULT(player1->id, player2->id, result, delta);
 }
@@ -4,7 +4,10 @@
 
 #include "jeux_globals.h"
 #include "debug.h"
+#include "lock_prof.h"
 #include "player_registry.h"
+#include "player_registry_ext.h"
+#include "player_ext.h"
 
 struct player_registry {
     PLAYER **preg_arr;
@@ -39,7 +42,7 @@ void preg_fini(PLAYER_REGISTRY *preg) {
         return;
     }
 
-    pthread_mutex_lock(&preg->mutex);
+    lprof_lock(&preg->mutex, LOCK_SITE_PREG);
     for(int i = 0; i < preg->cap; ++i) {
         if(preg->preg_arr[i] != NULL) {
             player_unref(preg->preg_arr[i], "because player registry is being freed");
@@ -49,13 +52,13 @@ void preg_fini(PLAYER_REGISTRY *preg) {
         free(preg->preg_arr);
         preg->preg_arr = NULL;
     }
-    pthread_mutex_unlock(&preg->mutex);
+    lprof_unlock(&preg->mutex);
     pthread_mutex_destroy(&preg->mutex);
     free(preg);
 }
 
 PLAYER *preg_register(PLAYER_REGISTRY *preg, char *name) {
-    pthread_mutex_lock(&preg->mutex);
+    lprof_lock(&preg->mutex, LOCK_SITE_PREG);
     if(preg->len >= preg->cap) {
         preg->preg_arr = reallocarray(preg->preg_arr, preg->cap * 2, sizeof(PLAYER *));
 
@@ -75,7 +78,7 @@ PLAYER *preg_register(PLAYER_REGISTRY *preg, char *name) {
         }
     }
     if(player != NULL) {
-        pthread_mutex_unlock(&preg->mutex);
+        lprof_unlock(&preg->mutex);
         return player_ref(player, "existing player found");
     }
     for(int i = 0; i < preg->cap; ++i) {
@@ -87,6 +90,91 @@ PLAYER *preg_register(PLAYER_REGISTRY *preg, char *name) {
         }
     }
     preg->len++;
-    pthread_mutex_unlock(&preg->mutex);
+    lprof_unlock(&preg->mutex);
     return player;
 }
+
+PLAYER *preg_lookup(PLAYER_REGISTRY *preg, char *name) {
+    lprof_lock(&preg->mutex, LOCK_SITE_PREG);
+    PLAYER *player = NULL;
+    for(int i = 0; i < preg->cap; ++i) {
+        if(preg->preg_arr[i] != NULL && strcmp(name, player_get_name(preg->preg_arr[i])) == 0) {
+            player = player_ref(preg->preg_arr[i], "for reference being returned by preg_lookup()");
+            break;
+        }
+    }
+    lprof_unlock(&preg->mutex);
+    return player;
+}
+
+PLAYER *preg_lookup_id(PLAYER_REGISTRY *preg, int id) {
+    lprof_lock(&preg->mutex, LOCK_SITE_PREG);
+    PLAYER *player = NULL;
+    for(int i = 0; i < preg->cap; ++i) {
+        if(preg->preg_arr[i] != NULL && player_get_id(preg->preg_arr[i]) == id) {
+            player = player_ref(preg->preg_arr[i], "for reference being returned by preg_lookup_id()");
+            break;
+        }
+    }
+    lprof_unlock(&preg->mutex);
+    return player;
+}
+
+int preg_lookup_ids(PLAYER_REGISTRY *preg, int *ids, int n, PLAYER **players) {
+    int found = 0;
+    for(int j = 0; j < n; j++) {
+        players[j] = NULL;
+    }
+    lprof_lock(&preg->mutex, LOCK_SITE_PREG);
+    for(int i = 0; i < preg->cap && found < n; ++i) {
+        if(preg->preg_arr[i] == NULL) {
+            continue;
+        }
+        int id = player_get_id(preg->preg_arr[i]);
+        for(int j = 0; j < n; j++) {
+            if(ids[j] == id && players[j] == NULL) {
+                players[j] = player_ref(preg->preg_arr[i], "for reference being returned by preg_lookup_ids()");
+                found++;
+            }
+        }
+    }
+    lprof_unlock(&preg->mutex);
+    return found;
+}
+
+PLAYER **preg_all_players(PLAYER_REGISTRY *preg) {
+    lprof_lock(&preg->mutex, LOCK_SITE_PREG);
+    PLAYER **players = calloc(preg->len + 1, sizeof(PLAYER *));
+    if(players == NULL) {
+        lprof_unlock(&preg->mutex);
+        return NULL;
+    }
+    size_t n = 0;
+    for(int i = 0; i < preg->cap; ++i) {
+        if(preg->preg_arr[i] != NULL) {
+            players[n++] = player_ref(preg->preg_arr[i], "for reference being added to player's list");
+        }
+    }
+    lprof_unlock(&preg->mutex);
+    return players;
+}
+
+int preg_collect_idle(PLAYER_REGISTRY *preg) {
+    int removed = 0;
+    lprof_lock(&preg->mutex, LOCK_SITE_PREG);
+    for(int i = 0; i < preg->cap; ++i) {
+        /*
+         * New references to a registered player are only handed out under
+         * the registry mutex, so a count of one cannot grow while we hold it.
+         */
+        if(preg->preg_arr[i] != NULL && player_get_ref_count(preg->preg_arr[i]) == 1) {
+            player_unref(preg->preg_arr[i], "because idle player is being collected");
+            preg->preg_arr[i] = NULL;
+            preg->len--;
+            removed++;
+        }
+    }
+    lprof_unlock(&preg->mutex);
+    debug("%ld: Collected %d idle players", pthread_self(), removed);
+    return removed;
+}
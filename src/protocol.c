@@ -3,10 +3,62 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <malloc.h>
+#include <sys/uio.h>
 
 #include "protocol.h"
+#include "protocol_ext.h"
+#include "metrics.h"
+#include "census.h"
+#include "capture.h"
 #include "debug.h"
 
+/*
+ * Payloads of up to this many bytes are all allocated at this size, so
+ * that any one of them can be reused for another.
+ */
+#define PROTO_SMALL_PAYLOAD 256
+
+/* Small payloads each thread keeps for reuse. */
+#define PROTO_PAYLOAD_CACHE 8
+
+/* Storage a thread keeps to receive and build payloads without allocating. */
+struct proto_thread {
+    void *cache[PROTO_PAYLOAD_CACHE];
+    int ncached;
+    char *scratch;
+    size_t scratch_size;
+};
+
+static __thread struct proto_thread *me = NULL;
+
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+
+static void release_thread(void *arg) {
+    struct proto_thread *t = arg;
+    while(t->ncached > 0) {
+        free(t->cache[--t->ncached]);
+    }
+    free(t->scratch);
+    free(t);
+    me = NULL;
+}
+
+static void make_thread_key(void) {
+    pthread_key_create(&thread_key, release_thread);
+}
+
+static struct proto_thread *claim_thread(void) {
+    pthread_once(&thread_key_once, make_thread_key);
+    struct proto_thread *t = calloc(1, sizeof(struct proto_thread));
+    if(t != NULL) {
+        pthread_setspecific(thread_key, t);
+    }
+    return t;
+}
+
 static ssize_t fd_op(int fd, void *byte_ptr, size_t size, 
         ssize_t (*op_write)(int, const void *, size_t), 
         ssize_t (*op_read)(int, void *, size_t)) {
@@ -35,31 +87,120 @@ static ssize_t fd_op(int fd, void *byte_ptr, size_t size,
     return 1;
 }
 
-int proto_send_packet(int fd, JEUX_PACKET_HEADER *hdr, void *data) {
-    if(fd_op(fd, hdr, sizeof(JEUX_PACKET_HEADER), write, NULL) == -1) {
-        return -1;
-    }
-    size_t sz = ntohs(hdr->size);
-    if(data != NULL && sz > 0) {
-        if(fd_op(fd, data, sz, write, NULL) == -1) {
+/*
+ * The header and payload are written together: written separately, the
+ * payload can be held back by Nagle's algorithm until the peer's delayed
+ * ACK of the header, some 40ms later.
+ */
+static int write_packet(int fd, struct iovec *iov, int iovcnt) {
+    while(iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if(n == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
             return -1;
         }
+        while(iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
     }
+    return 0;
+}
+
+int proto_send_packet(int fd, JEUX_PACKET_HEADER *hdr, void *data) {
+    size_t sz = ntohs(hdr->size);
+    struct iovec iov[2] = {
+        { .iov_base = hdr, .iov_len = sizeof(JEUX_PACKET_HEADER) },
+        { .iov_base = data, .iov_len = sz }
+    };
+    if(write_packet(fd, iov, data != NULL && sz > 0 ? 2 : 1) == -1) {
+        return -1;
+    }
+    metrics_count(METRIC_PACKETS_OUT, 1);
+    metrics_count(METRIC_BYTES_OUT, sizeof(JEUX_PACKET_HEADER) + (data != NULL ? sz : 0));
 
     return 0;
 }
 
 int proto_recv_packet(int fd, JEUX_PACKET_HEADER *hdr, void **payloadp) {
+    CAPTURE *cap = packet_capture;
     if(fd_op(fd, hdr, sizeof(JEUX_PACKET_HEADER), NULL, read) == -1) {
+        if(cap != NULL) {
+            capture_end(cap, fd);
+        }
         return -1;
     }
     size_t payload_size = ntohs(hdr->size);
     if(payload_size > 0) {
-        *payloadp = malloc(sizeof(uint8_t) * payload_size);
+        *payloadp = proto_alloc_payload(payload_size);
         if(fd_op(fd, *payloadp, payload_size, NULL, read) == -1) {
+            if(cap != NULL) {
+                capture_end(cap, fd);
+            }
             return -1;
         }
     }
+    if(cap != NULL) {
+        capture_packet(cap, fd, hdr, payload_size > 0 ? *payloadp : NULL);
+    }
+    metrics_count(METRIC_PACKETS_IN, 1);
+    metrics_count(METRIC_BYTES_IN, sizeof(JEUX_PACKET_HEADER) + payload_size);
 
     return 0;
 }
+
+void *proto_alloc_payload(size_t size) {
+    void *payload;
+    if(size <= PROTO_SMALL_PAYLOAD && me != NULL && me->ncached > 0) {
+        payload = me->cache[--me->ncached];
+    } else {
+        payload = malloc(sizeof(uint8_t) * (size <= PROTO_SMALL_PAYLOAD ? PROTO_SMALL_PAYLOAD : size));
+    }
+    if(payload != NULL) {
+        census_create(CENSUS_PAYLOAD, CENSUS_MEM_PAYLOAD, size);
+    }
+    return payload;
+}
+
+void proto_free_payload(void *payload, size_t size) {
+    if(payload == NULL) {
+        return;
+    }
+    census_free(CENSUS_PAYLOAD, CENSUS_MEM_PAYLOAD, size);
+    /*
+     * Only storage with room for any small payload is kept, whoever
+     * allocated it: a host may pass in a payload it allocated itself.
+     */
+    if(size <= PROTO_SMALL_PAYLOAD && malloc_usable_size(payload) >= PROTO_SMALL_PAYLOAD &&
+            (me != NULL || (me = claim_thread()) != NULL) && me->ncached < PROTO_PAYLOAD_CACHE) {
+        me->cache[me->ncached++] = payload;
+        return;
+    }
+    free(payload);
+}
+
+void *proto_scratch_payload(size_t size) {
+    if(me == NULL && (me = claim_thread()) == NULL) {
+        return NULL;
+    }
+    if(size > me->scratch_size) {
+        size_t new_size = me->scratch_size == 0 ? PROTO_SMALL_PAYLOAD : me->scratch_size;
+        while(new_size < size) {
+            new_size *= 2;
+        }
+        char *scratch = realloc(me->scratch, new_size);
+        if(scratch == NULL) {
+            return NULL;
+        }
+        me->scratch = scratch;
+        me->scratch_size = new_size;
+    }
+    return me->scratch;
+}
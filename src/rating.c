@@ -0,0 +1,45 @@
+#include <pthread.h>
+#include <math.h>
+
+#include "rating.h"
+
+/* expect_table[RATING_EXPECT_SPAN + d] holds the expected score at a difference of d points */
+static int64_t expect_table[2 * RATING_EXPECT_SPAN + 1];
+static pthread_once_t expect_once = PTHREAD_ONCE_INIT;
+
+static void init_expect_table(void) {
+    for(int d = -RATING_EXPECT_SPAN; d <= RATING_EXPECT_SPAN; d++) {
+        double e = 1.0 / (1.0 + pow(10.0, d / 400.0));
+        expect_table[RATING_EXPECT_SPAN + d] = llround(e * RATING_ONE);
+    }
+}
+
+int rating_round(int64_t r) {
+    return (int)((r + RATING_ONE / 2) >> RATING_FRAC_BITS);
+}
+
+int64_t rating_expect(int64_t diff) {
+    pthread_once(&expect_once, init_expect_table);
+
+    const int64_t lo = -RATING_TO_FIXED(RATING_EXPECT_SPAN);
+    const int64_t hi = RATING_TO_FIXED(RATING_EXPECT_SPAN);
+    if(diff <= lo) {
+        return expect_table[0];
+    }
+    if(diff >= hi) {
+        return expect_table[2 * RATING_EXPECT_SPAN];
+    }
+    /* linear interpolation between the two whole-point entries around diff */
+    int64_t off = diff - lo;
+    int64_t idx = off >> RATING_FRAC_BITS;
+    int64_t frac = off & (RATING_ONE - 1);
+    int64_t e0 = expect_table[idx];
+    int64_t e1 = expect_table[idx + 1];
+    return e0 + (((e1 - e0) * frac) >> RATING_FRAC_BITS);
+}
+
+int64_t rating_elo_delta(int64_t r1, int64_t r2, int result) {
+    int64_t s1 = result == 0 ? RATING_ONE / 2 : result == 1 ? RATING_ONE : 0;
+    int64_t e1 = rating_expect(r2 - r1);
+    return RATING_ELO_K * (s1 - e1);
+}
@@ -0,0 +1,174 @@
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "rating_queue.h"
+#include "player_ext.h"
+#include "glicko.h"
+#include "game_log.h"
+#include "debug.h"
+
+RATING_QUEUE *rating_queue = NULL;
+
+struct rating_result {
+    PLAYER *p1;
+    PLAYER *p2;
+    int result;
+    struct rating_result *next;
+};
+
+struct rating_queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t pending_cond; /* signalled when results are posted */
+    pthread_cond_t applied_cond; /* signalled when a batch has been applied */
+    struct rating_result *head;
+    struct rating_result *tail;
+    volatile unsigned long posted;
+    volatile unsigned long applied;
+    volatile int stop;
+    pthread_t tid;
+};
+
+/*
+ * Apply a result with whichever rating engine the server is using, and
+ * record it in the game log so the history can be replayed.
+ */
+static void apply_result(PLAYER *player1, PLAYER *player2, int result) {
+    if(glicko_engine != NULL) {
+        glicko_record(glicko_engine, player_get_id(player1), player_get_id(player2), result);
+    } else {
+        player_post_result(player1, player2, result);
+    }
+    if(game_log != NULL) {
+        glog_append(game_log, player_get_name(player1), player_get_name(player2), result);
+    }
+}
+
+static void apply_batch(struct rating_result *batch) {
+    while(batch != NULL) {
+        struct rating_result *next = batch->next;
+        apply_result(batch->p1, batch->p2, batch->result);
+        player_unref(batch->p1, "because rating result has been applied");
+        player_unref(batch->p2, "because rating result has been applied");
+        free(batch);
+        batch = next;
+    }
+}
+
+static void *rating_thread(void *arg) {
+    RATING_QUEUE *rq = arg;
+    pthread_mutex_lock(&rq->mutex);
+    while(1) {
+        while(rq->head == NULL && !rq->stop) {
+            pthread_cond_wait(&rq->pending_cond, &rq->mutex);
+        }
+        if(rq->head == NULL) {
+            break;
+        }
+        /* detach everything pending so posters are not held up while we apply */
+        struct rating_result *batch = rq->head;
+        unsigned long batch_end = rq->posted;
+        rq->head = rq->tail = NULL;
+        pthread_mutex_unlock(&rq->mutex);
+
+        apply_batch(batch);
+        if(game_log != NULL) {
+            glog_flush(game_log);
+        }
+
+        pthread_mutex_lock(&rq->mutex);
+        rq->applied = batch_end;
+        pthread_cond_broadcast(&rq->applied_cond);
+    }
+    pthread_mutex_unlock(&rq->mutex);
+    return NULL;
+}
+
+RATING_QUEUE *rq_init(void) {
+    RATING_QUEUE *rq = malloc(sizeof(RATING_QUEUE));
+    if(rq == NULL) {
+        debug("%ld: Failed to initialize rating queue", pthread_self());
+        return NULL;
+    }
+    rq->head = rq->tail = NULL;
+    rq->posted = rq->applied = 0;
+    rq->stop = 0;
+    pthread_mutex_init(&rq->mutex, NULL);
+    pthread_cond_init(&rq->pending_cond, NULL);
+    pthread_cond_init(&rq->applied_cond, NULL);
+
+    if(pthread_create(&rq->tid, NULL, rating_thread, rq) != 0) {
+        pthread_cond_destroy(&rq->applied_cond);
+        pthread_cond_destroy(&rq->pending_cond);
+        pthread_mutex_destroy(&rq->mutex);
+        free(rq);
+        debug("%ld: Failed to start rating thread", pthread_self());
+        return NULL;
+    }
+    debug("%ld: Initialize rating queue", pthread_self());
+    return rq;
+}
+
+void rq_fini(RATING_QUEUE *rq) {
+    if(rq == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&rq->mutex);
+    rq->stop = 1;
+    pthread_cond_signal(&rq->pending_cond);
+    pthread_mutex_unlock(&rq->mutex);
+
+    /* the rating thread drains the queue before it exits */
+    pthread_join(rq->tid, NULL);
+
+    pthread_cond_destroy(&rq->applied_cond);
+    pthread_cond_destroy(&rq->pending_cond);
+    pthread_mutex_destroy(&rq->mutex);
+    free(rq);
+}
+
+int rq_post_result(RATING_QUEUE *rq, PLAYER *player1, PLAYER *player2, int result) {
+    if(player1 == NULL || player2 == NULL) {
+        return -1;
+    }
+    if(rq == NULL) {
+        apply_result(player1, player2, result);
+        if(game_log != NULL) {
+            glog_flush(game_log);
+        }
+        return 0;
+    }
+    struct rating_result *rr = malloc(sizeof(struct rating_result));
+    if(rr == NULL) {
+        debug("%ld: Failed to queue rating result, applying synchronously", pthread_self());
+        apply_result(player1, player2, result);
+        return 0;
+    }
+    rr->p1 = player_ref(player1, "for pending rating result");
+    rr->p2 = player_ref(player2, "for pending rating result");
+    rr->result = result;
+    rr->next = NULL;
+
+    pthread_mutex_lock(&rq->mutex);
+    if(rq->tail == NULL) {
+        rq->head = rr;
+    } else {
+        rq->tail->next = rr;
+    }
+    rq->tail = rr;
+    rq->posted++;
+    pthread_cond_signal(&rq->pending_cond);
+    pthread_mutex_unlock(&rq->mutex);
+    return 0;
+}
+
+void rq_flush(RATING_QUEUE *rq) {
+    if(rq == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&rq->mutex);
+    unsigned long target = rq->posted;
+    while(rq->applied < target) {
+        pthread_cond_wait(&rq->applied_cond, &rq->mutex);
+    }
+    pthread_mutex_unlock(&rq->mutex);
+}
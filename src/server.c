@@ -2,37 +2,66 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include "server.h"
 #include "player.h"
+#include "player_ext.h"
+#include "player_registry_ext.h"
+#include "glicko.h"
 #include "protocol.h"
+#include "protocol_ext.h"
 #include "jeux_globals.h"
+#include "metrics.h"
+#include "perfctr.h"
+#include "watchdog.h"
+#include "probes.h"
+#include "admin.h"
 #include "debug.h"
 #include "packet_common.h"
+#include "server_ext.h"
+#include "session.h"
+#include "client_ext.h"
+#include "client_registry_ext.h"
+#include "game_ext.h"
 
-static void user_handler(CLIENT *new_client) {
-    PLAYER **all_players = creg_all_players(client_registry); 
-    int player_idx = 0;
+/* Room for a MOVE payload, such as "5<-X", copied to the stack. */
+#define MOVE_BUF_SIZE 16
 
-    char *string_print = NULL;
-    size_t sz;
+/* A USERS reply being built in the thread's scratch payload. */
+struct users_reply {
+    size_t len;
+    int failed;         /* the scratch payload could not be grown */
+};
 
-    FILE *stream = open_memstream(&string_print, &sz);
-    while(all_players[player_idx] != NULL) {
-        char *player_name = player_get_name(all_players[player_idx]);
-        int player_rating = player_get_rating(all_players[player_idx]);
-        fprintf(stream, "%s\t%d\n", player_name, player_rating);
-        player_unref(all_players[player_idx], "for player removed from player's list");
-        player_idx++;
+static void add_user(PLAYER *player, void *arg) {
+    struct users_reply *reply = arg;
+    char *player_name = player_get_name(player);
+    /* the name, a tab, the rating, a newline and the null snprintf() writes */
+    size_t room = strlen(player_name) + 16;
+    char *buf;
+    if(reply->failed || (buf = proto_scratch_payload(reply->len + room)) == NULL) {
+        reply->failed = 1;
+        return;
+    }
+    reply->len += snprintf(buf + reply->len, room, "%s\t%d\n",
+                           player_name, player_get_rating(player));
+}
+
+static void user_handler(CLIENT *new_client) {
+    struct users_reply reply = {0};
+    creg_foreach_player(client_registry, add_user, &reply);
+    if(reply.failed) {
+        metrics_nack(METRIC_NACK_USERS);
+        client_send_nack(new_client);
+        return;
     }
-    fclose(stream);
-    free(all_players);
-    // need to free string_print
 
     JEUX_PACKET_HEADER new_pkt = {0};
-    pack_header(&new_pkt, JEUX_ACK_PKT, 0, 0, strlen(string_print));
-    client_send_packet(new_client, &new_pkt, string_print);
-    free(string_print);
+    pack_header(&new_pkt, JEUX_ACK_PKT, 0, 0, reply.len);
+    client_send_packet(new_client, &new_pkt, reply.len > 0 ? proto_scratch_payload(reply.len) : NULL);
 }
 
 static int invite_handler(CLIENT *new_client, void *payloadp, 
@@ -92,18 +121,13 @@ static int decline_handler(CLIENT *new_client, JEUX_PACKET_HEADER *pkt_hdr) {
 static int accept_handler(CLIENT *new_client, JEUX_PACKET_HEADER *pkt_hdr) {
     unpack_header(pkt_hdr);
     uint8_t id = pkt_hdr->id;
-    char *str_ptr = NULL;
-    int status = client_accept_invitation(new_client, id, &str_ptr); 
+    char state[GAME_STATE_SIZE];
+    int status = client_accept_invitation_into(new_client, id, state, sizeof(state)); 
     if(status == -1) {
-        if(str_ptr != NULL) {
-            free(str_ptr);
-        }
         return status;
     }
-    if(str_ptr != NULL) {
-        status = client_send_ack(new_client, str_ptr, strlen(str_ptr));
-        free(str_ptr);
-        return status;
+    if(state[0] != '\0') {
+        return client_send_ack(new_client, state, strlen(state));
     }
     return client_send_ack(new_client, NULL, 0);
 }
@@ -113,14 +137,21 @@ static int move_handler(CLIENT *new_client, void *payloadp, JEUX_PACKET_HEADER *
     uint8_t id = pkt_hdr->id;
 
     size_t payload_size = pkt_hdr->size;
-    char *move_name = calloc(payload_size + 1, sizeof(uint8_t));
+    /* moves are a few characters, so only a malformed one needs the heap */
+    char buf[MOVE_BUF_SIZE];
+    char *move_name = payload_size < sizeof(buf) ? buf : calloc(payload_size + 1, sizeof(uint8_t));
     if(move_name == NULL) {
         perror("calloc");
         return -1;
     }
-    memcpy(move_name, payloadp, payload_size);
+    if(payload_size > 0) {
+        memcpy(move_name, payloadp, payload_size);
+    }
+    move_name[payload_size] = '\0';
     int move_status = client_make_move(new_client, id, move_name);
-    free(move_name);
+    if(move_name != buf) {
+        free(move_name);
+    }
     if(move_status == -1) {
         return -1;
     }
@@ -137,9 +168,90 @@ static int resign_handler(CLIENT *new_client, JEUX_PACKET_HEADER *pkt_hdr) {
     return client_send_ack(new_client, NULL, 0);
 }
 
+static int history_handler(CLIENT *new_client, PLAYER *self, void *payloadp,
+        JEUX_PACKET_HEADER *pkt_hdr) {
+    unpack_header(pkt_hdr);
+    /* Glicko-2 ratings change once per period, not per game, so there is no history */
+    if(glicko_engine != NULL) {
+        return -1;
+    }
+    PLAYER *player = NULL;
+    if(payloadp == NULL || pkt_hdr->size == 0) {
+        player = player_ref(self, "for player whose history is being sent");
+    } else {
+        char *name = calloc(pkt_hdr->size + 1, sizeof(uint8_t));
+        if(name == NULL) {
+            perror("calloc");
+            return -1;
+        }
+        memcpy(name, payloadp, pkt_hdr->size);
+        player = preg_lookup(player_registry, name);
+        free(name);
+    }
+    if(player == NULL) {
+        return -1;
+    }
+
+    PLAYER_HISTORY_ENTRY entries[PLAYER_HISTORY_LEN];
+    int count = player_get_history(player, entries, PLAYER_HISTORY_LEN);
+    player_unref(player, "because history has been read");
+    int ids[PLAYER_HISTORY_LEN];
+    PLAYER *opponents[PLAYER_HISTORY_LEN];
+    for(int i = 0; i < count; i++) {
+        ids[i] = entries[i].opponent_id;
+    }
+    preg_lookup_ids(player_registry, ids, count, opponents);
+
+    char *string_print = NULL;
+    size_t sz;
+    FILE *stream = open_memstream(&string_print, &sz);
+    for(int i = 0; i < count; i++) {
+        PLAYER *opponent = opponents[i];
+        if(stream != NULL) {
+            fprintf(stream, "%u\t%s\t%c\t%d\n",
+                    entries[i].timestamp_sec,
+                    opponent != NULL ? player_get_name(opponent) : "?",
+                    entries[i].outcome == PLAYER_HISTORY_WIN ? 'W' :
+                    entries[i].outcome == PLAYER_HISTORY_LOSS ? 'L' : 'D',
+                    entries[i].rating);
+        }
+        if(opponent != NULL) {
+            player_unref(opponent, "because opponent name has been printed");
+        }
+    }
+    if(stream == NULL) {
+        return -1;
+    }
+    fclose(stream);
+
+    int status = client_send_ack(new_client, string_print, strlen(string_print));
+    free(string_print);
+    return status;
+}
+
+static int stats_handler(CLIENT *new_client) {
+    char *string_print = NULL;
+    size_t sz;
+    FILE *stream = open_memstream(&string_print, &sz);
+    if(stream == NULL) {
+        return -1;
+    }
+    metrics_write(stream);
+    fclose(stream);
+    if(sz > UINT16_MAX) {
+        free(string_print);
+        return -1;
+    }
+
+    int status = client_send_ack(new_client, string_print, sz);
+    free(string_print);
+    return status;
+}
+
 static PLAYER *login_handler(CLIENT *new_client, void *payloadp, 
         JEUX_PACKET_HEADER *pkt_hdr) {
     if(payloadp == NULL) {
+        metrics_nack(METRIC_NACK_LOGIN);
         client_send_nack(new_client);
         return NULL;
     }
@@ -149,6 +261,7 @@ static PLAYER *login_handler(CLIENT *new_client, void *payloadp,
     char *name = calloc(payload_size + 1, sizeof(uint8_t));
     if(name == NULL) {
         perror("calloc");
+        metrics_nack(METRIC_NACK_LOGIN);
         client_send_nack(new_client);
         return NULL;
     }
@@ -156,12 +269,14 @@ static PLAYER *login_handler(CLIENT *new_client, void *payloadp,
     PLAYER *new_player = preg_register(player_registry, name); 
     if(new_player == NULL) {
         free(name);
+        metrics_nack(METRIC_NACK_LOGIN);
         client_send_nack(new_client);
         return NULL;
     }
     free(name);
     if(client_login(new_client, new_player) == -1) {
         player_unref(new_player, "failed login");
+        metrics_nack(METRIC_NACK_LOGIN);
         client_send_nack(new_client);
         return NULL;
     }
@@ -172,6 +287,119 @@ static PLAYER *login_handler(CLIENT *new_client, void *payloadp,
     return new_player;
 }
 
+PLAYER *jeux_handle_request(CLIENT *new_client, PLAYER *player, JEUX_PACKET_HEADER *hdr, void *payload) {
+    int fd = client_get_fd(new_client);
+    /* the handlers convert hdr to host byte order in place */
+    size_t payload_size = ntohs(hdr->size);
+    TRACE_JEUX_PACKET_RECEIVED(fd, hdr->type, payload_size);
+    metrics_request_begin(hdr->type, ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec));
+    perfctr_begin();
+    watchdog_begin(hdr->type, fd);
+    TRACE_JEUX_REQUEST_START(fd, hdr->type);
+    if(hdr->type == JEUX_LOGIN_PKT) {
+        if(player != NULL) {
+            metrics_nack(METRIC_NACK_ALREADY_LOGGED_IN);
+            client_send_nack(new_client);
+            debug("[%d] Already logged in (player %p [%s])", fd, 
+                    player, player_get_name(player));
+            proto_free_payload(payload, payload_size);
+        } else {
+            player = login_handler(new_client, payload, hdr);
+            proto_free_payload(payload, payload_size);
+        }
+    } else {
+        if(player == NULL) {
+            proto_free_payload(payload, payload_size);
+            metrics_nack(METRIC_NACK_NOT_LOGGED_IN);
+            client_send_nack(new_client);
+        } else {
+            switch(hdr->type) {
+                case JEUX_USERS_PKT:
+                    proto_free_payload(payload, payload_size);
+                    user_handler(new_client);
+                    break;
+                case JEUX_INVITE_PKT:
+                    int invite_status = invite_handler(new_client, payload, hdr);
+                    proto_free_payload(payload, payload_size);
+                    if(invite_status == -1) {
+                        metrics_nack(METRIC_NACK_INVITE);
+                        client_send_nack(new_client);
+                    }
+                    break;
+                case JEUX_REVOKE_PKT:
+                    proto_free_payload(payload, payload_size);
+                    int revoke_status = revoke_handler(new_client, hdr);
+                    if(revoke_status == -1) {
+                        metrics_nack(METRIC_NACK_REVOKE);
+                        client_send_nack(new_client);
+                    }
+                    break;
+                case JEUX_DECLINE_PKT:
+                    proto_free_payload(payload, payload_size);
+                    int decline_status = decline_handler(new_client, hdr);
+                    if(decline_status == -1) {
+                        metrics_nack(METRIC_NACK_DECLINE);
+                        client_send_nack(new_client);
+                    }
+                    break;
+                case JEUX_ACCEPT_PKT:
+                    proto_free_payload(payload, payload_size);
+                    int accept_status = accept_handler(new_client, hdr); 
+                    if(accept_status == -1) {
+                        metrics_nack(METRIC_NACK_ACCEPT);
+                        client_send_nack(new_client);
+                    }
+                    break;
+                case JEUX_MOVE_PKT:
+                    int move_status = move_handler(new_client, payload, hdr); 
+                    proto_free_payload(payload, payload_size);
+                    if(move_status == -1) {
+                        metrics_nack(METRIC_NACK_MOVE);
+                        client_send_nack(new_client);
+                    }
+                    break;
+                case JEUX_RESIGN_PKT:
+                    proto_free_payload(payload, payload_size);
+                    int resign_status = resign_handler(new_client, hdr);
+                    if(resign_status == -1) {
+                        metrics_nack(METRIC_NACK_RESIGN);
+                        client_send_nack(new_client);
+                    }
+                    break;
+                case JEUX_HISTORY_PKT:
+                    int history_status = history_handler(new_client, player, payload, hdr);
+                    proto_free_payload(payload, payload_size);
+                    if(history_status == -1) {
+                        metrics_nack(METRIC_NACK_HISTORY);
+                        client_send_nack(new_client);
+                    }
+                    break;
+                case JEUX_STATS_PKT:
+                    proto_free_payload(payload, payload_size);
+                    int stats_status = stats_handler(new_client);
+                    if(stats_status == -1) {
+                        metrics_nack(METRIC_NACK_STATS);
+                        client_send_nack(new_client);
+                    }
+                    break;
+                default:
+                    proto_free_payload(payload, payload_size);
+                    break;
+            }
+        }
+    }
+    watchdog_end();
+    perfctr_end(hdr->type);
+    uint64_t elapsed_ns = metrics_request_end(hdr->type);
+    TRACE_JEUX_REQUEST_DONE(fd, hdr->type, elapsed_ns);
+    if(atomic_load_explicit(&admin_tracing, memory_order_relaxed)) {
+        /* through the logger, so a slow stderr does not hold up the service thread */
+        logger_write(LOGGER_INFO, __FILE__, __func__, __LINE__, "%ld: [%d] %s request handled in %lu ns",
+                     pthread_self(), fd, metrics_pkt_name(hdr->type), elapsed_ns);
+    }
+    return player;
+}
+
 void *jeux_client_service(void *arg) {
     int fd = *((int *)arg);
     free(arg);
@@ -180,112 +408,27 @@ void *jeux_client_service(void *arg) {
         perror("pthread_detach");
         exit(status);
     }
-    CLIENT *new_client = NULL;
-    // potentially need to ref here? 
-    if((new_client = creg_register(client_registry, fd)) == NULL) {
+    /* each packet is written whole, so Nagle's algorithm could only delay it */
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    SESSION *session = session_open_fd(fd);
+    if(session == NULL) {
+        /* the registry is full; the client would otherwise wait forever */
+        debug("%ld: [%d] Refusing connection", pthread_self(), fd);
+        close(fd);
         return NULL;
     }
 
-    PLAYER *new_player = NULL;
     do {
         JEUX_PACKET_HEADER jph = {0};
         void *payloadp = NULL;
         int status = proto_recv_packet(fd, &jph, &payloadp);
         if(status == -1) {
-            if(payloadp != NULL) {
-                free(payloadp);
-            }
-            if(new_player != NULL) {
-                player_unref(new_player, "because server thread is discarding reference to logged in player");
-                client_logout(new_client);
-            }
-            if(creg_unregister(client_registry, new_client) == 0) {
-                debug("%lu: [%d] Ending client service", pthread_self(), fd);
-            }
+            proto_free_payload(payloadp, ntohs(jph.size));
+            session_close(session);
             return NULL;
         }
-        if(jph.type == JEUX_LOGIN_PKT) {
-            if(new_player != NULL) {
-                client_send_nack(new_client);
-                debug("[%d] Already logged in (player %p [%s])", fd, 
-                        new_player, player_get_name(new_player));
-                if(payloadp != NULL) {
-                    free(payloadp);
-                }
-            } else {
-                new_player = login_handler(new_client, payloadp, &jph);
-                free(payloadp);
-            }
-        } else {
-            if(new_player == NULL) {
-                client_send_nack(new_client);
-            } else {
-                switch(jph.type) {
-                    case JEUX_USERS_PKT:
-                        if(payloadp != NULL) {
-                            free(payloadp);
-                        }
-                        user_handler(new_client);
-                        break;
-                    case JEUX_INVITE_PKT:
-                        int invite_status = invite_handler(new_client, payloadp, &jph);
-                        if(payloadp != NULL) {
-                            free(payloadp);
-                        }
-                        if(invite_status == -1) {
-                            client_send_nack(new_client);
-                        }
-                        break;
-                    case JEUX_REVOKE_PKT:
-                        if(payloadp != NULL) {
-                            free(payloadp);
-                        }
-                        int revoke_status = revoke_handler(new_client, &jph);
-                        if(revoke_status == -1) {
-                            client_send_nack(new_client);
-                        }
-                        break;
-                    case JEUX_DECLINE_PKT:
-                        if(payloadp != NULL) {
-                            free(payloadp);
-                        }
-                        int decline_status = decline_handler(new_client, &jph);
-                        if(decline_status == -1) {
-                            client_send_nack(new_client);
-                        }
-                        break;
-                    case JEUX_ACCEPT_PKT:
-                        if(payloadp != NULL) {
-                            free(payloadp);
-                        }
-                        int accept_status = accept_handler(new_client, &jph); 
-                        if(accept_status == -1) {
-                            client_send_nack(new_client);
-                        }
-                        break;
-                    case JEUX_MOVE_PKT:
-                        int move_status = move_handler(new_client, payloadp, &jph); 
-                        if(payloadp != NULL) {
-                            free(payloadp);
-                        }
-                        if(move_status == -1) {
-                            client_send_nack(new_client);
-                        }
-                        break;
-                    case JEUX_RESIGN_PKT:
-                        if(payloadp != NULL) {
-                            free(payloadp);
-                        }
-                        int resign_status = resign_handler(new_client, &jph);
-                        if(resign_status == -1) {
-                            client_send_nack(new_client);
-                        }
-                        break;
-                    default:
-                        break;
-                }
-            }
-        }
+        session_push(session, &jph, payloadp);
     } while(1);
 
     return NULL;
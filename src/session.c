@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "client_registry.h"
+#include "client_registry_ext.h"
+#include "player_registry.h"
+#include "session.h"
+#include "server_ext.h"
+#include "protocol_ext.h"
+#include "game_ext.h"
+#include "rating_queue.h"
+#include "jeux_globals.h"
+#include "debug.h"
+
+struct session {
+    CLIENT *client;
+    PLAYER *player;     /* if null then not logged in */
+};
+
+static atomic_int next_conn = SESSION_CONN_BASE;
+
+int jeux_core_init(void) {
+    client_registry = creg_init();
+    player_registry = preg_init();
+    rating_queue = rq_init();
+    if(client_registry == NULL || player_registry == NULL || rating_queue == NULL) {
+        debug("%ld: Failed to initialize server core", pthread_self());
+        jeux_core_fini();
+        return -1;
+    }
+    return 0;
+}
+
+void jeux_core_fini(void) {
+    if(rating_queue != NULL) {
+        rq_fini(rating_queue);
+        rating_queue = NULL;
+    }
+    if(client_registry != NULL) {
+        creg_fini(client_registry);
+        client_registry = NULL;
+    }
+    if(player_registry != NULL) {
+        preg_fini(player_registry);
+        player_registry = NULL;
+    }
+    game_pool_drain();
+}
+
+static SESSION *session_create(int conn, CLIENT_SEND_FN send, void *arg) {
+    SESSION *session = malloc(sizeof(SESSION));
+    if(session == NULL) {
+        return NULL;
+    }
+    session->client = send != NULL ? creg_register_transport(client_registry, conn, send, arg)
+                                   : creg_register(client_registry, conn);
+    if(session->client == NULL) {
+        free(session);
+        return NULL;
+    }
+    session->player = NULL;
+    return session;
+}
+
+SESSION *session_open(CLIENT_SEND_FN send, void *arg) {
+    if(send == NULL) {
+        return NULL;
+    }
+    return session_create(atomic_fetch_add(&next_conn, 1), send, arg);
+}
+
+SESSION *session_open_fd(int fd) {
+    return session_create(fd, NULL, NULL);
+}
+
+int session_push(SESSION *session, JEUX_PACKET_HEADER *hdr, void *payload) {
+    if(hdr == NULL) {
+        return -1;
+    }
+    session->player = jeux_handle_request(session->client, session->player, hdr, payload);
+    return 0;
+}
+
+int session_conn(SESSION *session) {
+    return client_get_fd(session->client);
+}
+
+/* Transport for clients whose session is over. */
+static int discard(void *arg, JEUX_PACKET_HEADER *hdr, void *data) {
+    return -1;
+}
+
+void session_close(SESSION *session) {
+    CLIENT *client = session->client;
+    if(session->player != NULL) {
+        player_unref(session->player, "because session is discarding reference to logged in player");
+        client_logout(client);
+    }
+    /* threads still holding the client must not reach the host */
+    client_set_transport(client, discard, NULL);
+    debug("%lu: [%d] Ending client service", pthread_self(), client_get_fd(client));
+    creg_unregister(client_registry, client);
+    free(session);
+}
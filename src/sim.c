@@ -0,0 +1,472 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "sim.h"
+#include "client_registry.h"
+#include "player_registry.h"
+#include "session.h"
+#include "protocol_ext.h"
+#include "packet_common.h"
+#include "jeux_globals.h"
+#include "debug.h"
+
+/* Invitation IDs a client keeps track of: all that fit in a packet header. */
+#define SIM_MAX_IDS 256
+
+/* Invitations a client has open or games it is playing before it stops inviting. */
+#define SIM_MAX_GAMES 4
+
+/* Steps without anything happening before a simulation counts as stalled. */
+#define SIM_STALL_STEPS 100000
+
+#define SIM_BOARD 9
+
+typedef enum {
+    SG_FREE,                    /* ID not in use */
+    SG_OFFERED,                 /* we invited, not yet accepted */
+    SG_INVITED,                 /* we were invited */
+    SG_PLAYING
+} SIM_GAME_STATE;
+
+typedef struct sim_game {
+    SIM_GAME_STATE state;
+    GAME_ROLE role;             /* ours */
+    GAME_ROLE turn;             /* whose move it is */
+    char board[SIM_BOARD];      /* ' ', 'X' or 'O' */
+} SIM_GAME;
+
+typedef struct sim_packet {
+    JEUX_PACKET_HEADER hdr;     /* network byte order */
+    void *payload;
+} SIM_PACKET;
+
+/* A channel: a FIFO of packets. */
+typedef struct sim_queue {
+    SIM_PACKET *pkts;
+    size_t head, len, cap;
+} SIM_QUEUE;
+
+typedef struct sim_client {
+    char name[16];
+    SESSION *session;           /* server side */
+    int logged_in;              /* client side */
+    int pending;                /* type of the request awaiting its reply, or 0 */
+    int pending_id;
+    int pending_arg;            /* square moved on, or role invited as */
+    int request_ready;          /* request sent, not yet handled */
+    SIM_PACKET request;
+    SIM_QUEUE inbox;            /* packets sent by the server */
+    SIM_GAME games[SIM_MAX_IDS];
+    int top;                    /* above the highest ID ever used */
+} SIM_CLIENT;
+
+struct sim {
+    int nclients;
+    SIM_CLIENT *clients;
+    uint64_t rng;
+    SIM_STATS stats;
+};
+
+static SIM *current = NULL;
+static pthread_mutex_t current_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* xorshift64* */
+static uint64_t sim_rand(SIM *sim) {
+    uint64_t x = sim->rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    sim->rng = x;
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+static int sim_rand_below(SIM *sim, int n) {
+    return (int)((sim_rand(sim) >> 32) % n);
+}
+
+static void digest(SIM *sim, void *data, size_t size) {
+    uint64_t h = sim->stats.digest;
+    for(size_t i = 0; i < size; i++) {
+        h = (h ^ ((uint8_t *)data)[i]) * 0x100000001b3ULL;
+    }
+    sim->stats.digest = h;
+}
+
+/* Fields one at a time, so that structure padding stays out of the digest. */
+static void digest_packet(SIM *sim, SIM_PACKET *pkt) {
+    JEUX_PACKET_HEADER *hdr = &pkt->hdr;
+    digest(sim, &hdr->type, sizeof(hdr->type));
+    digest(sim, &hdr->id, sizeof(hdr->id));
+    digest(sim, &hdr->role, sizeof(hdr->role));
+    digest(sim, &hdr->size, sizeof(hdr->size));
+    digest(sim, &hdr->timestamp_sec, sizeof(hdr->timestamp_sec));
+    digest(sim, &hdr->timestamp_nsec, sizeof(hdr->timestamp_nsec));
+    if(pkt->payload != NULL) {
+        digest(sim, pkt->payload, ntohs(hdr->size));
+    }
+}
+
+static uint64_t sim_clock(void) {
+    return current->stats.now_ns;
+}
+
+static int queue_push(SIM_QUEUE *q, JEUX_PACKET_HEADER *hdr, void *data) {
+    if(q->len == q->cap) {
+        size_t cap = q->cap == 0 ? 8 : q->cap * 2;
+        SIM_PACKET *pkts = malloc(cap * sizeof(SIM_PACKET));
+        if(pkts == NULL) {
+            return -1;
+        }
+        for(size_t i = 0; i < q->len; i++) {
+            pkts[i] = q->pkts[(q->head + i) % q->cap];
+        }
+        free(q->pkts);
+        q->pkts = pkts;
+        q->cap = cap;
+        q->head = 0;
+    }
+    SIM_PACKET *pkt = &q->pkts[(q->head + q->len) % q->cap];
+    size_t size = ntohs(hdr->size);
+    pkt->hdr = *hdr;
+    pkt->payload = NULL;
+    if(data != NULL && size > 0) {
+        if((pkt->payload = malloc(size)) == NULL) {
+            return -1;
+        }
+        memcpy(pkt->payload, data, size);
+    }
+    q->len++;
+    return 0;
+}
+
+static SIM_PACKET queue_pop(SIM_QUEUE *q) {
+    SIM_PACKET pkt = q->pkts[q->head];
+    q->head = (q->head + 1) % q->cap;
+    q->len--;
+    return pkt;
+}
+
+static void queue_clear(SIM_QUEUE *q) {
+    while(q->len > 0) {
+        free(queue_pop(q).payload);
+    }
+    free(q->pkts);
+}
+
+/* The sessions' transport: deliver into the receiving client's channel. */
+static int sim_send(void *arg, JEUX_PACKET_HEADER *hdr, void *data) {
+    return queue_push(&((SIM_CLIENT *)arg)->inbox, hdr, data);
+}
+
+SIM *sim_init(int nclients, uint64_t seed) {
+    if(nclients < 2 || nclients > SIM_MAX_CLIENTS) {
+        return NULL;
+    }
+    pthread_mutex_lock(&current_mutex);
+    if(current != NULL) {
+        pthread_mutex_unlock(&current_mutex);
+        return NULL;
+    }
+    SIM *sim = calloc(1, sizeof(SIM));
+    if(sim == NULL || (sim->clients = calloc(nclients, sizeof(SIM_CLIENT))) == NULL) {
+        free(sim);
+        pthread_mutex_unlock(&current_mutex);
+        return NULL;
+    }
+    sim->nclients = nclients;
+    /* xorshift must not start at zero */
+    sim->rng = seed * 0x9e3779b97f4a7c15ULL + 1;
+    sim->stats.digest = 0xcbf29ce484222325ULL;
+    current = sim;
+    pthread_mutex_unlock(&current_mutex);
+
+    client_registry = creg_init();
+    player_registry = preg_init();
+    packet_clock = sim_clock;
+    for(int i = 0; i < nclients; i++) {
+        SIM_CLIENT *c = &sim->clients[i];
+        snprintf(c->name, sizeof(c->name), "sim%d", i);
+        c->session = session_open(sim_send, c);
+    }
+    debug("%ld: Simulation of %d clients with seed %lu", pthread_self(), nclients, seed);
+    return sim;
+}
+
+static void send_request(SIM_CLIENT *c, int type, int id, int role, char *payload) {
+    size_t size = payload == NULL ? 0 : strlen(payload);
+    pack_header(&c->request.hdr, type, id, role, size);
+    c->request.payload = NULL;
+    if(size > 0 && (c->request.payload = proto_alloc_payload(size)) != NULL) {
+        memcpy(c->request.payload, payload, size);
+    }
+    c->pending = type;
+    c->pending_id = id;
+    c->request_ready = 1;
+}
+
+static int count_games(SIM_CLIENT *c) {
+    int n = 0;
+    for(int id = 0; id < c->top; id++) {
+        n += c->games[id].state != SG_FREE;
+    }
+    return n;
+}
+
+/*
+ * Decide on the next request.  Invitations and games waiting on this
+ * client are dealt with first, in random order; otherwise it may invite
+ * someone, revoke an invitation nobody has answered, or ask for USERS.
+ *
+ * @return 1 if a request was sent, 0 if there was nothing to do.
+ */
+static int client_act(SIM *sim, SIM_CLIENT *c, int index) {
+    if(!c->logged_in) {
+        send_request(c, JEUX_LOGIN_PKT, 0, 0, c->name);
+        return 1;
+    }
+    int ready[SIM_MAX_IDS], nready = 0, offered[SIM_MAX_IDS], noffered = 0;
+    for(int id = 0; id < c->top; id++) {
+        SIM_GAME *g = &c->games[id];
+        if(g->state == SG_INVITED || (g->state == SG_PLAYING && g->turn == g->role)) {
+            ready[nready++] = id;
+        } else if(g->state == SG_OFFERED) {
+            offered[noffered++] = id;
+        }
+    }
+    int r = sim_rand_below(sim, 100);
+    if(r < 1) {
+        send_request(c, JEUX_USERS_PKT, 0, 0, NULL);
+        return 1;
+    }
+    if(nready > 0) {
+        int id = ready[sim_rand_below(sim, nready)];
+        SIM_GAME *g = &c->games[id];
+        if(g->state == SG_INVITED) {
+            send_request(c, r < 90 ? JEUX_ACCEPT_PKT : JEUX_DECLINE_PKT, id, 0, NULL);
+        } else if(r < 97) {
+            int empty[SIM_BOARD], nempty = 0;
+            for(int sq = 0; sq < SIM_BOARD; sq++) {
+                if(g->board[sq] == ' ') {
+                    empty[nempty++] = sq;
+                }
+            }
+            if(nempty == 0) {
+                send_request(c, JEUX_RESIGN_PKT, id, 0, NULL);
+                return 1;
+            }
+            char move[2] = { '1' + empty[sim_rand_below(sim, nempty)], '\0' };
+            send_request(c, JEUX_MOVE_PKT, id, 0, move);
+            c->pending_arg = move[0] - '1';
+        } else {
+            send_request(c, JEUX_RESIGN_PKT, id, 0, NULL);
+        }
+        return 1;
+    }
+    if(noffered > 0 && r < 5) {
+        send_request(c, JEUX_REVOKE_PKT, offered[sim_rand_below(sim, noffered)], 0, NULL);
+        return 1;
+    }
+    if(count_games(c) < SIM_MAX_GAMES) {
+        int other = sim_rand_below(sim, sim->nclients - 1);
+        if(other >= index) {
+            other++;
+        }
+        /* the role in an INVITE is the one offered to the target */
+        int role = sim_rand_below(sim, 2) ? FIRST_PLAYER_ROLE : SECOND_PLAYER_ROLE;
+        send_request(c, JEUX_INVITE_PKT, 0, role, sim->clients[other].name);
+        c->pending_arg = role == FIRST_PLAYER_ROLE ? SECOND_PLAYER_ROLE : FIRST_PLAYER_ROLE;
+        return 1;
+    }
+    return 0;
+}
+
+static void start_game(SIM_GAME *g) {
+    g->state = SG_PLAYING;
+    g->turn = FIRST_PLAYER_ROLE;
+    memset(g->board, ' ', SIM_BOARD);
+}
+
+/* Take the board and turn from an unparsed game state (see game.h). */
+static void read_state(SIM_GAME *g, char *state, size_t size) {
+    /* five rows of six characters, squares on the even rows and columns */
+    if(state == NULL || size < 31) {
+        return;
+    }
+    for(int sq = 0; sq < SIM_BOARD; sq++) {
+        g->board[sq] = state[(sq / 3) * 12 + (sq % 3) * 2];
+    }
+    g->turn = state[30] == 'X' ? FIRST_PLAYER_ROLE : SECOND_PLAYER_ROLE;
+}
+
+/* The server hands out the lowest free ID, so the slots in use stay few. */
+static void use_slot(SIM_CLIENT *c, int id) {
+    if(id >= c->top) {
+        c->top = id + 1;
+    }
+}
+
+static void client_receive(SIM *sim, SIM_CLIENT *c, SIM_PACKET *pkt) {
+    JEUX_PACKET_HEADER hdr = pkt->hdr;
+    unpack_header(&hdr);
+    SIM_GAME *g = hdr.id < SIM_MAX_IDS ? &c->games[hdr.id] : NULL;
+    switch(hdr.type) {
+        case JEUX_ACK_PKT:
+        case JEUX_NACK_PKT: {
+            /*
+             * A NACK means the other side got there first, and whatever it
+             * did has already been reported, ahead of the NACK: the ID may
+             * even be in use again.  So a NACK changes nothing.
+             */
+            int ok = hdr.type == JEUX_ACK_PKT;
+            ok ? sim->stats.acks++ : sim->stats.nacks++;
+            SIM_GAME *pg = &c->games[c->pending_id];
+            if(ok && c->pending == JEUX_LOGIN_PKT) {
+                c->logged_in = 1;
+            } else if(ok && c->pending == JEUX_INVITE_PKT && g != NULL) {
+                use_slot(c, hdr.id);
+                g->state = SG_OFFERED;
+                g->role = c->pending_arg;
+            } else if(ok && c->pending == JEUX_ACCEPT_PKT && pg->state == SG_INVITED) {
+                start_game(pg);
+                read_state(pg, pkt->payload, hdr.size);
+            } else if(ok && (c->pending == JEUX_DECLINE_PKT || c->pending == JEUX_REVOKE_PKT)) {
+                pg->state = SG_FREE;
+            } else if(ok && c->pending == JEUX_MOVE_PKT && pg->state == SG_PLAYING) {
+                pg->board[c->pending_arg] = pg->role == FIRST_PLAYER_ROLE ? 'X' : 'O';
+                pg->turn = pg->role == FIRST_PLAYER_ROLE ? SECOND_PLAYER_ROLE : FIRST_PLAYER_ROLE;
+            }
+            c->pending = 0;
+            break;
+        }
+        case JEUX_INVITED_PKT:
+            sim->stats.notifications++;
+            if(g != NULL) {
+                use_slot(c, hdr.id);
+                g->state = SG_INVITED;
+                g->role = hdr.role;
+            }
+            break;
+        case JEUX_ACCEPTED_PKT:
+            sim->stats.notifications++;
+            if(g != NULL) {
+                start_game(g);
+                read_state(g, pkt->payload, hdr.size);
+            }
+            break;
+        case JEUX_MOVED_PKT:
+            sim->stats.notifications++;
+            if(g != NULL) {
+                read_state(g, pkt->payload, hdr.size);
+            }
+            break;
+        case JEUX_REVOKED_PKT:
+        case JEUX_DECLINED_PKT:
+            sim->stats.notifications++;
+            if(g != NULL) {
+                g->state = SG_FREE;
+            }
+            break;
+        case JEUX_ENDED_PKT:
+            sim->stats.notifications++;
+            if(g != NULL) {
+                /* each side is told, and the first role's count stands for the game */
+                if(g->state == SG_PLAYING && g->role == FIRST_PLAYER_ROLE) {
+                    sim->stats.games++;
+                }
+                g->state = SG_FREE;
+            }
+            break;
+        default:
+            sim->stats.notifications++;
+            break;
+    }
+}
+
+/*
+ * Take one step: pick a client, then one of the things it could do.
+ *
+ * @return 1 if anything happened, 0 if not.
+ */
+static int sim_step(SIM *sim) {
+    sim->stats.steps++;
+    sim->stats.now_ns += SIM_STEP_NS;
+    int index = sim_rand_below(sim, sim->nclients);
+    SIM_CLIENT *c = &sim->clients[index];
+    int choices[3], n = 0;
+    if(c->request_ready) {
+        choices[n++] = 0;
+    }
+    if(c->inbox.len > 0) {
+        choices[n++] = 1;
+    }
+    if(c->pending == 0) {
+        choices[n++] = 2;
+    }
+    if(n == 0) {
+        return 0;
+    }
+    switch(choices[sim_rand_below(sim, n)]) {
+        case 0:
+            c->request_ready = 0;
+            digest_packet(sim, &c->request);
+            sim->stats.requests++;
+            session_push(c->session, &c->request.hdr, c->request.payload);
+            return 1;
+        case 1: {
+            SIM_PACKET pkt = queue_pop(&c->inbox);
+            digest_packet(sim, &pkt);
+            client_receive(sim, c, &pkt);
+            free(pkt.payload);
+            return 1;
+        }
+        default:
+            return client_act(sim, c, index);
+    }
+}
+
+int sim_run(SIM *sim, uint64_t games) {
+    uint64_t idle = 0;
+    while(sim->stats.games < games) {
+        if(sim_step(sim)) {
+            idle = 0;
+        } else if(++idle == SIM_STALL_STEPS) {
+            debug("%ld: Simulation stalled after %lu steps", pthread_self(), sim->stats.steps);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void sim_stats(SIM *sim, SIM_STATS *stats) {
+    *stats = sim->stats;
+}
+
+void sim_fini(SIM *sim) {
+    for(int i = 0; i < sim->nclients; i++) {
+        SIM_CLIENT *c = &sim->clients[i];
+        if(c->request_ready) {
+            proto_free_payload(c->request.payload, ntohs(c->request.hdr.size));
+        }
+        if(c->session != NULL) {
+            session_close(c->session);
+        }
+    }
+    /* after every session is closed, as closing one notifies the others */
+    for(int i = 0; i < sim->nclients; i++) {
+        queue_clear(&sim->clients[i].inbox);
+    }
+    creg_fini(client_registry);
+    preg_fini(player_registry);
+    client_registry = NULL;
+    player_registry = NULL;
+    packet_clock = NULL;
+
+    pthread_mutex_lock(&current_mutex);
+    current = NULL;
+    pthread_mutex_unlock(&current_mutex);
+    free(sim->clients);
+    free(sim);
+}
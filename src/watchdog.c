@@ -0,0 +1,303 @@
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "watchdog.h"
+#include "lock_prof.h"
+#include "metrics.h"
+#include "debug.h"
+
+/*
+ * Reports go through the asynchronous logger, at warn level, so that a
+ * slow stderr never holds up the service thread that finishes a flagged
+ * request.  They are written whether or not debug.h compiles warn() in,
+ * since the watchdog only runs when asked for.
+ */
+#define watchdog_log(S, ...)                                                   \
+  do {                                                                         \
+    if (logger_enabled(LOGGER_WARN))                                           \
+      logger_write(LOGGER_WARN, __FILE__, __extension__ __FUNCTION__,          \
+                   __LINE__, S, ##__VA_ARGS__);                                \
+  } while (0)
+
+/* Indexes of the counts of what flagged requests were waiting for. */
+#define WAITING_NONE 0
+#define WAITING_SEND 1
+#define WAITING_LOCK 2          /* plus the LOCK_SITE */
+#define WAITING_KINDS (WAITING_LOCK + LOCK_SITES)
+
+struct watchdog_slot {
+    _Atomic uint64_t start_ns;  /* start of the request in flight, 0 if none */
+    _Atomic uint64_t seq;       /* requests begun */
+    _Atomic uint64_t flagged;   /* seq of the last request flagged */
+    atomic_int type;
+    atomic_int fd;
+    atomic_int waiting;
+    atomic_int in_use;          /* owned by a live thread */
+    struct watchdog_slot *next;
+};
+
+atomic_int watchdog_running = 0;
+__thread atomic_int *watchdog_waiting = NULL;
+
+static struct watchdog_slot *_Atomic slots = NULL;
+static __thread struct watchdog_slot *my_slot = NULL;
+
+static pthread_key_t slot_key;
+static pthread_once_t slot_key_once = PTHREAD_ONCE_INIT;
+
+static _Atomic uint64_t budgets[METRICS_PKT_TYPES];
+static _Atomic uint64_t slow[METRICS_PKT_TYPES];
+static _Atomic uint64_t waiting_counts[WAITING_KINDS];
+
+static pthread_mutex_t control_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stop_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t watchdog_tid;
+static int stop;
+
+/* Runs at thread exit: hand the slot to the next thread. */
+static void release_slot(void *arg) {
+    struct watchdog_slot *slot = arg;
+    my_slot = NULL;
+    watchdog_waiting = NULL;
+    atomic_store(&slot->start_ns, 0);
+    atomic_store(&slot->in_use, 0);
+}
+
+static void make_slot_key(void) {
+    pthread_key_create(&slot_key, release_slot);
+}
+
+static struct watchdog_slot *claim_slot(void) {
+    pthread_once(&slot_key_once, make_slot_key);
+    struct watchdog_slot *slot;
+    for(slot = atomic_load(&slots); slot != NULL; slot = slot->next) {
+        int expected = 0;
+        if(atomic_compare_exchange_strong(&slot->in_use, &expected, 1)) {
+            break;
+        }
+    }
+    if(slot == NULL) {
+        slot = calloc(1, sizeof(struct watchdog_slot));
+        if(slot == NULL) {
+            return NULL;
+        }
+        atomic_init(&slot->in_use, 1);
+        slot->next = atomic_load(&slots);
+        while(!atomic_compare_exchange_weak(&slots, &slot->next, slot))
+            ;
+    }
+    pthread_setspecific(slot_key, slot);
+    return slot;
+}
+
+void watchdog_begin_slow(int type, int fd) {
+    struct watchdog_slot *slot = my_slot;
+    if(slot == NULL && (slot = my_slot = claim_slot()) == NULL) {
+        return;
+    }
+    /* this thread is the only writer of its slot, save for flagged */
+    atomic_store_explicit(&slot->type, type, memory_order_relaxed);
+    atomic_store_explicit(&slot->fd, fd, memory_order_relaxed);
+    atomic_store_explicit(&slot->waiting, 0, memory_order_relaxed);
+    uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_relaxed) + 1;
+    atomic_store_explicit(&slot->seq, seq, memory_order_release);
+    atomic_store_explicit(&slot->start_ns, metrics_now_ns(), memory_order_release);
+    watchdog_waiting = &slot->waiting;
+}
+
+void watchdog_end_slow(void) {
+    struct watchdog_slot *slot = my_slot;
+    watchdog_waiting = NULL;
+    uint64_t start = atomic_load_explicit(&slot->start_ns, memory_order_relaxed);
+    atomic_store_explicit(&slot->start_ns, 0, memory_order_release);
+    uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    if(atomic_load(&slot->flagged) == seq) {
+        watchdog_log("watchdog: fd %d %s request finished after %lu ms",
+                atomic_load_explicit(&slot->fd, memory_order_relaxed),
+                metrics_pkt_name(atomic_load_explicit(&slot->type, memory_order_relaxed)),
+                (metrics_now_ns() - start) / 1000000);
+    }
+}
+
+static void describe_wait(int waiting, char *buf, size_t size) {
+    int kind = waiting >> 16, arg = waiting & 0xffff;
+    if(kind == WATCHDOG_WAIT_LOCK && arg < LOCK_SITES) {
+        snprintf(buf, size, "waiting for lock %s", lprof_site_name(arg));
+    } else if(kind == WATCHDOG_WAIT_SEND) {
+        snprintf(buf, size, "waiting to send to fd %d", arg);
+    } else {
+        snprintf(buf, size, "running");
+    }
+}
+
+static int waiting_index(int waiting) {
+    int kind = waiting >> 16, arg = waiting & 0xffff;
+    if(kind == WATCHDOG_WAIT_LOCK && arg < LOCK_SITES) {
+        return WAITING_LOCK + arg;
+    }
+    return kind == WATCHDOG_WAIT_SEND ? WAITING_SEND : WAITING_NONE;
+}
+
+/* Flag the request in flight on a slot if it is over budget. */
+static void check_slot(struct watchdog_slot *slot, uint64_t now) {
+    uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    uint64_t start = atomic_load_explicit(&slot->start_ns, memory_order_acquire);
+    int type = atomic_load_explicit(&slot->type, memory_order_relaxed);
+    int fd = atomic_load_explicit(&slot->fd, memory_order_relaxed);
+    int waiting = atomic_load_explicit(&slot->waiting, memory_order_relaxed);
+    if(start == 0 || start > now || atomic_load_explicit(&slot->seq, memory_order_acquire) != seq) {
+        return;
+    }
+    if(type < 0 || type >= METRICS_PKT_TYPES) {
+        type = 0;
+    }
+    uint64_t budget = atomic_load_explicit(&budgets[type], memory_order_relaxed);
+    uint64_t flagged = atomic_load(&slot->flagged);
+    if(budget == 0 || now - start <= budget || flagged == seq) {
+        return;
+    }
+    if(!atomic_compare_exchange_strong(&slot->flagged, &flagged, seq)) {
+        return;
+    }
+    atomic_fetch_add_explicit(&slow[type], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&waiting_counts[waiting_index(waiting)], 1, memory_order_relaxed);
+    char what[64];
+    describe_wait(waiting, what, sizeof(what));
+    watchdog_log("watchdog: fd %d %s request running for %lu ms (budget %lu ms), %s",
+            fd, metrics_pkt_name(type), (now - start) / 1000000, budget / 1000000, what);
+}
+
+/* Scan often enough to catch a request within a quarter of its budget. */
+static long scan_interval_ms(void) {
+    uint64_t least = 0;
+    for(int type = 0; type < METRICS_PKT_TYPES; type++) {
+        uint64_t b = atomic_load_explicit(&budgets[type], memory_order_relaxed);
+        if(b != 0 && (least == 0 || b < least)) {
+            least = b;
+        }
+    }
+    long ms = least / 4000000;
+    if(ms < WATCHDOG_MIN_SCAN_MS) {
+        ms = WATCHDOG_MIN_SCAN_MS;
+    }
+    if(least == 0 || ms > WATCHDOG_MAX_SCAN_MS) {
+        ms = WATCHDOG_MAX_SCAN_MS;
+    }
+    return ms;
+}
+
+static void *watchdog_thread(void *arg) {
+    pthread_mutex_lock(&control_mutex);
+    while(!stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        long ms = scan_interval_ms();
+        deadline.tv_sec += ms / 1000;
+        deadline.tv_nsec += (ms % 1000) * 1000000;
+        if(deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        int err = 0;
+        while(!stop && err != ETIMEDOUT) {
+            err = pthread_cond_timedwait(&stop_cond, &control_mutex, &deadline);
+        }
+        if(stop) {
+            break;
+        }
+        pthread_mutex_unlock(&control_mutex);
+        uint64_t now = metrics_now_ns();
+        for(struct watchdog_slot *slot = atomic_load(&slots); slot != NULL; slot = slot->next) {
+            check_slot(slot, now);
+        }
+        pthread_mutex_lock(&control_mutex);
+    }
+    pthread_mutex_unlock(&control_mutex);
+    return NULL;
+}
+
+int watchdog_start(uint64_t budget_ns) {
+    for(int type = 0; type < METRICS_PKT_TYPES; type++) {
+        atomic_store(&budgets[type], budget_ns);
+    }
+    pthread_mutex_lock(&control_mutex);
+    if(atomic_load(&watchdog_running)) {
+        pthread_cond_signal(&stop_cond);
+        pthread_mutex_unlock(&control_mutex);
+        return 0;
+    }
+    stop = 0;
+    if(pthread_create(&watchdog_tid, NULL, watchdog_thread, NULL) != 0) {
+        pthread_mutex_unlock(&control_mutex);
+        debug("%ld: Failed to start watchdog thread", pthread_self());
+        return -1;
+    }
+    atomic_store(&watchdog_running, 1);
+    pthread_mutex_unlock(&control_mutex);
+    debug("%ld: Started watchdog (budget %lu ms)", pthread_self(), budget_ns / 1000000);
+    return 0;
+}
+
+void watchdog_stop(void) {
+    pthread_mutex_lock(&control_mutex);
+    if(!atomic_load(&watchdog_running)) {
+        pthread_mutex_unlock(&control_mutex);
+        return;
+    }
+    atomic_store(&watchdog_running, 0);
+    stop = 1;
+    pthread_cond_signal(&stop_cond);
+    pthread_mutex_unlock(&control_mutex);
+    pthread_join(watchdog_tid, NULL);
+    debug("%ld: Stopped watchdog", pthread_self());
+}
+
+int watchdog_set_budget(int type, uint64_t budget_ns) {
+    if(type < 0 || type >= METRICS_PKT_TYPES) {
+        return -1;
+    }
+    atomic_store(&budgets[type], budget_ns);
+    /* wake the watchdog so a shorter budget shortens its interval */
+    pthread_mutex_lock(&control_mutex);
+    pthread_cond_signal(&stop_cond);
+    pthread_mutex_unlock(&control_mutex);
+    return 0;
+}
+
+uint64_t watchdog_get_budget(int type) {
+    if(type < 0 || type >= METRICS_PKT_TYPES) {
+        return 0;
+    }
+    return atomic_load(&budgets[type]);
+}
+
+uint64_t watchdog_read_slow(int type) {
+    if(type < 0 || type >= METRICS_PKT_TYPES) {
+        return 0;
+    }
+    return atomic_load_explicit(&slow[type], memory_order_relaxed);
+}
+
+void watchdog_write(FILE *out) {
+    for(int type = 0; type < METRICS_PKT_TYPES; type++) {
+        uint64_t n = watchdog_read_slow(type);
+        if(n != 0) {
+            fprintf(out, "watchdog_slow_%s\t%lu\n", metrics_pkt_name(type), n);
+        }
+    }
+    for(int k = 0; k < WAITING_KINDS; k++) {
+        uint64_t n = atomic_load_explicit(&waiting_counts[k], memory_order_relaxed);
+        if(n == 0) {
+            continue;
+        }
+        if(k == WAITING_NONE) {
+            fprintf(out, "watchdog_waiting_none\t%lu\n", n);
+        } else if(k == WAITING_SEND) {
+            fprintf(out, "watchdog_waiting_send\t%lu\n", n);
+        } else {
+            fprintf(out, "watchdog_waiting_lock_%s\t%lu\n", lprof_site_name(k - WAITING_LOCK), n);
+        }
+    }
+}
@@ -0,0 +1,128 @@
+#include <criterion/criterion.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "debug.h"
+#include "admin.h"
+#include "player_registry_ext.h"
+#include "jeux_globals.h"
+#include "tests_defs.h"
+#include "excludes.h"
+
+#define ADMIN_SOCKET SOCKET_DIR "admin.sock"
+
+static void init() {
+    mkdir(TEST_OUTPUT, 0777);
+    client_registry = creg_init();
+    player_registry = preg_init();
+    admin_server = admin_start(ADMIN_SOCKET);
+    cr_assert_not_null(admin_server, "Admin endpoint could not be started");
+}
+
+static FILE *admin_connect(void) {
+    struct sockaddr_un sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, ADMIN_SOCKET);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    cr_assert(fd >= 0, "Failed to create socket");
+    cr_assert_eq(connect(fd, (struct sockaddr *)&sa, sizeof(sa)), 0,
+		 "Failed to connect to admin endpoint");
+    FILE *f = fdopen(fd, "r");
+    cr_assert_not_null(f, "Failed to open stream on admin connection");
+    return f;
+}
+
+/*
+ * Send a command and collect its reply, up to but not including the
+ * terminating "." line.
+ */
+static char *admin_command(FILE *f, char *cmd) {
+    dprintf(fileno(f), "%s\n", cmd);
+    char *reply = NULL;
+    size_t sz;
+    FILE *out = open_memstream(&reply, &sz);
+    char *line = NULL;
+    size_t cap = 0;
+    while(getline(&line, &cap, f) != -1 && strcmp(line, ".\n") != 0)
+	fputs(line, out);
+    free(line);
+    fclose(out);
+    return reply;
+}
+
+Test(admin_suite, players_and_gc, .init = init, .timeout = 5) {
+    PLAYER *alice = preg_register(player_registry, "Alice");
+    PLAYER *bob = preg_register(player_registry, "Bob");
+    player_unref(bob, "because test no longer needs Bob");
+
+    FILE *f = admin_connect();
+    char *reply = admin_command(f, "players");
+    cr_assert(strstr(reply, "Alice\t1500\t2\n") != NULL, "Player list (%s) does not show Alice", reply);
+    cr_assert(strstr(reply, "Bob\t1500\t1\n") != NULL, "Player list (%s) does not show Bob", reply);
+    free(reply);
+
+    reply = admin_command(f, "gc");
+    cr_assert(strcmp(reply, "collected 1\n") == 0, "GC reply (%s) does not match expected", reply);
+    free(reply);
+
+    reply = admin_command(f, "players");
+    cr_assert(strstr(reply, "Bob") == NULL, "Idle player Bob (%s) was not collected", reply);
+    cr_assert(strstr(reply, "Alice") != NULL, "Referenced player Alice (%s) was collected", reply);
+    free(reply);
+
+    fclose(f);
+    player_unref(alice, "because test is done");
+    admin_stop(admin_server);
+}
+
+Test(admin_suite, stats_and_trace, .init = init, .timeout = 5) {
+    FILE *f = admin_connect();
+    char *reply = admin_command(f, "stats");
+    cr_assert(strstr(reply, "packets_in\t") != NULL, "Stats (%s) do not include packet counts", reply);
+    free(reply);
+
+    reply = admin_command(f, "trace on");
+    cr_assert(strcmp(reply, "") == 0, "Trace reply (%s) is not empty", reply);
+    cr_assert_eq(admin_tracing, 1, "Tracing was not turned on");
+    free(reply);
+    reply = admin_command(f, "trace off");
+    cr_assert_eq(admin_tracing, 0, "Tracing was not turned off");
+    free(reply);
+
+    reply = admin_command(f, "bogus");
+    cr_assert(strncmp(reply, "error:", 6) == 0, "Reply to unknown command (%s) is not an error", reply);
+    free(reply);
+    fclose(f);
+    admin_stop(admin_server);
+}
+
+/*
+ * Stopping the endpoint must not hang while a connection is open and idle.
+ */
+Test(admin_suite, stop_with_open_connection, .init = init, .timeout = 5) {
+    FILE *f = admin_connect();
+    free(admin_command(f, "help"));
+    admin_stop(admin_server);
+    cr_assert_neq(access(ADMIN_SOCKET, F_OK), 0, "Admin socket was not removed");
+    fclose(f);
+}
+
+/* A path that names anything other than a socket is left alone. */
+Test(admin_suite, regular_file_not_replaced, .timeout = 5) {
+    char *path = SOCKET_DIR "admin_not_a_socket";
+    mkdir(TEST_OUTPUT, 0777);
+    FILE *f = fopen(path, "w");
+    cr_assert_not_null(f, "Failed to create file");
+    fputs("keep me\n", f);
+    fclose(f);
+    ADMIN_SERVER *admin = admin_start(path);
+    cr_assert_null(admin, "Admin endpoint was started over a regular file");
+    cr_assert_eq(access(path, F_OK), 0, "Regular file was removed");
+    unlink(path);
+}
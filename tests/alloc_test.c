@@ -0,0 +1,236 @@
+#include <criterion/criterion.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "client_registry.h"
+#include "session.h"
+#include "protocol_ext.h"
+#include "packet_common.h"
+
+/*
+ * Heap allocations on the request paths, counted by interposing malloc(),
+ * calloc(), realloc() and free() for the whole test program and passing
+ * every call through to the C library.  Only calls made by the testing
+ * thread while counting is on are counted, so the server's own threads
+ * (the rating thread, for one) and the test framework do not disturb the
+ * counts.
+ *
+ * AddressSanitizer supplies its own allocator, so under it there is
+ * nothing to interpose and nothing here is built.
+ */
+
+#if !defined(__SANITIZE_ADDRESS__)
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static __thread int counting;
+static __thread long allocs;
+
+void *malloc(size_t size) {
+    if(counting) {
+        allocs++;
+    }
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    if(counting) {
+        allocs++;
+    }
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    if(counting) {
+        allocs++;
+    }
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+static void count_start(void) {
+    allocs = 0;
+    counting = 1;
+}
+
+static long count_stop(void) {
+    counting = 0;
+    return allocs;
+}
+
+#define MAX_PKTS (16)
+
+typedef struct outbox {
+    int count;
+    JEUX_PACKET_HEADER hdrs[MAX_PKTS];  /* host byte order */
+} OUTBOX;
+
+/* Keeps the last packets, so a long warm-up does not need a long outbox. */
+static int collect(void *arg, JEUX_PACKET_HEADER *hdr, void *data) {
+    OUTBOX *out = arg;
+    JEUX_PACKET_HEADER *h = &out->hdrs[out->count++ % MAX_PKTS];
+    *h = *hdr;
+    unpack_header(h);
+    return 0;
+}
+
+static JEUX_PACKET_HEADER *last(OUTBOX *out) {
+    return &out->hdrs[(out->count - 1) % MAX_PKTS];
+}
+
+/*
+ * Push a request as the service thread would, with the payload in storage
+ * from proto_alloc_payload(), and count the allocations made.
+ */
+static long push(SESSION *session, int type, int id, int role, char *payload) {
+    JEUX_PACKET_HEADER hdr = {0};
+    size_t size = payload == NULL ? 0 : strlen(payload);
+    pack_header(&hdr, type, id, role, size);
+    count_start();
+    void *data = NULL;
+    if(size > 0) {
+        data = proto_alloc_payload(size);
+        memcpy(data, payload, size);
+    }
+    session_push(session, &hdr, data);
+    return count_stop();
+}
+
+static void expect(OUTBOX *out, int type) {
+    cr_assert(out->count > 0, "No packet was sent");
+    cr_assert_eq(last(out)->type, type, "Type of last packet (%d) does not match expected (%d)",
+                 last(out)->type, type);
+}
+
+/* Start a game, make a move each, and ask for the users. */
+static void play(SESSION *sa, OUTBOX *alice, SESSION *sb, OUTBOX *bob, int *alice_id, int *bob_id) {
+    push(sa, JEUX_INVITE_PKT, 0, SECOND_PLAYER_ROLE, "Bob");
+    expect(alice, JEUX_ACK_PKT);
+    *alice_id = last(alice)->id;
+    *bob_id = last(bob)->id;
+    push(sb, JEUX_ACCEPT_PKT, *bob_id, 0, NULL);
+    expect(bob, JEUX_ACK_PKT);
+    push(sa, JEUX_MOVE_PKT, *alice_id, 0, "5");
+    expect(alice, JEUX_ACK_PKT);
+    push(sb, JEUX_MOVE_PKT, *bob_id, 0, "1");
+    expect(bob, JEUX_ACK_PKT);
+    push(sa, JEUX_USERS_PKT, 0, 0, NULL);
+    expect(alice, JEUX_ACK_PKT);
+}
+
+static void resign(SESSION *sa, OUTBOX *alice, int alice_id) {
+    push(sa, JEUX_RESIGN_PKT, alice_id, 0, NULL);
+    expect(alice, JEUX_ACK_PKT);
+}
+
+static void init() {
+    cr_assert_eq(jeux_core_init(), 0, "Core initialization failed");
+}
+
+Test(alloc_suite, counting_works, .timeout = 5) {
+    count_start();
+    void *p = malloc(16);
+    void *q = calloc(1, 16);
+    p = realloc(p, 4096);
+    long n = count_stop();
+    free(p);
+    free(q);
+    cr_assert_eq(n, 3, "Allocations counted (%ld) does not match expected (%d)", n, 3);
+}
+
+/*
+ * Once a game has been played through, the next game's ACCEPT, its MOVEs
+ * and a USERS request allocate nothing.
+ */
+Test(alloc_suite, steady_state_requests_allocate_nothing, .init = init, .timeout = 5) {
+    OUTBOX alice = {0}, bob = {0};
+    SESSION *sa = session_open(collect, &alice);
+    SESSION *sb = session_open(collect, &bob);
+    cr_assert(sa != NULL && sb != NULL, "Returned value was NULL");
+    push(sa, JEUX_LOGIN_PKT, 0, 0, "Alice");
+    push(sb, JEUX_LOGIN_PKT, 0, 0, "Bob");
+
+    int alice_id, bob_id;
+    play(sa, &alice, sb, &bob, &alice_id, &bob_id);
+    resign(sa, &alice, alice_id);
+
+    long n;
+    push(sa, JEUX_INVITE_PKT, 0, SECOND_PLAYER_ROLE, "Bob");
+    alice_id = last(&alice)->id;
+    bob_id = last(&bob)->id;
+    n = push(sb, JEUX_ACCEPT_PKT, bob_id, 0, NULL);
+    expect(&bob, JEUX_ACK_PKT);
+    cr_assert_eq(n, 0, "ACCEPT made %ld allocations", n);
+    n = push(sa, JEUX_MOVE_PKT, alice_id, 0, "5");
+    expect(&alice, JEUX_ACK_PKT);
+    cr_assert_eq(n, 0, "MOVE made %ld allocations", n);
+    n = push(sb, JEUX_MOVE_PKT, bob_id, 0, "1");
+    expect(&bob, JEUX_ACK_PKT);
+    cr_assert_eq(n, 0, "MOVE made %ld allocations", n);
+    n = push(sa, JEUX_USERS_PKT, 0, 0, NULL);
+    expect(&alice, JEUX_ACK_PKT);
+    cr_assert_eq(n, 0, "USERS made %ld allocations", n);
+
+    resign(sa, &alice, alice_id);
+    session_close(sa);
+    session_close(sb);
+    jeux_core_fini();
+}
+
+/* Receiving a request into a recycled payload allocates nothing. */
+Test(alloc_suite, steady_state_receive_allocates_nothing, .timeout = 5) {
+    int fds[2];
+    cr_assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0, "socketpair failed");
+    JEUX_PACKET_HEADER out = {0}, in;
+    pack_header(&out, JEUX_MOVE_PKT, 0, 0, 4);
+    for(int i = 0; i < 2; i++) {
+        cr_assert_eq(proto_send_packet(fds[0], &out, "5<-X"), 0, "Send failed");
+        void *payload = NULL;
+        if(i == 1) {
+            count_start();
+        }
+        cr_assert_eq(proto_recv_packet(fds[1], &in, &payload), 0, "Receive failed");
+        cr_assert_eq(memcmp(payload, "5<-X", 4), 0, "Payload does not match what was sent");
+        proto_free_payload(payload, ntohs(in.size));
+    }
+    long n = count_stop();
+    close(fds[0]);
+    close(fds[1]);
+    cr_assert_eq(n, 0, "Receive made %ld allocations", n);
+}
+
+#endif /* !__SANITIZE_ADDRESS__ */
+
+/*
+ * A payload the host allocated at its exact size is never handed out
+ * again as storage for a larger small payload.
+ */
+Test(alloc_suite, foreign_payload_not_reused, .timeout = 5) {
+    void *held[16];
+    /* empty this thread's cache, so the foreign payload would go in it */
+    for(int i = 0; i < 16; i++) {
+        held[i] = proto_alloc_payload(1);
+    }
+    void *foreign = malloc(5);
+    cr_assert_not_null(foreign, "malloc failed");
+    proto_free_payload(foreign, 5);
+    void *payload = proto_alloc_payload(200);
+    cr_assert_not_null(payload, "Returned value was NULL");
+    cr_assert(malloc_usable_size(payload) >= 200, "Payload of 200 bytes has room for only %lu",
+              malloc_usable_size(payload));
+    proto_free_payload(payload, 200);
+    for(int i = 0; i < 16; i++) {
+        proto_free_payload(held[i], 1);
+    }
+}
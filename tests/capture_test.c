@@ -0,0 +1,147 @@
+#include <criterion/criterion.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <pthread.h>
+
+#include "debug.h"
+#include "capture.h"
+#include "protocol.h"
+#include "protocol_ext.h"
+#include "packet_common.h"
+#include "tests_defs.h"
+#include "excludes.h"
+
+#define CAPTURE_FILE TEST_OUTPUT "packets.cap"
+
+static void init() {
+    mkdir(TEST_OUTPUT, 0777);
+    unlink(CAPTURE_FILE);
+}
+
+/*
+ * Packets received by proto_recv_packet() while a capture is open are
+ * recorded with their connection, in order, and so is the end of the
+ * connection.
+ */
+Test(capture_suite, recv_records_packets, .init = init, .timeout = 5) {
+    int sv[2];
+    cr_assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0, "socketpair failed");
+    packet_capture = capture_open(CAPTURE_FILE);
+    cr_assert_not_null(packet_capture, "Returned value was NULL");
+
+    JEUX_PACKET_HEADER hdr = {0};
+    pack_header(&hdr, JEUX_LOGIN_PKT, 0, 0, 5);
+    cr_assert_eq(proto_send_packet(sv[0], &hdr, "Alice"), 0, "Send failed");
+    pack_header(&hdr, JEUX_USERS_PKT, 0, 0, 0);
+    cr_assert_eq(proto_send_packet(sv[0], &hdr, NULL), 0, "Send failed");
+    close(sv[0]);
+
+    for(int i = 0; i < 3; i++) {
+        JEUX_PACKET_HEADER in;
+        void *payload = NULL;
+        int status = proto_recv_packet(sv[1], &in, &payload);
+        cr_assert_eq(status, i < 2 ? 0 : -1, "Receive %d returned %d", i, status);
+        proto_free_payload(payload, ntohs(in.size));
+    }
+    close(sv[1]);
+    capture_close(packet_capture);
+    packet_capture = NULL;
+
+    FILE *in = capture_open_read(CAPTURE_FILE);
+    cr_assert_not_null(in, "Returned value was NULL");
+    CAPTURE_RECORD rec;
+    int exp_event[] = { CAPTURE_PACKET, CAPTURE_PACKET, CAPTURE_CLOSE };
+    int exp_type[] = { JEUX_LOGIN_PKT, JEUX_USERS_PKT, 0 };
+    uint64_t last_ns = 0;
+    for(int i = 0; i < 3; i++) {
+        int status = capture_read(in, &rec);
+        cr_assert_eq(status, 0, "Read of record %d returned %d", i, status);
+        cr_assert_eq(rec.conn, sv[1], "Connection (%d) does not match expected (%d)", rec.conn, sv[1]);
+        cr_assert_eq(rec.event, exp_event[i], "Event (%d) does not match expected (%d)",
+                     rec.event, exp_event[i]);
+        cr_assert_eq(rec.hdr.type, exp_type[i], "Type (%d) does not match expected (%d)",
+                     rec.hdr.type, exp_type[i]);
+        cr_assert(rec.time_ns >= last_ns, "Records are out of time order");
+        last_ns = rec.time_ns;
+        if(i == 0) {
+            cr_assert_eq(ntohs(rec.hdr.size), 5, "Size (%d) does not match expected (%d)",
+                         ntohs(rec.hdr.size), 5);
+            cr_assert(!memcmp(rec.payload, "Alice", 5), "Payload does not match expected");
+        } else {
+            cr_assert_null(rec.payload, "Expected no payload");
+        }
+        free(rec.payload);
+    }
+    int status = capture_read(in, &rec);
+    cr_assert_eq(status, 1, "Expected end of file, got %d", status);
+    fclose(in);
+}
+
+#define NTHREAD 4
+#define NPACKET 20000
+
+static void *record_thread(void *arg) {
+    int conn = (int)(long)arg;
+    JEUX_PACKET_HEADER hdr = {0};
+    pack_header(&hdr, JEUX_USERS_PKT, 0, 0, 0);
+    for(int i = 0; i < NPACKET; i++) {
+        capture_packet(packet_capture, conn, &hdr, NULL);
+    }
+    capture_end(packet_capture, conn);
+    return NULL;
+}
+
+/*
+ * Records made by several connections at once are all written out, each
+ * connection's end after its packets, and the file is in time order.
+ */
+Test(capture_suite, concurrent_records_merged, .init = init, .timeout = 15) {
+    packet_capture = capture_open(CAPTURE_FILE);
+    cr_assert_not_null(packet_capture, "Returned value was NULL");
+    pthread_t tids[NTHREAD];
+    for(int i = 0; i < NTHREAD; i++) {
+        pthread_create(&tids[i], NULL, record_thread, (void *)(long)i);
+    }
+    for(int i = 0; i < NTHREAD; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    capture_close(packet_capture);
+    packet_capture = NULL;
+
+    FILE *in = capture_open_read(CAPTURE_FILE);
+    cr_assert_not_null(in, "Returned value was NULL");
+    CAPTURE_RECORD rec;
+    int packets[NTHREAD] = {0}, ends[NTHREAD] = {0};
+    uint64_t last_ns = 0;
+    int status;
+    while((status = capture_read(in, &rec)) == 0) {
+        cr_assert(rec.conn >= 0 && rec.conn < NTHREAD, "Unexpected connection %d", rec.conn);
+        cr_assert(rec.time_ns >= last_ns, "Records are out of time order");
+        last_ns = rec.time_ns;
+        if(rec.event == CAPTURE_PACKET) {
+            cr_assert_eq(ends[rec.conn], 0, "Packet recorded after end of connection %d", rec.conn);
+            packets[rec.conn]++;
+        } else {
+            ends[rec.conn]++;
+        }
+        free(rec.payload);
+    }
+    cr_assert_eq(status, 1, "Expected end of file, got %d", status);
+    fclose(in);
+    for(int i = 0; i < NTHREAD; i++) {
+        cr_assert_eq(packets[i], NPACKET, "Connection %d: %d packets recorded, expected %d",
+                     i, packets[i], NPACKET);
+        cr_assert_eq(ends[i], 1, "Connection %d: %d ends recorded, expected 1", i, ends[i]);
+    }
+}
+
+Test(capture_suite, reject_foreign_file, .init = init, .timeout = 5) {
+    FILE *f = fopen(CAPTURE_FILE, "w");
+    fputs("not a capture\n", f);
+    fclose(f);
+    cr_assert_null(capture_open_read(CAPTURE_FILE), "Foreign file was accepted");
+}
@@ -0,0 +1,131 @@
+#include <criterion/criterion.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "census.h"
+#include "game.h"
+#include "game_ext.h"
+#include "protocol.h"
+#include "protocol_ext.h"
+#include "packet_common.h"
+#include "tests_defs.h"
+
+/* Port of the server started by the shutdown test. */
+#define CENSUS_PORT 9994
+
+Test(census_suite, counts_live_peak_and_total, .timeout = 5) {
+    CENSUS_COUNTS counts;
+    census_create(CENSUS_CLIENT, CENSUS_MEM_CLIENT, 100);
+    census_create(CENSUS_CLIENT, CENSUS_MEM_CLIENT, 100);
+    census_free(CENSUS_CLIENT, CENSUS_MEM_CLIENT, 100);
+    census_create(CENSUS_CLIENT, CENSUS_MEM_CLIENT, 100);
+    census_read(CENSUS_CLIENT, &counts);
+    cr_assert_eq(counts.live, 2, "Live count (%ld) does not match expected (%d)", counts.live, 2);
+    cr_assert_eq(counts.peak, 2, "Peak count (%ld) does not match expected (%d)", counts.peak, 2);
+    cr_assert_eq(counts.total, 3, "Total count (%lu) does not match expected (%d)", counts.total, 3);
+    int64_t live, peak;
+    census_bytes(CENSUS_MEM_CLIENT, 50);
+    census_bytes(CENSUS_MEM_CLIENT, -250);
+    census_read_bytes(CENSUS_MEM_CLIENT, &live, &peak);
+    cr_assert_eq(live, 0, "Live bytes (%ld) do not match expected (%d)", live, 0);
+    cr_assert_eq(peak, 250, "Peak bytes (%ld) do not match expected (%d)", peak, 250);
+}
+
+Test(census_suite, game_and_moves_return_to_zero, .timeout = 5) {
+    GAME *game = game_create();
+    GAME_MOVE *move = game_parse_move(game, FIRST_PLAYER_ROLE, "5");
+    CENSUS_COUNTS counts;
+    census_read(CENSUS_GAME_MOVE, &counts);
+    cr_assert_eq(counts.live, 1, "Live moves (%ld) do not match expected (%d)", counts.live, 1);
+    game_apply_move(game, move);
+    game_free_move(move);
+    game_unref(game, "because test is done");
+    census_read(CENSUS_GAME, &counts);
+    cr_assert_eq(counts.live, 0, "Live games (%ld) do not match expected (%d)", counts.live, 0);
+    cr_assert_eq(counts.total, 1, "Total games (%lu) does not match expected (%d)", counts.total, 1);
+    cr_assert_eq(census_check_empty(stderr), 0, "Census is not empty");
+}
+
+static int connect_server(void) {
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(CENSUS_PORT);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for(int i = 0; i < 50; i++) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0)
+	    return fd;
+	close(fd);
+	usleep(100000);
+    }
+    cr_assert_fail("Could not connect to server");
+    return -1;
+}
+
+static void send_pkt(int fd, int type, int id, int role, char *payload) {
+    JEUX_PACKET_HEADER hdr;
+    size_t size = payload == NULL ? 0 : strlen(payload);
+    pack_header(&hdr, type, id, role, size);
+    cr_assert_eq(proto_send_packet(fd, &hdr, payload), 0, "Send failed");
+}
+
+/* Receive packets until one of the given type arrives; returns its id. */
+static int recv_pkt(int fd, int type) {
+    while(1) {
+	JEUX_PACKET_HEADER hdr;
+	void *payload = NULL;
+	cr_assert_eq(proto_recv_packet(fd, &hdr, &payload), 0, "Receive failed");
+	proto_free_payload(payload, ntohs(hdr.size));
+	if(hdr.type == type)
+	    return hdr.id;
+    }
+}
+
+/*
+ * Run a server with -C through logins, an invitation, a game abandoned
+ * by a disconnect, a request before login and an unknown request, and
+ * check that it finds nothing live after terminate().
+ */
+Test(census_suite, nothing_live_after_terminate, .timeout = 30) {
+    pid_t pid = fork();
+    if(pid == 0) {
+	execl("bin/jeux", "jeux", "-p", "9994", "-C", NULL);
+	fprintf(stderr, "Failed to exec server\n");
+	abort();
+    }
+    int alice = connect_server();
+    int bob = connect_server();
+    send_pkt(alice, JEUX_INVITE_PKT, 0, 0, "Bob");
+    recv_pkt(alice, JEUX_NACK_PKT);
+    send_pkt(alice, JEUX_LOGIN_PKT, 0, 0, "Alice");
+    recv_pkt(alice, JEUX_ACK_PKT);
+    send_pkt(bob, JEUX_LOGIN_PKT, 0, 0, "Bob");
+    recv_pkt(bob, JEUX_ACK_PKT);
+    send_pkt(alice, JEUX_STATS_PKT + 10, 0, 0, "junk");
+    send_pkt(alice, JEUX_INVITE_PKT, 0, SECOND_PLAYER_ROLE, "Bob");
+    int alice_id = recv_pkt(alice, JEUX_ACK_PKT);
+    int bob_id = recv_pkt(bob, JEUX_INVITED_PKT);
+    send_pkt(bob, JEUX_ACCEPT_PKT, bob_id, 0, NULL);
+    recv_pkt(bob, JEUX_ACK_PKT);
+    recv_pkt(alice, JEUX_ACCEPTED_PKT);
+    send_pkt(alice, JEUX_MOVE_PKT, alice_id, 0, "5");
+    recv_pkt(alice, JEUX_ACK_PKT);
+    close(bob);
+    send_pkt(alice, JEUX_USERS_PKT, 0, 0, NULL);
+    recv_pkt(alice, JEUX_ACK_PKT);
+
+    kill(pid, SIGHUP);
+    int status;
+    cr_assert_eq(waitpid(pid, &status, 0), pid, "Server was not reaped");
+    close(alice);
+    cr_assert(WIFEXITED(status), "Server did not exit normally");
+    cr_assert_eq(WEXITSTATUS(status), 0, "Server found live objects after terminate()");
+}
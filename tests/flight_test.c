@@ -0,0 +1,113 @@
+#include <criterion/criterion.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "debug.h"
+#include "game.h"
+#include "flight.h"
+#include "tests_defs.h"
+#include "excludes.h"
+
+#define FLIGHT_DUMP TEST_OUTPUT "flight.dump"
+
+/* Number of short-lived threads in the ring reuse test. */
+#define NTHREAD (10)
+
+static void init() {
+    cr_assert_eq(flight_init(FLIGHT_DUMP), 0, "Flight recorder could not be initialized");
+}
+
+/*
+ * Read back a dump, keeping the events for one object (oldest first) and
+ * counting the rings.
+ */
+static int read_dump(uint64_t object, FLIGHT_EVENT *found, char **whys, int max, int *nrings) {
+    FILE *in = fopen(FLIGHT_DUMP, "r");
+    cr_assert_not_null(in, "Dump file was not created");
+    char magic[FLIGHT_DUMP_MAGIC_LEN];
+    uint32_t header[2];
+    cr_assert_eq(fread(magic, sizeof(magic), 1, in), 1, "Dump header is missing");
+    cr_assert_eq(fread(header, sizeof(header), 1, in), 1, "Dump header is missing");
+    cr_assert_eq(header[1], FLIGHT_RING_EVENTS, "Ring size (%u) does not match expected (%d)",
+		 header[1], FLIGHT_RING_EVENTS);
+    static FLIGHT_EVENT ring[FLIGHT_RING_EVENTS];
+    FLIGHT_DUMP_RECORD rec;
+    int n = 0;
+    *nrings = 0;
+    while(fread(&rec, sizeof(rec), 1, in) == 1 && rec.tag != FLIGHT_DUMP_END) {
+	if(rec.tag == FLIGHT_DUMP_RING) {
+	    (*nrings)++;
+	    cr_assert_eq(fread(ring, sizeof(ring), 1, in), 1, "Ring is truncated");
+	    cr_assert(rec.count <= FLIGHT_RING_EVENTS, "Test ring unexpectedly wrapped");
+	    for(int i = 0; i < rec.count; i++)
+		if(ring[i].object == object && n < max)
+		    found[n++] = ring[i];
+	} else {
+	    cr_assert_eq(rec.tag, FLIGHT_DUMP_STRING, "Unknown record tag %u", rec.tag);
+	    char *text = calloc(rec.count + 1, 1);
+	    cr_assert_eq(fread(text, 1, rec.count, in), rec.count, "String is truncated");
+	    for(int i = 0; i < n; i++)
+		if(found[i].why == rec.value)
+		    whys[i] = strdup(text);
+	    free(text);
+	}
+    }
+    cr_assert_eq(rec.tag, FLIGHT_DUMP_END, "Dump has no end record");
+    fclose(in);
+    return n;
+}
+
+Test(flight_suite, game_lifecycle, .init = init, .timeout = 5) {
+    GAME *game = game_create();
+    game_ref(game, "for test reference");
+    game_unref(game, "because test reference is done");
+    game_unref(game, "because test is done");
+    cr_assert_eq(flight_dump(), 0, "Dump failed");
+
+    FLIGHT_EVENT found[8];
+    char *whys[8] = { NULL };
+    int nrings;
+    int n = read_dump((uintptr_t)game, found, whys, 8, &nrings);
+    int want_types[] = { FLIGHT_CREATE, FLIGHT_REF, FLIGHT_REF, FLIGHT_UNREF, FLIGHT_UNREF, FLIGHT_FREE };
+    int want_refs[] = { 0, 1, 2, 1, 0, 0 };
+    cr_assert_eq(n, 6, "Number of events (%d) does not match expected (%d)", n, 6);
+    for(int i = 0; i < n; i++) {
+	cr_assert_eq(found[i].object_type, FLIGHT_GAME, "Event %d has wrong object type", i);
+	cr_assert_eq(found[i].event_type, want_types[i], "Event %d type (%d) does not match expected (%d)",
+		     i, found[i].event_type, want_types[i]);
+	cr_assert_eq(found[i].ref_count, want_refs[i], "Event %d ref count (%d) does not match expected (%d)",
+		     i, found[i].ref_count, want_refs[i]);
+	if(i > 0)
+	    cr_assert(found[i].timestamp_ns >= found[i - 1].timestamp_ns, "Event %d is out of order", i);
+    }
+    cr_assert(whys[2] != NULL && strcmp(whys[2], "for test reference") == 0,
+	      "Reason (%s) was not recovered from the dump", whys[2]);
+    cr_assert(whys[5] != NULL && strcmp(whys[5], "because test is done") == 0,
+	      "Free reason (%s) was not recovered from the dump", whys[5]);
+}
+
+static void *short_thread(void *arg) {
+    game_unref(game_create(), "because thread is done");
+    return NULL;
+}
+
+/*
+ * Threads that run one after another pass the same ring along, so a
+ * server with a thread per connection does not grow a ring per connection.
+ */
+Test(flight_suite, rings_are_reused, .init = init, .timeout = 5) {
+    game_unref(game_create(), "to give the main thread a ring");
+    for(int i = 0; i < NTHREAD; i++) {
+	pthread_t tid;
+	pthread_create(&tid, NULL, short_thread, NULL);
+	pthread_join(tid, NULL);
+    }
+    cr_assert_eq(flight_dump(), 0, "Dump failed");
+    FLIGHT_EVENT found[1];
+    char *whys[1];
+    int nrings;
+    read_dump(0, found, whys, 0, &nrings);
+    cr_assert_eq(nrings, 2, "Number of rings (%d) does not match expected (%d)", nrings, 2);
+}
@@ -0,0 +1,126 @@
+#include <criterion/criterion.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <wait.h>
+
+#include "client_registry.h"
+#include "jeux_client.h"
+#include "protocol.h"
+#include "census.h"
+
+/* Port of the server whose footprint is measured. */
+#define FOOTPRINT_PORT "9992"
+
+/*
+ * Most a logged-in, idle connection may add to the server's resident set
+ * size, in bytes; the JEUX_IDLE_CONN_BUDGET environment variable
+ * overrides it.  bin/footprint_bench measures the same thing at scale.
+ */
+#define IDLE_CONN_BUDGET (64 * 1024)
+
+/* Connections opened for the measurement, short of MAX_CLIENTS. */
+#define NCONNS (48)
+
+static pid_t server_pid;
+
+static void start_server(void) {
+    signal(SIGPIPE, SIG_IGN);
+    server_pid = fork();
+    if(server_pid == 0) {
+	execl("bin/jeux", "jeux", "-p", FOOTPRINT_PORT, NULL);
+	fprintf(stderr, "Failed to exec server\n");
+	abort();
+    }
+}
+
+static void stop_server(void) {
+    kill(server_pid, SIGHUP);
+    waitpid(server_pid, NULL, 0);
+}
+
+static void on_reply(JC_CONN *conn, void *arg, JEUX_PACKET_HEADER *hdr, void *payload) {
+    *(int *)arg = hdr == NULL ? -1 : hdr->type;
+}
+
+static void on_event(JC_CONN *conn, void *arg, JEUX_PACKET_HEADER *hdr, void *payload) {
+    if(hdr == NULL) {
+	*(int *)arg = 1;
+    }
+}
+
+static JC_CONN *connect_server(JC_LOOP *loop, int *lost) {
+    for(int i = 0; i < 50; i++) {
+	JC_CONN *conn = jc_connect(loop, "127.0.0.1", FOOTPRINT_PORT, on_event, lost);
+	if(conn != NULL)
+	    return conn;
+	usleep(100000);
+    }
+    cr_assert_fail("Could not connect to server");
+    return NULL;
+}
+
+/* Log a new connection in and return the type of the reply. */
+static int login(JC_LOOP *loop, JC_CONN *conn, int n) {
+    char name[32];
+    int reply = 0;
+    snprintf(name, sizeof(name), "idle%d", n);
+    jc_request(conn, JEUX_LOGIN_PKT, 0, 0, name, strlen(name), on_reply, &reply);
+    while(reply == 0) {
+	cr_assert(jc_loop_run(loop, 5000) > 0, "No reply to login %d", n);
+    }
+    return reply;
+}
+
+Test(footprint_suite, idle_connections_within_budget, .init = start_server,
+     .fini = stop_server, .timeout = 30) {
+    long budget = IDLE_CONN_BUDGET;
+    char *env = getenv("JEUX_IDLE_CONN_BUDGET");
+    if(env != NULL) {
+	budget = atol(env);
+    }
+    JC_LOOP *loop = jc_loop_create();
+    int lost = 0;
+    /* the first connection starts the server's allocator and thread stacks off */
+    JC_CONN *probe = connect_server(loop, &lost);
+    cr_assert_eq(login(loop, probe, NCONNS), JEUX_ACK_PKT, "Login was not acknowledged");
+    usleep(200000);
+    int64_t before = census_rss_bytes(server_pid);
+    cr_assert(before > 0, "Server RSS could not be read");
+
+    for(int i = 0; i < NCONNS; i++) {
+	JC_CONN *conn = connect_server(loop, &lost);
+	cr_assert_eq(login(loop, conn, i), JEUX_ACK_PKT, "Login %d was not acknowledged", i);
+    }
+    usleep(200000);
+    int64_t after = census_rss_bytes(server_pid);
+    int64_t per_conn = (after - before) / NCONNS;
+    cr_assert(per_conn <= budget, "Idle connection footprint (%ld bytes) exceeds budget (%ld bytes)",
+	      per_conn, budget);
+    cr_assert_eq(lost, 0, "A connection was lost");
+    jc_loop_destroy(loop);
+}
+
+/*
+ * A connection the registry has no room for is closed by the server,
+ * rather than left open with no thread serving it.
+ */
+Test(footprint_suite, refused_when_full, .init = start_server, .fini = stop_server, .timeout = 30) {
+    JC_LOOP *loop = jc_loop_create();
+    int lost = 0;
+    for(int i = 0; i < MAX_CLIENTS; i++) {
+	JC_CONN *conn = connect_server(loop, &lost);
+	cr_assert_eq(login(loop, conn, i), JEUX_ACK_PKT, "Login %d was not acknowledged", i);
+    }
+    cr_assert_eq(lost, 0, "A connection was lost");
+    int reply = 0;
+    JC_CONN *extra = connect_server(loop, &lost);
+    jc_request(extra, JEUX_LOGIN_PKT, 0, 0, "extra", 5, on_reply, &reply);
+    while(lost == 0) {
+	cr_assert(jc_loop_run(loop, 5000) > 0, "Connection beyond capacity was not closed");
+    }
+    cr_assert_eq(reply, -1, "Request beyond capacity got a reply (%d)", reply);
+    jc_loop_destroy(loop);
+}
@@ -0,0 +1,63 @@
+#include <criterion/criterion.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "debug.h"
+#include "game_log.h"
+#include "tests_defs.h"
+#include "excludes.h"
+
+#define LOG_FILE TEST_OUTPUT "game_log.hist"
+
+static void init() {
+    mkdir(TEST_OUTPUT, 0777);
+    unlink(LOG_FILE);
+}
+
+Test(game_log_suite, append_read, .init = init, .timeout = 5) {
+    GAME_LOG *log = glog_open(LOG_FILE);
+    cr_assert_not_null(log, "Returned value was NULL");
+    cr_assert_eq(glog_append(log, "Alice", "Bob", 1), 0, "Append failed");
+    cr_assert_eq(glog_append(log, "Carol", "Alice", 0), 0, "Append failed");
+    glog_close(log);
+
+    // Reopening appends after the existing records.
+    log = glog_open(LOG_FILE);
+    cr_assert_not_null(log, "Reopen returned NULL");
+    cr_assert_eq(glog_append(log, "Bob", "Carol", 2), 0, "Append failed");
+    glog_close(log);
+
+    char *exp_name1[] = { "Alice", "Carol", "Bob" };
+    char *exp_name2[] = { "Bob", "Alice", "Carol" };
+    int exp_result[] = { 1, 0, 2 };
+
+    FILE *in = glog_open_read(LOG_FILE);
+    cr_assert_not_null(in, "Returned value was NULL");
+    GAME_LOG_RECORD rec;
+    for(int i = 0; i < 3; i++) {
+	int status = glog_read(in, &rec);
+	cr_assert_eq(status, 0, "Read of record %d returned %d", i, status);
+	cr_assert(!strcmp(rec.name1, exp_name1[i]), "Name (%s) does not match expected (%s)",
+		  rec.name1, exp_name1[i]);
+	cr_assert(!strcmp(rec.name2, exp_name2[i]), "Name (%s) does not match expected (%s)",
+		  rec.name2, exp_name2[i]);
+	cr_assert_eq(rec.result, exp_result[i], "Result (%d) does not match expected (%d)",
+		     rec.result, exp_result[i]);
+	free(rec.name1);
+	free(rec.name2);
+    }
+    int status = glog_read(in, &rec);
+    cr_assert_eq(status, 1, "Expected end of file, got %d", status);
+    fclose(in);
+}
+
+Test(game_log_suite, reject_foreign_file, .init = init, .timeout = 5) {
+    FILE *f = fopen(LOG_FILE, "w");
+    fputs("not a game log\n", f);
+    fclose(f);
+    cr_assert_null(glog_open(LOG_FILE), "Opened a file that is not a game log");
+    cr_assert_null(glog_open_read(LOG_FILE), "Opened a file that is not a game log");
+}
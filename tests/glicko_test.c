@@ -0,0 +1,76 @@
+#include <criterion/criterion.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "debug.h"
+#include "glicko.h"
+#include "excludes.h"
+
+/*
+ * The worked example from Glickman's "Example of the Glicko-2 system":
+ * a player rated 1500 (RD 200) beats a 1400 (RD 30) and loses to a
+ * 1550 (RD 100) and a 1700 (RD 300) in one rating period.
+ */
+Test(glicko_suite, glickman_example, .timeout = 5) {
+    GLICKO *g = glicko_init(0.5, 0);
+    cr_assert_not_null(g, "Returned value was NULL");
+    glicko_set(g, 0, 1500, 200, 0.06);
+    glicko_set(g, 1, 1400, 30, 0.06);
+    glicko_set(g, 2, 1550, 100, 0.06);
+    glicko_set(g, 3, 1700, 300, 0.06);
+
+    cr_assert_eq(glicko_record(g, 0, 1, 1), 0, "Failed to record result");
+    cr_assert_eq(glicko_record(g, 2, 0, 1), 0, "Failed to record result");
+    cr_assert_eq(glicko_record(g, 0, 3, 2), 0, "Failed to record result");
+
+    // Nothing changes until the period is closed.
+    int r = glicko_get_rating(g, 0);
+    cr_assert_eq(r, 1500, "Player rating (%d) does not match expected (%d)", r, 1500);
+
+    long n = glicko_close_period(g);
+    cr_assert_eq(n, 3, "Number of results applied (%ld) was not %d", n, 3);
+
+    double rating, rd, vol;
+    glicko_get(g, 0, &rating, &rd, &vol);
+    cr_assert(fabs(rating - 1464.06) < 0.01, "Rating (%f) does not match expected (%f)",
+	      rating, 1464.06);
+    cr_assert(fabs(rd - 151.52) < 0.01, "RD (%f) does not match expected (%f)",
+	      rd, 151.52);
+    cr_assert(fabs(vol - 0.05999) < 0.00001, "Volatility (%f) does not match expected (%f)",
+	      vol, 0.05999);
+    glicko_fini(g);
+}
+
+Test(glicko_suite, idle_player_deviation_grows, .timeout = 5) {
+    GLICKO *g = glicko_init(GLICKO_DEFAULT_TAU, 0);
+    cr_assert_not_null(g, "Returned value was NULL");
+    glicko_set(g, 5, 1600, 50, 0.06);
+    glicko_close_period(g);
+
+    double rating, rd;
+    glicko_get(g, 5, &rating, &rd, NULL);
+    cr_assert(fabs(rating - 1600) < 0.0001, "Idle player's rating (%f) changed", rating);
+    cr_assert(rd > 50, "Idle player's RD (%f) did not grow", rd);
+
+    // A player the engine has never seen reports the initial parameters.
+    glicko_get(g, 1000, &rating, &rd, NULL);
+    cr_assert_eq(rating, GLICKO_INITIAL_RATING, "Unknown player's rating (%f) was not initial", rating);
+    cr_assert_eq(rd, GLICKO_INITIAL_RD, "Unknown player's RD (%f) was not initial", rd);
+    glicko_fini(g);
+}
+
+Test(glicko_suite, idle_player_deviation_capped, .timeout = 5) {
+    GLICKO *g = glicko_init(GLICKO_DEFAULT_TAU, 0);
+    cr_assert_not_null(g, "Returned value was NULL");
+    glicko_set(g, 0, 1600, 340, 0.06);
+    for(int i = 0; i < 100; i++) {
+	glicko_close_period(g);
+    }
+
+    double rd;
+    glicko_get(g, 0, NULL, &rd, NULL);
+    cr_assert(rd <= GLICKO_INITIAL_RD + 0.0001, "Idle player's RD (%f) exceeds initial RD (%f)",
+	      rd, GLICKO_INITIAL_RD);
+    glicko_fini(g);
+}
@@ -0,0 +1,220 @@
+#include <criterion/criterion.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <wait.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "jeux_client.h"
+#include "game.h"
+#include "protocol.h"
+#include "packet_common.h"
+
+/* Port of the server the client library talks to. */
+#define CLIENT_PORT "9993"
+
+#define MAX_EVENTS (16)
+
+/* What one connection saw, in order. */
+typedef struct seen {
+    int replies[MAX_EVENTS];    /* ACK, NACK or -1 for none */
+    int nreplies;
+    int events[MAX_EVENTS];     /* notification type, or -1 when lost */
+    int event_ids[MAX_EVENTS];
+    int nevents;
+} SEEN;
+
+static pid_t server_pid;
+
+static void start_server(void) {
+    signal(SIGPIPE, SIG_IGN);
+    server_pid = fork();
+    if(server_pid == 0) {
+	execl("bin/jeux", "jeux", "-p", CLIENT_PORT, NULL);
+	fprintf(stderr, "Failed to exec server\n");
+	abort();
+    }
+}
+
+static void stop_server(void) {
+    kill(server_pid, SIGHUP);
+    waitpid(server_pid, NULL, 0);
+}
+
+static void on_reply(JC_CONN *conn, void *arg, JEUX_PACKET_HEADER *hdr, void *payload) {
+    SEEN *seen = arg;
+    seen->replies[seen->nreplies++] = hdr == NULL ? -1 : hdr->type;
+}
+
+static void on_event(JC_CONN *conn, void *arg, JEUX_PACKET_HEADER *hdr, void *payload) {
+    SEEN *seen = arg;
+    seen->events[seen->nevents] = hdr == NULL ? -1 : hdr->type;
+    seen->event_ids[seen->nevents] = hdr == NULL ? -1 : hdr->id;
+    seen->nevents++;
+}
+
+static JC_CONN *connect_server(JC_LOOP *loop, SEEN *seen) {
+    for(int i = 0; i < 50; i++) {
+	JC_CONN *conn = jc_connect(loop, "127.0.0.1", CLIENT_PORT, on_event, seen);
+	if(conn != NULL)
+	    return conn;
+	usleep(100000);
+    }
+    cr_assert_fail("Could not connect to server");
+    return NULL;
+}
+
+static void run_until(JC_LOOP *loop, int *count, int want) {
+    while(*count < want) {
+	cr_assert(jc_loop_run(loop, 5000) > 0, "Nothing arrived (have %d, want %d)", *count, want);
+    }
+}
+
+/*
+ * Requests queued back to back, without waiting, are answered in order,
+ * and notifications on two connections in the same loop reach the right
+ * callbacks.
+ */
+Test(jeux_client_suite, pipelined_requests_and_notifications, .init = start_server,
+     .fini = stop_server, .timeout = 15) {
+    JC_LOOP *loop = jc_loop_create();
+    cr_assert_not_null(loop, "Returned value was NULL");
+    SEEN alice = {0}, bob = {0};
+    JC_CONN *ca = connect_server(loop, &alice);
+    JC_CONN *cb = connect_server(loop, &bob);
+
+    jc_request(cb, JEUX_LOGIN_PKT, 0, 0, "Bob", 3, on_reply, &bob);
+    jc_request(ca, JEUX_USERS_PKT, 0, 0, NULL, 0, on_reply, &alice);
+    jc_request(ca, JEUX_LOGIN_PKT, 0, 0, "Alice", 5, on_reply, &alice);
+    jc_request(ca, JEUX_USERS_PKT, 0, 0, NULL, 0, on_reply, &alice);
+    jc_request(ca, JEUX_INVITE_PKT, 0, FIRST_PLAYER_ROLE, "Nobody", 6, on_reply, &alice);
+    cr_assert_eq(jc_outstanding(ca), 4, "Outstanding (%d) does not match expected (%d)",
+                 jc_outstanding(ca), 4);
+    run_until(loop, &alice.nreplies, 4);
+    int want[] = { JEUX_NACK_PKT, JEUX_ACK_PKT, JEUX_ACK_PKT, JEUX_NACK_PKT };
+    for(int i = 0; i < 4; i++) {
+	cr_assert_eq(alice.replies[i], want[i], "Reply %d (%d) does not match expected (%d)",
+		     i, alice.replies[i], want[i]);
+    }
+    run_until(loop, &bob.nreplies, 1);
+
+    jc_request(ca, JEUX_INVITE_PKT, 0, FIRST_PLAYER_ROLE, "Bob", 3, on_reply, &alice);
+    run_until(loop, &bob.nevents, 1);
+    cr_assert_eq(bob.events[0], JEUX_INVITED_PKT, "Event (%d) does not match expected (%d)",
+                 bob.events[0], JEUX_INVITED_PKT);
+    jc_request(cb, JEUX_ACCEPT_PKT, bob.event_ids[0], 0, NULL, 0, on_reply, &bob);
+    run_until(loop, &alice.nevents, 1);
+    cr_assert_eq(alice.events[0], JEUX_ACCEPTED_PKT, "Event (%d) does not match expected (%d)",
+                 alice.events[0], JEUX_ACCEPTED_PKT);
+    /* Bob's acceptance can overtake the acknowledgement of the invitation */
+    run_until(loop, &alice.nreplies, 5);
+    cr_assert_eq(alice.replies[4], JEUX_ACK_PKT, "Invitation was not acknowledged");
+    cr_assert_eq(jc_outstanding(ca), 0, "Requests are still outstanding");
+    jc_loop_destroy(loop);
+}
+
+/*
+ * When the server goes away, outstanding requests get a NULL reply and the
+ * connection's event callback is told.
+ */
+Test(jeux_client_suite, lost_connection, .init = start_server, .timeout = 15) {
+    JC_LOOP *loop = jc_loop_create();
+    SEEN seen = {0};
+    JC_CONN *conn = connect_server(loop, &seen);
+    jc_request(conn, JEUX_LOGIN_PKT, 0, 0, "Alice", 5, on_reply, &seen);
+    run_until(loop, &seen.nreplies, 1);
+    stop_server();
+    jc_request(conn, JEUX_USERS_PKT, 0, 0, NULL, 0, on_reply, &seen);
+    while(seen.nevents == 0) {
+	cr_assert_neq(jc_loop_run(loop, 5000), 0, "Loss of the connection was not noticed");
+    }
+    cr_assert_eq(seen.events[0], -1, "Event (%d) does not match expected (%d)", seen.events[0], -1);
+    cr_assert_eq(seen.nreplies, 2, "Outstanding request was not given a reply");
+    cr_assert_eq(seen.replies[1], -1, "Reply (%d) does not match expected (%d)", seen.replies[1], -1);
+    cr_assert_eq(jc_loop_run(loop, 0), -1, "Lost connection is still in the loop");
+    jc_loop_destroy(loop);
+}
+
+/*
+ * Connect to a listening socket of the test's own, standing in for the
+ * server, so the test controls exactly what the client is sent.
+ */
+static JC_CONN *connect_fake_server(JC_LOOP *loop, SEEN *seen, int *lfdp, int *sfdp) {
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {0};
+    socklen_t len = sizeof(addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    cr_assert(bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == 0 && listen(lfd, 1) == 0,
+	      "Could not listen");
+    getsockname(lfd, (struct sockaddr *)&addr, &len);
+    char port[16];
+    snprintf(port, sizeof(port), "%d", ntohs(addr.sin_port));
+
+    JC_CONN *conn = jc_connect(loop, "127.0.0.1", port, on_event, seen);
+    cr_assert_not_null(conn, "Could not connect");
+    *sfdp = accept(lfd, NULL, NULL);
+    cr_assert(*sfdp >= 0, "Accept failed");
+    *lfdp = lfd;
+    return conn;
+}
+
+/*
+ * A wakeup that completes no packet still counts as something happening,
+ * so a caller waiting for a reply does not take it for a timeout.
+ */
+Test(jeux_client_suite, partial_packet_not_timeout, .timeout = 15) {
+    int lfd, sfd;
+    JC_LOOP *loop = jc_loop_create();
+    SEEN seen = {0};
+    connect_fake_server(loop, &seen, &lfd, &sfd);
+
+    JEUX_PACKET_HEADER hdr = {0};
+    pack_header(&hdr, JEUX_INVITED_PKT, 7, 0, 0);
+    size_t half = sizeof(hdr) / 2;
+    cr_assert_eq(write(sfd, &hdr, half), half, "Write failed");
+    cr_assert(jc_loop_run(loop, 5000) > 0, "Part of a packet was taken for a timeout");
+    cr_assert_eq(seen.nevents, 0, "Part of a packet was dispatched");
+    cr_assert_eq(write(sfd, (char *)&hdr + half, sizeof(hdr) - half), sizeof(hdr) - half,
+		 "Write failed");
+    cr_assert(jc_loop_run(loop, 5000) > 0, "Rest of the packet did not arrive");
+    cr_assert_eq(seen.nevents, 1, "Packet was not dispatched");
+    cr_assert_eq(seen.events[0], JEUX_INVITED_PKT, "Event (%d) does not match expected (%d)",
+		 seen.events[0], JEUX_INVITED_PKT);
+    cr_assert_eq(jc_loop_run(loop, 0), 0, "Nothing happened, but no timeout was reported");
+    jc_loop_destroy(loop);
+    close(sfd);
+    close(lfd);
+}
+
+/*
+ * A header that gives a payload size, sent without a payload, is refused
+ * rather than queued, since the server would read the next request as
+ * its payload.
+ */
+Test(jeux_client_suite, send_missing_payload, .timeout = 15) {
+    int lfd, sfd;
+    JC_LOOP *loop = jc_loop_create();
+    SEEN seen = {0};
+    JC_CONN *conn = connect_fake_server(loop, &seen, &lfd, &sfd);
+
+    JEUX_PACKET_HEADER hdr = {0};
+    pack_header(&hdr, JEUX_LOGIN_PKT, 0, 0, 5);
+    cr_assert_eq(jc_send(conn, &hdr, NULL, NULL, NULL), -1, "Header without its payload was queued");
+    cr_assert_eq(jc_outstanding(conn), 0, "Refused request is outstanding");
+    pack_header(&hdr, JEUX_USERS_PKT, 0, 0, 0);
+    cr_assert_eq(jc_send(conn, &hdr, NULL, NULL, NULL), 0, "Request without payload was refused");
+    /* queued requests are written before the loop waits */
+    jc_loop_run(loop, 0);
+
+    JEUX_PACKET_HEADER in;
+    cr_assert_eq(read(sfd, &in, sizeof(in)), sizeof(in), "Request did not arrive");
+    cr_assert_eq(in.type, JEUX_USERS_PKT, "Type (%d) does not match expected (%d)",
+		 in.type, JEUX_USERS_PKT);
+    jc_loop_destroy(loop);
+    close(sfd);
+    close(lfd);
+}
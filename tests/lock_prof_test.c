@@ -0,0 +1,106 @@
+#include <criterion/criterion.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "lock_prof.h"
+#include "excludes.h"
+
+/* Number of threads contending for the same mutex. */
+#define NTHREAD (8)
+
+/* Number of times each thread takes the mutex. */
+#define NITER (2000)
+
+static pthread_mutex_t shared = PTHREAD_MUTEX_INITIALIZER;
+
+static void *contend_thread(void *arg) {
+    for(int i = 0; i < NITER; i++) {
+	lprof_lock(&shared, LOCK_SITE_GAME_BOARD);
+	usleep(1);
+	lprof_unlock(&shared);
+    }
+    return NULL;
+}
+
+/* Get the value of a "<name>\t<value>" line from the profile, or -1. */
+static long profile_value(char *name) {
+    char *buf = NULL;
+    size_t sz;
+    FILE *out = open_memstream(&buf, &sz);
+    lprof_write(out);
+    fclose(out);
+    long value = -1;
+    size_t len = strlen(name);
+    for(char *line = buf; line != NULL && *line != '\0'; line = strchr(line, '\n')) {
+	if(*line == '\n')
+	    line++;
+	if(strncmp(line, name, len) == 0 && line[len] == '\t') {
+	    value = atol(line + len + 1);
+	    break;
+	}
+    }
+    free(buf);
+    return value;
+}
+
+Test(lock_prof_suite, disabled_records_nothing, .timeout = 5) {
+    lprof_lock(&shared, LOCK_SITE_GAME);
+    lprof_unlock(&shared);
+    cr_assert_eq(profile_value("lock_game_acquired"), -1, "Disabled profiler recorded an acquisition");
+    cr_assert_eq(lprof_depth, 0, "Disabled profiler tracked a held mutex");
+}
+
+Test(lock_prof_suite, contended_site, .timeout = 15) {
+    lprof_enable(1);
+    pthread_t tids[NTHREAD];
+    for(int i = 0; i < NTHREAD; i++)
+	pthread_create(&tids[i], NULL, contend_thread, NULL);
+    for(int i = 0; i < NTHREAD; i++)
+	pthread_join(tids[i], NULL);
+
+    long acquired = profile_value("lock_game_board_acquired");
+    cr_assert_eq(acquired, NTHREAD * NITER, "Acquisitions (%ld) do not match expected (%d)",
+		 acquired, NTHREAD * NITER);
+    long contended = profile_value("lock_game_board_contended");
+    cr_assert(contended > 0 && contended <= acquired, "Contended acquisitions (%ld) out of range",
+	      contended);
+    long held = profile_value("lock_game_board_hold_ns_count");
+    cr_assert_eq(held, acquired, "Hold count (%ld) does not match acquisitions (%ld)", held, acquired);
+    long hold_p50 = profile_value("lock_game_board_hold_ns_p50");
+    cr_assert(hold_p50 >= 1000, "Median hold time (%ld) is shorter than the sleep inside", hold_p50);
+}
+
+/*
+ * Recursive and out-of-order releases must each get the hold time of
+ * their own acquisition.
+ */
+Test(lock_prof_suite, nested_and_recursive, .timeout = 5) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_t rec, other;
+    pthread_mutex_init(&rec, &attr);
+    pthread_mutex_init(&other, NULL);
+
+    lprof_enable(1);
+    lprof_lock(&rec, LOCK_SITE_CLIENT_INV);
+    lprof_lock(&rec, LOCK_SITE_CLIENT_INV);
+    lprof_lock(&other, LOCK_SITE_PLAYER);
+    cr_assert_eq(lprof_depth, 3, "Held stack depth (%d) does not match expected (%d)", lprof_depth, 3);
+    lprof_unlock(&rec);
+    lprof_unlock(&other);
+    lprof_enable(0);
+    /* acquired while enabled, so still tracked after disabling */
+    lprof_unlock(&rec);
+    cr_assert_eq(lprof_depth, 0, "Held stack depth (%d) does not match expected (%d)", lprof_depth, 0);
+
+    cr_assert_eq(profile_value("lock_client_inv_acquired"), 2, "Recursive acquisitions not counted");
+    cr_assert_eq(profile_value("lock_client_inv_hold_ns_count"), 2, "Recursive holds not counted");
+    cr_assert_eq(profile_value("lock_player_hold_ns_count"), 1, "Nested hold not counted");
+    cr_assert_eq(pthread_mutex_trylock(&rec), 0, "Recursive mutex was left locked");
+    pthread_mutex_unlock(&rec);
+}
@@ -0,0 +1,145 @@
+#include <criterion/criterion.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "metrics.h"
+#include "tests_defs.h"
+
+#define LOGGER_OUTPUT TEST_OUTPUT "logger.out"
+
+/* Number of threads and records per thread in the concurrent test. */
+#define NTHREAD (8)
+#define NRECORD (5000)
+
+static FILE *out;
+
+static void init() {
+    out = fopen(LOGGER_OUTPUT, "w+");
+    cr_assert_not_null(out, "Logger output file could not be created");
+    cr_assert_eq(logger_start(out), 0, "Logger could not be started");
+}
+
+/* Read back everything written so far. */
+static char *read_output(void) {
+    logger_flush();
+    static char buf[4 << 20];
+    rewind(out);
+    size_t n = fread(buf, 1, sizeof(buf) - 1, out);
+    buf[n] = '\0';
+    return buf;
+}
+
+static int count_lines(char *text, char *needle) {
+    int n = 0;
+    for(char *p = text; (p = strstr(p, needle)) != NULL; p += strlen(needle))
+        n++;
+    return n;
+}
+
+Test(logger_suite, formats_like_printf, .init = init, .timeout = 5) {
+    logger_write(LOGGER_INFO, "f.c", "fn", 42, "[%d|%5ld|%-3u|%x|%c|%.2f|%*d|%.*s|%%|%zu|%hhd]",
+		 -7, 123456789012L, 5u, 255u, 'z', 3.14159, 4, 9, 3, "abcdef", (size_t)17, 300);
+    char *text = read_output();
+    char expected[256];
+    snprintf(expected, sizeof(expected), "[%d|%5ld|%-3u|%x|%c|%.2f|%*d|%.*s|%%|%zu|%hhd]",
+	     -7, 123456789012L, 5u, 255u, 'z', 3.14159, 4, 9, 3, "abcdef", (size_t)17, (signed char)300);
+    cr_assert(strstr(text, expected) != NULL, "Output (%s) does not contain expected (%s)", text, expected);
+    cr_assert(strstr(text, "INFO: f.c:fn:42 ") != NULL, "Output (%s) has no location prefix", text);
+}
+
+Test(logger_suite, strings_are_copied, .init = init, .timeout = 5) {
+    char name[16];
+    strcpy(name, "Alice");
+    logger_write(LOGGER_DEBUG, "f.c", "fn", 1, "hello %s", name);
+    strcpy(name, "Mallory");
+    char *text = read_output();
+    cr_assert(strstr(text, "hello Alice") != NULL, "Output (%s) does not contain the original string", text);
+}
+
+Test(logger_suite, level_filters, .init = init, .timeout = 5) {
+    atomic_store(&logger_level, LOGGER_WARN);
+    if(logger_enabled(LOGGER_DEBUG))
+	logger_write(LOGGER_DEBUG, "f.c", "fn", 1, "filtered");
+    if(logger_enabled(LOGGER_ERROR))
+	logger_write(LOGGER_ERROR, "f.c", "fn", 1, "kept");
+    char *text = read_output();
+    cr_assert(strstr(text, "filtered") == NULL, "Record below the level was written");
+    cr_assert(strstr(text, "kept") != NULL, "Record at the level was not written");
+    cr_assert_eq(logger_parse_level("success"), LOGGER_SUCCESS, "Level name was not parsed");
+    cr_assert_eq(logger_parse_level("loud"), -1, "Unknown level name was accepted");
+}
+
+static void *log_thread(void *arg) {
+    long id = (long)arg;
+    for(int i = 0; i < NRECORD; i++)
+	logger_write(LOGGER_DEBUG, "f.c", "fn", 1, "thread %ld record %d", id, i);
+    return NULL;
+}
+
+/*
+ * Every record is either written whole or counted as dropped.
+ */
+Test(logger_suite, concurrent_records_are_written_or_dropped, .init = init, .timeout = 20) {
+    pthread_t tids[NTHREAD];
+    for(long i = 0; i < NTHREAD; i++)
+	pthread_create(&tids[i], NULL, log_thread, (void *)i);
+    for(int i = 0; i < NTHREAD; i++)
+	pthread_join(tids[i], NULL);
+    char *text = read_output();
+    int written = count_lines(text, "\n");
+    int dropped = metrics_read(METRIC_LOG_DROPPED);
+    cr_assert_eq(written + dropped, NTHREAD * NRECORD,
+		 "Written (%d) plus dropped (%d) does not match expected (%d)",
+		 written, dropped, NTHREAD * NRECORD);
+    cr_assert_eq(count_lines(text, " record "), written, "Some records were torn");
+}
+
+Test(logger_suite, stop_writes_everything, .init = init, .timeout = 5) {
+    for(int i = 0; i < 100; i++)
+	logger_write(LOGGER_DEBUG, "f.c", "fn", 1, "record %d", i);
+    logger_stop();
+    static char buf[1 << 16];
+    rewind(out);
+    size_t n = fread(buf, 1, sizeof(buf) - 1, out);
+    buf[n] = '\0';
+    cr_assert(strstr(buf, "record 99\n") != NULL, "Last record was not written by logger_stop()");
+}
+
+/*
+ * Records logged while the logger is being stopped are written either by
+ * its last pass or by the callers themselves, never lost.
+ */
+Test(logger_suite, stop_while_writing_loses_nothing, .init = init, .timeout = 20) {
+    FILE *err = fopen(TEST_OUTPUT "logger.err", "w+");
+    cr_assert_not_null(err, "Stderr capture file could not be created");
+    fflush(stderr);
+    int saved = dup(2);
+    dup2(fileno(err), 2);
+    int dropped = metrics_read(METRIC_LOG_DROPPED);
+
+    pthread_t tids[NTHREAD];
+    for(long i = 0; i < NTHREAD; i++)
+	pthread_create(&tids[i], NULL, log_thread, (void *)i);
+    logger_stop();
+    for(int i = 0; i < NTHREAD; i++)
+	pthread_join(tids[i], NULL);
+    fflush(stderr);
+    dup2(saved, 2);
+    close(saved);
+    dropped = metrics_read(METRIC_LOG_DROPPED) - dropped;
+
+    int written = count_lines(read_output(), " record ");
+    static char buf[4 << 20];
+    rewind(err);
+    size_t n = fread(buf, 1, sizeof(buf) - 1, err);
+    buf[n] = '\0';
+    fclose(err);
+    int direct = count_lines(buf, " record ");
+    cr_assert_eq(written + direct + dropped, NTHREAD * NRECORD,
+		 "Written (%d), written directly (%d) and dropped (%d) do not add up to %d",
+		 written, direct, dropped, NTHREAD * NRECORD);
+}
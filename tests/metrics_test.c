@@ -0,0 +1,168 @@
+#include <criterion/criterion.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "debug.h"
+#include "game.h"
+#include "metrics.h"
+#include "protocol_ext.h"
+#include "packet_common.h"
+#include "excludes.h"
+
+/* Number of concurrent threads updating metrics. */
+#define NTHREAD (32)
+
+/* Number of updates made by each thread. */
+#define NITER (100000)
+
+static void *count_thread(void *arg) {
+    for(int i = 0; i < NITER; i++) {
+	metrics_count(METRIC_BYTES_IN, 3);
+	metrics_nack(METRIC_NACK_MOVE);
+	metrics_record_latency(METRIC_LATENCY_HANDLE, JEUX_MOVE_PKT, i);
+    }
+    return NULL;
+}
+
+/*
+ * Every quantile of a histogram must be within the relative error that
+ * its bucket layout promises.
+ */
+Test(metrics_suite, histogram_quantiles, .timeout = 5) {
+    static METRICS_HISTOGRAM hist;
+    static METRICS_HIST_SNAPSHOT snap;
+    int n = 1000000;
+    for(int v = 1; v <= n; v++)
+	metrics_hist_record(&hist, v);
+    metrics_hist_read(&hist, &snap);
+    cr_assert_eq(snap.count, n, "Histogram count (%lu) does not match expected (%d)",
+		 snap.count, n);
+    cr_assert_eq(snap.max, n, "Histogram max (%lu) does not match expected (%d)",
+		 snap.max, n);
+    cr_assert_eq(snap.sum, (uint64_t)n * (n + 1) / 2, "Histogram sum (%lu) is wrong", snap.sum);
+    double qs[] = { 0.001, 0.1, 0.5, 0.9, 0.99, 0.999, 1 };
+    for(int i = 0; i < sizeof(qs) / sizeof(qs[0]); i++) {
+	double want = qs[i] * n;
+	uint64_t got = metrics_hist_quantile(&snap, qs[i]);
+	cr_assert(got >= want && got <= want * (1 + 1.0 / (1 << METRICS_HIST_SUB_BITS)),
+		  "Quantile %g (%lu) is not within bucket error of %g", qs[i], got, want);
+    }
+}
+
+Test(metrics_suite, histogram_empty_and_overflow, .timeout = 5) {
+    static METRICS_HISTOGRAM hist;
+    static METRICS_HIST_SNAPSHOT snap;
+    metrics_hist_read(&hist, &snap);
+    cr_assert_eq(metrics_hist_quantile(&snap, 0.5), 0, "Quantile of empty histogram is not 0");
+    uint64_t big = (uint64_t)1 << (METRICS_HIST_MAX_BITS + 4);
+    metrics_hist_record(&hist, 0);
+    metrics_hist_record(&hist, big);
+    metrics_hist_read(&hist, &snap);
+    cr_assert_eq(metrics_hist_quantile(&snap, 0.5), 0, "Median (%lu) is not 0",
+		 metrics_hist_quantile(&snap, 0.5));
+    cr_assert_eq(metrics_hist_quantile(&snap, 1), big, "Overflow value (%lu) is not %lu",
+		 metrics_hist_quantile(&snap, 1), big);
+}
+
+/*
+ * Concurrent updates land in different shards; the totals read back
+ * must still be exact.
+ */
+Test(metrics_suite, concurrent_counts, .timeout = 15) {
+    pthread_t tids[NTHREAD];
+    for(int i = 0; i < NTHREAD; i++)
+	pthread_create(&tids[i], NULL, count_thread, NULL);
+    for(int i = 0; i < NTHREAD; i++)
+	pthread_join(tids[i], NULL);
+
+    int64_t bytes = metrics_read(METRIC_BYTES_IN);
+    cr_assert_eq(bytes, 3L * NTHREAD * NITER, "Bytes in (%ld) does not match expected (%ld)",
+		 bytes, 3L * NTHREAD * NITER);
+    uint64_t nacks = metrics_read_nacks(METRIC_NACK_MOVE);
+    cr_assert_eq(nacks, (uint64_t)NTHREAD * NITER, "NACK count (%lu) does not match expected (%lu)",
+		 nacks, (uint64_t)NTHREAD * NITER);
+
+    char *buf = NULL;
+    size_t sz;
+    FILE *out = open_memstream(&buf, &sz);
+    metrics_write(out);
+    fclose(out);
+    char want[64];
+    snprintf(want, sizeof(want), "latency_ns_move_count\t%d\n", NTHREAD * NITER);
+    cr_assert(strstr(buf, want) != NULL, "Metrics output does not contain \"%s\"", want);
+    free(buf);
+}
+
+Test(metrics_suite, active_games_gauge, .timeout = 5) {
+    GAME *games[10];
+    for(int i = 0; i < 10; i++)
+	games[i] = game_create();
+    cr_assert_eq(metrics_read(METRIC_ACTIVE_GAMES), 10, "Active games (%ld) does not match expected (%d)",
+		 metrics_read(METRIC_ACTIVE_GAMES), 10);
+    for(int i = 0; i < 10; i++)
+	game_unref(games[i], "because test is done");
+    cr_assert_eq(metrics_read(METRIC_ACTIVE_GAMES), 0, "Active games (%ld) does not match expected (%d)",
+		 metrics_read(METRIC_ACTIVE_GAMES), 0);
+}
+
+static void split_ns(uint64_t ns, uint32_t *sec, uint32_t *nsec) {
+    *sec = ns / 1000000000;
+    *nsec = ns % 1000000000;
+}
+
+/*
+ * A request sent while the previous one was still being handled has
+ * queued for at least the overlap.
+ */
+Test(metrics_suite, request_delay_and_queue, .timeout = 5) {
+    static METRICS_HIST_SNAPSHOT snap;
+    uint32_t sec, nsec;
+    split_ns(metrics_now_ns(), &sec, &nsec);
+    metrics_request_begin(JEUX_MOVE_PKT, sec, nsec);
+    uint64_t done = metrics_now_ns();
+    metrics_request_end(JEUX_MOVE_PKT);
+
+    uint64_t overlap = 5000000;
+    split_ns(done - overlap, &sec, &nsec);
+    metrics_request_begin(JEUX_RESIGN_PKT, sec, nsec);
+    metrics_request_end(JEUX_RESIGN_PKT);
+
+    metrics_read_latency(METRIC_LATENCY_QUEUE, JEUX_RESIGN_PKT, &snap);
+    cr_assert_eq(snap.count, 1, "Queue count (%lu) does not match expected (%d)", snap.count, 1);
+    cr_assert(snap.max >= overlap, "Queueing delay (%lu) is less than overlap (%lu)", snap.max, overlap);
+    uint64_t queued = snap.max;
+    metrics_read_latency(METRIC_LATENCY_DELAY, JEUX_RESIGN_PKT, &snap);
+    cr_assert(snap.max >= queued, "Delay (%lu) is less than queueing delay (%lu)", snap.max, queued);
+
+    /* a timestamp from the future or from another clock is not used */
+    split_ns(metrics_now_ns() + overlap, &sec, &nsec);
+    metrics_request_begin(JEUX_ACCEPT_PKT, sec, nsec);
+    metrics_request_end(JEUX_ACCEPT_PKT);
+    metrics_request_begin(JEUX_ACCEPT_PKT, 0, 0);
+    metrics_request_end(JEUX_ACCEPT_PKT);
+    metrics_read_latency(METRIC_LATENCY_DELAY, JEUX_ACCEPT_PKT, &snap);
+    cr_assert_eq(snap.count, 0, "Implausible timestamps (%lu) were used", snap.count);
+    metrics_read_latency(METRIC_LATENCY_HANDLE, JEUX_ACCEPT_PKT, &snap);
+    cr_assert_eq(snap.count, 2, "Handling count (%lu) does not match expected (%d)", snap.count, 2);
+}
+
+Test(metrics_suite, notification_stamp, .timeout = 5) {
+    JEUX_PACKET_HEADER hdr;
+    uint64_t start = metrics_request_begin(JEUX_MOVE_PKT, 0, 0);
+    usleep(2000);
+    pack_header(&hdr, JEUX_MOVED_PKT, 0, 0, 0);
+    uint64_t stamp = (uint64_t)ntohl(hdr.timestamp_sec) * 1000000000 + ntohl(hdr.timestamp_nsec);
+    cr_assert_eq(stamp, start, "Notification stamp (%lu) is not request receipt time (%lu)",
+		 stamp, start);
+    pack_header(&hdr, JEUX_ACK_PKT, 0, 0, 0);
+    stamp = (uint64_t)ntohl(hdr.timestamp_sec) * 1000000000 + ntohl(hdr.timestamp_nsec);
+    cr_assert(stamp > start, "Reply stamp (%lu) is not the time it was sent", stamp);
+    metrics_request_end(JEUX_MOVE_PKT);
+    pack_header(&hdr, JEUX_MOVED_PKT, 0, 0, 0);
+    stamp = (uint64_t)ntohl(hdr.timestamp_sec) * 1000000000 + ntohl(hdr.timestamp_nsec);
+    cr_assert(stamp > start, "Stamp outside a request (%lu) is not the time it was sent", stamp);
+}
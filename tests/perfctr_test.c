@@ -0,0 +1,67 @@
+#include <criterion/criterion.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "perfctr.h"
+#include "protocol.h"
+
+/* Number of short-lived threads in the descriptor test. */
+#define NTHREAD (10)
+
+static int count_fds(void) {
+    DIR *dir = opendir("/proc/self/fd");
+    cr_assert_not_null(dir, "Cannot list open files");
+    int n = 0;
+    while(readdir(dir) != NULL)
+	n++;
+    closedir(dir);
+    return n;
+}
+
+static void *request_thread(void *arg) {
+    perfctr_begin();
+    usleep(1000);
+    perfctr_end(JEUX_USERS_PKT);
+    return NULL;
+}
+
+/*
+ * Whether or not the kernel allows counting, enabling must not fail
+ * loudly, and requests are counted only when it succeeds.
+ */
+Test(perfctr_suite, counts_only_when_available, .timeout = 5) {
+    int ret = perfctr_enable(1);
+    cr_assert_eq(atomic_load(&perfctr_enabled), ret == 0, "Enabled flag does not match perfctr_enable()");
+    perfctr_begin();
+    usleep(1000);
+    perfctr_end(JEUX_LOGIN_PKT);
+    uint64_t totals[PERFCTR_NEVENTS];
+    int available[PERFCTR_NEVENTS];
+    uint64_t n = perfctr_read(JEUX_LOGIN_PKT, totals, available);
+    if(ret == -1) {
+	cr_assert_eq(n, 0, "Requests (%lu) counted with counters unavailable", n);
+	return;
+    }
+    cr_assert_eq(n, 1, "Requests (%lu) does not match expected (%d)", n, 1);
+    if(available[PERFCTR_CONTEXT_SWITCHES])
+	cr_assert(totals[PERFCTR_CONTEXT_SWITCHES] >= 1, "Sleep was not counted as a context switch");
+    if(available[PERFCTR_INSTRUCTIONS])
+	cr_assert(totals[PERFCTR_INSTRUCTIONS] > 0, "No instructions were counted");
+}
+
+/*
+ * Each service thread opens its own counters; they must be closed when it
+ * exits or a server would run out of descriptors.
+ */
+Test(perfctr_suite, thread_counters_are_closed, .timeout = 5) {
+    perfctr_enable(1);
+    int before = count_fds();
+    for(int i = 0; i < NTHREAD; i++) {
+	pthread_t tid;
+	pthread_create(&tid, NULL, request_thread, NULL);
+	pthread_join(tid, NULL);
+    }
+    int after = count_fds();
+    cr_assert_eq(after, before, "Open files (%d) do not match expected (%d)", after, before);
+}
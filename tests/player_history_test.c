@@ -0,0 +1,108 @@
+#include <criterion/criterion.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "player.h"
+#include "player_ext.h"
+#include "excludes.h"
+
+/* Number of results posted by each thread in multithreaded tests. */
+#define NITER (100000)
+
+Test(player_history_suite, empty, .timeout = 5) {
+    PLAYER *player = player_create("Alice");
+    PLAYER_HISTORY_ENTRY entries[PLAYER_HISTORY_LEN];
+    int n = player_get_history(player, entries, PLAYER_HISTORY_LEN);
+    cr_assert_eq(n, 0, "History length (%d) was not 0", n);
+}
+
+Test(player_history_suite, series, .timeout = 5) {
+    PLAYER *alice = player_create("Alice");
+    PLAYER *bob = player_create("Bob");
+    PLAYER *carol = player_create("Carol");
+
+    player_post_result(alice, bob, 1);
+    player_post_result(carol, alice, 0);
+    player_post_result(alice, carol, 2);
+
+    PLAYER_HISTORY_ENTRY entries[PLAYER_HISTORY_LEN];
+    int n = player_get_history(alice, entries, PLAYER_HISTORY_LEN);
+    cr_assert_eq(n, 3, "History length (%d) was not 3", n);
+
+    int exp_opponent[] = { player_get_id(bob), player_get_id(carol), player_get_id(carol) };
+    int exp_outcome[] = { PLAYER_HISTORY_WIN, PLAYER_HISTORY_DRAW, PLAYER_HISTORY_LOSS };
+    for(int i = 0; i < n; i++) {
+	cr_assert_eq(entries[i].opponent_id, exp_opponent[i], "Opponent (%d) does not match expected (%d)",
+		     entries[i].opponent_id, exp_opponent[i]);
+	cr_assert_eq(entries[i].outcome, exp_outcome[i], "Outcome (%d) does not match expected (%d)",
+		     entries[i].outcome, exp_outcome[i]);
+    }
+    cr_assert_eq(entries[0].rating, 1516, "Rating after first game (%d) does not match expected (%d)",
+		 entries[0].rating, 1516);
+    cr_assert_eq(entries[n - 1].rating, player_get_rating(alice),
+		 "Last rating (%d) does not match current rating (%d)",
+		 entries[n - 1].rating, player_get_rating(alice));
+
+    // Asking for fewer entries returns the most recent ones.
+    PLAYER_HISTORY_ENTRY last;
+    n = player_get_history(alice, &last, 1);
+    cr_assert_eq(n, 1, "History length (%d) was not 1", n);
+    cr_assert_eq(last.outcome, PLAYER_HISTORY_LOSS, "Outcome (%d) does not match expected (%d)",
+		 last.outcome, PLAYER_HISTORY_LOSS);
+}
+
+Test(player_history_suite, capped, .timeout = 5) {
+    PLAYER *alice = player_create("Alice");
+    PLAYER *bob = player_create("Bob");
+    size_t bytes = player_history_bytes();
+    cr_assert(bytes > 0, "History bytes were not accounted");
+
+    for(int i = 0; i < 10 * PLAYER_HISTORY_LEN; i++)
+	player_post_result(alice, bob, (i % 3));
+
+    PLAYER_HISTORY_ENTRY entries[PLAYER_HISTORY_LEN];
+    int n = player_get_history(alice, entries, PLAYER_HISTORY_LEN);
+    cr_assert_eq(n, PLAYER_HISTORY_LEN, "History length (%d) was not %d", n, PLAYER_HISTORY_LEN);
+    cr_assert_eq(player_history_bytes(), bytes, "History memory grew (%lu -> %lu)",
+		 bytes, player_history_bytes());
+
+    player_unref(bob, "test done");
+    cr_assert(player_history_bytes() < bytes, "History memory was not released when player was freed");
+}
+
+static PLAYER *players[2];
+static volatile int done;
+
+static void *post_thread(void *arg) {
+    unsigned int seed = (unsigned long)arg;
+    for(int i = 0; i < NITER; i++)
+	player_post_result(players[0], players[1], rand_r(&seed) % 3);
+    return NULL;
+}
+
+/*
+ * Concurrency test: read the history while another thread posts results
+ * for the same players, as the rating queue does.  Each reply must be
+ * consistent: consecutive ratings may not differ by more than one Elo
+ * adjustment.
+ */
+Test(player_history_suite, concurrent_read, .timeout = 15) {
+    players[0] = player_create("Alice");
+    players[1] = player_create("Bob");
+    pthread_t tid;
+    pthread_create(&tid, NULL, post_thread, (void *)1);
+
+    PLAYER_HISTORY_ENTRY entries[PLAYER_HISTORY_LEN];
+    for(int k = 0; k < 1000; k++) {
+	int n = player_get_history(players[0], entries, PLAYER_HISTORY_LEN);
+	for(int i = 1; i < n; i++) {
+	    int d = entries[i].rating - entries[i - 1].rating;
+	    cr_assert(d >= -33 && d <= 33, "Ratings %d and %d are more than one game apart",
+		      entries[i - 1].rating, entries[i].rating);
+	}
+    }
+    pthread_join(tid, NULL);
+}
@@ -6,6 +6,8 @@
 
 #include "debug.h"
 #include "player_registry.h"
+#include "player_registry_ext.h"
+#include "player_ext.h"
 #include "excludes.h"
 
 /* Number of threads we create in multithreaded tests. */
@@ -59,6 +61,31 @@ Test(player_registry_suite, one_registry_three_players, .timeout = 5) {
 		 p, player2);
 }
 
+/*
+ * Look up several players by id at once, including one twice and one that
+ * is not registered.
+ */
+Test(player_registry_suite, lookup_ids, .timeout = 5) {
+    PLAYER_REGISTRY *pr = preg_init();
+    cr_assert_not_null(pr);
+    PLAYER *alice = preg_register(pr, "Alice");
+    PLAYER *bob = preg_register(pr, "Bob");
+    PLAYER *other = player_create("Other");
+
+    int ids[] = { player_get_id(bob), player_get_id(other), player_get_id(alice), player_get_id(bob) };
+    PLAYER *exp[] = { bob, NULL, alice, bob };
+    PLAYER *players[4];
+    int n = preg_lookup_ids(pr, ids, 4, players);
+    cr_assert_eq(n, 3, "Number found (%d) does not match expected (%d)", n, 3);
+    for(int i = 0; i < 4; i++) {
+	cr_assert_eq(players[i], exp[i], "Player %d (%p) does not match expected (%p)",
+		     i, players[i], exp[i]);
+	if(players[i] != NULL)
+	    player_unref(players[i], "test done");
+    }
+    player_unref(other, "test done");
+}
+
 /*
  * Create two registries, register different players in each, and check that
  * each player is found in the appropriate registry and not in the other.
@@ -0,0 +1,111 @@
+#include <criterion/criterion.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "player.h"
+#include "rating_queue.h"
+#include "excludes.h"
+
+/* Number of results posted by each thread in multithreaded tests. */
+#define NITER (100000)
+
+/* Number of threads we create in multithreaded tests. */
+#define NTHREAD (10)
+
+/* Number of players we create. */
+#define NPLAYER (100)
+
+Test(rating_queue_suite, post_flush, .timeout = 5) {
+    RATING_QUEUE *rq = rq_init();
+    cr_assert_not_null(rq, "Returned value was NULL");
+    PLAYER *player_alice = player_create("Alice");
+    PLAYER *player_bob = player_create("Bob");
+
+    int err = rq_post_result(rq, player_alice, player_bob, 1);
+    cr_assert_eq(err, 0, "Returned value (%d) was not 0", err);
+    rq_flush(rq);
+
+    int r = player_get_rating(player_alice);
+    cr_assert_eq(r, 1516, "Player rating (%d) does not match expected (%d)",
+		 r, 1516);
+    r = player_get_rating(player_bob);
+    cr_assert_eq(r, 1484, "Player rating (%d) does not match expected (%d)",
+		 r, 1484);
+    rq_fini(rq);
+}
+
+/*
+ * Results must be applied in the order they were posted, so a series posted
+ * through the queue must end up with the same ratings as the same series
+ * applied synchronously.
+ */
+Test(rating_queue_suite, post_in_order, .timeout = 5) {
+    RATING_QUEUE *rq = rq_init();
+    cr_assert_not_null(rq, "Returned value was NULL");
+    PLAYER *qa = player_create("Alice"), *qb = player_create("Bob");
+    PLAYER *sa = player_create("Alice"), *sb = player_create("Bob");
+
+    unsigned int seed = 1;
+    for(int i = 0; i < 1000; i++) {
+	int result = rand_r(&seed) % 3;
+	rq_post_result(rq, qa, qb, result);
+	player_post_result(sa, sb, result);
+    }
+    rq_fini(rq);
+
+    cr_assert_eq(player_get_rating(qa), player_get_rating(sa),
+		 "Queued rating (%d) does not match synchronous rating (%d)",
+		 player_get_rating(qa), player_get_rating(sa));
+    cr_assert_eq(player_get_rating(qb), player_get_rating(sb),
+		 "Queued rating (%d) does not match synchronous rating (%d)",
+		 player_get_rating(qb), player_get_rating(sb));
+}
+
+static RATING_QUEUE *queue;
+static PLAYER *players[NPLAYER];
+
+static void *post_thread(void *arg) {
+    unsigned int seed = (unsigned long)arg;
+    for(int i = 0; i < NITER; i++) {
+	PLAYER *player1 = players[rand_r(&seed) % NPLAYER];
+	PLAYER *player2 = players[rand_r(&seed) % NPLAYER];
+	if(player1 == player2)
+	    continue;
+	rq_post_result(queue, player1, player2, rand_r(&seed) % 3);
+    }
+    return NULL;
+}
+
+/*
+ * Concurrency test: many threads post results while the rating thread
+ * applies them.  After a flush, no result may be lost and each player
+ * must hold only the reference we gave it.
+ */
+Test(rating_queue_suite, concurrent_post_flush, .timeout = 15) {
+    char name[32];
+    for(int i = 0; i < NPLAYER; i++) {
+	sprintf(name, "p%d", i);
+	players[i] = player_create(name);
+	cr_assert(players[i] != NULL, "Player creation failed");
+    }
+    queue = rq_init();
+    cr_assert_not_null(queue, "Returned value was NULL");
+
+    pthread_t tid[NTHREAD];
+    for(long i = 0; i < NTHREAD; i++)
+	pthread_create(&tid[i], NULL, post_thread, (void *)(i + 1));
+    for(int i = 0; i < NTHREAD; i++)
+	pthread_join(tid[i], NULL);
+    rq_flush(queue);
+
+    int moved = 0;
+    for(int i = 0; i < NPLAYER; i++)
+	moved |= player_get_rating(players[i]) != PLAYER_INITIAL_RATING;
+    cr_assert(moved, "No rating results were applied after flush");
+    rq_fini(queue);
+    for(int i = 0; i < NPLAYER; i++)
+	player_unref(players[i], "test done");
+}
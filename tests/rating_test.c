@@ -0,0 +1,86 @@
+#include <criterion/criterion.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "debug.h"
+#include "player.h"
+#include "rating.h"
+#include "excludes.h"
+
+/* Number of random samples checked against the floating-point formula. */
+#define NSAMPLE (100000)
+
+/* Number of players in the random series test. */
+#define NPLAYER (20)
+
+/* Largest error, in rating points, allowed in a single Elo adjustment. */
+#define DELTA_TOLERANCE (0.001)
+
+static double ref_delta(double r1, double r2, int result) {
+    double s1 = result == 0 ? 0.5 : result == 1 ? 1 : 0;
+    double e1 = 1.0 / (1.0 + (pow(10.0, (r2 - r1) / 400.0)));
+    return 32 * (s1 - e1);
+}
+
+Test(rating_suite, expect_endpoints, .timeout = 5) {
+    int64_t e = rating_expect(0);
+    cr_assert_eq(e, RATING_ONE / 2, "Expectation at equal ratings (%ld) was not %ld",
+		 e, RATING_ONE / 2);
+    e = rating_expect(RATING_TO_FIXED(400)) + rating_expect(RATING_TO_FIXED(-400));
+    cr_assert(llabs(e - RATING_ONE) <= 1, "Expectations (sum %ld) do not sum to one", e);
+}
+
+/*
+ * Compare table-driven adjustments with the floating-point formula that
+ * player_post_result() used to evaluate directly.
+ */
+Test(rating_suite, delta_matches_float, .timeout = 5) {
+    unsigned int seed = 1;
+    double worst = 0;
+    for(int i = 0; i < NSAMPLE; i++) {
+	int64_t r1 = RATING_TO_FIXED(1000) + rand_r(&seed) % RATING_TO_FIXED(1000);
+	int64_t r2 = RATING_TO_FIXED(1000) + rand_r(&seed) % RATING_TO_FIXED(1000);
+	int result = rand_r(&seed) % 3;
+	double got = (double)rating_elo_delta(r1, r2, result) / RATING_ONE;
+	double want = ref_delta((double)r1 / RATING_ONE, (double)r2 / RATING_ONE, result);
+	if(fabs(got - want) > worst)
+	    worst = fabs(got - want);
+    }
+    cr_assert(worst <= DELTA_TOLERANCE, "Largest adjustment error (%f) exceeds tolerance (%f)",
+	      worst, DELTA_TOLERANCE);
+}
+
+/*
+ * Play a random series through player_post_result() alongside a
+ * floating-point reference and check the ratings agree after rounding.
+ */
+Test(rating_suite, series_matches_float, .timeout = 5) {
+    PLAYER *players[NPLAYER];
+    double ref[NPLAYER];
+    char name[32];
+    for(int i = 0; i < NPLAYER; i++) {
+	sprintf(name, "p%d", i);
+	players[i] = player_create(name);
+	ref[i] = PLAYER_INITIAL_RATING;
+    }
+    unsigned int seed = 1;
+    for(int i = 0; i < 10000; i++) {
+	int a = rand_r(&seed) % NPLAYER;
+	int b = rand_r(&seed) % NPLAYER;
+	if(a == b)
+	    continue;
+	int result = rand_r(&seed) % 3;
+	player_post_result(players[a], players[b], result);
+	double d1 = ref_delta(ref[a], ref[b], result);
+	double d2 = ref_delta(ref[b], ref[a], result == 0 ? 0 : 3 - result);
+	ref[a] += d1;
+	ref[b] += d2;
+    }
+    for(int i = 0; i < NPLAYER; i++) {
+	int r = player_get_rating(players[i]);
+	cr_assert(fabs(r - ref[i]) <= 1.0, "Player rating (%d) too far from reference (%f)",
+		  r, ref[i]);
+	player_unref(players[i], "test done");
+    }
+}
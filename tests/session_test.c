@@ -0,0 +1,139 @@
+#include <criterion/criterion.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "client_registry.h"
+#include "client_registry_ext.h"
+#include "jeux_globals.h"
+#include "session.h"
+#include "protocol_ext.h"
+#include "packet_common.h"
+#include "census.h"
+
+/*
+ * Sessions driven directly, with packets for each client collected by its
+ * send function instead of going through a socket.
+ */
+
+#define MAX_PKTS (32)
+
+typedef struct outbox {
+    int count;
+    JEUX_PACKET_HEADER hdrs[MAX_PKTS];  /* host byte order */
+} OUTBOX;
+
+static int collect(void *arg, JEUX_PACKET_HEADER *hdr, void *data) {
+    OUTBOX *out = arg;
+    cr_assert(out->count < MAX_PKTS, "Too many packets sent to one client");
+    out->hdrs[out->count] = *hdr;
+    unpack_header(&out->hdrs[out->count]);
+    out->count++;
+    return 0;
+}
+
+static void push(SESSION *session, int type, int id, int role, char *payload) {
+    JEUX_PACKET_HEADER hdr = {0};
+    size_t size = payload == NULL ? 0 : strlen(payload);
+    void *data = NULL;
+    pack_header(&hdr, type, id, role, size);
+    if(size > 0) {
+        data = proto_alloc_payload(size);
+        memcpy(data, payload, size);
+    }
+    cr_assert_eq(session_push(session, &hdr, data), 0, "Push of packet type %d failed", type);
+}
+
+static void expect(OUTBOX *out, int index, int type) {
+    cr_assert(out->count > index, "Packet %d was not sent", index);
+    cr_assert_eq(out->hdrs[index].type, type, "Type of packet %d (%d) does not match expected (%d)",
+                 index, out->hdrs[index].type, type);
+}
+
+static void init() {
+    cr_assert_eq(jeux_core_init(), 0, "Core initialization failed");
+}
+
+Test(session_suite, play_through_callbacks, .init = init, .timeout = 5) {
+    OUTBOX alice = {0}, bob = {0};
+    SESSION *sa = session_open(collect, &alice);
+    SESSION *sb = session_open(collect, &bob);
+    cr_assert(sa != NULL && sb != NULL, "Returned value was NULL");
+    cr_assert(session_conn(sa) >= SESSION_CONN_BASE, "Connection number is not a virtual one");
+    cr_assert_neq(session_conn(sa), session_conn(sb), "Sessions share a connection number");
+
+    push(sa, JEUX_LOGIN_PKT, 0, 0, "Alice");
+    push(sb, JEUX_LOGIN_PKT, 0, 0, "Bob");
+    expect(&alice, 0, JEUX_ACK_PKT);
+    expect(&bob, 0, JEUX_ACK_PKT);
+
+    push(sa, JEUX_INVITE_PKT, 0, FIRST_PLAYER_ROLE, "Bob");
+    expect(&bob, 1, JEUX_INVITED_PKT);
+    expect(&alice, 1, JEUX_ACK_PKT);
+
+    push(sb, JEUX_ACCEPT_PKT, bob.hdrs[1].id, 0, NULL);
+    expect(&alice, 2, JEUX_ACCEPTED_PKT);
+    expect(&bob, 2, JEUX_ACK_PKT);
+
+    /* Bob took the first role, so the move is his */
+    push(sb, JEUX_MOVE_PKT, bob.hdrs[1].id, 0, "5");
+    expect(&alice, 3, JEUX_MOVED_PKT);
+    expect(&bob, 3, JEUX_ACK_PKT);
+
+    /* closing Bob's session resigns his game */
+    session_close(sb);
+    int bob_count = bob.count;
+    expect(&alice, 4, JEUX_RESIGNED_PKT);
+    expect(&alice, 5, JEUX_ENDED_PKT);
+    cr_assert_eq(alice.hdrs[5].role, SECOND_PLAYER_ROLE, "Winner (%d) does not match expected (%d)",
+                 alice.hdrs[5].role, SECOND_PLAYER_ROLE);
+
+    push(sa, JEUX_USERS_PKT, 0, 0, NULL);
+    expect(&alice, 6, JEUX_ACK_PKT);
+    cr_assert_eq(bob.count, bob_count, "Packets were sent to a closed session");
+    session_close(sa);
+    jeux_core_fini();
+    cr_assert_eq(census_check_empty(stderr), 0, "Objects are still live after shutdown");
+}
+
+Test(session_suite, requests_need_login, .init = init, .timeout = 5) {
+    OUTBOX out = {0};
+    SESSION *session = session_open(collect, &out);
+    cr_assert_not_null(session, "Returned value was NULL");
+    push(session, JEUX_USERS_PKT, 0, 0, NULL);
+    expect(&out, 0, JEUX_NACK_PKT);
+    cr_assert_eq(session_push(session, NULL, NULL), -1, "Push without a header succeeded");
+    cr_assert_null(session_open(NULL, NULL), "Session without a send function was opened");
+    session_close(session);
+    jeux_core_fini();
+}
+
+/*
+ * A client with a transport is never shut down or closed through its
+ * connection number, even one that happens to be an open descriptor,
+ * while a session_open_fd() session closes its descriptor.
+ */
+Test(session_suite, descriptors_closed_only_if_owned, .init = init, .timeout = 5) {
+    OUTBOX out = {0};
+    int sv[2];
+    cr_assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0, "socketpair failed");
+    CLIENT *client = creg_register_transport(client_registry, sv[0], collect, &out);
+    cr_assert_not_null(client, "Returned value was NULL");
+    creg_shutdown_all(client_registry);
+    char c = 'x';
+    cr_assert_eq(write(sv[1], &c, 1), 1, "Write failed");
+    cr_assert_eq(read(sv[0], &c, 1), 1, "Descriptor of a transport client was shut down");
+    creg_unregister(client_registry, client);
+    cr_assert_neq(fcntl(sv[0], F_GETFD), -1, "Descriptor of a transport client was closed");
+
+    SESSION *session = session_open_fd(sv[0]);
+    cr_assert_not_null(session, "Returned value was NULL");
+    session_close(session);
+    cr_assert_eq(fcntl(sv[0], F_GETFD), -1, "Descriptor of a session was not closed");
+    close(sv[1]);
+    jeux_core_fini();
+}
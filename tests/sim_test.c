@@ -0,0 +1,58 @@
+#include <criterion/criterion.h>
+#include <stdio.h>
+
+#include "sim.h"
+#include "census.h"
+
+/*
+ * Deterministic simulation tests: a run is a function of its seed, and
+ * leaves nothing behind once it is over.
+ */
+
+#define NCLIENT (8)
+#define NGAMES (2000)
+
+static void run(uint64_t seed, SIM_STATS *stats) {
+    SIM *sim = sim_init(NCLIENT, seed);
+    cr_assert_not_null(sim, "Returned value was NULL");
+    cr_assert_eq(sim_run(sim, NGAMES), 0, "Simulation with seed %lu stalled", seed);
+    sim_stats(sim, stats);
+    sim_fini(sim);
+}
+
+Test(sim_suite, same_seed_same_run, .timeout = 30) {
+    SIM_STATS a, b;
+    run(7, &a);
+    run(7, &b);
+    cr_assert_eq(a.games, NGAMES, "Games (%lu) do not match expected (%d)", a.games, NGAMES);
+    cr_assert_eq(a.steps, b.steps, "Steps (%lu) do not match first run (%lu)", b.steps, a.steps);
+    cr_assert_eq(a.requests, b.requests, "Requests (%lu) do not match first run (%lu)",
+                 b.requests, a.requests);
+    /* the last few replies may not have been read when the run stops */
+    cr_assert(a.acks + a.nacks <= a.requests, "Replies (%lu) outnumber requests (%lu)",
+              a.acks + a.nacks, a.requests);
+    cr_assert_eq(a.now_ns, a.steps * SIM_STEP_NS, "Virtual clock does not match steps");
+    cr_assert_eq(a.digest, b.digest, "Digest (%016lx) does not match first run (%016lx)",
+                 b.digest, a.digest);
+}
+
+Test(sim_suite, different_seed_different_run, .timeout = 30) {
+    SIM_STATS a, b;
+    run(1, &a);
+    run(2, &b);
+    cr_assert_neq(a.digest, b.digest, "Different seeds gave the same digest");
+}
+
+Test(sim_suite, nothing_left_after_fini, .timeout = 30) {
+    SIM_STATS stats;
+    run(3, &stats);
+    cr_assert_eq(census_check_empty(stderr), 0, "Objects are still live after the simulation");
+}
+
+Test(sim_suite, one_at_a_time, .timeout = 5) {
+    SIM *sim = sim_init(NCLIENT, 1);
+    cr_assert_not_null(sim, "Returned value was NULL");
+    cr_assert_null(sim_init(NCLIENT, 2), "A second simulation was allowed");
+    cr_assert_null(sim_init(1, 2), "A simulation of one client was allowed");
+    sim_fini(sim);
+}
@@ -0,0 +1,201 @@
+#include <criterion/criterion.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "client_registry.h"
+#include "client.h"
+#include "player.h"
+#include "player_ext.h"
+#include "player_registry.h"
+#include "player_registry_ext.h"
+#include "census.h"
+#include "lock_prof.h"
+#include "metrics.h"
+#include "jeux_globals.h"
+
+/*
+ * Lock-contention stress tests.
+ *
+ * Many threads issue random invitations, accepts, declines, revokes,
+ * resignations and moves among a few logged-in clients, using whatever
+ * invitation IDs they guess, so that most operations race with others on
+ * the same clients, invitations and games.  Notifications go to
+ * /dev/null.  Afterwards every client logs out, and all invitations,
+ * games and moves must have been freed, every player must be referenced
+ * only by the registry, and ratings must still add up to what they
+ * started at.  Throughput is logged so that locking changes can be
+ * compared for speed as well.
+ */
+
+/* Threads issuing operations. */
+#define NTHREAD (16)
+
+/* Logged-in clients shared by every thread. */
+#define NCLIENT (8)
+
+/* Operations per thread. */
+#define NOPS (20000)
+
+/* Invitation IDs guessed at; clients reuse the lowest free ones. */
+#define NIDS (4)
+
+typedef enum {
+    OP_INVITE, OP_ACCEPT, OP_DECLINE, OP_REVOKE, OP_RESIGN, OP_MOVE, NOP_TYPES
+} OP_TYPE;
+
+static char *op_names[NOP_TYPES] = { "invite", "accept", "decline", "revoke", "resign", "move" };
+
+static CLIENT *clients[NCLIENT];
+static _Atomic long succeeded[NOP_TYPES];
+
+static void init(void) {
+    client_registry = creg_init();
+    player_registry = preg_init();
+    char name[32];
+    for(int i = 0; i < NCLIENT; i++) {
+        int fd = open("/dev/null", O_WRONLY);
+        cr_assert(fd >= 0, "Cannot open /dev/null");
+        clients[i] = creg_register(client_registry, fd);
+        cr_assert_not_null(clients[i], "Error registering client");
+        snprintf(name, sizeof(name), "p%d", i);
+        PLAYER *player = preg_register(player_registry, name);
+        cr_assert_eq(client_login(clients[i], player), 0, "Error logging in client");
+        player_unref(player, "because client holds it");
+    }
+}
+
+static OP_TYPE pick_op(unsigned int *seed) {
+    int r = rand_r(seed) % 100;
+    return r < 20 ? OP_INVITE : r < 40 ? OP_ACCEPT : r < 43 ? OP_DECLINE :
+        r < 46 ? OP_REVOKE : r < 50 ? OP_RESIGN : OP_MOVE;
+}
+
+static void *stress_thread(void *arg) {
+    unsigned int seed = (unsigned long)arg;
+    for(int i = 0; i < NOPS; i++) {
+        CLIENT *client = clients[rand_r(&seed) % NCLIENT];
+        CLIENT *other = clients[rand_r(&seed) % NCLIENT];
+        int id = rand_r(&seed) % NIDS;
+        OP_TYPE op = pick_op(&seed);
+        int ret = -1;
+        switch(op) {
+            case OP_INVITE: {
+                if(client == other) {
+                    continue;
+                }
+                GAME_ROLE role = rand_r(&seed) % 2 ? FIRST_PLAYER_ROLE : SECOND_PLAYER_ROLE;
+                ret = client_make_invitation(client, other, role,
+                        role == FIRST_PLAYER_ROLE ? SECOND_PLAYER_ROLE : FIRST_PLAYER_ROLE);
+                break;
+            }
+            case OP_ACCEPT: {
+                char *state = NULL;
+                ret = client_accept_invitation(client, id, &state);
+                free(state);
+                break;
+            }
+            case OP_DECLINE:
+                ret = client_decline_invitation(client, id);
+                break;
+            case OP_REVOKE:
+                ret = client_revoke_invitation(client, id);
+                break;
+            case OP_RESIGN:
+                ret = client_resign_game(client, id);
+                break;
+            case OP_MOVE: {
+                char move[2] = { '1' + rand_r(&seed) % 9, '\0' };
+                ret = client_make_move(client, id, move);
+                break;
+            }
+            default:
+                break;
+        }
+        if(ret != -1) {
+            atomic_fetch_add(&succeeded[op], 1);
+        }
+    }
+    return NULL;
+}
+
+static void run_stress(void) {
+    pthread_t tids[NTHREAD];
+    uint64_t start = metrics_now_ns();
+    for(long i = 0; i < NTHREAD; i++) {
+        pthread_create(&tids[i], NULL, stress_thread, (void *)(i + 1));
+    }
+    for(int i = 0; i < NTHREAD; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    double secs = (metrics_now_ns() - start) / 1e9;
+    cr_log_info("stress: %d threads, %d ops in %.3f s (%.0f ops/sec)\n",
+                NTHREAD, NTHREAD * NOPS, secs, NTHREAD * NOPS / secs);
+    for(int op = 0; op < NOP_TYPES; op++) {
+        cr_log_info("stress: %s succeeded %ld\n", op_names[op], atomic_load(&succeeded[op]));
+    }
+    CENSUS_COUNTS games;
+    census_read(CENSUS_GAME, &games);
+    cr_log_info("stress: %lu games, at most %ld at once\n", games.total, games.peak);
+
+    cr_assert(atomic_load(&succeeded[OP_ACCEPT]) > 0, "No invitation was ever accepted");
+    cr_assert(atomic_load(&succeeded[OP_MOVE]) > 0, "No move was ever made");
+    /* an accept fails after creating its game if the source resigns it first */
+    cr_assert(games.total >= atomic_load(&succeeded[OP_ACCEPT]),
+              "Games created (%lu) are fewer than accepts (%ld)",
+              games.total, atomic_load(&succeeded[OP_ACCEPT]));
+}
+
+static void check_invariants(void) {
+    for(int i = 0; i < NCLIENT; i++) {
+        cr_assert_eq(client_logout(clients[i]), 0, "Error logging out client %d", i);
+    }
+    CENSUS_COUNTS counts;
+    census_read(CENSUS_INVITATION, &counts);
+    cr_assert_eq(counts.live, 0, "Invitations (%ld) still live after logout", counts.live);
+    census_read(CENSUS_GAME, &counts);
+    cr_assert_eq(counts.live, 0, "Games (%ld) still live after logout", counts.live);
+    census_read(CENSUS_GAME_MOVE, &counts);
+    cr_assert_eq(counts.live, 0, "Moves (%ld) still live after logout", counts.live);
+
+    /* Elo is zero-sum, so only rounding can move the total */
+    long total = 0;
+    char name[32];
+    for(int i = 0; i < NCLIENT; i++) {
+        snprintf(name, sizeof(name), "p%d", i);
+        PLAYER *player = preg_lookup(player_registry, name);
+        cr_assert_not_null(player, "Player %s is no longer registered", name);
+        size_t refs = player_get_ref_count(player);
+        cr_assert_eq(refs, 2, "Player %s has %lu references besides the registry's and ours",
+                     name, refs - 2);
+        total += player_get_rating(player);
+        player_unref(player, "because test is done with it");
+    }
+    long drift = total - (long)NCLIENT * PLAYER_INITIAL_RATING;
+    cr_assert(drift >= -NCLIENT && drift <= NCLIENT, "Ratings drifted by %ld in total", drift);
+
+    for(int i = 0; i < NCLIENT; i++) {
+        cr_assert_eq(creg_unregister(client_registry, clients[i]), 0, "Error unregistering client %d", i);
+    }
+    creg_fini(client_registry);
+    preg_fini(player_registry);
+    cr_assert_eq(census_check_empty(stderr), 0, "Objects are still live after shutdown");
+}
+
+Test(stress_suite, random_ops_on_shared_clients, .init = init, .timeout = 60) {
+    run_stress();
+    check_invariants();
+}
+
+/*
+ * The same, with the lock profiler's per-thread stacks of held mutexes in
+ * use on every acquisition.
+ */
+Test(stress_suite, random_ops_with_lock_profiling, .init = init, .timeout = 60) {
+    lprof_enable(1);
+    run_stress();
+    lprof_enable(0);
+    check_invariants();
+}
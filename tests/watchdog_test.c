@@ -0,0 +1,70 @@
+#include <criterion/criterion.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "watchdog.h"
+#include "lock_prof.h"
+#include "protocol.h"
+
+/* Budget used by the tests, in milliseconds. */
+#define BUDGET_MS (20)
+
+static pthread_mutex_t held = PTHREAD_MUTEX_INITIALIZER;
+
+/* Handle a MOVE request that has to wait for a mutex the test holds. */
+static void *blocked_request(void *arg) {
+    watchdog_begin(JEUX_MOVE_PKT, 42);
+    lprof_lock(&held, LOCK_SITE_CLIENT_FD);
+    lprof_unlock(&held);
+    watchdog_end();
+    return NULL;
+}
+
+static void *quick_request(void *arg) {
+    for(int i = 0; i < 100; i++) {
+        watchdog_begin(JEUX_USERS_PKT, 42);
+        lprof_lock(&held, LOCK_SITE_CLIENT_FD);
+        lprof_unlock(&held);
+        watchdog_end();
+    }
+    return NULL;
+}
+
+/*
+ * A request stuck on a mutex for several times its budget is flagged once,
+ * and the mutex it was waiting for is recorded.
+ */
+Test(watchdog_suite, flags_request_blocked_on_lock, .timeout = 5) {
+    cr_assert_eq(watchdog_start(BUDGET_MS * 1000000), 0, "Watchdog did not start");
+    pthread_mutex_lock(&held);
+    pthread_t tid;
+    pthread_create(&tid, NULL, blocked_request, NULL);
+    usleep(4 * BUDGET_MS * 1000);
+    pthread_mutex_unlock(&held);
+    pthread_join(tid, NULL);
+    watchdog_stop();
+
+    uint64_t n = watchdog_read_slow(JEUX_MOVE_PKT);
+    cr_assert_eq(n, 1, "Slow MOVE requests (%lu) do not match expected (%d)", n, 1);
+    char buf[1024] = {0};
+    FILE *out = fmemopen(buf, sizeof(buf) - 1, "w");
+    watchdog_write(out);
+    fclose(out);
+    cr_assert_not_null(strstr(buf, "watchdog_waiting_lock_client_fd\t1\n"),
+                       "Lock waited for was not recorded:\n%s", buf);
+}
+
+/*
+ * Requests within budget are not flagged.
+ */
+Test(watchdog_suite, quick_requests_not_flagged, .timeout = 5) {
+    cr_assert_eq(watchdog_start(BUDGET_MS * 1000000), 0, "Watchdog did not start");
+    pthread_t tid;
+    pthread_create(&tid, NULL, quick_request, NULL);
+    pthread_join(tid, NULL);
+    usleep(2 * BUDGET_MS * 1000);
+    watchdog_stop();
+    uint64_t n = watchdog_read_slow(JEUX_USERS_PKT);
+    cr_assert_eq(n, 0, "Slow USERS requests (%lu) do not match expected (%d)", n, 0);
+}
@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdint.h>
+
+#include "protocol.h"
+#include "capture.h"
+#include "metrics.h"
+#include "jeux_client.h"
+
+/*
+ * Replay a packet capture against a server.
+ *
+ * Usage: capture_replay -p <port> [-h <host>] [-f] <capture file>
+ *
+ * Every connection in the capture (see capture.h) is opened to the server
+ * when its first packet is due and closed when it ended in the capture,
+ * and every packet is sent, with its header as captured, at the time it
+ * arrived relative to the start of the capture, or one after another as
+ * fast as the server replies with -f.  Each request waits for its ACK or
+ * NACK before the next is sent, so requests reach the server in the order
+ * they were captured; packets arriving on other connections meanwhile are
+ * read and discarded, so the server is never held up writing to them.  A
+ * connection whose reply does not come in time is closed, and opened
+ * again if the capture has more for it.  The server should be started
+ * afresh, as the capture was.
+ *
+ * Writes "name<TAB>value" lines to stdout: the requests sent, ACKs, NACKs
+ * and errors (no reply, or a connection lost), the time the capture and
+ * the replay took, and a latency histogram "latency_ns_<type>" per packet
+ * type in the format of metrics_hist_write().  At recorded speed latency
+ * is measured from when a request was due, so a server that falls behind
+ * is charged for it.
+ */
+
+/* How long to wait for a reply before giving up on it. */
+#define REPLY_TIMEOUT_MS 5000
+
+static char *host = "127.0.0.1";
+static char *port = NULL;
+static int fast = 0;
+
+static CAPTURE_RECORD *records;
+static size_t nrecords, records_cap;
+
+static JC_LOOP *loop;
+static JC_CONN **conns;         /* for each captured connection, or NULL */
+static int nconns;
+
+static uint64_t requests, acks, nacks, errors;
+static METRICS_HISTOGRAM *hists;
+
+static void usage_exit(char *prog) {
+    fprintf(stderr, "Usage: %s -p <port> [-h <host>] [-f] <capture file>\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+static void *xreallocarray(void *ptr, size_t n, size_t size) {
+    void *p = reallocarray(ptr, n, size);
+    if(p == NULL) {
+        perror("reallocarray");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static void load_capture(char *path) {
+    FILE *in = capture_open_read(path);
+    if(in == NULL) {
+        fprintf(stderr, "Cannot read packet capture %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    CAPTURE_RECORD rec;
+    int status;
+    while((status = capture_read(in, &rec)) == 0) {
+        if(rec.conn < 0) {
+            status = -1;
+            break;
+        }
+        if(nrecords == records_cap) {
+            records_cap = records_cap == 0 ? 1024 : records_cap * 2;
+            records = xreallocarray(records, records_cap, sizeof(CAPTURE_RECORD));
+        }
+        records[nrecords++] = rec;
+        if(rec.conn >= nconns) {
+            int n = rec.conn + 1;
+            conns = xreallocarray(conns, n, sizeof(JC_CONN *));
+            for(int i = nconns; i < n; i++) {
+                conns[i] = NULL;
+            }
+            nconns = n;
+        }
+    }
+    fclose(in);
+    if(status == -1) {
+        fprintf(stderr, "Packet capture %s is corrupt\n", path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void sleep_until(uint64_t ns) {
+    struct timespec ts = { .tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000 };
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+        ;
+}
+
+/* Notifications are discarded; a lost connection is forgotten. */
+static void conn_event(JC_CONN *conn, void *arg, JEUX_PACKET_HEADER *hdr, void *payload) {
+    if(hdr == NULL) {
+        conns[(intptr_t)arg] = NULL;
+    }
+}
+
+static JC_CONN *open_conn(int conn) {
+    return conns[conn] = jc_connect(loop, host, port, conn_event, (void *)(intptr_t)conn);
+}
+
+static void close_conn(int conn) {
+    if(conns[conn] != NULL) {
+        jc_close(conns[conn]);
+        conns[conn] = NULL;
+    }
+}
+
+/* Reply status still to come. */
+#define PENDING (-2)
+
+static void got_reply(JC_CONN *conn, void *arg, JEUX_PACKET_HEADER *hdr, void *payload) {
+    int *status = arg;
+    *status = hdr == NULL ? -1 : hdr->type == JEUX_ACK_PKT ? 0 : 1;
+}
+
+/*
+ * Send a request and dispatch packets on every open connection until its
+ * reply arrives.
+ *
+ * @return 0 on ACK, 1 on NACK, -1 on timeout or a lost connection.
+ */
+static int send_and_await(int conn, JEUX_PACKET_HEADER *hdr, void *payload) {
+    int status = PENDING;
+    if(jc_send(conns[conn], hdr, payload, got_reply, &status) == -1) {
+        close_conn(conn);
+        return -1;
+    }
+    while(status == PENDING) {
+        if(jc_loop_run(loop, REPLY_TIMEOUT_MS) <= 0) {
+            /* closing gives the reply up, so nothing is left to write status later */
+            close_conn(conn);
+        }
+    }
+    return status;
+}
+
+static void replay(void) {
+    uint64_t start = metrics_now_ns();
+    for(size_t i = 0; i < nrecords; i++) {
+        CAPTURE_RECORD *rec = &records[i];
+        uint64_t due = fast ? metrics_now_ns() : start + rec->time_ns;
+        if(!fast) {
+            sleep_until(due);
+        }
+        if(rec->event == CAPTURE_CLOSE) {
+            close_conn(rec->conn);
+            continue;
+        }
+        if(conns[rec->conn] == NULL && open_conn(rec->conn) == NULL) {
+            errors++;
+            continue;
+        }
+        requests++;
+        int status = send_and_await(rec->conn, &rec->hdr, rec->payload);
+        if(status == -1) {
+            errors++;
+            continue;
+        }
+        status == 0 ? acks++ : nacks++;
+        int type = rec->hdr.type < METRICS_PKT_TYPES ? rec->hdr.type : 0;
+        metrics_hist_record(&hists[type], metrics_now_ns() - due);
+    }
+    uint64_t elapsed = metrics_now_ns() - start;
+    for(int conn = 0; conn < nconns; conn++) {
+        close_conn(conn);
+    }
+
+    printf("requests\t%lu\n", requests);
+    printf("acks\t%lu\n", acks);
+    printf("nacks\t%lu\n", nacks);
+    printf("errors\t%lu\n", errors);
+    printf("captured_ns\t%lu\n", nrecords > 0 ? records[nrecords - 1].time_ns : 0);
+    printf("replayed_ns\t%lu\n", elapsed);
+    printf("requests_per_sec\t%.0f\n", elapsed > 0 ? requests / (elapsed / 1e9) : 0.0);
+    METRICS_HIST_SNAPSHOT *snap = malloc(sizeof(METRICS_HIST_SNAPSHOT));
+    if(snap == NULL) {
+        return;
+    }
+    for(int type = 0; type < METRICS_PKT_TYPES; type++) {
+        metrics_hist_read(&hists[type], snap);
+        if(snap->count == 0) {
+            continue;
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "latency_ns_%s", metrics_pkt_name(type));
+        metrics_hist_write(stdout, name, snap);
+    }
+    free(snap);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while((opt = getopt(argc, argv, "p:h:f")) != -1) {
+        switch(opt) {
+            case 'p':
+                port = optarg;
+                break;
+            case 'h':
+                host = optarg;
+                break;
+            case 'f':
+                fast = 1;
+                break;
+            default:
+                usage_exit(argv[0]);
+        }
+    }
+    if(port == NULL || optind != argc - 1) {
+        usage_exit(argv[0]);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    hists = calloc(METRICS_PKT_TYPES, sizeof(METRICS_HISTOGRAM));
+    loop = jc_loop_create();
+    if(hists == NULL || loop == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    load_capture(argv[optind]);
+    replay();
+
+    for(size_t i = 0; i < nrecords; i++) {
+        free(records[i].payload);
+    }
+    free(records);
+    jc_loop_destroy(loop);
+    free(conns);
+    free(hists);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "flight.h"
+
+/*
+ * Decode a flight recorder dump.
+ *
+ * Usage: flight_decode [-o <object address>] <dump file>
+ *
+ * Prints the events from every ring merged in time order, one per line:
+ * "<seconds>.<nanoseconds> T<thread> <object type> <address> <event>
+ * <ref count> <reason>", where the time is CLOCK_MONOTONIC.  With -o only
+ * the events for the given object are printed, which is usually enough
+ * to see where a reference was leaked or dropped twice.
+ */
+
+struct string_entry {
+    uint64_t addr;
+    char *text;
+};
+
+/* an event and its position in load order, which is ring order within a thread */
+struct decoded_event {
+    FLIGHT_EVENT e;
+    size_t seq;
+};
+
+static struct decoded_event *events;
+static size_t nevents, events_cap;
+
+static struct string_entry *strings;
+static size_t nstrings, strings_cap;
+
+static char *object_names[] = {
+    [FLIGHT_CLIENT] = "client",
+    [FLIGHT_GAME] = "game",
+    [FLIGHT_INVITATION] = "invitation",
+    [FLIGHT_PLAYER] = "player",
+};
+
+static char *event_names[] = {
+    [FLIGHT_CREATE] = "create",
+    [FLIGHT_REF] = "ref",
+    [FLIGHT_UNREF] = "unref",
+    [FLIGHT_FREE] = "free",
+};
+
+static void *xreallocarray(void *ptr, size_t n, size_t size) {
+    void *p = reallocarray(ptr, n, size);
+    if(p == NULL) {
+        perror("reallocarray");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static void corrupt_exit(char *path) {
+    fprintf(stderr, "Flight recorder dump %s is corrupt\n", path);
+    exit(EXIT_FAILURE);
+}
+
+static void add_ring(FLIGHT_EVENT *ring, uint64_t count, uint32_t ring_events) {
+    uint64_t n = count < ring_events ? count : ring_events;
+    if(nevents + n > events_cap) {
+        events_cap = (nevents + n) * 2;
+        events = xreallocarray(events, events_cap, sizeof(struct decoded_event));
+    }
+    /* oldest first: once the ring has wrapped, the oldest is at the write position */
+    uint64_t start = count < ring_events ? 0 : count % ring_events;
+    for(uint64_t i = 0; i < n; i++) {
+        events[nevents].e = ring[(start + i) % ring_events];
+        events[nevents].seq = nevents;
+        nevents++;
+    }
+}
+
+static void load_dump(char *path) {
+    FILE *in = fopen(path, "r");
+    if(in == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    char magic[FLIGHT_DUMP_MAGIC_LEN];
+    uint32_t header[2];
+    if(fread(magic, sizeof(magic), 1, in) != 1 || fread(header, sizeof(header), 1, in) != 1 ||
+            memcmp(magic, FLIGHT_DUMP_MAGIC, FLIGHT_DUMP_MAGIC_LEN) != 0 ||
+            header[0] != FLIGHT_DUMP_VERSION || header[1] == 0) {
+        corrupt_exit(path);
+    }
+    uint32_t ring_events = header[1];
+    FLIGHT_EVENT *ring = xreallocarray(NULL, ring_events, sizeof(FLIGHT_EVENT));
+    FLIGHT_DUMP_RECORD rec;
+    while(fread(&rec, sizeof(rec), 1, in) == 1 && rec.tag != FLIGHT_DUMP_END) {
+        if(rec.tag == FLIGHT_DUMP_RING) {
+            if(fread(ring, sizeof(FLIGHT_EVENT), ring_events, in) != ring_events) {
+                corrupt_exit(path);
+            }
+            add_ring(ring, rec.count, ring_events);
+        } else if(rec.tag == FLIGHT_DUMP_STRING) {
+            char *text = malloc(rec.count + 1);
+            if(text == NULL || fread(text, 1, rec.count, in) != rec.count) {
+                corrupt_exit(path);
+            }
+            text[rec.count] = '\0';
+            if(nstrings == strings_cap) {
+                strings_cap = strings_cap == 0 ? 64 : strings_cap * 2;
+                strings = xreallocarray(strings, strings_cap, sizeof(struct string_entry));
+            }
+            strings[nstrings].addr = rec.value;
+            strings[nstrings++].text = text;
+        } else {
+            corrupt_exit(path);
+        }
+    }
+    if(rec.tag != FLIGHT_DUMP_END) {
+        fprintf(stderr, "Flight recorder dump %s is truncated\n", path);
+    }
+    free(ring);
+    fclose(in);
+}
+
+static char *lookup_string(uint64_t addr) {
+    if(addr == 0) {
+        return "";
+    }
+    for(size_t i = 0; i < nstrings; i++) {
+        if(strings[i].addr == addr) {
+            return strings[i].text;
+        }
+    }
+    return "?";
+}
+
+static int compare_events(const void *a, const void *b) {
+    const struct decoded_event *ea = a, *eb = b;
+    if(ea->e.timestamp_ns != eb->e.timestamp_ns) {
+        return ea->e.timestamp_ns < eb->e.timestamp_ns ? -1 : 1;
+    }
+    return ea->seq < eb->seq ? -1 : ea->seq > eb->seq;
+}
+
+static void usage_exit(char *prog) {
+    fprintf(stderr, "Usage: %s [-o <object address>] <dump file>\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t only = 0;
+    int opt;
+    while((opt = getopt(argc, argv, "o:")) != -1) {
+        switch(opt) {
+            case 'o':
+                only = strtoull(optarg, NULL, 16);
+                break;
+            default:
+                usage_exit(argv[0]);
+        }
+    }
+    if(optind != argc - 1) {
+        usage_exit(argv[0]);
+    }
+    load_dump(argv[optind]);
+    qsort(events, nevents, sizeof(struct decoded_event), compare_events);
+    for(size_t i = 0; i < nevents; i++) {
+        FLIGHT_EVENT *e = &events[i].e;
+        if(only != 0 && e->object != only) {
+            continue;
+        }
+        if(e->object_type > FLIGHT_PLAYER || e->event_type > FLIGHT_FREE) {
+            continue;
+        }
+        printf("%" PRIu64 ".%09" PRIu64 " T%u %s 0x%" PRIx64 " %s %u %s\n",
+               e->timestamp_ns / 1000000000, e->timestamp_ns % 1000000000, e->thread,
+               object_names[e->object_type], e->object, event_names[e->event_type],
+               e->ref_count, lookup_string(e->why));
+    }
+    for(size_t i = 0; i < nstrings; i++) {
+        free(strings[i].text);
+    }
+    free(strings);
+    free(events);
+    return EXIT_SUCCESS;
+}
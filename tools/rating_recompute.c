@@ -0,0 +1,357 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "player.h"
+#include "game_log.h"
+#include "glicko.h"
+
+/*
+ * Recompute every player's rating from a game history file.
+ *
+ * Usage: rating_recompute -i <history file> [-o <snapshot file>] [-t threads] [-c]
+ *                         [-r elo|glicko2] [-P <rating period secs>]
+ *
+ * With -r elo (the default) the history is replayed through player_post_result(), so the result is
+ * exactly what the server would hold had it applied every game with the
+ * current rating code.  Games are scheduled into waves: a game goes into
+ * the wave after the last wave that contains either of its players, so no
+ * two games in a wave share a player and every player's games are applied
+ * in history order.  The games of each wave are split across the threads,
+ * with a barrier between waves.
+ *
+ * With -r glicko2 the history is replayed through a Glicko-2 engine (see
+ * glicko.h), on one thread, closing a rating period whenever a game was
+ * logged in a later period than the one before it, and once at the end.
+ * Periods are counted from the epoch in steps of the given length
+ * (default 3600 seconds, as for the server), whereas the server counts
+ * them from when it started, so the ratings are those of a server with
+ * the same period length but not necessarily the same period boundaries.
+ * -t and -c do not apply.
+ *
+ * The snapshot lists one player per line, "name<TAB>rating", in order of
+ * first appearance in the history.  With -c the history is also replayed
+ * sequentially and the two results are compared.
+ */
+
+#define DEFAULT_RATING_PERIOD_SECS 3600
+
+struct game {
+    int p1;
+    int p2;
+    int result;
+    uint32_t timestamp_sec;
+};
+
+static char **names;
+static size_t nnames, names_cap;
+
+static struct game *games;
+static size_t ngames, games_cap;
+
+/* open-addressing table mapping a username to its index in names */
+static int *name_table;
+static size_t name_table_cap;
+
+static struct game *schedule;  /* games ordered by wave */
+static size_t *wave_start;     /* schedule index of the first game of each wave */
+static size_t nwaves;
+
+static PLAYER **players;
+static int nthreads = 1;
+static pthread_barrier_t wave_barrier;
+
+static uint64_t hash_name(char *name) {
+    uint64_t h = 14695981039346656037ULL;
+    while(*name != '\0') {
+        h ^= (unsigned char)*name++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void *xreallocarray(void *ptr, size_t n, size_t size) {
+    void *p = reallocarray(ptr, n, size);
+    if(p == NULL) {
+        perror("reallocarray");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static void grow_name_table(void) {
+    size_t new_cap = name_table_cap == 0 ? 1024 : name_table_cap * 2;
+    int *table = xreallocarray(NULL, new_cap, sizeof(int));
+    memset(table, 0xff, new_cap * sizeof(int));
+    for(size_t i = 0; i < nnames; i++) {
+        size_t slot = hash_name(names[i]) & (new_cap - 1);
+        while(table[slot] != -1) {
+            slot = (slot + 1) & (new_cap - 1);
+        }
+        table[slot] = i;
+    }
+    free(name_table);
+    name_table = table;
+    name_table_cap = new_cap;
+}
+
+/* Returns the index of name, adding it if it has not been seen.  Takes ownership of name. */
+static int intern_name(char *name) {
+    if(2 * (nnames + 1) > name_table_cap) {
+        grow_name_table();
+    }
+    size_t slot = hash_name(name) & (name_table_cap - 1);
+    while(name_table[slot] != -1) {
+        if(strcmp(names[name_table[slot]], name) == 0) {
+            free(name);
+            return name_table[slot];
+        }
+        slot = (slot + 1) & (name_table_cap - 1);
+    }
+    if(nnames == names_cap) {
+        names_cap = names_cap == 0 ? 1024 : names_cap * 2;
+        names = xreallocarray(names, names_cap, sizeof(char *));
+    }
+    names[nnames] = name;
+    name_table[slot] = nnames;
+    return nnames++;
+}
+
+static void load_history(char *path) {
+    FILE *in = glog_open_read(path);
+    if(in == NULL) {
+        fprintf(stderr, "Cannot read game history file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    GAME_LOG_RECORD rec;
+    int status;
+    while((status = glog_read(in, &rec)) == 0) {
+        if(ngames == games_cap) {
+            games_cap = games_cap == 0 ? 1024 : games_cap * 2;
+            games = xreallocarray(games, games_cap, sizeof(struct game));
+        }
+        struct game *g = &games[ngames++];
+        g->p1 = intern_name(rec.name1);
+        g->p2 = intern_name(rec.name2);
+        g->result = rec.result;
+        g->timestamp_sec = rec.timestamp_sec;
+    }
+    if(status == -1) {
+        fprintf(stderr, "Game history file %s is corrupt after %lu records\n", path, ngames);
+        exit(EXIT_FAILURE);
+    }
+    fclose(in);
+}
+
+static void schedule_waves(void) {
+    int *wave = xreallocarray(NULL, ngames, sizeof(int));
+    size_t *last = calloc(nnames, sizeof(size_t));
+    if(last == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    nwaves = 0;
+    for(size_t i = 0; i < ngames; i++) {
+        size_t w1 = last[games[i].p1], w2 = last[games[i].p2];
+        size_t w = (w1 > w2 ? w1 : w2) + 1;
+        last[games[i].p1] = last[games[i].p2] = w;
+        wave[i] = w - 1;
+        if(w > nwaves) {
+            nwaves = w;
+        }
+    }
+    free(last);
+
+    /* counting sort by wave; stable, so each wave keeps history order */
+    wave_start = calloc(nwaves + 1, sizeof(size_t));
+    if(wave_start == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for(size_t i = 0; i < ngames; i++) {
+        wave_start[wave[i] + 1]++;
+    }
+    for(size_t w = 0; w < nwaves; w++) {
+        wave_start[w + 1] += wave_start[w];
+    }
+    size_t *fill = xreallocarray(NULL, nwaves + 1, sizeof(size_t));
+    memcpy(fill, wave_start, (nwaves + 1) * sizeof(size_t));
+    schedule = xreallocarray(NULL, ngames == 0 ? 1 : ngames, sizeof(struct game));
+    for(size_t i = 0; i < ngames; i++) {
+        schedule[fill[wave[i]]++] = games[i];
+    }
+    free(fill);
+    free(wave);
+}
+
+static void *replay_thread(void *arg) {
+    long t = (long)arg;
+    for(size_t w = 0; w < nwaves; w++) {
+        size_t start = wave_start[w], len = wave_start[w + 1] - start;
+        size_t lo = start + len * t / nthreads;
+        size_t hi = start + len * (t + 1) / nthreads;
+        for(size_t i = lo; i < hi; i++) {
+            player_post_result(players[schedule[i].p1], players[schedule[i].p2], schedule[i].result);
+        }
+        pthread_barrier_wait(&wave_barrier);
+    }
+    return NULL;
+}
+
+static PLAYER **create_players(void) {
+    PLAYER **p = xreallocarray(NULL, nnames == 0 ? 1 : nnames, sizeof(PLAYER *));
+    for(size_t i = 0; i < nnames; i++) {
+        p[i] = player_create(names[i]);
+        if(p[i] == NULL) {
+            fprintf(stderr, "Failed to create player %s\n", names[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    return p;
+}
+
+static void replay_parallel(void) {
+    players = create_players();
+    pthread_barrier_init(&wave_barrier, NULL, nthreads);
+    pthread_t *tids = xreallocarray(NULL, nthreads, sizeof(pthread_t));
+    for(long t = 1; t < nthreads; t++) {
+        pthread_create(&tids[t], NULL, replay_thread, (void *)t);
+    }
+    replay_thread((void *)0);
+    for(int t = 1; t < nthreads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    free(tids);
+    pthread_barrier_destroy(&wave_barrier);
+}
+
+static GLICKO *replay_glicko(int period_secs) {
+    GLICKO *g = glicko_init(GLICKO_DEFAULT_TAU, 0);
+    if(g == NULL) {
+        fprintf(stderr, "Failed to initialize Glicko-2 engine\n");
+        exit(EXIT_FAILURE);
+    }
+    for(size_t i = 0; i < ngames; i++) {
+        if(i > 0 && games[i].timestamp_sec / period_secs != games[i - 1].timestamp_sec / period_secs) {
+            glicko_close_period(g);
+        }
+        if(glicko_record(g, games[i].p1, games[i].p2, games[i].result) == -1) {
+            fprintf(stderr, "Failed to record game %lu\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+    glicko_close_period(g);
+    return g;
+}
+
+static int check_sequential(void) {
+    PLAYER **seq = create_players();
+    for(size_t i = 0; i < ngames; i++) {
+        player_post_result(seq[games[i].p1], seq[games[i].p2], games[i].result);
+    }
+    int mismatches = 0;
+    for(size_t i = 0; i < nnames; i++) {
+        int a = player_get_rating(players[i]), b = player_get_rating(seq[i]);
+        if(a != b) {
+            fprintf(stderr, "Mismatch for %s: parallel %d, sequential %d\n", names[i], a, b);
+            mismatches++;
+        }
+        player_unref(seq[i], "because sequential check is done");
+    }
+    free(seq);
+    return mismatches;
+}
+
+static void usage_exit(char *prog) {
+    fprintf(stderr, "Usage: %s -i <history file> [-o <snapshot file>] [-t threads] [-c] "
+            "[-r elo|glicko2] [-P <rating period secs>]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    char *in_path = NULL, *out_path = NULL;
+    int check = 0;
+    int use_glicko = 0;
+    int period_secs = DEFAULT_RATING_PERIOD_SECS;
+    int opt;
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    while((opt = getopt(argc, argv, "i:o:t:cr:P:")) != -1) {
+        switch(opt) {
+            case 'i':
+                in_path = optarg;
+                break;
+            case 'o':
+                out_path = optarg;
+                break;
+            case 't':
+                nthreads = atoi(optarg);
+                break;
+            case 'c':
+                check = 1;
+                break;
+            case 'r':
+                if(strcmp(optarg, "glicko2") == 0) {
+                    use_glicko = 1;
+                } else if(strcmp(optarg, "elo") != 0) {
+                    usage_exit(argv[0]);
+                }
+                break;
+            case 'P':
+                period_secs = atoi(optarg);
+                break;
+            default:
+                usage_exit(argv[0]);
+        }
+    }
+    if(in_path == NULL || nthreads < 1 || period_secs < 1 || optind != argc ||
+            (use_glicko && check)) {
+        usage_exit(argv[0]);
+    }
+
+    load_history(in_path);
+    GLICKO *engine = NULL;
+    if(use_glicko) {
+        engine = replay_glicko(period_secs);
+        fprintf(stderr, "Replayed %lu games between %lu players with Glicko-2\n", ngames, nnames);
+    } else {
+        schedule_waves();
+        replay_parallel();
+        fprintf(stderr, "Replayed %lu games between %lu players in %lu waves on %d threads\n",
+                ngames, nnames, nwaves, nthreads);
+    }
+
+    FILE *out = stdout;
+    if(out_path != NULL && (out = fopen(out_path, "w")) == NULL) {
+        perror("fopen");
+        exit(EXIT_FAILURE);
+    }
+    for(size_t i = 0; i < nnames; i++) {
+        fprintf(out, "%s\t%d\n", names[i],
+                engine != NULL ? glicko_get_rating(engine, i) : player_get_rating(players[i]));
+    }
+    if(out != stdout) {
+        fclose(out);
+    }
+
+    int status = EXIT_SUCCESS;
+    if(check && check_sequential() != 0) {
+        status = EXIT_FAILURE;
+    }
+    for(size_t i = 0; i < nnames; i++) {
+        if(players != NULL) {
+            player_unref(players[i], "because recomputation is done");
+        }
+        free(names[i]);
+    }
+    glicko_fini(engine);
+    free(players);
+    free(names);
+    free(name_table);
+    free(games);
+    free(schedule);
+    free(wave_start);
+    return status;
+}